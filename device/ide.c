@@ -8,6 +8,7 @@
 #include "interrupt.h"
 #include "string.h"
 #include "memory.h"
+#include "pci.h"
 
 // 分区表项
 typedef struct partition_table_entry
@@ -32,6 +33,14 @@ typedef struct mbr_sec
     uint16_t signature;                 // 结束标记字
 } PACKED mbr_sec;                       // 保证结构体大小为512字节
 
+// 物理区域描述符，描述DMA传输中的一段物理内存，该段内存不能跨越64KB边界
+struct prd_entry
+{
+    uint32_t phys_addr;                 // 物理内存的起始地址，必须2字节对齐
+    uint16_t byte_cnt;                  // 字节数，0表示64KB
+    uint16_t flags;                     // 最高位置1表示这是表中的最后一项
+} PACKED;
+
 #define port_data(pchannel) ((pchannel)->port_base + 0)
 #define port_error(pchannel) ((pchannel)->port_base + 1)
 #define port_sec_cnt(pchannel) ((pchannel)->port_base + 2)
@@ -58,6 +67,33 @@ typedef struct mbr_sec
 #define CMD_IDENTIFY 0xec               // 获取硬盘相关信息
 #define CMD_READ 0x20                   // 读硬盘
 #define CMD_WRITE 0x30                  // 写硬盘
+#define CMD_READ_DMA 0xc8               // 以DMA方式读硬盘
+#define CMD_WRITE_DMA 0xca              // 以DMA方式写硬盘
+
+// 总线主控IDE寄存器，第二个通道的寄存器位于第一个通道之后8个端口处
+#define port_bm_cmd(pchannel) ((pchannel)->bmide_base + 0)
+#define port_bm_status(pchannel) ((pchannel)->bmide_base + 2)
+#define port_bm_prdt(pchannel) ((pchannel)->bmide_base + 4)
+
+#define BIT_BM_CMD_START 0x01           // 启动总线主控传输
+#define BIT_BM_CMD_READ 0x08            // 传输方向为从硬盘到内存
+#define BIT_BM_STAT_ERR 0x02            // 传输出错，写1清除
+#define BIT_BM_STAT_INTR 0x04           // 硬盘已发出中断，写1清除
+#define BIT_BM_STAT_CAPABLE 0x60        // 主盘和从盘能否进行DMA，由BIOS设置，写回时需保留
+
+#define PRD_LAST 0x8000                 // 标记PRD表的最后一项
+#define PRD_MAX_CNT (PAGE_SIZE / sizeof(prd_entry))     // PRD表占一页，最多容纳的表项数
+#define PRD_MAX_BYTES 0x10000           // 一个表项最多描述64KB
+#define PCI_CLASS_STORAGE 0x01          // 大容量存储控制器的类代码
+#define PCI_SUBCLASS_IDE 0x01           // IDE控制器的子类代码
+#define PCI_PROG_IF_BUS_MASTER 0x80     // 编程接口的第7位表示支持总线主控
+
+#define IDE_MAX_SECTORS 256             // 一条读写命令最多传输的扇区数，扇区数寄存器写入0即表示256
+#define IDE_REQ_MAX_PAGES (IDE_MAX_SECTORS * 512 / PAGE_SIZE + 1)       // 一个请求的缓冲区最多涉及的页数
+#define IDE_REQ_MAX_PRD (2 * IDE_REQ_MAX_PAGES)     // 一个请求预先解析出的PRD表项数上限，经由内核缓冲区中转的页可能被拆分为两段
+
+#define IDENTIFY_CAPABILITY 49          // 硬盘参数中的能力字
+#define IDENTIFY_CAP_DMA 0x0100         // 能力字的第8位表示硬盘支持DMA
 
 void intr_disk_handler(const uint32_t intr_no);                                 // 硬盘中断处理函数
 void scan_partition(disk *hd, const uint32_t start_lba);                           //  扫描分区表获取分区信息          
@@ -65,10 +101,34 @@ void select_disk(disk *hd);         // 在dev端口中选择指定硬盘
 void select_sectors(disk *hd, const uint32_t start_lba, const uint8_t sec_cnt);     // 选择读取的起始扇区和扇区数
 void send_cmd(disk *hd, const uint8_t cmd);             // 向指定硬盘发送命令
 bool disk_is_ready(disk *hd);                           // 测试硬盘是否已将数据准备完毕 
+bool disk_poll_ready(disk *hd);                         // 以忙等方式测试硬盘是否已将数据准备完毕
 void read_from_sectors(disk *hd, void *dst, const uint32_t sec_cnt);            // 从指定硬盘读取sec_cnt个扇区数据到内存dst处
 void write_to_sectors(disk *hd, void *src, const uint32_t sec_cnt);             // 将内存src处的sec_cnt个扇区数据写入到硬盘中
 void identify_disk(disk *hd);                                                   // 获取硬盘参数
 bool partition_info(node *pnode, int arg UNUSED);                               // 输出分区信息
+void bmide_init(void);                                                          // 查找支持总线主控的IDE控制器，为各通道准备DMA
+bool prd_append(prd_entry *table, uint32_t *prd_cnt, uint32_t max_cnt, uint32_t paddr, uint32_t len);      // 向PRD表追加一段物理内存
+bool prd_append_vaddr(prd_entry *table, uint32_t *prd_cnt, uint32_t max_cnt, void *buf, uint32_t len);      // 将一段虚拟内存按物理页拆分后追加到PRD表中
+bool dma_build_prdt(ide_channel *channel, io_request *req);                     // 根据批次中各请求的缓冲区构造PRD表
+bool dma_start(ide_channel *channel, io_request *req);                          // 尝试以DMA方式启动一个请求批次
+bool dma_finish(ide_channel *channel);                                          // 结束DMA传输，返回传输是否成功
+void elevator_add(disk *hd, io_request *req);                                   // 将请求与队列中相邻的批次合并，或按LBA顺序插入请求队列
+io_request *elevator_next(disk *hd);                                            // 按C-LOOK算法选出硬盘的下一个请求批次
+bool ide_intr_check(ide_channel *channel, uint8_t status);                      // 判断硬盘是否已完成通道当前的命令，是则清除中断等待标志
+void ide_wake_worker(ide_channel *channel);                                     // 唤醒一个等待者来完成通道当前的请求批次
+void ide_run(ide_channel *channel, intr_status *old_status);                    // 完成硬盘已发出中断的批次，通道空闲时启动下一个批次
+io_request *ide_next_batch(ide_channel *channel);                               // 从两块硬盘的请求队列中选出下一个批次
+void ide_start(ide_channel *channel, io_request *req, intr_status *old_status); // 向硬盘发出请求批次对应的命令
+void ide_complete(ide_channel *channel, intr_status *old_status);               // 硬盘中断到来后完成通道当前的请求批次
+bool ide_pio_transfer(ide_channel *channel, io_request *req, intr_status *old_status);    // 以PIO方式传输批次中所有请求的数据
+void ide_finish(ide_channel *channel, bool error);                              // 结束通道当前的请求批次，只唤醒该批次中请求的提交者
+bool ide_requeue_batch(ide_channel *channel, io_request *req);                  // 批次无法以DMA方式传输时拆散批次，让只能以DMA方式传输的请求由提交者重新提交
+void ide_request_init_prd(io_request *req, disk *hd, prd_entry *prd, uint32_t prd_cnt, uint32_t start_lba, uint32_t sec_cnt, bool is_write);     // 以预先解析好的物理内存段初始化一个硬盘请求
+void ide_request_setup(io_request *req, disk *hd, void *buf, uint32_t start_lba, uint32_t sec_cnt, bool is_write);    // 初始化硬盘请求的各个字段
+bool user_page_dma_ok(void *vaddr, bool is_write);                              // 判断用户页能否由控制器直接读写
+uint32_t user_buf_prd(void *buf, uint32_t len, bool is_write, prd_entry *prd, void **bounce, uint32_t bounce_size, bool *bounced);     // 在当前线程中解析用户缓冲区的物理内存段
+void user_buf_copy_out(void *buf, uint32_t len, void *bounce, bool *bounced);   // 将经由内核缓冲区中转的页复制回用户缓冲区
+void disk_rw(disk *hd, void *buf, uint32_t start_lba, uint32_t sec_cnt, bool is_write);    // read_disk和write_disk的公共实现
 
 uint8_t channel_cnt;               // ide通道数量
 ide_channel channels[2];            // 个人计算机一般只支持两个ide通道
@@ -94,9 +154,19 @@ void ide_init(void)
     for (uint8_t i = 0; i < channel_cnt; i++)
     {
         sprintf(channels[i].name, "ide%d", i);
-        mutex_lock_init(&channels[i].mutex);
-        sem_init(&channels[i].disk_done, 0);
+        spin_lock_init(&channels[i].lock);
+        wait_queue_init(&channels[i].disk_done);
         channels[i].intr_is_expected = false;
+        channels[i].active = NULL;
+        channels[i].intr_done = false;
+        list_init(&channels[i].wait_list);
+        channels[i].next_disk = 0;
+        channels[i].bmide_base = 0;
+        for (uint8_t j = 0; j < 2; j++)
+        {
+            list_init(&channels[i].disks[j].req_queue);
+            channels[i].disks[j].next_lba = 0;
+        }
 
         switch (i)
         {
@@ -137,24 +207,567 @@ void ide_init(void)
         disk_cnt -= channel_disk_cnt;
     }
 
+    bmide_init();
+
     printk("All partitions' infomation: \n");
     list_traversal(&partition_list, partition_info, 0);
 
     printk("Init IDE successfully!\n");
 }  
 
-// 硬盘中断处理函数
+// 硬盘中断处理函数，只记录硬盘已完成当前命令并唤醒一个等待者，数据传输和下一个批次的启动都在线程中进行
 void intr_disk_handler(const uint32_t intr_no)
 {
-    uint32_t channel_no = intr_no - 0x2e;
-    if (channels[channel_no].intr_is_expected)
+    ide_channel *channel = &channels[intr_no - 0x2e];
+    uint8_t status = inb(port_status(channel));            // 读一下状态端口，使硬盘可以产生下一次中断
+
+    spin_lock(&channel->lock);
+    if (ide_intr_check(channel, status))
+    {
+        if (channel->active)
+        {
+            ide_wake_worker(channel);
+        }
+        else
+        {
+            wake_up_all(&channel->disk_done);       // 唤醒等待识别硬盘命令的线程
+        }
+    }
+    spin_unlock(&channel->lock);
+}
+
+// 判断硬盘是否已完成通道当前的命令，是则清除中断等待标志并返回true，须持有通道的锁，status为刚读出的状态寄存器
+// 之前的命令残留的中断(如PIO读命令每个扇区产生的中断)可能在下一个批次开始后才到达，
+// 因此硬盘忙或者尚未到达命令完成时应有的状态时忽略该中断
+bool ide_intr_check(ide_channel *channel, uint8_t status)
+{
+    if (!channel->intr_is_expected || (status & BIT_STAT_BSY))
+    {
+        return false;
+    }
+
+    io_request *req = channel->active;
+    if (req)
+    {
+        if (channel->active_dma)
+        {
+            // DMA命令完成或出错时总线主控状态寄存器的中断位或出错位才会置位，两者在启动传输前已清除
+            if (!(inb(port_bm_status(channel)) & (BIT_BM_STAT_INTR | BIT_BM_STAT_ERR)))
+            {
+                return false;
+            }
+        }
+        else if (!(status & BIT_STAT_ERR) && (req->is_write ? (status & BIT_STAT_DRQ) : !(status & BIT_STAT_DRQ)))
+        {
+            // PIO读命令须等到数据就绪，写命令须等到数据全部写入
+            return false;
+        }
+        channel->intr_done = true;
+    }
+    channel->intr_is_expected = false;
+    return true;
+}
+
+// 唤醒一个等待者来完成通道当前的请求批次，优先选择该批次中请求的提交者，须持有通道的锁
+// 没有线程在等待时什么也不做，由之后调用ide_submit或ide_wait的线程完成
+void ide_wake_worker(ide_channel *channel)
+{
+    for (io_request *r = channel->active; r; r = r->next)
+    {
+        if (list_find(&channel->wait_list, &r->wait_node))
+        {
+            wake_up_one(&r->done_wq);
+            return;
+        }
+    }
+    if (channel->wait_list.length)
     {
-        sem_up(&channels[channel_no].disk_done);            // 唤醒等待中断的线程
-        channels[channel_no].intr_is_expected = false;
+        io_request *r = member2struct(channel->wait_list.head.next, io_request, wait_node);
+        wake_up_one(&r->done_wq);
     }
-    inb(port_status(&channels[channel_no]));            // 读一下状态端口，使硬盘可以产生下一次中断
 }                                
 
+// 查找支持总线主控的IDE控制器(如PIIX)，为各通道分配PRD表
+// 找不到时各通道的bmide_base保持为0，硬盘读写全部使用PIO方式
+void bmide_init(void)
+{
+    pci_device ide_ctrl;
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide_ctrl) ||
+        !((pci_config_read(&ide_ctrl, PCI_CLASS) >> 8) & PCI_PROG_IF_BUS_MASTER))
+    {
+        printk("No bus master IDE controller, disks work in PIO mode\n");
+        return;
+    }
+
+    // 总线主控寄存器位于BAR4指向的I/O空间中
+    uint32_t bar4 = pci_config_read(&ide_ctrl, PCI_BAR4);
+    if (!(bar4 & 0x1))
+    {
+        printk("Bus master IDE registers are not in I/O space, disks work in PIO mode\n");
+        return;
+    }
+
+    // 允许控制器发起DMA，高16位的状态寄存器写1清除，因此只写回命令寄存器
+    uint32_t command = pci_config_read(&ide_ctrl, PCI_COMMAND) & 0xffff;
+    pci_config_write(&ide_ctrl, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    for (uint8_t i = 0; i < channel_cnt; i++)
+    {
+        // PRD表不能跨越64KB边界，占用单独的一页即可保证这一点
+        channels[i].prdt = get_kernel_pages(1);
+        if (channels[i].prdt == NULL)
+        {
+            continue;
+        }
+        channels[i].prdt_phys = (uint32_t)vaddr2paddr(channels[i].prdt);
+        channels[i].bmide_base = (uint16_t)((bar4 & 0xfffc) + i * 8);
+        printk("%s: bus master IDE at port 0x%x\n", channels[i].name, channels[i].bmide_base);
+    }
+}
+
+// 向PRD表追加一段物理内存，与上一项物理连续且合并后不超过64KB、不跨越64KB边界时合并到上一项，表满时返回false
+bool prd_append(prd_entry *table, uint32_t *prd_cnt, uint32_t max_cnt, uint32_t paddr, uint32_t len)
+{
+    if (*prd_cnt)
+    {
+        prd_entry *prd = &table[*prd_cnt - 1];
+        uint32_t prd_len = (prd->byte_cnt ? prd->byte_cnt : PRD_MAX_BYTES);     // byte_cnt为0表示64KB
+        if (paddr == prd->phys_addr + prd_len && prd_len + len <= PRD_MAX_BYTES &&
+            (prd->phys_addr & ~(PRD_MAX_BYTES - 1)) == ((paddr + len - 1) & ~(PRD_MAX_BYTES - 1)))
+        {
+            prd->byte_cnt = (uint16_t)(prd_len + len);
+            return true;
+        }
+    }
+
+    if (*prd_cnt == max_cnt)
+    {
+        return false;
+    }
+    prd_entry *prd = &table[(*prd_cnt)++];
+    prd->phys_addr = paddr;
+    prd->byte_cnt = (uint16_t)len;
+    prd->flags = 0;
+    return true;
+}
+
+// 将当前页表中虚拟地址buf起始的len字节按物理页拆分后追加到PRD表中，存在未映射的页或表满时返回false
+bool prd_append_vaddr(prd_entry *table, uint32_t *prd_cnt, uint32_t max_cnt, void *buf, uint32_t len)
+{
+    while (len)
+    {
+        uint32_t seg = PAGE_SIZE - ((uint32_t)buf & (PAGE_SIZE - 1));     // 到当前页末尾为止
+        seg = (seg > len ? len : seg);
+
+        uint32_t paddr = (uint32_t)vaddr2paddr(buf);
+        if (!paddr || !prd_append(table, prd_cnt, max_cnt, paddr, seg))
+        {
+            return false;
+        }
+        buf = (uint8_t *)buf + seg;
+        len -= seg;
+    }
+    return true;
+}
+
+// 根据批次中各请求的缓冲区构造PRD表，内核缓冲区按所在的物理页解析，其他缓冲区使用提交者预先解析好的物理内存段
+// 缓冲区未对齐或未映射时返回false，由调用者改用PIO方式
+bool dma_build_prdt(ide_channel *channel, io_request *req)
+{
+    uint32_t prd_cnt = 0;
+    for (io_request *r = req; r; r = r->next)
+    {
+        if (r->prd)
+        {
+            for (uint32_t i = 0; i < r->prd_cnt; i++)
+            {
+                uint32_t len = (r->prd[i].byte_cnt ? r->prd[i].byte_cnt : PRD_MAX_BYTES);
+                if (!prd_append(channel->prdt, &prd_cnt, PRD_MAX_CNT, r->prd[i].phys_addr, len))
+                {
+                    return false;
+                }
+            }
+        }
+        else if (((uint32_t)r->buf & 0x1) || !prd_append_vaddr(channel->prdt, &prd_cnt, PRD_MAX_CNT, r->buf, r->sec_cnt * 512))
+        {
+            return false;
+        }
+    }
+
+    if (!prd_cnt)
+    {
+        return false;
+    }
+    channel->prdt[prd_cnt - 1].flags = PRD_LAST;
+    return true;
+}
+
+// 尝试以DMA方式启动一个请求批次，须持有通道的锁
+// 数据由控制器直接搬运，全部传输完毕后硬盘发出中断，返回false表示无法使用DMA
+bool dma_start(ide_channel *channel, io_request *req)
+{
+    disk *hd = req->hd;
+    // 初始化完成之前以轮询方式等待硬盘，不使用DMA
+    if (!init_finish || !hd->dma || !channel->bmide_base || !dma_build_prdt(channel, req))
+    {
+        return false;
+    }
+
+    uint8_t dir = (req->is_write ? 0 : BIT_BM_CMD_READ);
+    outl(channel->prdt_phys, port_bm_prdt(channel));
+    outb(dir, port_bm_cmd(channel));
+    // 清除上一次传输遗留的中断和出错标志
+    uint8_t bm_status = inb(port_bm_status(channel));
+    outb((bm_status & BIT_BM_STAT_CAPABLE) | BIT_BM_STAT_ERR | BIT_BM_STAT_INTR, port_bm_status(channel));
+
+    select_sectors(hd, req->start_lba, (uint8_t)req->batch_sec_cnt);
+    send_cmd(hd, req->is_write ? CMD_WRITE_DMA : CMD_READ_DMA);
+    outb(dir | BIT_BM_CMD_START, port_bm_cmd(channel));
+    return true;
+}
+
+// 硬盘中断到来后结束DMA传输，返回传输是否成功
+bool dma_finish(ide_channel *channel)
+{
+    uint8_t dir = inb(port_bm_cmd(channel)) & BIT_BM_CMD_READ;
+    outb(dir, port_bm_cmd(channel));
+    uint8_t bm_status = inb(port_bm_status(channel));
+    uint8_t status = inb(port_status(channel));
+    outb((bm_status & BIT_BM_STAT_CAPABLE) | BIT_BM_STAT_ERR | BIT_BM_STAT_INTR, port_bm_status(channel));
+
+    return !(bm_status & BIT_BM_STAT_ERR) && !(status & (BIT_STAT_BSY | BIT_STAT_ERR));
+}
+
+// 将请求与队列中LBA相邻、方向相同的批次合并，无法合并时按起始LBA升序插入请求队列，须持有通道的锁
+void elevator_add(disk *hd, io_request *req)
+{
+    list *queue = &hd->req_queue;
+    for (node *pnode = queue->head.next; pnode != &queue->tail; pnode = pnode->next)
+    {
+        io_request *head = member2struct(pnode, io_request, queue_node);
+        if (head->is_write != req->is_write || head->batch_sec_cnt + req->sec_cnt > IDE_MAX_SECTORS)
+        {
+            continue;
+        }
+
+        if (head->start_lba + head->batch_sec_cnt == req->start_lba)
+        {
+            // 紧接在批次之后，挂到批次末尾
+            io_request *tail = head;
+            while (tail->next)
+            {
+                tail = tail->next;
+            }
+            tail->next = req;
+            head->batch_sec_cnt += req->sec_cnt;
+            return;
+        }
+        if (req->start_lba + req->sec_cnt == head->start_lba)
+        {
+            // 紧接在批次之前，成为批次的首个请求并代替原首个请求留在队列中
+            req->next = head;
+            req->batch_sec_cnt += head->batch_sec_cnt;
+            list_insert_before(queue, pnode, &req->queue_node);
+            list_remove(queue, pnode);
+            return;
+        }
+    }
+
+    node *pnode = queue->head.next;
+    while (pnode != &queue->tail)
+    {
+        io_request *head = member2struct(pnode, io_request, queue_node);
+        if (head->start_lba > req->start_lba)
+        {
+            break;
+        }
+        pnode = pnode->next;
+    }
+    list_insert_before(queue, pnode, &req->queue_node);
+}
+
+// 按C-LOOK算法选出硬盘的下一个请求批次：磁头只朝LBA增大的方向扫描，
+// 选择起始LBA不小于磁头位置的第一个批次，没有时回到LBA最小的批次，须持有通道的锁
+io_request *elevator_next(disk *hd)
+{
+    list *queue = &hd->req_queue;
+    if (!queue->length)
+    {
+        return NULL;
+    }
+
+    for (node *pnode = queue->head.next; pnode != &queue->tail; pnode = pnode->next)
+    {
+        io_request *req = member2struct(pnode, io_request, queue_node);
+        if (req->start_lba >= hd->next_lba)
+        {
+            return req;
+        }
+    }
+    io_request *first = member2struct(queue->head.next, io_request, queue_node);
+    return first;
+}
+
+// 推进通道上的传输：完成硬盘已发出中断的批次，通道空闲时启动下一个批次，直到需要等待硬盘中断为止
+// 须持有通道的锁且只能在线程中调用，PIO数据传输期间会暂时释放锁并恢复中断状态*old_status，
+// 此时active仍指向该批次且intr_done为false，其他线程只会将请求加入队列，不会访问通道的端口
+void ide_run(ide_channel *channel, intr_status *old_status)
+{
+    while (true)
+    {
+        if (channel->active)
+        {
+            if (!channel->intr_done)
+            {
+                return;
+            }
+            channel->intr_done = false;
+            ide_complete(channel, old_status);
+            continue;
+        }
+
+        io_request *req = ide_next_batch(channel);
+        if (!req)
+        {
+            return;
+        }
+        ide_start(channel, req, old_status);
+    }
+}
+
+// 从两块硬盘的请求队列中选出下一个批次并设为通道当前的批次，两块硬盘轮流获得通道，须持有通道的锁
+io_request *ide_next_batch(ide_channel *channel)
+{
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        disk *hd = &channel->disks[(channel->next_disk + i) % 2];
+        io_request *req = elevator_next(hd);
+        if (!req)
+        {
+            continue;
+        }
+
+        list_remove(&hd->req_queue, &req->queue_node);
+        hd->next_lba = req->start_lba + req->batch_sec_cnt;
+        channel->next_disk = (hd->dev_no + 1) % 2;
+        channel->active = req;
+        return req;
+    }
+    return NULL;
+}
+
+// 向硬盘发出请求批次对应的命令，优先使用DMA，须持有通道的锁
+// PIO写命令随即写入数据，写入期间暂时释放锁
+void ide_start(ide_channel *channel, io_request *req, intr_status *old_status)
+{
+    inb(port_status(channel));          // 清除硬盘可能残留的中断请求
+    channel->active_dma = dma_start(channel, req);
+    if (channel->active_dma || ide_requeue_batch(channel, req))
+    {
+        return;
+    }
+
+    disk *hd = req->hd;
+    select_sectors(hd, req->start_lba, (uint8_t)req->batch_sec_cnt);
+    send_cmd(hd, req->is_write ? CMD_WRITE : CMD_READ);
+    if (req->is_write)
+    {
+        channel->intr_is_expected = false;      // 写入各扇区期间产生的中断不表示命令完成
+        if (!ide_pio_transfer(channel, req, old_status))
+        {
+            channel->intr_is_expected = false;
+            ide_finish(channel, true);
+        }
+    }
+}
+
+// 硬盘中断到来后完成通道当前的请求批次，须持有通道的锁
+// DMA出错时该硬盘改用PIO方式，并以PIO方式重新传输整个批次
+void ide_complete(ide_channel *channel, intr_status *old_status)
+{
+    io_request *req = channel->active;
+    disk *hd = req->hd;
+    if (channel->active_dma)
+    {
+        if (!dma_finish(channel))
+        {
+            printk("DMA error:  disk: %s  sector: %d, fall back to PIO mode\n", hd->name, req->start_lba);
+            hd->dma = false;
+            ide_start(channel, req, old_status);
+            return;
+        }
+        ide_finish(channel, false);
+        return;
+    }
+
+    bool ok = (req->is_write ? !(inb(port_status(channel)) & BIT_STAT_ERR) : ide_pio_transfer(channel, req, old_status));
+    ide_finish(channel, !ok);
+}
+
+// 以PIO方式传输批次中所有请求的数据，每个扇区传输前等待硬盘就绪，返回传输是否成功
+// 须持有通道的锁，传输期间释放锁并恢复中断状态*old_status，返回时重新持有锁
+// 写命令在写入最后一个扇区之前才开始等待中断，从而忽略之前各扇区写入后产生的中断
+bool ide_pio_transfer(ide_channel *channel, io_request *req, intr_status *old_status)
+{
+    disk *hd = req->hd;
+    uint32_t sec_left = req->batch_sec_cnt;
+    spin_unlock_irqrestore(&channel->lock, *old_status);
+    for (io_request *r = req; r; r = r->next)
+    {
+        for (uint32_t i = 0; i < r->sec_cnt; ++i)
+        {
+            if (!disk_poll_ready(hd))
+            {
+                *old_status = spin_lock_irqsave(&channel->lock);
+                return false;
+            }
+
+            void *buf = (uint8_t *)r->buf + i * 512;
+            if (!r->is_write)
+            {
+                read_from_sectors(hd, buf, 1);
+            }
+            else if (--sec_left)
+            {
+                write_to_sectors(hd, buf, 1);
+            }
+            else
+            {
+                *old_status = spin_lock_irqsave(&channel->lock);
+                channel->intr_is_expected = true;
+                write_to_sectors(hd, buf, 1);
+                return true;
+            }
+        }
+    }
+    *old_status = spin_lock_irqsave(&channel->lock);
+    return true;
+}
+
+// 结束通道当前的请求批次，只唤醒该批次中请求的提交者，须持有通道的锁
+void ide_finish(ide_channel *channel, bool error)
+{
+    io_request *req = channel->active;
+    channel->active = NULL;
+    while (req)
+    {
+        // 提交者须持有通道的锁才能看到done，因此唤醒之前请求不会被释放
+        io_request *next = req->next;
+        req->error = error;
+        req->done = true;
+        wake_up_one(&req->done_wq);
+        req = next;
+    }
+}
+
+// 初始化一个硬盘请求，buf须位于内核空间(请求可能由其他线程完成)，sec_cnt不超过256
+void ide_request_init(io_request *req, disk *hd, void *buf, uint32_t start_lba, uint32_t sec_cnt, bool is_write)
+{
+    ASSERT((uint32_t)buf >= KERNEL_SPACE_START);
+    ide_request_setup(req, hd, buf, start_lba, sec_cnt, is_write);
+}
+
+// 以提交者预先解析好的物理内存段prd初始化一个硬盘请求，该请求只能以DMA方式传输，prd在请求完成前须保持有效
+void ide_request_init_prd(io_request *req, disk *hd, prd_entry *prd, uint32_t prd_cnt, uint32_t start_lba, uint32_t sec_cnt, bool is_write)
+{
+    ASSERT(prd != NULL && prd_cnt > 0);
+    ide_request_setup(req, hd, NULL, start_lba, sec_cnt, is_write);
+    req->prd = prd;
+    req->prd_cnt = prd_cnt;
+}
+
+// ide_request_init和ide_request_init_prd的公共部分
+void ide_request_setup(io_request *req, disk *hd, void *buf, uint32_t start_lba, uint32_t sec_cnt, bool is_write)
+{
+    ASSERT(hd != NULL);
+    ASSERT(sec_cnt > 0 && sec_cnt <= IDE_MAX_SECTORS);
+    req->hd = hd;
+    req->buf = buf;
+    req->start_lba = start_lba;
+    req->sec_cnt = req->batch_sec_cnt = sec_cnt;
+    req->is_write = is_write;
+    req->done = req->error = false;
+    req->next = NULL;
+    wait_queue_init(&req->done_wq);
+    node_init(&req->wait_node);
+    req->prd = NULL;
+    req->prd_cnt = 0;
+    req->retry = false;
+}
+
+// 批次无法以DMA方式传输时，若其中有只能以DMA方式传输的请求则拆散批次并返回true，须持有通道的锁
+// 这些请求以retry标记结束，由提交者改用其他方式重新提交，其余请求重新加入请求队列
+bool ide_requeue_batch(ide_channel *channel, io_request *req)
+{
+    io_request *r = req;
+    while (r && !r->prd)
+    {
+        r = r->next;
+    }
+    if (!r)
+    {
+        return false;
+    }
+
+    channel->active = NULL;
+    while (req)
+    {
+        io_request *next = req->next;
+        req->next = NULL;
+        if (req->prd)
+        {
+            req->retry = true;
+            req->done = true;
+            wake_up_one(&req->done_wq);
+        }
+        else
+        {
+            req->batch_sec_cnt = req->sec_cnt;
+            elevator_add(req->hd, req);
+        }
+        req = next;
+    }
+    return true;
+}
+
+// 将请求提交到所在硬盘的请求队列后立即返回，通道空闲时立即启动传输
+void ide_submit(io_request *req)
+{
+    ide_channel *channel = req->hd->my_channel;
+    intr_status old_status = spin_lock_irqsave(&channel->lock);
+    elevator_add(req->hd, req);
+    ide_run(channel, &old_status);
+    spin_unlock_irqrestore(&channel->lock, old_status);
+}
+
+// 等待请求完成，返回请求是否成功
+// 被中断唤醒的等待者负责完成通道当前的批次并启动下一个批次，该批次不一定包含自己的请求
+bool ide_wait(io_request *req)
+{
+    ide_channel *channel = req->hd->my_channel;
+    intr_status old_status = spin_lock_irqsave(&channel->lock);
+    while (!req->done)
+    {
+        if (!init_finish)
+        {
+            ide_intr_check(channel, inb(port_status(channel)));     // 初始化完成之前以轮询代替硬盘中断
+        }
+
+        if (channel->intr_done)
+        {
+            ide_run(channel, &old_status);
+        }
+        else if (init_finish)
+        {
+            list_push_back(&channel->wait_list, &req->wait_node);
+            wait_queue_sleep(&req->done_wq, &channel->lock);
+            list_remove(&channel->wait_list, &req->wait_node);
+        }
+    }
+    spin_unlock_irqrestore(&channel->lock, old_status);
+    return !req->error;
+}
+
 //  扫描分区表获取分区信息
 void scan_partition(disk *hd, const uint32_t start_lba)
 {
@@ -268,12 +881,17 @@ bool disk_is_ready(disk *hd)
     }
     else
     {
-        // 轮询方式
-        while (!(~(inb(port_status(hd->my_channel))) & BIT_STAT_BSY));
-        return inb(port_status(hd->my_channel)) & BIT_STAT_DRQ;
+        return disk_poll_ready(hd);
     }
 }         
 
+// 以忙等方式测试硬盘是否已将数据准备完毕
+bool disk_poll_ready(disk *hd)
+{
+    while (!(~(inb(port_status(hd->my_channel))) & BIT_STAT_BSY));
+    return inb(port_status(hd->my_channel)) & BIT_STAT_DRQ;
+}
+
  // 从指定硬盘读取sec_cnt个扇区数据到内存dst处
 void read_from_sectors(disk *hd, void *dst, const uint32_t sec_cnt)
 {
@@ -287,71 +905,170 @@ void write_to_sectors(disk *hd, void *src, const uint32_t sec_cnt)
 }            
 
 
-// 从指定硬盘中读取start_lba起始的sec_cnt个扇区到dst
-void read_disk(disk *hd, void *dst, uint32_t start_lba, uint32_t sec_cnt)
+// 判断当前页表中的用户页能否由控制器直接读写，is_write表示写硬盘，此时控制器只读取该页
+// 读硬盘时页须可写，只读的页(如写时复制共享的页)经由内核缓冲区中转
+bool user_page_dma_ok(void *vaddr, bool is_write)
 {
-    ASSERT(hd != NULL);
-    mutex_lock_acquire(&hd->my_channel->mutex);
-    while (sec_cnt)
+    uint32_t pde = *(uint32_t *)PDE_PTR((uint32_t)vaddr);
+    if (!(pde & PG_P_1))
+    {
+        return false;
+    }
+    uint32_t pte = *(uint32_t *)PTE_PTR((uint32_t)vaddr);
+    return (pte & PG_P_1) && (is_write || (pde & pte & PG_RW_W));
+}
+
+// 在当前线程中将用户缓冲区buf起始的len字节解析为物理内存段写入prd，返回表项数
+// 不能直接读写的页改用内核缓冲区*bounce中相同偏移处的内存，并在bounced中标记，*bounce为NULL时分配bounce_size字节
+// 写硬盘时这些页的数据先复制到内核缓冲区中
+uint32_t user_buf_prd(void *buf, uint32_t len, bool is_write, prd_entry *prd, void **bounce, uint32_t bounce_size, bool *bounced)
+{
+    uint32_t prd_cnt = 0;
+    uint32_t off = 0;
+    for (uint32_t i = 0; off < len; i++)
     {
-        uint8_t sec_op = (uint8_t)(sec_cnt >= 256 ? 256 : sec_cnt); 
+        void *vaddr = (uint8_t *)buf + off;
+        uint32_t seg = PAGE_SIZE - ((uint32_t)vaddr & (PAGE_SIZE - 1));     // 到当前页末尾为止
+        seg = (seg > len - off ? len - off : seg);
 
-        select_sectors(hd, start_lba, sec_op);
-        send_cmd(hd, CMD_READ);
-        if (init_finish)
+        bounced[i] = !user_page_dma_ok(vaddr, is_write);
+        bool ok;
+        if (bounced[i])
         {
-            sem_down(&hd->my_channel->disk_done);        // 发送命令后阻塞自己，等待硬盘中断
+            if (!*bounce)
+            {
+                *bounce = kmalloc(bounce_size);
+                ASSERT(*bounce != NULL);
+            }
+            void *kaddr = (uint8_t *)*bounce + off;
+            if (is_write)
+            {
+                memcpy(kaddr, vaddr, seg);
+            }
+            ok = prd_append_vaddr(prd, &prd_cnt, IDE_REQ_MAX_PRD, kaddr, seg);
         }
-
-        if (!disk_is_ready(hd))
+        else
         {
-            char error[80];
-            sprintf(error, "Read disk error:  disk: %s  sector: %d\n", hd->name, start_lba);
-            panic_spin(__FILE__, __LINE__, __func__, error);
+            ok = prd_append(prd, &prd_cnt, IDE_REQ_MAX_PRD, (uint32_t)vaddr2paddr(vaddr), seg);
         }
-
-        read_from_sectors(hd, dst, sec_op);
-
-        sec_cnt -= (uint32_t)sec_op;
-        start_lba += sec_op;
-        dst += (sec_op * 512);
+        ASSERT(ok);
+        off += seg;
     }
+    return prd_cnt;
+}
 
-    mutex_lock_release(&hd->my_channel->mutex);
-}   
+// 读硬盘完成后，将user_buf_prd中经由内核缓冲区中转的页复制回用户缓冲区
+void user_buf_copy_out(void *buf, uint32_t len, void *bounce, bool *bounced)
+{
+    uint32_t off = 0;
+    for (uint32_t i = 0; off < len; i++)
+    {
+        uint32_t seg = PAGE_SIZE - (((uint32_t)buf + off) & (PAGE_SIZE - 1));
+        seg = (seg > len - off ? len - off : seg);
+        if (bounced[i])
+        {
+            memcpy((uint8_t *)buf + off, (uint8_t *)bounce + off, seg);
+        }
+        off += seg;
+    }
+}
 
-// 将内存src处的sec_cnt个扇区数据写入到硬盘start_lba处
-void write_disk(disk *hd, void *src, uint32_t start_lba, uint32_t sec_cnt)
+// read_disk和write_disk的公共实现，每次提交不超过256个扇区的请求并等待其完成
+// 请求可能由其他进程的线程完成，因此用户缓冲区在当前线程中预先解析出物理内存段，由控制器直接读写，
+// 只有不能直接读写的页经由内核缓冲区中转，无法使用DMA时整段经由内核缓冲区中转
+void disk_rw(disk *hd, void *buf, uint32_t start_lba, uint32_t sec_cnt, bool is_write)
 {
     ASSERT(hd != NULL);
-    mutex_lock_acquire(&hd->my_channel->mutex);
+    bool user_buf = ((uint32_t)buf < KERNEL_SPACE_START);
+    uint32_t bounce_size = (sec_cnt >= IDE_MAX_SECTORS ? IDE_MAX_SECTORS : sec_cnt) * 512;
+    void *bounce = NULL;            // 内核中转缓冲区，需要时才分配
+    prd_entry *prd = NULL;
+    bool bounced[IDE_REQ_MAX_PAGES];
+
     while (sec_cnt)
     {
-        uint8_t sec_op = (uint8_t)(sec_cnt >= 256 ? 256 : sec_cnt); 
-
-        select_sectors(hd, start_lba, sec_op);
-        send_cmd(hd, CMD_WRITE);
+        uint32_t sec_op = (sec_cnt >= IDE_MAX_SECTORS ? IDE_MAX_SECTORS : sec_cnt);
+        uint32_t bytes = sec_op * 512;
+        io_request req;
+        bool ok = false;
+        bool done = false;
 
-        if (!disk_is_ready(hd))
+        if (!user_buf)
         {
-            char error[80];
-            sprintf(error, "Write disk error:  disk: %s  sector: %d\n", hd->name, start_lba);
-            panic_spin(__FILE__, __LINE__, __func__, error);
+            ide_request_init(&req, hd, buf, start_lba, sec_op, is_write);
+            ide_submit(&req);
+            ok = ide_wait(&req);
+            done = true;
+        }
+        else if (init_finish && hd->dma && hd->my_channel->bmide_base && !((uint32_t)buf & 0x1))
+        {
+            if (!prd)
+            {
+                prd = kmalloc(IDE_REQ_MAX_PRD * sizeof(prd_entry));
+                ASSERT(prd != NULL);
+            }
+            uint32_t prd_cnt = user_buf_prd(buf, bytes, is_write, prd, &bounce, bounce_size, bounced);
+            ide_request_init_prd(&req, hd, prd, prd_cnt, start_lba, sec_op, is_write);
+            ide_submit(&req);
+            ok = ide_wait(&req);
+            done = !req.retry;
+            if (ok && done && !is_write)
+            {
+                user_buf_copy_out(buf, bytes, bounce, bounced);
+            }
         }
 
-        write_to_sectors(hd, src, sec_op);
-
-        if (init_finish)
+        if (!done)
         {
-            sem_down(&hd->my_channel->disk_done);   // 写完数据后等待硬盘将数据完全写入扇区，然后发出硬盘中断唤醒当前线程以进行下一次写入
+            if (!bounce)
+            {
+                bounce = kmalloc(bounce_size);
+                ASSERT(bounce != NULL);
+            }
+            if (is_write)
+            {
+                memcpy(bounce, buf, bytes);
+            }
+            ide_request_init(&req, hd, bounce, start_lba, sec_op, is_write);
+            ide_submit(&req);
+            ok = ide_wait(&req);
+            if (ok && !is_write)
+            {
+                memcpy(buf, bounce, bytes);
+            }
         }
 
-        sec_cnt -= (uint32_t)sec_op;
+        if (!ok)
+        {
+            char error[80];
+            sprintf(error, "%s disk error:  disk: %s  sector: %d\n", is_write ? "Write" : "Read", hd->name, start_lba);
+            panic_spin(__FILE__, __LINE__, __func__, error);
+        }
+        sec_cnt -= sec_op;
         start_lba += sec_op;
-        src += (sec_op * 512);
+        buf += bytes;
     }
 
-    mutex_lock_release(&hd->my_channel->mutex);
+    if (bounce)
+    {
+        sys_free(bounce);
+    }
+    if (prd)
+    {
+        sys_free(prd);
+    }
+}
+
+// 从指定硬盘中读取start_lba起始的sec_cnt个扇区到dst
+void read_disk(disk *hd, void *dst, uint32_t start_lba, uint32_t sec_cnt)
+{
+    disk_rw(hd, dst, start_lba, sec_cnt, false);
+}   
+
+// 将内存src处的sec_cnt个扇区数据写入到硬盘start_lba处
+void write_disk(disk *hd, void *src, uint32_t start_lba, uint32_t sec_cnt)
+{
+    disk_rw(hd, src, start_lba, sec_cnt, true);
 }    
 
  // 获取硬盘参数
@@ -362,7 +1079,7 @@ void identify_disk(disk *hd)
     send_cmd(hd, CMD_IDENTIFY);
     if (init_finish)
     {
-        sem_down(&hd->my_channel->disk_done);
+        wait_event(&hd->my_channel->disk_done, !hd->my_channel->intr_is_expected);
     }
     if (!disk_is_ready(hd))
     {
@@ -403,6 +1120,10 @@ void identify_disk(disk *hd)
     printk("Sectors: %u\n", sec_cnt);
     printk("Capacity: %uMB\n", (sec_cnt * 512) / 1024 / 1024);
 
+    // 记录硬盘是否支持DMA，通道是否支持由bmide_init决定
+    hd->dma = (*(uint16_t *)(buf + IDENTIFY_CAPABILITY * 2) & IDENTIFY_CAP_DMA);
+    printk("DMA: %s\n", hd->dma ? "supported" : "unsupported");
+
     sys_free(buf);
 }    
 
@@ -11,6 +11,8 @@
 typedef struct ide_channel ide_channel;
 typedef struct disk disk;
 typedef struct partition partition; 
+typedef struct prd_entry prd_entry;
+typedef struct io_request io_request;
 
 struct partition
 {
@@ -25,7 +27,9 @@ struct partition
     superblock *sb;         // 指向该分区的超级块
     bitmap block_bitmap;    // 该分区的块位图
     bitmap inode_bitmap;    // 该分区的inode位图
-    list inode_list;        // 该分区的打开文件链表
+    bitmap block_bitmap_dirty;  // 块位图中已修改但尚未写回硬盘的扇区，每位对应一个扇区
+    bitmap inode_bitmap_dirty;  // inode位图中已修改但尚未写回硬盘的扇区，每位对应一个扇区
+    rw_lock rwlock;         // 保护两个位图及挂载信息，只读访问时持有读锁
 
     list mount_list;        // 挂载在该分区上的其他分区
     partition *parent_part; // 非空时表示本分区挂载于一个父分区
@@ -40,6 +44,29 @@ struct disk
     partition primary[4];           // mbr最多支持四个主分区
     partition logic[16];            // mbr可支持任意数量的逻辑分区，这里将逻辑分区的上限人为限定在16个
     uint8_t dev_no;                 // 指示硬盘是主盘还是从盘，0为主盘，1为从盘
+    bool dma;                       // 是否使用DMA方式传输数据，硬盘或控制器不支持时使用PIO方式
+    list req_queue;                 // 尚未开始传输的请求批次，按起始LBA升序排列
+    uint32_t next_lba;              // 电梯算法的磁头位置，即上一个批次结束处的LBA
+};
+
+// 硬盘读写请求，LBA相邻的同向请求会被合并为一个批次，由一条命令传输
+struct io_request
+{
+    disk *hd;
+    void *buf;                      // 数据缓冲区，须位于内核空间，prd非空时不使用
+    uint32_t start_lba;
+    uint32_t sec_cnt;               // 本请求的扇区数
+    uint32_t batch_sec_cnt;         // 作为批次的首个请求时，整个批次的扇区数
+    bool is_write;
+    volatile bool done;             // 请求已完成，由完成路径置位
+    bool error;                     // 请求是否出错
+    io_request *next;               // 批次中紧随其后的请求
+    node queue_node;                // 批次的首个请求用于挂到硬盘的请求队列中
+    wait_queue done_wq;             // 提交者在其上等待本请求完成
+    prd_entry *prd;                 // 提交者预先解析好的缓冲区物理内存段，非空时本请求只能以DMA方式传输
+    uint32_t prd_cnt;               // prd中的表项数
+    bool retry;                     // 本请求无法以DMA方式传输而未被执行，须由提交者改用其他方式重新提交
+    node wait_node;                 // 提交者等待期间用于挂到通道的等待者链表中
 };
 
 struct ide_channel
@@ -48,9 +75,17 @@ struct ide_channel
     disk disks[2];                  // 一个ide通道最多有两块硬盘
     uint32_t port_base;             // 起始端口号
     uint32_t intr_no;               // 中断号
-    mutex_lock mutex;               // 通道互斥锁，方便区分中断来自主盘还是从盘
-    bool intr_is_expected;          // 指示当前通道是否正在等待中断
-    semaphore disk_done;            // 线程发送硬盘命令后使用该信号量阻塞自己，等待硬盘中断将其唤醒
+    spinlock lock;                  // 保护两块硬盘的请求队列及通道当前的请求批次，中断处理函数也会获取
+    bool intr_is_expected;          // 指示当前通道是否正在等待中断，由硬盘中断处理函数清除
+    wait_queue disk_done;           // 识别硬盘的线程在该队列上等待硬盘中断
+    io_request *active;             // 正在传输的请求批次，为NULL表示通道空闲，同一时刻一个通道只能执行一条命令
+    bool intr_done;                 // 硬盘已对当前批次发出中断，等待某个线程完成该批次
+    list wait_list;                 // 正在等待请求完成的提交者，中断到来时从中选出一个线程完成当前批次
+    bool active_dma;                // 当前批次是否以DMA方式传输
+    uint8_t next_disk;              // 下一次优先调度的硬盘，两块硬盘轮流使用通道
+    uint16_t bmide_base;            // 总线主控IDE寄存器的起始端口号，为0表示该通道不支持DMA
+    prd_entry *prdt;                // 物理区域描述符表，DMA传输时描述内存缓冲区所在的各段物理内存
+    uint32_t prdt_phys;             // PRD表的物理地址
 };
 
 extern ide_channel channels[];         
@@ -59,6 +94,9 @@ extern list partition_list;                // 分区链表
 extern void ide_init(void);                 // 硬盘相关初始化
 extern void read_disk(disk *hd, void *dst, uint32_t start_lba, uint32_t sec_cnt);     // 从指定硬盘中读取start_lba起始的sec_cnt个扇区到dst
 extern void write_disk(disk *hd, void *src, uint32_t start_lba, uint32_t sec_cnt);   // 将内存src处的sec_cnt个扇区数据写入到硬盘start_lba处
+extern void ide_request_init(io_request *req, disk *hd, void *buf, uint32_t start_lba, uint32_t sec_cnt, bool is_write);  // 初始化一个硬盘请求
+extern void ide_submit(io_request *req);    // 将请求提交到所在硬盘的请求队列后立即返回
+extern bool ide_wait(io_request *req);      // 等待请求完成，返回请求是否成功
 
 extern bool part_name_check(node *pnode, int arg);         // 作为list_traversal的回调函数以分区名查找指定分区
 
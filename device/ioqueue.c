@@ -2,41 +2,50 @@
 
 void ioqueue_init(ioqueue *pioqueue, uint8_t *buffer, uint32_t buf_size)
 {
-    sem_init(&pioqueue->full, 0);
-    sem_init(&pioqueue->empty, buf_size);
-    mutex_lock_init(&pioqueue->mutex);
+    spin_lock_init(&pioqueue->lock);
+    wait_queue_init(&pioqueue->readers);
+    wait_queue_init(&pioqueue->writers);
 
     pioqueue->buffer = buffer;
     pioqueue->buf_size = buf_size;
 
     pioqueue->head = 0;
     pioqueue->tail = 0;
+    pioqueue->cnt = 0;
 }
 
-// 入队，写缓冲区
+// 判断队列是否已满
+bool ioqueue_is_full(ioqueue *pioqueue)
+{
+    return pioqueue->cnt == pioqueue->buf_size;
+}
+
+// 入队，写缓冲区，队列已满时阻塞直到有空槽位
 void ioqueue_push_back(ioqueue *pioqueue, const uint8_t val)
 {
-    sem_down(&pioqueue->empty);
-    mutex_lock_acquire(&pioqueue->mutex);
+    intr_status old_status = spin_lock_irqsave(&pioqueue->lock);
+    wait_event_locked(&pioqueue->writers, pioqueue->cnt < pioqueue->buf_size, &pioqueue->lock);
 
     pioqueue->buffer[pioqueue->tail] = val;
     pioqueue->tail = (pioqueue->tail + 1) % pioqueue->buf_size;
+    pioqueue->cnt++;
 
-    mutex_lock_release(&pioqueue->mutex);
-    sem_up(&pioqueue->full);
+    wake_up_one(&pioqueue->readers);
+    spin_unlock_irqrestore(&pioqueue->lock, old_status);
 }   
 
-// 出队， 读缓冲区
+// 出队， 读缓冲区，队列为空时阻塞直到有数据
 uint8_t ioqueue_pop_front(ioqueue *pioqueue)
 {
-    sem_down(&pioqueue->full);
-    mutex_lock_acquire(&pioqueue->mutex);
+    intr_status old_status = spin_lock_irqsave(&pioqueue->lock);
+    wait_event_locked(&pioqueue->readers, pioqueue->cnt > 0, &pioqueue->lock);
 
     uint8_t val = pioqueue->buffer[pioqueue->head];
     pioqueue->head = (pioqueue->head + 1) % pioqueue->buf_size;
+    pioqueue->cnt--;
 
-    mutex_lock_release(&pioqueue->mutex);
-    sem_up(&pioqueue->empty);
+    wake_up_one(&pioqueue->writers);
+    spin_unlock_irqrestore(&pioqueue->lock, old_status);
 
     return val;
-}        
\ No newline at end of file
+}
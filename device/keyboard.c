@@ -212,7 +212,11 @@ void intr_keyboard_handler(void)
             }
         }
 
-        ioqueue_push_back(&kb_buf, ch);
+        // 中断处理程序中不能阻塞，缓冲区已满时丢弃该字符
+        if (!ioqueue_is_full(&kb_buf))
+        {
+            ioqueue_push_back(&kb_buf, ch);
+        }
     }
 
 }
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "pci.h"
+#include "io.h"
+
+#define PCI_CONFIG_ADDR 0xcf8       // 配置地址端口
+#define PCI_CONFIG_DATA 0xcfc       // 配置数据端口
+#define PCI_CONFIG_ENABLE 0x80000000    // 配置地址的第31位置1才会访问配置空间
+
+#define PCI_MAX_BUS 256
+#define PCI_MAX_DEV 32
+#define PCI_MAX_FUNC 8
+
+uint32_t pci_config_addr(pci_device *pdev, uint8_t offset);     // 生成设备配置空间中offset处的配置地址
+
+// 生成设备配置空间中offset处的配置地址，offset须4字节对齐
+uint32_t pci_config_addr(pci_device *pdev, uint8_t offset)
+{
+    return PCI_CONFIG_ENABLE | ((uint32_t)pdev->bus << 16) | ((uint32_t)pdev->dev << 11) | 
+           ((uint32_t)pdev->func << 8) | (offset & 0xfc);
+}
+
+// 读取设备配置空间中offset处的32位数据
+uint32_t pci_config_read(pci_device *pdev, uint8_t offset)
+{
+    outl(pci_config_addr(pdev, offset), PCI_CONFIG_ADDR);
+    return inl(PCI_CONFIG_DATA);
+}
+
+// 向设备配置空间中offset处写入32位数据
+void pci_config_write(pci_device *pdev, uint8_t offset, uint32_t val)
+{
+    outl(pci_config_addr(pdev, offset), PCI_CONFIG_ADDR);
+    outl(val, PCI_CONFIG_DATA);
+}
+
+// 以暴力枚举的方式查找第一个指定类别的设备，找到时将其位置写入pdev并返回true
+bool pci_find_class(uint8_t class_code, uint8_t subclass, pci_device *pdev)
+{
+    for (uint32_t bus = 0; bus < PCI_MAX_BUS; ++bus)
+    {
+        for (uint32_t dev = 0; dev < PCI_MAX_DEV; ++dev)
+        {
+            for (uint32_t func = 0; func < PCI_MAX_FUNC; ++func)
+            {
+                pci_device cur = {bus, dev, func};
+                if ((pci_config_read(&cur, PCI_VENDOR_ID) & 0xffff) == 0xffff)
+                {
+                    // 功能0不存在时整个设备都不存在
+                    if (func == 0) break;
+                    continue;
+                }
+
+                uint32_t class_reg = pci_config_read(&cur, PCI_CLASS);
+                if ((class_reg >> 24) == class_code && ((class_reg >> 16) & 0xff) == subclass)
+                {
+                    *pdev = cur;
+                    return true;
+                }
+
+                // 单功能设备只有功能0
+                if (func == 0 && !(pci_config_read(&cur, PCI_HEADER_TYPE) & 0x00800000))
+                {
+                    break;
+                }
+            }
+        }
+    }
+    return false;
+}
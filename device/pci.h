@@ -0,0 +1,29 @@
+#ifndef __DEVICE_PCI_H
+#define __DEVICE_PCI_H
+
+#include "stdint.h"
+#include "stdbool.h"
+
+// 配置空间中的一些寄存器偏移
+#define PCI_VENDOR_ID       0x00        // 低16位为厂商号，高16位为设备号
+#define PCI_COMMAND         0x04        // 低16位为命令寄存器，高16位为状态寄存器
+#define PCI_CLASS           0x08        // 从高到低依次为类代码、子类代码、编程接口、版本号
+#define PCI_HEADER_TYPE     0x0c        // 第16~23位为头部类型，其第7位表示多功能设备
+#define PCI_BAR4            0x20        // 基址寄存器4
+
+#define PCI_COMMAND_IO          0x0001  // 允许设备响应I/O空间访问
+#define PCI_COMMAND_MASTER      0x0004  // 允许设备作为总线主控发起DMA
+
+// PCI设备在配置空间中的位置
+typedef struct pci_device
+{
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+} pci_device;
+
+extern uint32_t pci_config_read(pci_device *pdev, uint8_t offset);                 // 读取设备配置空间中offset处的32位数据
+extern void pci_config_write(pci_device *pdev, uint8_t offset, uint32_t val);      // 向设备配置空间中offset处写入32位数据
+extern bool pci_find_class(uint8_t class_code, uint8_t subclass, pci_device *pdev);    // 查找第一个指定类别的设备
+
+#endif
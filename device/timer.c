@@ -6,24 +6,46 @@
 #include "timer.h"
 
 #define TIMER_CLK_FREQ 1193180  //8253系列定时计数器的CLK引脚频率
-#define HZ 100      //每秒产生的时钟中断次数， 相当于每10ms产生一次时钟中断
 #define TIMER_START_VAL  (TIMER_CLK_FREQ/HZ)  //计数初值 == 11931
 #define MS_PER_TICK  (1000/HZ)           //每个tick对应的毫秒数
 
 #define TIMER_WORK_MODE  0x34   //工作方式：计数器0， 16位计数初值， 方式2--分频脉冲， 二进制计数
+#define TIMER_ONESHOT_MODE 0x30 //工作方式：计数器0， 16位计数初值， 方式0--计数结束中断， 二进制计数
+#define TIMER_LATCH_CMD  0x00   //锁存计数器0的当前计数值
+#define TIMER_ONESHOT_MAX_TICKS (0xffff / TIMER_START_VAL)     // 单次模式下16位计数初值最多能覆盖的tick数
+#define TIMER_TICKLESS_MAX_TICKS (60 * HZ)      // 没有睡眠线程时，无时钟空闲状态最长持续的tick数
+
+#define TIMER_WHEEL_SIZE 256    // 时间轮的槽数，必须是2的幂
+#define TIMER_WHEEL_SLOT(tick) (&timer_wheel[(tick) & (TIMER_WHEEL_SIZE - 1)])     // 指定时刻对应的时间轮槽
 
 uint32_t ticks = 0;         //从系统开中断开始到当前时刻总共发生的时钟中断数
+list timer_wheel[TIMER_WHEEL_SIZE];     // 睡眠线程按唤醒时刻散列到各槽中，槽内的线程可能相差若干圈
+volatile bool tickless[MAX_CPU_CNT];    // 各处理器是否处于无时钟空闲状态，BSP的标志在补上空闲期间经过的tick后才清除
+bool tickless_lapic;                    // BSP的单次定时使用本地APIC定时器，否则使用8253的单次模式
+uint32_t tickless_ticks;                // BSP本次单次定时覆盖的tick数
+uint32_t tickless_deadline;             // BSP无时钟空闲状态的结束时刻，8253的单次定时不够长时分段定时
+spinlock timer_lock;                    // 保护ticks和时间轮，各处理器上的线程都可能睡眠或被提前唤醒
 
 void intr_timer_handler(void);     // 时钟中断处理函数
+uint32_t timer_read(void);                          // 锁存并读取计数器0的当前计数值
 void sleep_ticks(const uint32_t timing_ticks);      // 使当前线程睡眠timing_ticks个tick
+void timer_wheel_expire(void);                      // 唤醒当前时刻对应槽中所有到期的线程
+void timer_program(uint8_t mode, uint16_t count);   // 以指定工作方式和计数初值设置计数器0
+void timer_advance(uint32_t tick_cnt);              // 使系统时间前进tick_cnt个tick，并处理期间到期的定时
+uint32_t timer_next_expiry(uint32_t max_ticks);     // 时间轮中最早到期的线程距当前时刻的tick数，最多为max_ticks
+void timer_oneshot_next(void);                      // 以8253的单次模式定时到tickless_deadline，超出16位计数范围时只定时其中一段
 
 //初始化8253定时计数器
 void timer_init(void)
 {
     // 注意不要把计数初值写成TIMER_CLK_FREQ了，这样的话产生的时钟中断频率是错误的(虽然没有非常明显的区别)
-    outb(TIMER_WORK_MODE, 0x43);
-    outb((uint8_t)TIMER_START_VAL, 0x40);        //低字节
-    outb((uint8_t)(TIMER_START_VAL >> 8), 0x40); //高字节
+    timer_program(TIMER_WORK_MODE, TIMER_START_VAL);
+
+    for (uint32_t i = 0; i < TIMER_WHEEL_SIZE; ++i)
+    {
+        list_init(&timer_wheel[i]);
+    }
+    spin_lock_init(&timer_lock);
 
     intr_handler_table[0x20] = (intr_entry)intr_timer_handler;      // 在中断处理函数表中注册时钟中断处理函数
 
@@ -32,31 +54,292 @@ void timer_init(void)
 
 // 时钟中断处理函数
 void intr_timer_handler(void)
+{
+    uint32_t elapsed = 1;
+    if (tickless[current->cpu])
+    {
+        if (tickless_lapic)
+        {
+            // 停止8253之前已经锁存的中断，这个tick确实已经过去，退出空闲状态后按周期性时钟中断处理
+            timer_tickless_exit();
+        }
+        else
+        {
+            // 8253的一段单次定时到期，补上这段时间经过的tick
+            elapsed = tickless_ticks;
+            timer_advance(elapsed);
+            if ((int32_t)(tickless_deadline - ticks) > 0 && !thread_need_preempt())
+            {
+                // 还没到最近的定时且没有就绪线程，接着定时下一段，不必调度
+                timer_oneshot_next();
+                return;
+            }
+            tickless_ticks = 0;
+            timer_program(TIMER_WORK_MODE, TIMER_START_VAL);
+            tickless[current->cpu] = false;
+            timer_sched_tick(elapsed);
+            return;
+        }
+    }
+
+    timer_advance(elapsed);
+    timer_sched_tick(elapsed);
+}
+
+// 当前处理器的一个调度tick：扣减当前线程的时间片，与其他处理器均衡负载，必要时重新调度
+// BSP由8253的时钟中断调用，其他处理器由本地APIC定时器中断调用，elapsed为距上次调用经过的tick数
+void timer_sched_tick(uint32_t elapsed)
 {
     //判断内核栈是否溢出
     ASSERT(current->magic == MAGIC);
 
-    ticks++;
     current->ticks--;
-    current->elapsed_ticks++;
+    current->elapsed_ticks += elapsed;
+    thread_balance();
+
     if ((int32_t)current->ticks <= 0)
     {
         current->ticks = 0;
         // 时间片用完时需要线程调度
         schedule();
     }
+    else if (thread_need_preempt())
+    {
+        // 有更高级别的线程就绪时，抢占当前线程
+        schedule();
+    }
+}
+
+// 锁存并读取计数器0的当前计数值
+uint32_t timer_read(void)
+{
+    outb(TIMER_LATCH_CMD, 0x43);
+    uint32_t count = inb(0x40);
+    count |= ((uint32_t)inb(0x40) << 8);
+    return count;
+}
+
+// 轮询计数器0忙等待us微秒，不依赖时钟中断，计数器须处于周期模式，用于系统启动期间的短延时
+// 计数器在方式2下从TIMER_START_VAL递减到1后重新装入初值，两次读数之间经过的计数不能超过一个周期
+void timer_udelay(uint32_t us)
+{
+    uint32_t remain = us * (TIMER_CLK_FREQ / 1000) / 1000;
+    uint32_t last = timer_read();
+    while (remain)
+    {
+        uint32_t now = timer_read();
+        uint32_t passed = (now <= last ? last - now : last + TIMER_START_VAL - now);
+        last = now;
+        remain = (passed < remain ? remain - passed : 0);
+    }
 }
 
-// 使当前线程睡眠timing_ticks个tick
+// 以指定工作方式和计数初值设置计数器0
+void timer_program(uint8_t mode, uint16_t count)
+{
+    outb(mode, 0x43);
+    outb((uint8_t)count, 0x40);         //低字节
+    outb((uint8_t)(count >> 8), 0x40);  //高字节
+}
+
+// 使系统时间前进tick_cnt个tick，并处理期间到期的定时
+void timer_advance(uint32_t tick_cnt)
+{
+    bool boost = false;
+    spin_lock(&timer_lock);
+    while (tick_cnt--)
+    {
+        ticks++;
+        timer_wheel_expire();
+        boost |= (ticks % MLFQ_BOOST_INTERVAL == 0);
+    }
+    spin_unlock(&timer_lock);
+
+    if (boost)
+    {
+        // 定期将所有线程提升到最高级别
+        thread_priority_boost();
+    }
+}
+
+// 时间轮中最早到期的线程距当前时刻的tick数，至少为1，没有更近的定时时为max_ticks，调用者须持有timer_lock
+uint32_t timer_next_expiry(uint32_t max_ticks)
+{
+    uint32_t next = max_ticks;
+    for (uint32_t i = 0; i < TIMER_WHEEL_SIZE; ++i)
+    {
+        list *slot = &timer_wheel[i];
+        for (node *pnode = slot->head.next; pnode != &slot->tail; pnode = pnode->next)
+        {
+            task_struct *pthread = member2struct(pnode, task_struct, general_list_node);
+            int32_t remain = (int32_t)(pthread->wakeup_tick - ticks);
+            if (remain < (int32_t)next)
+            {
+                next = (remain > 1 ? remain : 1);
+            }
+        }
+    }
+    return next;
+}
+
+// 以8253的单次模式定时到tickless_deadline，超出16位计数范围时只定时其中一段，到期后由时钟中断处理函数接着定时
+void timer_oneshot_next(void)
+{
+    uint32_t remain = tickless_deadline - ticks;
+    tickless_ticks = (remain < TIMER_ONESHOT_MAX_TICKS ? remain : TIMER_ONESHOT_MAX_TICKS);
+    timer_program(TIMER_ONESHOT_MODE, tickless_ticks * TIMER_START_VAL);
+}
+
+// 处理器空闲时调用(须关中断)：停止周期性时钟中断
+// AP的时钟中断只用于调度，直接停止本地APIC定时器，有新的就绪线程时由重新调度IPI唤醒
+// BSP负责推进系统时间和时间轮，只有其他处理器都空闲时才停止8253，改为在最近的睡眠线程到期时触发一次中断
+// 单次定时优先使用本地APIC定时器，32位计数足以覆盖很长的空闲；没有本地APIC时使用8253的单次模式分段定时
+void timer_tickless_enter(void)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    uint32_t cpu = current->cpu;
+    if (tickless[cpu])
+    {
+        return;
+    }
+    if (!cpus[cpu].bsp)
+    {
+        lapic_timer_stop();
+        tickless[cpu] = true;
+        return;
+    }
+
+    // 先置位标志再检查其他处理器，检查之后才离开空闲的处理器能看到标志，会通知BSP退出空闲状态
+    tickless[cpu] = true;
+    if (!thread_others_idle())
+    {
+        tickless[cpu] = false;
+        return;
+    }
+
+    spin_lock(&timer_lock);
+    uint32_t next = timer_next_expiry(TIMER_TICKLESS_MAX_TICKS);
+    spin_unlock(&timer_lock);
+
+    // 最近的定时就在下一个tick，保持周期模式即可
+    if (next == 1)
+    {
+        tickless[cpu] = false;
+        return;
+    }
+
+    tickless_deadline = ticks + next;
+    tickless_ticks = lapic_timer_oneshot(next);
+    tickless_lapic = (tickless_ticks != 0);
+    if (tickless_lapic)
+    {
+        // 只写入控制字而不写入计数初值，8253在单次模式下停止计数，不会再产生中断
+        outb(TIMER_ONESHOT_MODE, 0x43);
+    }
+    else
+    {
+        timer_oneshot_next();
+    }
+}
+
+// 处理器被中断唤醒后调用：恢复周期性时钟中断，处理器不在无时钟空闲状态时什么也不做
+// BSP按单次定时已经过的计数补上空闲期间的tick，补完之后才清除标志
+// AP离开空闲后运行的线程会读取系统时间，因此BSP仍处于无时钟空闲状态时通知其退出，并等待它补上tick
+void timer_tickless_exit(void)
+{
+    intr_status old_status = set_intr_status(INTR_OFF);
+    uint32_t cpu = current->cpu;
+
+    if (tickless[cpu] && !cpus[cpu].bsp)
+    {
+        lapic_timer_start();
+        tickless[cpu] = false;
+        if (tickless[0])
+        {
+            smp_send_resched(0);
+            while (tickless[0])
+            {
+                cpu_relax();
+            }
+        }
+    }
+    else if (tickless[cpu])
+    {
+        uint32_t passed;
+        if (tickless_lapic)
+        {
+            passed = lapic_timer_passed();
+            lapic_timer_stop();
+        }
+        else
+        {
+            // 计数结束后计数器会从0xffff继续递减，此时视为整段定时都已经过
+            uint32_t remain = timer_read();
+            uint32_t total = tickless_ticks * TIMER_START_VAL;
+            passed = (remain <= total ? total - remain : total) / TIMER_START_VAL;
+        }
+
+        tickless_ticks = 0;
+        timer_program(TIMER_WORK_MODE, TIMER_START_VAL);
+        // 不足一个tick的部分被舍弃，每次提前唤醒最多使系统时间慢一个tick
+        timer_advance(passed);
+        tickless[cpu] = false;
+    }
+
+    set_intr_status(old_status);
+}
+
+// 唤醒当前时刻对应槽中所有到期的线程，调用者须持有timer_lock
+void timer_wheel_expire(void)
+{
+    list *slot = TIMER_WHEEL_SLOT(ticks);
+    node *pnode = slot->head.next;
+    while (pnode != &slot->tail)
+    {
+        // 唤醒后结点会被挂到就绪队列上，必须先记下后继结点
+        node *next = pnode->next;
+        task_struct *pthread = member2struct(pnode, task_struct, general_list_node);
+        if ((int32_t)(ticks - pthread->wakeup_tick) >= 0)
+        {
+            list_remove(slot, pnode);
+            thread_unblock(pthread);
+        }
+        pnode = next;
+    }
+}
+
+// 使当前线程睡眠timing_ticks个tick，睡眠期间线程处于阻塞态，不占用处理器
 void sleep_ticks(const uint32_t timing_ticks)
 {
-    uint32_t start_ticks = ticks;
-    while ((ticks - start_ticks) < timing_ticks)
+    if (!timing_ticks)
     {
-        thread_yield();
+        return;
     }
+
+    intr_status old_status = spin_lock_irqsave(&timer_lock);
+
+    current->wakeup_tick = ticks + timing_ticks;
+    list_push_back(TIMER_WHEEL_SLOT(current->wakeup_tick), &current->general_list_node);
+    thread_block_locked(TASK_BLOCKED, &timer_lock);
+
+    set_intr_status(old_status);
 }     
 
+// 提前唤醒因sleep_ticks或sleep_ms而睡眠的线程，线程不在睡眠时什么也不做
+void wake_up_sleeper(task_struct *pthread)
+{
+    intr_status old_status = spin_lock_irqsave(&timer_lock);
+
+    list *slot = TIMER_WHEEL_SLOT(pthread->wakeup_tick);
+    if (pthread->status == TASK_BLOCKED && list_find(slot, &pthread->general_list_node))
+    {
+        list_remove(slot, &pthread->general_list_node);
+        thread_unblock(pthread);
+    }
+
+    spin_unlock_irqrestore(&timer_lock, old_status);
+}
+
 // 使当前线程睡眠m_seconds毫秒
 void sleep_ms(const uint32_t m_seconds)
 {
@@ -3,9 +3,18 @@
 
 #include "stdint.h"
 
+#define HZ 100      //每秒产生的时钟中断次数， 相当于每10ms产生一次时钟中断
+
+typedef struct task_struct task_struct;
+
 extern uint32_t ticks;                 //从系统开中断开始到当前时刻总共发生的时钟中断数 
 
 extern void timer_init(void);   //初始化8253定时计数器
 extern void sleep_ms(const uint32_t m_seconds);      // 使当前线程睡眠m_seconds毫秒
+extern void timer_udelay(uint32_t us);              // 轮询8253忙等待us微秒，不依赖时钟中断
+extern void timer_sched_tick(uint32_t elapsed);     // 当前处理器的一个调度tick，必要时重新调度
+extern void timer_tickless_enter(void);             // 处理器空闲时停止周期性时钟中断，BSP改为在最近的定时到期时触发一次
+extern void timer_tickless_exit(void);              // 退出空闲状态，恢复周期性时钟中断
+extern void wake_up_sleeper(task_struct *pthread);  // 提前唤醒正在睡眠的线程
 
 #endif
\ No newline at end of file
@@ -0,0 +1,440 @@
+#include "buffer.h"
+#include "ide.h"
+#include "dir.h"
+#include "memory.h"
+#include "string.h"
+#include "global.h"
+#include "debug.h"
+#include "stdio.h"
+#include "thread.h"
+#include "timer.h"
+
+#define BUF_HASH(hd, lba) ((((uint32_t)(hd) >> 4) ^ (lba)) & (BUF_HASH_SIZE - 1))
+
+// 哈希查找时使用的关键字
+typedef struct buffer_key
+{
+    disk *hd;
+    uint32_t lba;
+} buffer_key;
+
+buffer *buf_pool;                       // 缓冲区数组
+list buf_hash_table[BUF_HASH_SIZE];     // 以(硬盘, 扇区地址)为关键字的哈希表
+list buf_lru_list;                      // 引用计数为0的缓冲区，表头为最久未使用的缓冲区
+list buf_dirty_list;                    // 脏缓冲区链表，表头为最早变脏的缓冲区
+uint32_t buf_dirty_seq;                 // 最近一次有缓冲区变脏时分配的序号，受buf_cache_lock保护
+mutex_lock buf_cache_lock;              // 保护哈希表、LRU链表、脏缓冲区链表和所有缓冲区的引用计数
+wait_queue buf_writeback_wq;            // 等待缓冲区异步写回完成的线程
+mutex_lock buf_flush_lock;              // 使各批回写互斥进行，同步操作借此等待进行中的回写完成
+io_request flush_reqs[BUF_FLUSH_BATCH]; // 回写时提交的请求，受buf_flush_lock保护
+task_struct *flusher;                   // 回写线程
+
+bool buffer_check(node *pnode, int key);        // 作为list_traversal的回调函数判断缓冲区是否对应指定的(硬盘, 扇区地址)
+buffer *buffer_lookup(disk *hd, uint32_t lba);  // 若指定扇区已被缓存，则固定并返回其缓冲区，否则返回NULL
+buffer *buffer_evict(void);                     // 从LRU链表中取出一个可被淘汰的干净缓冲区，没有时返回NULL
+void buffer_clean(buffer *pbuf);                // 将缓冲区标记为干净并移出脏缓冲区链表
+void buffer_wait_writeback(buffer *pbuf);       // 等待缓冲区的异步写回完成
+uint32_t buffer_writeback_batch(disk *hd, bool expired_only, uint32_t end_seq);    // 将一批最早变脏的缓冲区提交给硬盘驱动写回并等待完成，返回写回的缓冲区数
+void buffer_writeback(disk *hd, bool expired_only);     // 将脏缓冲区批量提交给硬盘驱动写回并等待完成
+void buffer_flusher(void *arg UNUSED);          // 回写线程
+
+// 缓冲区高速缓存初始化
+void buffer_init(void)
+{
+    buf_pool = (buffer *)get_kernel_pages(DIV_ROUND_UP(sizeof(buffer) * BUF_CNT, PAGE_SIZE));
+    ASSERT(buf_pool);
+    uint8_t *data = (uint8_t *)get_kernel_contig_pages(DIV_ROUND_UP(BUF_CNT * SECTOR_SIZE, PAGE_SIZE));
+    ASSERT(data);
+
+    for (uint32_t i = 0; i < BUF_HASH_SIZE; ++i)
+    {
+        list_init(&buf_hash_table[i]);
+    }
+    list_init(&buf_lru_list);
+    list_init(&buf_dirty_list);
+    buf_dirty_seq = 0;
+    mutex_lock_init(&buf_cache_lock);
+    wait_queue_init(&buf_writeback_wq);
+    mutex_lock_init(&buf_flush_lock);
+
+    for (uint32_t i = 0; i < BUF_CNT; ++i)
+    {
+        buffer *pbuf = &buf_pool[i];
+        pbuf->hd = NULL;
+        pbuf->lba = 0;
+        pbuf->ref_cnt = 0;
+        pbuf->valid = pbuf->dirty = pbuf->writeback = false;
+        mutex_lock_init(&pbuf->lock);
+        node_init(&pbuf->hash_node);
+        node_init(&pbuf->lru_node);
+        node_init(&pbuf->dirty_node);
+        pbuf->data = data + i * SECTOR_SIZE;
+        list_push_back(&buf_lru_list, &pbuf->lru_node);
+    }
+
+    printk("Init buffer cache successfully!\n");
+}
+
+// 启动回写线程，须在线程初始化之后调用
+void buffer_flusher_start(void)
+{
+    flusher = thread_start("flusher", buffer_flusher, NULL, 10);
+}
+
+// 回写线程：定期写回变脏较久的缓冲区，脏缓冲区过多时被提前唤醒并写回全部脏缓冲区
+void buffer_flusher(void *arg UNUSED)
+{
+    while (1)
+    {
+        sleep_ms(BUF_FLUSH_INTERVAL_MS);
+        buffer_writeback(NULL, buf_dirty_list.length < BUF_DIRTY_HIGH);
+    }
+}
+
+// 将脏缓冲区批量提交给硬盘驱动写回并等待完成，hd为NULL时为所有硬盘
+// expired_only为true时只写回变脏超过BUF_DIRTY_EXPIRE个tick的缓冲区
+// 提交前将缓冲区固定并置为干净，因此写回期间缓冲区仍可被读写，再次被修改时会重新变脏
+// 只写回开始前已经变脏的缓冲区，之后才变脏的留给下一次回写，因此持续写入时也能返回
+// 每批写回完成后释放buf_flush_lock，让其他回写者交替进行，最后一次取得锁时已没有进行中的回写
+void buffer_writeback(disk *hd, bool expired_only)
+{
+    mutex_lock_acquire(&buf_cache_lock);
+    uint32_t end_seq = buf_dirty_seq;
+    mutex_lock_release(&buf_cache_lock);
+
+    uint32_t cnt;
+    do
+    {
+        mutex_lock_acquire(&buf_flush_lock);
+        cnt = buffer_writeback_batch(hd, expired_only, end_seq);
+        mutex_lock_release(&buf_flush_lock);
+    } while (cnt);
+}
+
+// 将一批最早变脏的缓冲区提交给硬盘驱动写回并等待完成，只处理变脏序号不超过end_seq的缓冲区
+// 返回写回的缓冲区数，须持有buf_flush_lock
+uint32_t buffer_writeback_batch(disk *hd, bool expired_only, uint32_t end_seq)
+{
+    ASSERT(buf_flush_lock.holder == current);
+    buffer *batch[BUF_FLUSH_BATCH];
+    uint32_t cnt = 0;
+
+    mutex_lock_acquire(&buf_cache_lock);
+    node *pnode = buf_dirty_list.head.next;
+    while (pnode != &buf_dirty_list.tail && cnt < BUF_FLUSH_BATCH)
+    {
+        node *next = pnode->next;
+        buffer *pbuf = member2struct(pnode, buffer, dirty_node);
+        if ((int32_t)(pbuf->dirty_seq - end_seq) > 0 || (expired_only && ticks - pbuf->dirty_tick < BUF_DIRTY_EXPIRE))
+        {
+            // 链表按变脏的先后排列，之后的缓冲区都是在回写开始后才变脏的或未到期
+            break;
+        }
+        if ((!hd || pbuf->hd == hd) && !pbuf->writeback)
+        {
+            if (pbuf->ref_cnt++ == 0)
+            {
+                list_remove(&buf_lru_list, &pbuf->lru_node);
+            }
+            buffer_clean(pbuf);
+            pbuf->writeback = true;
+            batch[cnt++] = pbuf;
+        }
+        pnode = next;
+    }
+    mutex_lock_release(&buf_cache_lock);
+
+    if (!cnt)
+    {
+        return 0;
+    }
+
+    // 一次性提交所有请求，由电梯算法合并相邻的扇区
+    for (uint32_t i = 0; i < cnt; ++i)
+    {
+        ide_request_init(&flush_reqs[i], batch[i]->hd, batch[i]->data, batch[i]->lba, 1, true);
+        ide_submit(&flush_reqs[i]);
+    }
+    for (uint32_t i = 0; i < cnt; ++i)
+    {
+        if (!ide_wait(&flush_reqs[i]))
+        {
+            char error[80];
+            sprintf(error, "Write back buffer error:  disk: %s  sector: %d\n", batch[i]->hd->name, batch[i]->lba);
+            panic_spin(__FILE__, __LINE__, __func__, error);
+        }
+    }
+
+    mutex_lock_acquire(&buf_cache_lock);
+    for (uint32_t i = 0; i < cnt; ++i)
+    {
+        batch[i]->writeback = false;
+        if (--batch[i]->ref_cnt == 0)
+        {
+            list_push_back(&buf_lru_list, &batch[i]->lru_node);
+        }
+    }
+    mutex_lock_release(&buf_cache_lock);
+    wake_up_all(&buf_writeback_wq);
+    return cnt;
+}
+
+// 将缓冲区标记为干净并移出脏缓冲区链表，须持有buf_cache_lock
+void buffer_clean(buffer *pbuf)
+{
+    if (pbuf->dirty)
+    {
+        pbuf->dirty = false;
+        list_remove(&buf_dirty_list, &pbuf->dirty_node);
+    }
+}
+
+// 等待缓冲区的异步写回完成，避免随后的同步写入被较早的回写数据覆盖
+void buffer_wait_writeback(buffer *pbuf)
+{
+    wait_event(&buf_writeback_wq, !pbuf->writeback);
+}
+
+// 从LRU链表中取出最久未使用的干净缓冲区，全部是脏缓冲区时返回NULL，须持有buf_cache_lock
+buffer *buffer_evict(void)
+{
+    for (node *pnode = buf_lru_list.head.next; pnode != &buf_lru_list.tail; pnode = pnode->next)
+    {
+        buffer *pbuf = member2struct(pnode, buffer, lru_node);
+        if (!pbuf->dirty)
+        {
+            list_remove(&buf_lru_list, pnode);
+            return pbuf;
+        }
+    }
+    return NULL;
+}
+
+// 作为list_traversal的回调函数判断缓冲区是否对应指定的(硬盘, 扇区地址)
+bool buffer_check(node *pnode, int key)
+{
+    buffer *pbuf = member2struct(pnode, buffer, hash_node);
+    return (pbuf->hd == ((buffer_key *)key)->hd && pbuf->lba == ((buffer_key *)key)->lba);
+}
+
+// 获取指定扇区的缓冲区，不保证数据有效，适用于整扇区覆盖写
+// 返回时调用者持有缓冲区的锁，使用完毕后必须调用buffer_release
+buffer *buffer_get(disk *hd, uint32_t lba)
+{
+    ASSERT(hd != NULL);
+    mutex_lock_acquire(&buf_cache_lock);
+
+    buffer *pbuf;
+    buffer_key key = {hd, lba};
+    list *bucket = &buf_hash_table[BUF_HASH(hd, lba)];
+    while (1)
+    {
+        node *pnode = list_traversal(bucket, buffer_check, (int)&key);
+        if (pnode)
+        {
+            // 缓存命中，若缓冲区原本空闲，需要将其从LRU链表中取出
+            pbuf = member2struct(pnode, buffer, hash_node);
+            if (pbuf->ref_cnt++ == 0)
+            {
+                list_remove(&buf_lru_list, &pbuf->lru_node);
+            }
+            break;
+        }
+
+        // 缓存未命中，淘汰最久未使用的干净缓冲区
+        if (buf_lru_list.length == 0)
+        {
+            panic_spin(__FILE__, __LINE__, __func__, "No free buffer in buffer cache!");
+        }
+        pbuf = buffer_evict();
+        if (pbuf)
+        {
+            if (pbuf->hd)
+            {
+                list_remove(&buf_hash_table[BUF_HASH(pbuf->hd, pbuf->lba)], &pbuf->hash_node);
+            }
+            pbuf->hd = hd;
+            pbuf->lba = lba;
+            pbuf->valid = false;
+            pbuf->ref_cnt = 1;
+            list_push_front(bucket, &pbuf->hash_node);
+            break;
+        }
+
+        // 空闲的缓冲区全部是脏的，说明回写跟不上写入的速度
+        // 释放buf_cache_lock后写回一批最早变脏的缓冲区，写回期间其他线程仍可访问缓存
+        // 期间其他线程可能已经缓存了该扇区，因此写回后必须重新查找
+        uint32_t end_seq = buf_dirty_seq;
+        mutex_lock_release(&buf_cache_lock);
+        if (flusher)
+        {
+            wake_up_sleeper(flusher);
+        }
+        mutex_lock_acquire(&buf_flush_lock);
+        buffer_writeback_batch(NULL, false, end_seq);
+        mutex_lock_release(&buf_flush_lock);
+        mutex_lock_acquire(&buf_cache_lock);
+    }
+
+    mutex_lock_release(&buf_cache_lock);
+
+    mutex_lock_acquire(&pbuf->lock);
+    return pbuf;
+}
+
+// 若指定扇区已被缓存，则固定并返回其缓冲区，否则返回NULL
+buffer *buffer_lookup(disk *hd, uint32_t lba)
+{
+    mutex_lock_acquire(&buf_cache_lock);
+
+    buffer_key key = {hd, lba};
+    node *pnode = list_traversal(&buf_hash_table[BUF_HASH(hd, lba)], buffer_check, (int)&key);
+    if (!pnode)
+    {
+        mutex_lock_release(&buf_cache_lock);
+        return NULL;
+    }
+    buffer *pbuf = member2struct(pnode, buffer, hash_node);
+    if (pbuf->ref_cnt++ == 0)
+    {
+        list_remove(&buf_lru_list, &pbuf->lru_node);
+    }
+
+    mutex_lock_release(&buf_cache_lock);
+
+    mutex_lock_acquire(&pbuf->lock);
+    return pbuf;
+}
+
+// 获取指定扇区的缓冲区，数据无效时从硬盘读入
+buffer *buffer_read(disk *hd, uint32_t lba)
+{
+    buffer *pbuf = buffer_get(hd, lba);
+    if (!pbuf->valid)
+    {
+        read_disk(hd, pbuf->data, lba, 1);
+        pbuf->valid = true;
+    }
+    return pbuf;
+}
+
+// 将缓冲区立即写回硬盘
+void buffer_write(buffer *pbuf)
+{
+    ASSERT(pbuf->ref_cnt > 0 && pbuf->lock.holder == current);
+    buffer_wait_writeback(pbuf);
+    write_disk(pbuf->hd, pbuf->data, pbuf->lba, 1);
+    pbuf->valid = true;
+
+    mutex_lock_acquire(&buf_cache_lock);
+    buffer_clean(pbuf);
+    mutex_lock_release(&buf_cache_lock);
+}
+
+// 将缓冲区标记为脏，由回写线程或同步操作写回，调用者无需等待硬盘
+void buffer_mark_dirty(buffer *pbuf)
+{
+    ASSERT(pbuf->ref_cnt > 0 && pbuf->lock.holder == current);
+    pbuf->valid = true;
+
+    mutex_lock_acquire(&buf_cache_lock);
+    if (!pbuf->dirty)
+    {
+        pbuf->dirty = true;
+        pbuf->dirty_tick = ticks;
+        pbuf->dirty_seq = ++buf_dirty_seq;
+        list_push_back(&buf_dirty_list, &pbuf->dirty_node);
+    }
+    bool pressure = (buf_dirty_list.length >= BUF_DIRTY_HIGH);
+    mutex_lock_release(&buf_cache_lock);
+
+    if (pressure && flusher)
+    {
+        wake_up_sleeper(flusher);
+    }
+}
+
+// 释放缓冲区
+void buffer_release(buffer *pbuf)
+{
+    ASSERT(pbuf->ref_cnt > 0);
+    mutex_lock_release(&pbuf->lock);
+
+    mutex_lock_acquire(&buf_cache_lock);
+    if (--pbuf->ref_cnt == 0)
+    {
+        // 最近使用的缓冲区放在LRU链表尾部
+        list_push_back(&buf_lru_list, &pbuf->lru_node);
+    }
+    mutex_lock_release(&buf_cache_lock);
+}
+
+// 将指定硬盘(hd为NULL时为所有硬盘)的脏缓冲区写回，返回时这些缓冲区均已写入硬盘
+void buffer_flush(disk *hd)
+{
+    buffer_writeback(hd, false);
+}
+
+// 经由缓冲区读取连续sec_cnt个扇区到dst
+void buffer_read_sectors(disk *hd, void *dst, uint32_t start_lba, uint32_t sec_cnt)
+{
+    for (uint32_t i = 0; i < sec_cnt; ++i)
+    {
+        buffer *pbuf = buffer_read(hd, start_lba + i);
+        memcpy(dst + i * SECTOR_SIZE, pbuf->data, SECTOR_SIZE);
+        buffer_release(pbuf);
+    }
+}
+
+// 将src处连续sec_cnt个扇区写入缓冲区并标记为脏，由回写线程写入硬盘
+void buffer_write_sectors(disk *hd, const void *src, uint32_t start_lba, uint32_t sec_cnt)
+{
+    for (uint32_t i = 0; i < sec_cnt; ++i)
+    {
+        buffer *pbuf = buffer_get(hd, start_lba + i);
+        memcpy(pbuf->data, src + i * SECTOR_SIZE, SECTOR_SIZE);
+        buffer_mark_dirty(pbuf);
+        buffer_release(pbuf);
+    }
+}
+
+// 绕过缓冲区直接读硬盘前调用：将[start_lba, start_lba + sec_cnt)中的脏缓冲区写回，保证硬盘上的数据是最新的
+void buffer_flush_range(disk *hd, uint32_t start_lba, uint32_t sec_cnt)
+{
+    for (uint32_t i = 0; i < sec_cnt; ++i)
+    {
+        buffer *pbuf = buffer_lookup(hd, start_lba + i);
+        if (pbuf)
+        {
+            if (pbuf->dirty)
+            {
+                buffer_write(pbuf);
+            }
+            else
+            {
+                buffer_wait_writeback(pbuf);
+            }
+            buffer_release(pbuf);
+        }
+    }
+}
+
+// 绕过缓冲区直接写硬盘前调用：用src中的新数据更新[start_lba, start_lba + sec_cnt)中已被缓存的扇区
+// 必须在直接写入之前等待这些扇区进行中的回写完成，否则较早的回写数据可能覆盖新数据
+void buffer_update_range(disk *hd, const void *src, uint32_t start_lba, uint32_t sec_cnt)
+{
+    for (uint32_t i = 0; i < sec_cnt; ++i)
+    {
+        buffer *pbuf = buffer_lookup(hd, start_lba + i);
+        if (pbuf)
+        {
+            buffer_wait_writeback(pbuf);
+            memcpy(pbuf->data, src + i * SECTOR_SIZE, SECTOR_SIZE);
+            pbuf->valid = true;
+            mutex_lock_acquire(&buf_cache_lock);
+            buffer_clean(pbuf);
+            mutex_lock_release(&buf_cache_lock);
+            buffer_release(pbuf);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef __FS_BUFFER_H
+#define __FS_BUFFER_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "list.h"
+#include "sync.h"
+
+#define BUF_CNT 512             // 缓冲区数量，每个缓冲区缓存一个扇区
+#define BUF_HASH_SIZE 128       // 哈希桶数量，必须是2的幂
+#define BUF_DIRTY_HIGH (BUF_CNT / 4)    // 脏缓冲区达到该数量时立即唤醒回写线程
+#define BUF_DIRTY_EXPIRE 300            // 缓冲区变脏超过该tick数(约3秒)后由回写线程定期写回
+#define BUF_FLUSH_INTERVAL_MS 1000      // 回写线程定期醒来的间隔
+#define BUF_FLUSH_BATCH 64              // 回写时一次提交的最大请求数
+
+typedef struct disk disk;
+
+// 扇区缓冲区
+typedef struct buffer
+{
+    disk *hd;               // 缓冲区对应的硬盘，为NULL时表示缓冲区从未被使用
+    uint32_t lba;           // 缓冲区对应的扇区地址
+    uint32_t ref_cnt;       // 引用计数，为0时缓冲区位于LRU链表中，可被淘汰
+    bool valid;             // 缓冲区中的数据是否有效(已从硬盘读入或已被整体写入)
+    bool dirty;             // 缓冲区中的数据是否已被修改且尚未写回硬盘
+    bool writeback;         // 缓冲区正在被异步写回，期间缓冲区被固定，不会被淘汰
+    uint32_t dirty_tick;    // 缓冲区变脏的时刻
+    uint32_t dirty_seq;     // 缓冲区变脏时分配的序号，回写据此跳过开始后才变脏的缓冲区
+    mutex_lock lock;        // 缓冲区数据的互斥锁，引用者在释放缓冲区前一直持有该锁
+
+    node hash_node;         // 用于将缓冲区挂到哈希桶中
+    node lru_node;          // 用于将缓冲区挂到LRU链表中
+    node dirty_node;        // 用于将缓冲区按变脏的先后顺序挂到脏缓冲区链表中
+
+    uint8_t *data;          // 扇区数据
+} buffer;
+
+extern void buffer_init(void);                              // 缓冲区高速缓存初始化
+extern void buffer_flusher_start(void);                     // 启动回写线程
+extern buffer *buffer_get(disk *hd, uint32_t lba);          // 获取指定扇区的缓冲区，不保证数据有效，适用于整扇区覆盖写
+extern buffer *buffer_read(disk *hd, uint32_t lba);         // 获取指定扇区的缓冲区，数据无效时从硬盘读入
+extern void buffer_write(buffer *pbuf);                     // 将缓冲区立即写回硬盘
+extern void buffer_mark_dirty(buffer *pbuf);                // 将缓冲区标记为脏，由回写线程或同步操作写回
+extern void buffer_release(buffer *pbuf);                   // 释放缓冲区
+extern void buffer_flush(disk *hd);                         // 将指定硬盘(hd为NULL时为所有硬盘)的脏缓冲区写回
+
+extern void buffer_read_sectors(disk *hd, void *dst, uint32_t start_lba, uint32_t sec_cnt);         // 经由缓冲区读取连续sec_cnt个扇区到dst
+extern void buffer_write_sectors(disk *hd, const void *src, uint32_t start_lba, uint32_t sec_cnt);  // 将src处连续sec_cnt个扇区写入缓冲区并标记为脏
+extern void buffer_flush_range(disk *hd, uint32_t start_lba, uint32_t sec_cnt);     // 绕过缓冲区直接读硬盘前，写回该范围内的脏缓冲区
+extern void buffer_update_range(disk *hd, const void *src, uint32_t start_lba, uint32_t sec_cnt);   // 绕过缓冲区直接写硬盘前，更新该范围内已缓存的扇区
+
+#endif
@@ -0,0 +1,208 @@
+#include "dcache.h"
+#include "ide.h"
+#include "memory.h"
+#include "string.h"
+#include "global.h"
+#include "debug.h"
+#include "sync.h"
+
+// 哈希查找时使用的关键字
+typedef struct dcache_key
+{
+    partition *part;
+    uint32_t parent_i_no;
+    const char *name;
+} dcache_key;
+
+dcache_entry *dcache_pool;                  // 缓存项数组
+list dcache_hash_table[DCACHE_HASH_SIZE];   // 以(分区, 目录inode编号, 文件名)为关键字的哈希表
+list dcache_lru_list;                       // 所有缓存项，表头为最久未使用或未被使用的缓存项
+mutex_lock dcache_lock;                     // 保护哈希表、LRU链表、所有缓存项和挂载信息的版本号
+uint32_t dcache_gen;                        // 挂载信息的版本号，每次挂载或卸载后加1
+
+uint32_t dcache_hash(partition *part, uint32_t parent_i_no, const char *name);   // 计算关键字对应的哈希桶下标
+bool dcache_check(node *pnode, int key);    // 作为list_traversal的回调函数判断缓存项是否对应指定的关键字
+dcache_entry *dcache_find(partition *part, uint32_t parent_i_no, const char *name);  // 在哈希表中查找缓存项，须持有dcache_lock
+void dcache_drop(dcache_entry *pde);        // 将缓存项移出哈希表并放到LRU链表表头，须持有dcache_lock
+
+// 目录项缓存初始化
+void dcache_init(void)
+{
+    dcache_pool = (dcache_entry *)get_kernel_pages(DIV_ROUND_UP(sizeof(dcache_entry) * DCACHE_SIZE, PAGE_SIZE));
+    ASSERT(dcache_pool);
+
+    for (uint32_t i = 0; i < DCACHE_HASH_SIZE; ++i)
+    {
+        list_init(&dcache_hash_table[i]);
+    }
+    list_init(&dcache_lru_list);
+    mutex_lock_init(&dcache_lock);
+    dcache_gen = 0;
+
+    for (uint32_t i = 0; i < DCACHE_SIZE; ++i)
+    {
+        dcache_entry *pde = &dcache_pool[i];
+        pde->part = NULL;
+        node_init(&pde->hash_node);
+        node_init(&pde->lru_node);
+        list_push_back(&dcache_lru_list, &pde->lru_node);
+    }
+}
+
+// 计算关键字对应的哈希桶下标
+uint32_t dcache_hash(partition *part, uint32_t parent_i_no, const char *name)
+{
+    uint32_t h = ((uint32_t)part >> 4) ^ parent_i_no;
+    while (*name)
+    {
+        h = h * 31 + (uint8_t)*name++;
+    }
+    return h & (DCACHE_HASH_SIZE - 1);
+}
+
+// 作为list_traversal的回调函数判断缓存项是否对应指定的关键字
+bool dcache_check(node *pnode, int key)
+{
+    dcache_entry *pde = member2struct(pnode, dcache_entry, hash_node);
+    dcache_key *pkey = (dcache_key *)key;
+    return (pde->part == pkey->part && pde->parent_i_no == pkey->parent_i_no && !strcmp(pde->name, pkey->name));
+}
+
+// 在哈希表中查找缓存项，须持有dcache_lock
+dcache_entry *dcache_find(partition *part, uint32_t parent_i_no, const char *name)
+{
+    dcache_key key = {part, parent_i_no, name};
+    node *pnode = list_traversal(&dcache_hash_table[dcache_hash(part, parent_i_no, name)], dcache_check, (int)&key);
+    if (!pnode)
+    {
+        return NULL;
+    }
+    dcache_entry *pde = member2struct(pnode, dcache_entry, hash_node);
+    return pde;
+}
+
+// 将缓存项移出哈希表并放到LRU链表表头，使其被优先复用，须持有dcache_lock
+void dcache_drop(dcache_entry *pde)
+{
+    list_remove(&dcache_hash_table[dcache_hash(pde->part, pde->parent_i_no, pde->name)], &pde->hash_node);
+    pde->part = NULL;
+    list_remove(&dcache_lru_list, &pde->lru_node);
+    list_push_front(&dcache_lru_list, &pde->lru_node);
+}
+
+// 获取挂载信息的版本号，查找目录表之前记录，缓存结果时据此丢弃查找期间挂载信息已改变的结果
+uint32_t dcache_generation(void)
+{
+    mutex_lock_acquire(&dcache_lock);
+    uint32_t gen = dcache_gen;
+    mutex_lock_release(&dcache_lock);
+    return gen;
+}
+
+// 在缓存中查找part分区中inode编号为parent_i_no的目录下名为name的文件，
+// 命中时返回true，*ret_part为NULL表示已知该文件不存在，否则结果存放在p_dentry中
+bool dcache_lookup(partition *part, uint32_t parent_i_no, const char *name, dentry *p_dentry, partition **ret_part)
+{
+    mutex_lock_acquire(&dcache_lock);
+    dcache_entry *pde = dcache_find(part, parent_i_no, name);
+    if (!pde)
+    {
+        mutex_lock_release(&dcache_lock);
+        return false;
+    }
+
+    *ret_part = pde->ret_part;
+    if (pde->ret_part)
+    {
+        memcpy(p_dentry, &pde->de, sizeof(dentry));
+    }
+    list_remove(&dcache_lru_list, &pde->lru_node);
+    list_push_back(&dcache_lru_list, &pde->lru_node);
+    mutex_lock_release(&dcache_lock);
+    return true;
+}
+
+// 缓存一次查找的结果，ret_part为NULL时缓存查找失败的结果，
+// 调用者须持有目录inode的读锁(或写锁)，gen为查找目录表之前获取的挂载信息版本号
+void dcache_add(partition *part, uint32_t parent_i_no, const char *name, const dentry *p_dentry, partition *ret_part, uint32_t gen)
+{
+    if (strlen(name) >= MAX_FILENAME_LEN)
+    {
+        return;
+    }
+
+    mutex_lock_acquire(&dcache_lock);
+    if (gen != dcache_gen)
+    {
+        // 查找期间发生了挂载或卸载，结果可能已经过时
+        mutex_lock_release(&dcache_lock);
+        return;
+    }
+
+    dcache_entry *pde = dcache_find(part, parent_i_no, name);
+    if (!pde)
+    {
+        // 复用最久未使用的缓存项
+        node *pnode = dcache_lru_list.head.next;
+        pde = member2struct(pnode, dcache_entry, lru_node);
+        if (pde->part)
+        {
+            list_remove(&dcache_hash_table[dcache_hash(pde->part, pde->parent_i_no, pde->name)], &pde->hash_node);
+        }
+        pde->part = part;
+        pde->parent_i_no = parent_i_no;
+        strcpy(pde->name, name);
+        list_push_front(&dcache_hash_table[dcache_hash(part, parent_i_no, name)], &pde->hash_node);
+    }
+
+    pde->ret_part = ret_part;
+    if (ret_part)
+    {
+        memcpy(&pde->de, p_dentry, sizeof(dentry));
+    }
+    list_remove(&dcache_lru_list, &pde->lru_node);
+    list_push_back(&dcache_lru_list, &pde->lru_node);
+    mutex_lock_release(&dcache_lock);
+}
+
+// 使指定目录中指定名字的缓存项失效，调用者须持有目录inode的写锁
+void dcache_invalidate(partition *part, uint32_t parent_i_no, const char *name)
+{
+    mutex_lock_acquire(&dcache_lock);
+    dcache_entry *pde = dcache_find(part, parent_i_no, name);
+    if (pde)
+    {
+        dcache_drop(pde);
+    }
+    mutex_lock_release(&dcache_lock);
+}
+
+// 使指定目录中的所有缓存项失效，用于inode编号被重新分配给新目录时清除旧目录遗留的缓存项
+void dcache_invalidate_dir(partition *part, uint32_t parent_i_no)
+{
+    mutex_lock_acquire(&dcache_lock);
+    for (uint32_t i = 0; i < DCACHE_SIZE; ++i)
+    {
+        dcache_entry *pde = &dcache_pool[i];
+        if (pde->part == part && pde->parent_i_no == parent_i_no)
+        {
+            dcache_drop(pde);
+        }
+    }
+    mutex_lock_release(&dcache_lock);
+}
+
+// 挂载信息改变后使所有缓存项失效，并使查找期间挂载信息已改变的结果不再被缓存
+void dcache_invalidate_all(void)
+{
+    mutex_lock_acquire(&dcache_lock);
+    ++dcache_gen;
+    for (uint32_t i = 0; i < DCACHE_SIZE; ++i)
+    {
+        if (dcache_pool[i].part)
+        {
+            dcache_drop(&dcache_pool[i]);
+        }
+    }
+    mutex_lock_release(&dcache_lock);
+}
@@ -0,0 +1,33 @@
+#ifndef __FS_DCACHE_H
+#define __FS_DCACHE_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "list.h"
+#include "dir.h"
+
+#define DCACHE_SIZE 256         // 缓存的目录项数量
+#define DCACHE_HASH_SIZE 128    // 哈希桶数量，必须是2的幂
+
+// 目录项缓存，记录在某个目录中按名字查找的结果(包括查找失败的结果)
+typedef struct dcache_entry
+{
+    partition *part;            // 被查找的目录所在分区，为NULL时表示该缓存项未被使用
+    uint32_t parent_i_no;       // 被查找的目录的inode编号
+    char name[MAX_FILENAME_LEN];    // 查找的文件名
+    partition *ret_part;        // 查找结果所在分区(已处理挂载点)，为NULL时表示目录中不存在该文件
+    dentry de;                  // 查找到的目录项(已处理挂载点)
+
+    node hash_node;             // 用于将缓存项挂到哈希桶中
+    node lru_node;              // 用于将缓存项挂到LRU链表中
+} dcache_entry;
+
+extern void dcache_init(void);          // 目录项缓存初始化
+extern uint32_t dcache_generation(void);    // 获取挂载信息的版本号，在查找目录表之前记录
+extern bool dcache_lookup(partition *part, uint32_t parent_i_no, const char *name, dentry *p_dentry, partition **ret_part);    // 在缓存中查找，命中时返回true
+extern void dcache_add(partition *part, uint32_t parent_i_no, const char *name, const dentry *p_dentry, partition *ret_part, uint32_t gen);  // 缓存一次查找的结果，ret_part为NULL时缓存查找失败的结果
+extern void dcache_invalidate(partition *part, uint32_t parent_i_no, const char *name);    // 使指定目录中指定名字的缓存项失效
+extern void dcache_invalidate_dir(partition *part, uint32_t parent_i_no);      // 使指定目录中的所有缓存项失效
+extern void dcache_invalidate_all(void);    // 挂载信息改变后使所有缓存项失效
+
+#endif
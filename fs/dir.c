@@ -1,5 +1,6 @@
 #include "dir.h"
 #include "ide.h"
+#include "buffer.h"
 #include "_syscall.h"
 #include "debug.h"
 #include "inode.h"
@@ -7,15 +8,50 @@
 #include "global.h"
 #include "file.h"
 #include "memory.h"
+#include "slab.h"
+#include "fs.h"
+#include "thread.h"
+#include "dcache.h"
+#include "superblock.h"
 
 extern partition *root_part;        // 根目录所在分区
 
+slab_cache *dir_cache;              // 目录结构的缓存
+
+#define DENTRY_PER_SEC (SECTOR_SIZE / sizeof(dentry))    // 每个扇区中的目录项数
+
+// 哈希索引的查找路径上的一个索引块
+typedef struct dx_frame
+{
+    uint32_t block;         // 索引块在目录表中的下标
+    uint32_t pos;           // 查找所经过的索引项的下标
+} dx_frame;
+
 bool is_mount_point(node *pnode, int i_no);     // 作为list_traversal的回调函数判断某个inode是否属于挂载点
+uint32_t dx_hash(const char *name);             // 计算文件名的哈希值
+bool dx_is_index_block(const void *buf);        // 判断目录表中的某个块是否是哈希索引块
+bool dir_is_indexed(inode *p_inode);            // 判断目录是否已经建立了哈希索引
+uint32_t dir_block_lba(inode *p_inode, uint32_t idx);       // 获取目录表中下标为idx的块的LBA，块不存在时返回0
+uint32_t dir_max_blocks(inode *p_inode);                    // 目录表最多占用的块数
+int32_t dir_block_alloc(inode *p_inode, uint32_t *idx);     // 为目录表分配一个新块，返回其LBA并通过idx返回其下标，失败时返回-1
+bool dir_block_free(inode *p_inode, uint32_t idx);          // 释放目录表中下标为idx的块
+int32_t dentry_block_search(dentry *buf, const char *filename);     // 在一个扇区的目录项中查找名为filename的目录项
+int32_t dentry_free_slot(dentry *buf);                      // 在一个扇区的目录项中查找空闲的目录项
+uint32_t dx_search_node(dx_node *node, uint32_t hash);      // 在索引块中找到覆盖hash的索引项
+void dx_insert(dx_node *node, uint32_t pos, uint32_t hash, uint32_t block);     // 在索引块的pos项之后插入一个索引项
+uint32_t dx_find_leaf(inode *p_inode, uint32_t hash, dx_frame *path, uint32_t *depth);  // 从根索引块开始找到覆盖hash的叶块
+bool dx_split_leaf(dentry *buf, dentry *new_buf, uint32_t *split_hash);     // 将已满的叶块按哈希值分成两半
+int32_t dx_split(inode *p_inode, dx_frame *path, uint32_t depth, uint32_t hash, dentry *buf, uint32_t *leaf_lba);  // 分裂已满的叶块并更新索引
+bool dx_create_index(inode *p_inode);           // 将只占一个块的线性目录转换为带索引的目录
+bool dx_find_dentry(inode *p_inode, const char *filename, dentry *p_dentry);    // 在带索引的目录中查找目录项
+bool dx_add_dentry(inode *p_inode, dentry *p_dentry);       // 向带索引的目录中加入目录项
+bool dx_del_dentry(inode *p_inode, const char *filename);   // 在带索引的目录中删除目录项
+bool dir_find_dentry(inode *p_inode, const char *filename, dentry *p_dentry);   // 在目录表中查找名为filename的目录项
 
 // 打开part分区中inode编号为i_no的目录
 dir *dir_open(partition *part, uint32_t i_no)
 {
-    dir *pdir = (dir *)kmalloc(sizeof(dir));
+    dir *pdir = (dir *)slab_alloc(dir_cache);
     ASSERT(pdir);
     pdir->p_inode = (inode *)inode_open(part, i_no);
     pdir->d_pos = 0;
@@ -32,7 +68,7 @@ void dir_close(dir *pdir)
     {
         sys_free(pdir->buf);
     }
-    sys_free(pdir);
+    slab_free(dir_cache, pdir);
 }      
 
 // 作为list_traversal的回调函数判断某个inode是否属于挂载点
@@ -42,200 +78,596 @@ bool is_mount_point(node *pnode, int i_no)
     return (p_mnt_pt->i_no == (uint32_t)i_no);
 }     
 
-// 在pdir的目录表中搜索名为filename的文件并返回对应目录项 
-partition *dir_search(dir *pdir, const char *filename, dentry *p_dentry)
+// 计算文件名的哈希值(FNV-1a)
+uint32_t dx_hash(const char *name)
 {
-    // 将目录表的所有数据块地址存储到all_blocks中
-    uint32_t *all_blocks = (uint32_t *)kmalloc(560);
-    ASSERT(all_blocks);
-    memset(all_blocks, 0, 560);
-    for(uint32_t i = 0; i < 12; ++i)
+    uint32_t hash = 2166136261u;
+    while (*name)
     {
-        all_blocks[i] = pdir->p_inode->i_sectors[i];
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619;
     }
-    if (pdir->p_inode->i_sectors[12])
+    return hash;
+}
+
+// 判断目录表中的某个块是否是哈希索引块
+bool dx_is_index_block(const void *buf)
+{
+    return (*(const uint32_t *)buf == DX_MAGIC);
+}
+
+// 判断目录是否已经建立了哈希索引，带索引的目录以目录表的第0块作为根索引块
+bool dir_is_indexed(inode *p_inode)
+{
+    buffer *pbuf = buffer_read(p_inode->part->my_disk, dir_block_lba(p_inode, 0));
+    bool indexed = dx_is_index_block(pbuf->data);
+    buffer_release(pbuf);
+    return indexed;
+}
+
+// 获取目录表中下标为idx的块的LBA，块不存在时返回0
+uint32_t dir_block_lba(inode *p_inode, uint32_t idx)
+{
+    uint32_t lba;
+    inode_bmap(p_inode, idx, 1, &lba);
+    return lba;
+}
+
+// 目录表最多占用的块数，支持索引的分区上由索引容量决定，否则只能逐块扫描，同时不超过分区格式下文件最多的块数
+uint32_t dir_max_blocks(inode *p_inode)
+{
+    partition *part = p_inode->part;
+    uint32_t max_blocks = ((part->sb->compat_flags & FS_COMPAT_DIR_INDEX) ? DX_MAX_BLOCKS : DIR_LINEAR_MAX_BLOCKS);
+    return (max_blocks < inode_max_blocks(part) ? max_blocks : inode_max_blocks(part));
+}
+
+// 为目录表分配一个新块并填入目录表中第一个空缺的位置，返回新块的LBA并通过idx返回其下标，失败时返回-1
+int32_t dir_block_alloc(inode *p_inode, uint32_t *idx)
+{
+    partition *part = p_inode->part;
+    uint32_t max_blocks = dir_max_blocks(p_inode);
+    uint32_t i = 0;
+    while (i < max_blocks && dir_block_lba(p_inode, i))
+    {
+        ++i;
+    }
+    if (i == max_blocks)
     {
-        read_disk(pdir->p_inode->part->my_disk, all_blocks + 12, pdir->p_inode->i_sectors[12], 1);
+        return -1;
     }
 
-    uint32_t de_cnt_per_sec = SECTOR_SIZE / sizeof(dentry);
-    dentry *buf = (dentry *)kmalloc(SECTOR_SIZE);
-    ASSERT(buf);
-    for (uint32_t i = 0; i < 140; ++i)
+    // 分配一个数据块，路径上缺少的索引块由inode_bmap_map分配
+    int32_t blk_lba = bitmap_alloc(part, BLOCK_BITMAP);
+    if (blk_lba == -1)
+    {
+        return -1;
+    }
+    if (!inode_bmap_map(p_inode, i, blk_lba, 1))
+    {
+        bitmap_free(part, BLOCK_BITMAP, blk_lba - part->sb->blocks_lba);
+        return -1;
+    }
+
+    inode_sync(p_inode);
+    bitmap_mark_dirty(part, BLOCK_BITMAP, blk_lba - part->sb->blocks_lba);
+    bitmap_flush(part);
+    *idx = i;
+    return blk_lba;
+}
+
+// 释放目录表中下标为idx的块，变空的索引块保留到目录被删除时再回收
+// 解除区段中间一个块的映射需要分裂区段，分配区段树结点失败时返回false，该块保持不变
+// 按分配的相反顺序撤销dir_block_alloc时不会失败
+bool dir_block_free(inode *p_inode, uint32_t idx)
+{
+    partition *part = p_inode->part;
+    uint32_t blk_lba = dir_block_lba(p_inode, idx);
+    if (!inode_bmap_map(p_inode, idx, 0, 1))
     {
-        if (all_blocks[i])
+        return false;
+    }
+    inode_sync(p_inode);
+    bitmap_free(part, BLOCK_BITMAP, blk_lba - part->sb->blocks_lba);
+    bitmap_mark_dirty(part, BLOCK_BITMAP, blk_lba - part->sb->blocks_lba);
+    bitmap_flush(part);
+    return true;
+}
+
+// 在一个扇区的目录项中查找名为filename的目录项，返回其下标，不存在时返回-1
+int32_t dentry_block_search(dentry *buf, const char *filename)
+{
+    for (uint32_t j = 0; j < DENTRY_PER_SEC; ++j)
+    {
+        if (buf[j].f_type != FT_UNKNOWN && !strcmp(filename, buf[j].filename))
         {
-            read_disk(pdir->p_inode->part->my_disk, buf, all_blocks[i], 1);
-            for (uint32_t j = 0; j < de_cnt_per_sec; ++j)
+            return j;
+        }
+    }
+    return -1;
+}
+
+// 在一个扇区的目录项中查找空闲的目录项，返回其下标，不存在时返回-1
+int32_t dentry_free_slot(dentry *buf)
+{
+    for (uint32_t j = 0; j < DENTRY_PER_SEC; ++j)
+    {
+        if (buf[j].f_type == FT_UNKNOWN)
+        {
+            return j;
+        }
+    }
+    return -1;
+}
+
+// 在索引块中找到覆盖hash的索引项，即除第一项外最后一个哈希值不大于hash的索引项
+uint32_t dx_search_node(dx_node *node, uint32_t hash)
+{
+    uint32_t lo = 1, hi = node->count;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (node->entries[mid].hash <= hash)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+// 在索引块的pos项之后插入一个索引项，调用者须保证索引块未满
+void dx_insert(dx_node *node, uint32_t pos, uint32_t hash, uint32_t block)
+{
+    ASSERT(node->count < DX_ENTRY_CNT);
+    for (uint32_t i = node->count; i > pos + 1; --i)
+    {
+        node->entries[i] = node->entries[i - 1];
+    }
+    node->entries[pos + 1].hash = hash;
+    node->entries[pos + 1].block = block;
+    ++node->count;
+}
+
+// 从根索引块开始找到覆盖hash的叶块，返回叶块在目录表中的下标，path记录路径上每个索引块及所经过的索引项，*depth为路径上的索引块数
+uint32_t dx_find_leaf(inode *p_inode, uint32_t hash, dx_frame *path, uint32_t *depth)
+{
+    dx_node *node = (dx_node *)slab_alloc(sector_cache);
+    ASSERT(node);
+
+    uint32_t block = 0;
+    uint32_t levels = 0;
+    uint32_t i = 0;
+    do
+    {
+        buffer_read_sectors(p_inode->part->my_disk, node, dir_block_lba(p_inode, block), 1);
+        ASSERT(node->magic == DX_MAGIC);
+        if (i == 0)
+        {
+            levels = node->levels;
+            ASSERT(levels <= DX_MAX_LEVELS);
+        }
+        path[i].block = block;
+        path[i].pos = dx_search_node(node, hash);
+        block = node->entries[path[i].pos].block;
+    } while (i++ < levels);
+
+    *depth = levels + 1;
+    slab_free(sector_cache, node);
+    return block;
+}
+
+// 将已满的叶块按哈希值分成两半，哈希值较小的一半留在buf中，另一半移到new_buf中，
+// 相同哈希值的目录项不会被分开，所有目录项的哈希值都相同时无法分裂，返回false
+bool dx_split_leaf(dentry *buf, dentry *new_buf, uint32_t *split_hash)
+{
+    // 按哈希值对目录项进行插入排序
+    uint32_t hash[DENTRY_PER_SEC];
+    for (uint32_t i = 0; i < DENTRY_PER_SEC; ++i)
+    {
+        dentry de = buf[i];
+        uint32_t h = dx_hash(de.filename);
+        uint32_t j = i;
+        while (j > 0 && hash[j - 1] > h)
+        {
+            hash[j] = hash[j - 1];
+            buf[j] = buf[j - 1];
+            --j;
+        }
+        hash[j] = h;
+        buf[j] = de;
+    }
+
+    // 从中间开始寻找哈希值发生变化的位置作为分裂点
+    uint32_t mid = DENTRY_PER_SEC / 2;
+    uint32_t split = mid;
+    while (split < DENTRY_PER_SEC && hash[split] == hash[split - 1])
+    {
+        ++split;
+    }
+    if (split == DENTRY_PER_SEC)
+    {
+        split = mid - 1;
+        while (split > 0 && hash[split] == hash[split - 1])
+        {
+            --split;
+        }
+        if (split == 0)
+        {
+            return false;
+        }
+    }
+
+    memset(new_buf, 0, SECTOR_SIZE);
+    memcpy(new_buf, buf + split, (DENTRY_PER_SEC - split) * sizeof(dentry));
+    memset(buf + split, 0, (DENTRY_PER_SEC - split) * sizeof(dentry));
+    *split_hash = hash[split];
+    return true;
+}
+
+// 分裂buf中已满的叶块(LBA为*leaf_lba)，并将新叶块的索引项插入父索引块，父索引块已满时一并分裂，
+// 返回后buf和*leaf_lba为覆盖hash的叶块，返回其中空闲目录项的下标，失败时返回-1且不修改硬盘上的目录表
+int32_t dx_split(inode *p_inode, dx_frame *path, uint32_t depth, uint32_t hash, dentry *buf, uint32_t *leaf_lba)
+{
+    disk *hd = p_inode->part->my_disk;
+    dx_node *root = (dx_node *)slab_alloc(sector_cache);
+    dx_node *node = (dx_node *)slab_alloc(sector_cache);
+    dx_node *new_node = (dx_node *)slab_alloc(sector_cache);
+    dentry *new_buf = (dentry *)slab_alloc(sector_cache);
+    ASSERT(root && node && new_node && new_buf);
+    int32_t slot = -1;
+
+    buffer_read_sectors(hd, root, dir_block_lba(p_inode, 0), 1);
+    if (depth > 1)
+    {
+        buffer_read_sectors(hd, node, dir_block_lba(p_inode, path[1].block), 1);
+    }
+    dx_node *parent = (depth > 1 ? node : root);
+
+    // 计算需要新分配的块数：新叶块，以及父索引块已满时分裂出的索引块
+    uint32_t need = 1;
+    if (parent->count == DX_ENTRY_CNT)
+    {
+        if (depth == 1)
+        {
+            // 根索引块已满，将其索引项分到两个新的索引块中，目录增加一层索引
+            need += 2;
+        }
+        else if (root->count < DX_ENTRY_CNT)
+        {
+            // 中间索引块已满，分裂为两个
+            need += 1;
+        }
+        else
+        {
+            goto out;
+        }
+    }
+
+    uint32_t split_hash;
+    if (!dx_split_leaf(buf, new_buf, &split_hash))
+    {
+        goto out;
+    }
+
+    // 先分配所有需要的块，分配失败时回滚，此前不修改目录表
+    uint32_t idx[3];
+    int32_t lba[3];
+    for (uint32_t i = 0; i < need; ++i)
+    {
+        lba[i] = dir_block_alloc(p_inode, &idx[i]);
+        if (lba[i] == -1)
+        {
+            while (i--)
             {
-                if (buf[j].f_type != FT_UNKNOWN && !strcmp(filename, buf[j].filename))
-                {
-                    memcpy(p_dentry, buf + j, sizeof(dentry));
-                    partition *ret_part = pdir->p_inode->part;
-                    if (buf[j].f_type == FT_DIRECTORY)
-                    {
-                        // 判断该目录是否是另一个分区的挂载点
-                        node *pnode = list_traversal(&pdir->p_inode->part->mount_list, is_mount_point, buf[j].i_no);
-                        if (pnode)
-                        {
-                            mount_point *p_mt_pt = member2struct(pnode, mount_point, list_node);
-                            p_dentry->i_no = p_mt_pt->part->sb->root_i_no;
-                            ret_part = p_mt_pt->part;
-                        }
-                        
-                        // 将挂载于另一个分区的分区根目录中的 .. 目录项重定向
-                        if (pdir->p_inode->part->parent_part && !strcmp(p_dentry->filename, "..") 
-                            && pdir->p_inode->i_no == pdir->p_inode->part->sb->root_i_no)
-                        {
-                            p_dentry->i_no = pdir->p_inode->part->mount_p_i_no;
-                            ret_part = pdir->p_inode->part->parent_part;
-                        }
-                    }
-                    sys_free(buf);
-                    sys_free(all_blocks);
-                    return ret_part;
-                }
+                dir_block_free(p_inode, idx[i]);
             }
+            goto out;
         }
     }
-    sys_free(buf);
-    sys_free(all_blocks);
-    return NULL;
+
+    buffer_write_sectors(hd, buf, *leaf_lba, 1);
+    buffer_write_sectors(hd, new_buf, lba[0], 1);
+
+    uint32_t pos = path[depth - 1].pos;
+    if (parent->count < DX_ENTRY_CNT)
+    {
+        dx_insert(parent, pos, split_hash, idx[0]);
+        buffer_write_sectors(hd, parent, dir_block_lba(p_inode, path[depth - 1].block), 1);
+    }
+    else
+    {
+        // 将已满的父索引块的后一半移到新索引块中，并将新叶块的索引项插入对应的一半
+        uint32_t half = DX_ENTRY_CNT / 2;
+        memset(new_node, 0, SECTOR_SIZE);
+        new_node->magic = DX_MAGIC;
+        new_node->count = DX_ENTRY_CNT - half;
+        memcpy(new_node->entries, parent->entries + half, new_node->count * sizeof(dx_entry));
+        parent->count = half;
+        if (pos < half)
+        {
+            dx_insert(parent, pos, split_hash, idx[0]);
+        }
+        else
+        {
+            dx_insert(new_node, pos - half, split_hash, idx[0]);
+        }
+
+        if (depth == 1)
+        {
+            // 根索引块的前一半移到另一个新索引块中，根索引块只保留指向两个新索引块的索引项
+            parent->levels = 0;
+            buffer_write_sectors(hd, parent, lba[1], 1);
+            buffer_write_sectors(hd, new_node, lba[2], 1);
+            uint32_t right_hash = new_node->entries[0].hash;
+            memset(root, 0, SECTOR_SIZE);
+            root->magic = DX_MAGIC;
+            root->levels = 1;
+            root->count = 2;
+            root->entries[0].block = idx[1];
+            root->entries[1].hash = right_hash;
+            root->entries[1].block = idx[2];
+        }
+        else
+        {
+            buffer_write_sectors(hd, parent, dir_block_lba(p_inode, path[1].block), 1);
+            buffer_write_sectors(hd, new_node, lba[1], 1);
+            dx_insert(root, path[0].pos, new_node->entries[0].hash, idx[1]);
+        }
+        buffer_write_sectors(hd, root, dir_block_lba(p_inode, 0), 1);
+    }
+
+    if (hash >= split_hash)
+    {
+        memcpy(buf, new_buf, SECTOR_SIZE);
+        *leaf_lba = lba[0];
+    }
+    slot = dentry_free_slot(buf);
+
+out:
+    slab_free(sector_cache, root);
+    slab_free(sector_cache, node);
+    slab_free(sector_cache, new_node);
+    slab_free(sector_cache, new_buf);
+    return slot;
 }
 
-// 在目录pdir下增加一个目录项
-bool add_dentry(dir *pdir, dentry *p_dentry)
+// 将只占一个块且该块已满的线性目录转换为带索引的目录：原有目录项移到新的叶块中，第0块改为根索引块
+bool dx_create_index(inode *p_inode)
 {
-    // 将目录表的所有数据块地址存储到all_blocks中
-    uint32_t *all_blocks = (uint32_t *)kmalloc(560);
-    ASSERT(all_blocks);
-    memset(all_blocks, 0, 560);
-    for(uint32_t i = 0; i < 12; ++i)
+    uint32_t leaf;
+    int32_t leaf_lba = dir_block_alloc(p_inode, &leaf);
+    if (leaf_lba == -1)
     {
-        all_blocks[i] = pdir->p_inode->i_sectors[i];
+        return false;
     }
-    if (pdir->p_inode->i_sectors[12])
+
+    void *buf = slab_alloc(sector_cache);
+    ASSERT(buf);
+    buffer_read_sectors(p_inode->part->my_disk, buf, dir_block_lba(p_inode, 0), 1);
+    buffer_write_sectors(p_inode->part->my_disk, buf, leaf_lba, 1);
+
+    dx_node *root = (dx_node *)buf;
+    memset(root, 0, SECTOR_SIZE);
+    root->magic = DX_MAGIC;
+    root->levels = 0;
+    root->count = 1;
+    root->entries[0].block = leaf;
+    buffer_write_sectors(p_inode->part->my_disk, root, dir_block_lba(p_inode, 0), 1);
+    slab_free(sector_cache, buf);
+    return true;
+}
+
+// 在带索引的目录中查找名为filename的目录项，只需读取查找路径上的索引块和一个叶块
+bool dx_find_dentry(inode *p_inode, const char *filename, dentry *p_dentry)
+{
+    dx_frame path[DX_MAX_LEVELS + 1];
+    uint32_t depth;
+    uint32_t leaf = dx_find_leaf(p_inode, dx_hash(filename), path, &depth);
+
+    dentry *buf = (dentry *)slab_alloc(sector_cache);
+    ASSERT(buf);
+    buffer_read_sectors(p_inode->part->my_disk, buf, dir_block_lba(p_inode, leaf), 1);
+    int32_t j = dentry_block_search(buf, filename);
+    if (j != -1)
     {
-        read_disk(pdir->p_inode->part->my_disk, all_blocks + 12, pdir->p_inode->i_sectors[12], 1);
+        memcpy(p_dentry, buf + j, sizeof(dentry));
     }
+    slab_free(sector_cache, buf);
+    return (j != -1);
+}
+
+// 向带索引的目录中加入目录项，叶块已满时将其按哈希值分裂
+bool dx_add_dentry(inode *p_inode, dentry *p_dentry)
+{
+    uint32_t hash = dx_hash(p_dentry->filename);
+    dx_frame path[DX_MAX_LEVELS + 1];
+    uint32_t depth;
+    uint32_t leaf = dx_find_leaf(p_inode, hash, path, &depth);
+    uint32_t leaf_lba = dir_block_lba(p_inode, leaf);
 
-    for (uint32_t i = 0; i < 140; ++i)
+    dentry *buf = (dentry *)slab_alloc(sector_cache);
+    ASSERT(buf);
+    buffer_read_sectors(p_inode->part->my_disk, buf, leaf_lba, 1);
+    int32_t j = dentry_free_slot(buf);
+    if (j == -1)
     {
-        if (!all_blocks[i])
+        j = dx_split(p_inode, path, depth, hash, buf, &leaf_lba);
+    }
+    if (j != -1)
+    {
+        memcpy(buf + j, p_dentry, sizeof(dentry));
+        buffer_write_sectors(p_inode->part->my_disk, buf, leaf_lba, 1);
+    }
+    slab_free(sector_cache, buf);
+    return (j != -1);
+}
+
+// 在带索引的目录中删除名为filename的目录项，变空的叶块不被回收
+bool dx_del_dentry(inode *p_inode, const char *filename)
+{
+    dx_frame path[DX_MAX_LEVELS + 1];
+    uint32_t depth;
+    uint32_t leaf_lba = dir_block_lba(p_inode, dx_find_leaf(p_inode, dx_hash(filename), path, &depth));
+
+    dentry *buf = (dentry *)slab_alloc(sector_cache);
+    ASSERT(buf);
+    buffer_read_sectors(p_inode->part->my_disk, buf, leaf_lba, 1);
+    int32_t j = dentry_block_search(buf, filename);
+    if (j != -1)
+    {
+        buf[j].f_type = FT_UNKNOWN;
+        buffer_write_sectors(p_inode->part->my_disk, buf, leaf_lba, 1);
+    }
+    slab_free(sector_cache, buf);
+    return (j != -1);
+}
+
+// 在目录表中查找名为filename的目录项，带索引的目录沿索引查找，否则逐块扫描
+bool dir_find_dentry(inode *p_inode, const char *filename, dentry *p_dentry)
+{
+    if (dir_is_indexed(p_inode))
+    {
+        return dx_find_dentry(p_inode, filename, p_dentry);
+    }
+
+    dentry *buf = (dentry *)slab_alloc(sector_cache);
+    ASSERT(buf);
+    bool found = false;
+    for (uint32_t i = 0; i < DIR_LINEAR_MAX_BLOCKS && !found; ++i)
+    {
+        uint32_t blk_lba = dir_block_lba(p_inode, i);
+        if (blk_lba)
         {
-            if (i < 12)
+            buffer_read_sectors(p_inode->part->my_disk, buf, blk_lba, 1);
+            int32_t j = dentry_block_search(buf, filename);
+            if (j != -1)
             {
-                // 分配一个数据块
-                uint32_t blk_lba = bitmap_alloc(pdir->p_inode->part, BLOCK_BITMAP);
-                if (blk_lba == -1)
-                {
-                    sys_free(all_blocks);
-                    return false;
-                }
+                memcpy(p_dentry, buf + j, sizeof(dentry));
+                found = true;
+            }
+        }
+    }
+    slab_free(sector_cache, buf);
+    return found;
+}
 
-                void *buf = kmalloc(SECTOR_SIZE);
-                ASSERT(buf);
-                memset(buf, 0, SECTOR_SIZE);
-                memcpy(buf, p_dentry, sizeof(dentry));
-                write_disk(pdir->p_inode->part->my_disk, buf, blk_lba, 1);
+// 在pdir的目录表中搜索名为filename的文件并返回对应目录项，查找期间持有目录inode的读锁
+partition *dir_search(dir *pdir, const char *filename, dentry *p_dentry)
+{
+    rw_lock_read_acquire(&pdir->p_inode->rwlock);
 
-                pdir->p_inode->i_sectors[i] = all_blocks[i] = blk_lba;
-                pdir->p_inode->i_size += sizeof(dentry);
+    // 先在目录项缓存中查找，缓存中的结果已经处理过挂载点
+    partition *ret_part;
+    if (dcache_lookup(pdir->p_inode->part, pdir->p_inode->i_no, filename, p_dentry, &ret_part))
+    {
+        rw_lock_read_release(&pdir->p_inode->rwlock);
+        return ret_part;
+    }
+    uint32_t gen = dcache_generation();
 
-                inode_sync(pdir->p_inode);
-                bitmap_sync(pdir->p_inode->part, BLOCK_BITMAP, blk_lba - pdir->p_inode->part->sb->blocks_lba);
-                sys_free(buf);
-                sys_free(all_blocks);
-                return true;
-            }
-            else if (i == 12 && pdir->p_inode->i_sectors[12] == 0)
-            {
-                // 分配一个索引块
-                uint32_t indirect_blk_lba = bitmap_alloc(pdir->p_inode->part, BLOCK_BITMAP);
-                if (indirect_blk_lba == -1)
-                {
-                    sys_free(all_blocks);
-                    return false;
-                }
-                // 分配一个数据块
-                uint32_t blk_lba = bitmap_alloc(pdir->p_inode->part, BLOCK_BITMAP);
-                if (blk_lba == -1)
-                {
-                    // 将之前分配的间接块回滚到未分配状态
-                    bitmap_set(&pdir->p_inode->part->block_bitmap, indirect_blk_lba - pdir->p_inode->part->sb->blocks_lba, 0);
-                    sys_free(all_blocks);
-                    return false;
-                }
+    ret_part = NULL;
+    if (dir_find_dentry(pdir->p_inode, filename, p_dentry))
+    {
+        ret_part = pdir->p_inode->part;
+        if (p_dentry->f_type == FT_DIRECTORY)
+        {
+            // 挂载信息由分区的读写锁保护
+            rw_lock_read_acquire(&pdir->p_inode->part->rwlock);
 
-                void *buf = kmalloc(SECTOR_SIZE);
-                ASSERT(buf);
-                memset(buf, 0, SECTOR_SIZE);
-                memcpy(buf, p_dentry, sizeof(dentry));
-                write_disk(pdir->p_inode->part->my_disk, buf, blk_lba, 1);
-
-                all_blocks[12] = blk_lba;
-                write_disk(pdir->p_inode->part->my_disk, all_blocks + 12, indirect_blk_lba, 1);
-
-                pdir->p_inode->i_sectors[12] = indirect_blk_lba;
-                pdir->p_inode->i_size += sizeof(dentry);
-                
-                inode_sync(pdir->p_inode);
-                bitmap_sync(pdir->p_inode->part, BLOCK_BITMAP, blk_lba - pdir->p_inode->part->sb->blocks_lba);
-                bitmap_sync(pdir->p_inode->part, BLOCK_BITMAP, indirect_blk_lba - pdir->p_inode->part->sb->blocks_lba);
-                sys_free(buf);
-                sys_free(all_blocks);
-                return true;
-            }
-            else
+            // 判断该目录是否是另一个分区的挂载点
+            node *pnode = list_traversal(&pdir->p_inode->part->mount_list, is_mount_point, p_dentry->i_no);
+            if (pnode)
             {
-                // 分配一个数据块
-                uint32_t blk_lba = bitmap_alloc(pdir->p_inode->part, BLOCK_BITMAP);
-                if (blk_lba == -1)
-                {
-                    sys_free(all_blocks);
-                    return false;
-                }
+                mount_point *p_mt_pt = member2struct(pnode, mount_point, list_node);
+                p_dentry->i_no = p_mt_pt->part->sb->root_i_no;
+                ret_part = p_mt_pt->part;
+            }
 
-                void *buf = kmalloc(SECTOR_SIZE);
-                ASSERT(buf);
-                memset(buf, 0, SECTOR_SIZE);
-                memcpy(buf, p_dentry, sizeof(dentry));
-                write_disk(pdir->p_inode->part->my_disk, buf, blk_lba, 1);
+            // 将挂载于另一个分区的分区根目录中的 .. 目录项重定向
+            if (pdir->p_inode->part->parent_part && !strcmp(p_dentry->filename, "..") 
+                && pdir->p_inode->i_no == pdir->p_inode->part->sb->root_i_no)
+            {
+                p_dentry->i_no = pdir->p_inode->part->mount_p_i_no;
+                ret_part = pdir->p_inode->part->parent_part;
+            }
+            rw_lock_read_release(&pdir->p_inode->part->rwlock);
+        }
+    }
 
-                all_blocks[i] = blk_lba;
-                write_disk(pdir->p_inode->part->my_disk, all_blocks + 12, pdir->p_inode->i_sectors[12], 1);
+    // 查找失败的结果同样被缓存，避免重复扫描整个目录表
+    dcache_add(pdir->p_inode->part, pdir->p_inode->i_no, filename, p_dentry, ret_part, gen);
+    rw_lock_read_release(&pdir->p_inode->rwlock);
+    return ret_part;
+}
 
-                pdir->p_inode->i_size += sizeof(dentry);
+// 在目录pdir下增加一个目录项，调用者须持有目录inode的写锁
+bool add_dentry(dir *pdir, dentry *p_dentry)
+{
+    ASSERT(pdir->p_inode->rwlock.writer == current);
+    dcache_invalidate(pdir->p_inode->part, pdir->p_inode->i_no, p_dentry->filename);
 
-                inode_sync(pdir->p_inode);
-                bitmap_sync(pdir->p_inode->part, BLOCK_BITMAP, blk_lba - pdir->p_inode->part->sb->blocks_lba);
-                sys_free(buf);
-                sys_free(all_blocks);
-                return true;
+    inode *p_inode = pdir->p_inode;
+    bool added = false;
+    if (dir_is_indexed(p_inode))
+    {
+        added = dx_add_dentry(p_inode, p_dentry);
+    }
+    else
+    {
+        // 在已有的块中寻找空闲的目录项
+        dentry *buf = (dentry *)slab_alloc(sector_cache);
+        ASSERT(buf);
+        uint32_t blk_cnt = 0;
+        for (uint32_t i = 0; i < DIR_LINEAR_MAX_BLOCKS && !added; ++i)
+        {
+            uint32_t blk_lba = dir_block_lba(p_inode, i);
+            if (blk_lba)
+            {
+                ++blk_cnt;
+                buffer_read_sectors(p_inode->part->my_disk, buf, blk_lba, 1);
+                int32_t j = dentry_free_slot(buf);
+                if (j != -1)
+                {
+                    memcpy(buf + j, p_dentry, sizeof(dentry));
+                    buffer_write_sectors(p_inode->part->my_disk, buf, blk_lba, 1);
+                    added = true;
+                }
             }
         }
-        uint32_t de_cnt_per_sec = SECTOR_SIZE / sizeof(dentry);
-        dentry *buf = (dentry *)kmalloc(SECTOR_SIZE);
-        ASSERT(buf);
-        read_disk(pdir->p_inode->part->my_disk, buf, all_blocks[i], 1);
-        for (uint32_t j = 0; j < de_cnt_per_sec; ++j)
+
+        if (!added)
         {
-            if (buf[j].f_type == FT_UNKNOWN)
+            if ((p_inode->part->sb->compat_flags & FS_COMPAT_DIR_INDEX) && blk_cnt == 1)
             {
-                memcpy(buf + j, p_dentry, sizeof(dentry));
-                write_disk(pdir->p_inode->part->my_disk, buf, all_blocks[i], 1);
-
-                pdir->p_inode->i_size += sizeof(dentry);
-                inode_sync(pdir->p_inode);
-                sys_free(buf);
-                sys_free(all_blocks);
-                return true;
+                // 目录增长超过一个块时为其建立哈希索引
+                added = (dx_create_index(p_inode) && dx_add_dentry(p_inode, p_dentry));
+            }
+            else
+            {
+                // 为目录表增加一个块
+                uint32_t idx;
+                int32_t blk_lba = dir_block_alloc(p_inode, &idx);
+                if (blk_lba != -1)
+                {
+                    memset(buf, 0, SECTOR_SIZE);
+                    memcpy(buf, p_dentry, sizeof(dentry));
+                    buffer_write_sectors(p_inode->part->my_disk, buf, blk_lba, 1);
+                    added = true;
+                }
             }
         }
-        sys_free(buf);
+        slab_free(sector_cache, buf);
     }
-    sys_free(all_blocks);
-    return false;
+
+    if (added)
+    {
+        p_inode->i_size += sizeof(dentry);
+        inode_sync(p_inode);
+    }
+    return added;
 }  
 
 // 初始化目录项
@@ -246,109 +678,81 @@ void dentry_init(uint32_t i_no, const char *filename, file_type f_type, dentry *
     p_dentry->f_type = f_type;
 }   
 
-// 在pdir的目录表中删除名为filename的目录项
+// 在pdir的目录表中删除名为filename的目录项，调用者须持有目录inode的写锁
 bool del_dentry(dir *pdir, const char *filename)
 {
     ASSERT(pdir && filename);
+    ASSERT(pdir->p_inode->rwlock.writer == current);
+    dcache_invalidate(pdir->p_inode->part, pdir->p_inode->i_no, filename);
 
-    uint32_t *all_blocks = (uint32_t *)kmalloc(560);
-    ASSERT(all_blocks);
-    memset(all_blocks, 0, 560);
-    for (uint32_t i = 0; i < 12; ++i)
-    {
-        all_blocks[i] = pdir->p_inode->i_sectors[i];
-    }
-    if (pdir->p_inode->i_sectors[12])
+    if (dir_is_indexed(pdir->p_inode))
     {
-        read_disk(pdir->p_inode->part->my_disk, all_blocks + 12, pdir->p_inode->i_sectors[12], 1);
+        if (!dx_del_dentry(pdir->p_inode, filename))
+        {
+            return false;
+        }
+        pdir->p_inode->i_size -= sizeof(dentry);
+        inode_sync(pdir->p_inode);
+        return true;
     }
 
-    dentry *buf = (dentry *)kmalloc(SECTOR_SIZE);
+    inode *p_inode = pdir->p_inode;
+    dentry *buf = (dentry *)slab_alloc(sector_cache);
     ASSERT(buf);
-    uint32_t de_cnt_per_sec = SECTOR_SIZE / sizeof(dentry);
-    int32_t de_to_del_idx = -1;             // 待删除目录项的索引
-    uint32_t valid_de_cnt_in_this_sec;  // 除去要删除的目录项以外当前扇区包含的有效目录项的数目
-    for (uint32_t i = 0; i < 140; ++i)
+    for (uint32_t i = 0; i < DIR_LINEAR_MAX_BLOCKS; ++i)
     {
-        if (all_blocks[i])
+        uint32_t blk_lba = dir_block_lba(p_inode, i);
+        if (!blk_lba)
         {
-            read_disk(pdir->p_inode->part->my_disk, buf, all_blocks[i], 1);
-            valid_de_cnt_in_this_sec = 0;
-            for (uint32_t j = 0; j < de_cnt_per_sec; ++j)
-            {
-                if (buf[j].f_type != FT_UNKNOWN)
-                {
-                    if (!strcmp(buf[j].filename, filename))
-                    {
-                        de_to_del_idx = j;
-                    }
-                    else
-                    {
-                        ++valid_de_cnt_in_this_sec;
-                    }
-                }
-            }
-            if (de_to_del_idx != -1)
-            {
-                pdir->p_inode->i_size -= sizeof(dentry);
-
-                // 如果删除某个目录项之后，该扇区不包含任何有效目录项，则应该回收该扇区
-                if (valid_de_cnt_in_this_sec == 0)
-                {
-                    bitmap_set(&pdir->p_inode->part->block_bitmap, all_blocks[i] - pdir->p_inode->part->sb->blocks_lba, 0);
-                    if (i < 12)
-                    {
-                        pdir->p_inode->i_sectors[i] = 0;
-                    }
-                    else
-                    {
-                        // 如果释放某个数据块之后，索引块也变为空，则应当一同回收索引块
-                        all_blocks[i] = 0;
-                        for (uint32_t i = 12; i < 140; ++i)
-                        {
-                            if (all_blocks[i])
-                            {
-                                write_disk(pdir->p_inode->part->my_disk, all_blocks + 12, pdir->p_inode->i_sectors[12], 1);
-                                bitmap_sync(pdir->p_inode->part, BLOCK_BITMAP, all_blocks[i] - pdir->p_inode->part->sb->blocks_lba);
-                                inode_sync(pdir->p_inode);
-
-                                sys_free(all_blocks);
-                                sys_free(buf);
-                                return true;
-                            }
-                        }
-                        bitmap_set(&pdir->p_inode->part->block_bitmap, pdir->p_inode->i_sectors[12] - pdir->p_inode->part->sb->blocks_lba, 0);
-                        bitmap_sync(pdir->p_inode->part, BLOCK_BITMAP, pdir->p_inode->i_sectors[12] - pdir->p_inode->part->sb->blocks_lba);
-                        pdir->p_inode->i_sectors[12] = 0;
-                    }
-                    bitmap_sync(pdir->p_inode->part, BLOCK_BITMAP, all_blocks[i] - pdir->p_inode->part->sb->blocks_lba);
-                }
-                else
-                {
-                    buf[de_to_del_idx].f_type = FT_UNKNOWN;
-                    write_disk(pdir->p_inode->part->my_disk, buf, all_blocks[i], 1);
-                }
+            continue;
+        }
+        buffer_read_sectors(p_inode->part->my_disk, buf, blk_lba, 1);
+        int32_t de_to_del_idx = dentry_block_search(buf, filename);
+        if (de_to_del_idx == -1)
+        {
+            continue;
+        }
 
-                inode_sync(pdir->p_inode);
-                sys_free(all_blocks);
-                sys_free(buf);
-                return true;
-            }
+        buf[de_to_del_idx].f_type = FT_UNKNOWN;
+        p_inode->i_size -= sizeof(dentry);
+        // 如果删除某个目录项之后，该块不包含任何有效目录项，则应该回收该块
+        bool empty = true;
+        for (uint32_t j = 0; j < DENTRY_PER_SEC && empty; ++j)
+        {
+            empty = (buf[j].f_type == FT_UNKNOWN);
         }
+        if (empty && dir_block_free(p_inode, i))
+        {
+            slab_free(sector_cache, buf);
+            return true;
+        }
+        buffer_write_sectors(p_inode->part->my_disk, buf, blk_lba, 1);
+        inode_sync(p_inode);
+        slab_free(sector_cache, buf);
+        return true;
     }
 
-    sys_free(all_blocks);
-    sys_free(buf);
+    slab_free(sector_cache, buf);
     return false;
-} 
+}
 
 // 在pdir下创建一个名为dirname的空目录
 int32_t dir_create(dir *pdir, const char *dirname)
 {
+    // 持有父目录的写锁，并重新确认同名文件不存在，避免与并发的创建操作冲突
+    rw_lock_write_acquire(&pdir->p_inode->rwlock);
+    dentry dir_e;
+    if (dir_search(pdir, dirname, &dir_e))
+    {
+        rw_lock_write_release(&pdir->p_inode->rwlock);
+        return -1;
+    }
+
     // 分配一个inode
     int32_t i_no = bitmap_alloc(pdir->p_inode->part, INODE_BITMAP);
     if (i_no == -1)
     {
+        rw_lock_write_release(&pdir->p_inode->rwlock);
         return -1;
     }
 
@@ -356,17 +760,21 @@ int32_t dir_create(dir *pdir, const char *dirname)
     int32_t blk_lba = bitmap_alloc(pdir->p_inode->part, BLOCK_BITMAP);
     if (blk_lba == -1)
     {
-        bitmap_set(&pdir->p_inode->part->inode_bitmap, i_no, 0);
+        bitmap_free(pdir->p_inode->part, INODE_BITMAP, i_no);
+        rw_lock_write_release(&pdir->p_inode->rwlock);
         return -1;
     }
 
+    // 该inode编号可能属于某个已被删除的目录，清除其遗留的目录项缓存
+    dcache_invalidate_dir(pdir->p_inode->part, i_no);
+
     // 在父目录表中添加对应目录项
-    dentry dir_e;
     dentry_init(i_no, dirname, FT_DIRECTORY, &dir_e);
     if (!add_dentry(pdir, &dir_e))
     {
-        bitmap_set(&pdir->p_inode->part->inode_bitmap, i_no, 0);
-        bitmap_set(&pdir->p_inode->part->block_bitmap, blk_lba - pdir->p_inode->part->sb->blocks_lba, 0);
+        bitmap_free(pdir->p_inode->part, INODE_BITMAP, i_no);
+        bitmap_free(pdir->p_inode->part, BLOCK_BITMAP, blk_lba - pdir->p_inode->part->sb->blocks_lba);
+        rw_lock_write_release(&pdir->p_inode->rwlock);
         return -1;
     }
 
@@ -375,7 +783,7 @@ int32_t dir_create(dir *pdir, const char *dirname)
     inode_init(pdir->p_inode->part, i_no, &new_inode);
 
     // 初始化目录表
-    dentry *buf = (dentry *)kmalloc(SECTOR_SIZE);
+    dentry *buf = (dentry *)slab_alloc(sector_cache);
     ASSERT(buf);
     memset(buf, 0, SECTOR_SIZE);
     buf[0].i_no = i_no;
@@ -386,35 +794,31 @@ int32_t dir_create(dir *pdir, const char *dirname)
     strcpy(buf[1].filename, "..");
 
     new_inode.i_size = 2 * sizeof(dentry);
-    new_inode.i_sectors[0] = blk_lba;
+    inode_bmap_map(&new_inode, 0, blk_lba, 1);     // 新inode中映射第一个块不需要分配索引块或区段树结点
 
     // 将inode、目录表和位图同步到硬盘
-    write_disk(pdir->p_inode->part->my_disk, buf, blk_lba, 1);
+    buffer_write_sectors(pdir->p_inode->part->my_disk, buf, blk_lba, 1);
     inode_sync(&new_inode);
-    bitmap_sync(pdir->p_inode->part, INODE_BITMAP, i_no);
-    bitmap_sync(pdir->p_inode->part, BLOCK_BITMAP, blk_lba - pdir->p_inode->part->sb->blocks_lba);
+    bitmap_mark_dirty(pdir->p_inode->part, INODE_BITMAP, i_no);
+    bitmap_mark_dirty(pdir->p_inode->part, BLOCK_BITMAP, blk_lba - pdir->p_inode->part->sb->blocks_lba);
+    bitmap_flush(pdir->p_inode->part);
+    rw_lock_write_release(&pdir->p_inode->rwlock);
 
-    sys_free(buf);
+    slab_free(sector_cache, buf);
     return 0;
 }  
 
 // 从pdir中读取一个目录项，读取的目录项由 d_pos 决定
 dentry *dir_read(dir *pdir)
 {
-    ASSERT(pdir->d_pos <= pdir->p_inode->i_size && !(pdir->d_pos % sizeof(dentry)));
-    if (pdir->d_pos == pdir->p_inode->i_size)
+    rw_lock_read_acquire(&pdir->p_inode->rwlock);
+    if (pdir->d_pos >= pdir->p_inode->i_size)
     {
+        // 读取过程中目录可能被其他线程缩短
+        rw_lock_read_release(&pdir->p_inode->rwlock);
         return NULL;
     }
-
-    uint32_t *all_blocks = (uint32_t *)kmalloc(560);
-    ASSERT(all_blocks);
-    memset(all_blocks, 0, 560);
-    for (uint32_t i = 0; i < 12; ++i)
-    {
-        all_blocks[i] = pdir->p_inode->i_sectors[i];
-    }
-    read_disk(pdir->p_inode->part->my_disk, all_blocks + 12, pdir->p_inode->i_sectors[12], 1);
+    ASSERT(!(pdir->d_pos % sizeof(dentry)));
 
     uint32_t de_cnt_per_sec = SECTOR_SIZE / sizeof(dentry);
     uint32_t cur_pos = 0;
@@ -423,11 +827,17 @@ dentry *dir_read(dir *pdir)
         pdir->buf = (dentry *)sys_malloc(SECTOR_SIZE);
         ASSERT (pdir->buf);
     }
-    for (uint32_t i = 0; i < 140; ++i)
+    uint32_t max_blocks = dir_max_blocks(pdir->p_inode);
+    for (uint32_t i = 0; i < max_blocks; ++i)
     {
-        if (all_blocks[i])
+        uint32_t blk_lba = dir_block_lba(pdir->p_inode, i);
+        if (blk_lba)
         {
-            read_disk(pdir->p_inode->part->my_disk, pdir->buf, all_blocks[i], 1);
+            buffer_read_sectors(pdir->p_inode->part->my_disk, pdir->buf, blk_lba, 1);
+            if (dx_is_index_block(pdir->buf))
+            {
+                continue;
+            }
             for (uint32_t j = 0; j < de_cnt_per_sec; ++j)
             {
                 if (pdir->buf[j].f_type != FT_UNKNOWN)
@@ -435,6 +845,7 @@ dentry *dir_read(dir *pdir)
                     if (cur_pos == pdir->d_pos)
                     {
                         pdir->d_pos += sizeof(dentry);
+                        rw_lock_read_release(&pdir->p_inode->rwlock);
                         return pdir->buf + j;
                     }
                     else
@@ -464,33 +875,31 @@ void find_parent_dir(partition *part, const uint32_t i_no, parent_dir_info *pd_i
 void get_child_dir_name(parent_dir_info *pd_inf, char *path)
 {
     dir *pdir = dir_open(pd_inf->part, pd_inf->i_no);
-
-    uint32_t *all_blocks = (uint32_t *)kmalloc(560);
-    ASSERT(all_blocks);
-    memset(all_blocks, 0, 560);
-    for (uint32_t i = 0; i < 12; ++i)
-    {
-        all_blocks[i] = pdir->p_inode->i_sectors[i];
-    }
-    read_disk(pdir->p_inode->part->my_disk, all_blocks + 12, pdir->p_inode->i_sectors[12], 1);
+    rw_lock_read_acquire(&pdir->p_inode->rwlock);
 
     uint32_t de_cnt_per_sec = SECTOR_SIZE / sizeof(dentry);
-    dentry *buf = (dentry *)kmalloc(SECTOR_SIZE);
+    dentry *buf = (dentry *)slab_alloc(sector_cache);
     ASSERT(buf);
-    for (uint32_t i = 0; i < 140; ++i)
+    uint32_t max_blocks = dir_max_blocks(pdir->p_inode);
+    for (uint32_t i = 0; i < max_blocks; ++i)
     {
-        if (all_blocks[i])
+        uint32_t blk_lba = dir_block_lba(pdir->p_inode, i);
+        if (blk_lba)
         {
-            read_disk(pdir->p_inode->part->my_disk, buf, all_blocks[i], 1);
+            buffer_read_sectors(pdir->p_inode->part->my_disk, buf, blk_lba, 1);
+            if (dx_is_index_block(buf))
+            {
+                continue;
+            }
             for (uint32_t j = 0; j < de_cnt_per_sec; ++j)
             {
                 if (buf[j].f_type != FT_UNKNOWN && buf[j].i_no == pd_inf->i_no_to_search)
                 {
                     strcat(path, "/");
                     strcat(path, buf[j].filename);
+                    rw_lock_read_release(&pdir->p_inode->rwlock);
                     dir_close(pdir);
-                    sys_free(buf);
-                    sys_free(all_blocks);
+                    slab_free(sector_cache, buf);
                     return;
                 }
             }
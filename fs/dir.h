@@ -7,9 +7,16 @@
 #define SECTOR_SIZE 512                 // 扇区大小
 
 #define MAX_FILENAME_LEN 32
+#define DIR_LINEAR_MAX_BLOCKS 140       // 不带索引的目录表最多占用的块数，这类目录只能逐块扫描
+
+#define DX_MAGIC 0x58444e49             // 哈希索引块的魔数，不可能是合法的inode编号，据此区分索引块和目录项块
+#define DX_MAX_LEVELS 1                 // 根索引块之下最多的中间索引块层数
+#define DX_ENTRY_CNT ((SECTOR_SIZE - 8) / 8)    // 每个索引块中最多的索引项数
+#define DX_MAX_BLOCKS (1 + DX_ENTRY_CNT + DX_ENTRY_CNT * DX_ENTRY_CNT)    // 带索引的目录表最多占用的块数，即根索引块、一层中间索引块及其下的叶块
 
 typedef struct inode inode;
 typedef struct partition partition;
+typedef struct slab_cache slab_cache;
 
 typedef enum file_type
 {
@@ -26,6 +33,22 @@ typedef struct dentry
     file_type f_type;       // 文件类型
 } dentry;
 
+// 哈希索引项
+typedef struct dx_entry
+{
+    uint32_t hash;          // 该索引项覆盖的最小哈希值，索引块中第一项的哈希值在查找时被忽略
+    uint32_t block;         // 下一级索引块或叶块在目录表中的下标
+} dx_entry;
+
+// 哈希索引块，带索引的目录以目录表的第0块作为根索引块，叶块仍是普通的目录项数组
+typedef struct dx_node
+{
+    uint32_t magic;         // 固定为DX_MAGIC
+    uint16_t levels;        // 仅对根索引块有效，根之下的中间索引块层数
+    uint16_t count;         // 有效索引项数
+    dx_entry entries[DX_ENTRY_CNT];     // 按哈希值升序排列的索引项
+} dx_node;
+
 // 用于操作目录的目录结构
 typedef struct dir
 {
@@ -50,6 +73,8 @@ typedef struct parent_dir_info
     uint32_t i_no_to_search;    // 需要在父目录表中搜索的inode编号
 } parent_dir_info;
 
+extern slab_cache *dir_cache;       // 目录结构的缓存
+
 extern dir *dir_open(partition *part, uint32_t i_no);       // 打开part分区中inode编号为i_no的目录
 extern void dir_close(dir *pdir);       // 关闭指定目录
 extern partition *dir_search(dir *pdir, const char *filename, dentry *p_dentry); // 在pdir的目录表中搜索名为filename的文件并返回对应目录项
@@ -0,0 +1,513 @@
+#include "extent.h"
+#include "inode.h"
+#include "ide.h"
+#include "buffer.h"
+#include "file.h"
+#include "global.h"
+#include "debug.h"
+#include "string.h"
+
+#define EXT_ROOT(p_inode) ((extent_header *)(p_inode)->i_sectors)           // inode中的区段树根结点
+#define EXT_ROOT_SIZE (sizeof(((inode *)0)->i_sectors))                     // 根结点所占的字节数
+#define EXT_FIRST(eh) ((extent *)((eh) + 1))                                // 叶结点中的第一个区段
+#define EXT_FIRST_IDX(eh) ((extent_idx *)((eh) + 1))                        // 索引结点中的第一个索引项
+#define EXT_ENTRY_SIZE(depth) ((depth) ? sizeof(extent_idx) : sizeof(extent))     // 结点中每一项的大小
+#define EXT_NODE_MAX(size, depth) (((size) - sizeof(extent_header)) / EXT_ENTRY_SIZE(depth))    // 大小为size的结点最多能容纳的项数
+
+// 区段树查找路径上的一个结点
+typedef struct ext_path
+{
+    buffer *pbuf;           // 结点所在块的缓冲区，根结点为NULL
+    extent_header *eh;      // 结点
+    int32_t pos;            // 查找所经过的项的下标，叶结点中没有不大于目标的区段时为-1
+} ext_path;
+
+uint32_t ext_entry_block(extent_header *eh, uint32_t i);        // 获取结点中第i项的block
+int32_t ext_search(extent_header *eh, uint32_t idx);            // 在结点中找到最后一个block不大于idx的项
+uint32_t ext_find_path(inode *p_inode, uint32_t idx, ext_path *path);     // 从根结点开始找到覆盖文件第idx个块的叶结点，返回树的深度
+void ext_path_release(ext_path *path, uint32_t depth);          // 释放查找路径上持有的缓冲区
+void ext_mark_dirty(ext_path *path, uint32_t level);            // 将查找路径上的结点标记为已修改
+uint32_t ext_boundary(ext_path *path, uint32_t depth);          // 获取查找路径上的子树所能覆盖的块下标的上界
+void ext_fix_keys(ext_path *path, uint32_t depth, uint32_t idx);    // 使查找路径上的索引项不大于idx
+void ext_insert_entry(extent_header *eh, uint32_t pos, const void *entry);     // 在未满的结点的pos处插入一项
+void ext_remove_entry(extent_header *eh, uint32_t pos);         // 删除结点的第pos项
+uint32_t ext_node_alloc(partition *part);                       // 为区段树分配一个结点，失败返回0
+bool ext_insert(inode *p_inode, ext_path *path, uint32_t *depth, const extent *new_ex);    // 将区段插入叶结点，必要时分裂结点
+uint32_t ext_do_map(inode *p_inode, ext_path *path, uint32_t *depth, uint32_t idx, uint32_t lba, uint32_t cnt);    // 将从idx开始的空洞映射到从lba开始的物理块
+uint32_t ext_do_unmap(inode *p_inode, ext_path *path, uint32_t *depth, uint32_t idx, uint32_t cnt);   // 解除从idx开始的块的映射
+bool ext_truncate_node(partition *part, extent_header *eh, uint32_t blk_cnt);     // 释放子树中下标不小于blk_cnt的块
+
+// 初始化inode中的区段树，cnt不为0时从lba开始的cnt个块作为文件的前cnt个块
+void extent_init(inode *p_inode, uint32_t lba, uint32_t cnt)
+{
+    memset(p_inode->i_sectors, 0, EXT_ROOT_SIZE);
+    extent_header *eh = EXT_ROOT(p_inode);
+    eh->magic = EXT_MAGIC;
+    eh->depth = 0;
+    eh->max = EXT_NODE_MAX(EXT_ROOT_SIZE, 0);
+    eh->count = 0;
+    if (cnt)
+    {
+        EXT_FIRST(eh)->block = 0;
+        EXT_FIRST(eh)->len = cnt;
+        EXT_FIRST(eh)->start = lba;
+        eh->count = 1;
+    }
+}
+
+// 获取结点中第i项的block
+uint32_t ext_entry_block(extent_header *eh, uint32_t i)
+{
+    return (eh->depth ? EXT_FIRST_IDX(eh)[i].block : EXT_FIRST(eh)[i].block);
+}
+
+// 在结点中二分查找最后一个block不大于idx的项，返回其下标，不存在时返回-1
+int32_t ext_search(extent_header *eh, uint32_t idx)
+{
+    int32_t low = 0, high = (int32_t)eh->count - 1;
+    int32_t ret = -1;
+    while (low <= high)
+    {
+        int32_t mid = (low + high) / 2;
+        if (ext_entry_block(eh, mid) <= idx)
+        {
+            ret = mid;
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    return ret;
+}
+
+// 从根结点开始找到覆盖文件第idx个块的叶结点，path记录路径上的每个结点，返回树的深度
+// 索引结点中没有不大于idx的索引项时沿第一个索引项向下，路径上所有结点的缓冲区在ext_path_release之前一直被持有
+uint32_t ext_find_path(inode *p_inode, uint32_t idx, ext_path *path)
+{
+    extent_header *eh = EXT_ROOT(p_inode);
+    ASSERT(eh->magic == EXT_MAGIC && eh->depth <= EXT_MAX_DEPTH);
+    uint32_t depth = eh->depth;
+    path[0].pbuf = NULL;
+    path[0].eh = eh;
+    for (uint32_t level = 0; level < depth; ++level)
+    {
+        ASSERT(path[level].eh->count);
+        int32_t pos = ext_search(path[level].eh, idx);
+        path[level].pos = (pos == -1) ? 0 : pos;
+
+        uint32_t child = EXT_FIRST_IDX(path[level].eh)[path[level].pos].child;
+        path[level + 1].pbuf = buffer_read(p_inode->part->my_disk, child);
+        path[level + 1].eh = (extent_header *)path[level + 1].pbuf->data;
+        ASSERT(path[level + 1].eh->magic == EXT_MAGIC && path[level + 1].eh->depth == depth - level - 1);
+    }
+    path[depth].pos = ext_search(path[depth].eh, idx);
+    return depth;
+}
+
+// 释放查找路径上持有的缓冲区
+void ext_path_release(ext_path *path, uint32_t depth)
+{
+    for (uint32_t level = 1; level <= depth; ++level)
+    {
+        buffer_release(path[level].pbuf);
+    }
+}
+
+// 将查找路径上的结点标记为已修改，根结点随inode一起由调用者同步
+void ext_mark_dirty(ext_path *path, uint32_t level)
+{
+    if (path[level].pbuf)
+    {
+        buffer_mark_dirty(path[level].pbuf);
+    }
+}
+
+// 获取查找路径上的子树所能覆盖的块下标的上界，即路径上各索引项的下一个索引项中最小的block
+uint32_t ext_boundary(ext_path *path, uint32_t depth)
+{
+    uint32_t limit = 0xffffffff;
+    for (uint32_t level = 0; level < depth; ++level)
+    {
+        extent_header *eh = path[level].eh;
+        if (path[level].pos + 1 < eh->count && EXT_FIRST_IDX(eh)[path[level].pos + 1].block < limit)
+        {
+            limit = EXT_FIRST_IDX(eh)[path[level].pos + 1].block;
+        }
+    }
+    return limit;
+}
+
+// 向查找路径所指的叶结点加入第idx个块之前，将路径上大于idx的索引项(只可能是结点的第一项)改为idx
+void ext_fix_keys(ext_path *path, uint32_t depth, uint32_t idx)
+{
+    for (uint32_t level = 0; level < depth; ++level)
+    {
+        extent_idx *ix = EXT_FIRST_IDX(path[level].eh) + path[level].pos;
+        if (ix->block > idx)
+        {
+            ix->block = idx;
+            ext_mark_dirty(path, level);
+        }
+    }
+}
+
+// 在未满的结点的pos处插入一项
+void ext_insert_entry(extent_header *eh, uint32_t pos, const void *entry)
+{
+    ASSERT(eh->count < eh->max && pos <= eh->count);
+    uint32_t size = EXT_ENTRY_SIZE(eh->depth);
+    uint8_t *base = (uint8_t *)(eh + 1);
+    for (uint32_t i = eh->count; i > pos; --i)
+    {
+        memcpy(base + i * size, base + (i - 1) * size, size);
+    }
+    memcpy(base + pos * size, entry, size);
+    ++eh->count;
+}
+
+// 删除结点的第pos项
+void ext_remove_entry(extent_header *eh, uint32_t pos)
+{
+    ASSERT(pos < eh->count);
+    uint32_t size = EXT_ENTRY_SIZE(eh->depth);
+    uint8_t *base = (uint8_t *)(eh + 1);
+    for (uint32_t i = pos; i + 1 < eh->count; ++i)
+    {
+        memcpy(base + i * size, base + (i + 1) * size, size);
+    }
+    --eh->count;
+}
+
+// 为区段树分配一个结点，失败返回0，调用者负责同步块位图
+uint32_t ext_node_alloc(partition *part)
+{
+    int32_t blk_lba = bitmap_alloc(part, BLOCK_BITMAP);
+    if (blk_lba == -1)
+    {
+        return 0;
+    }
+    bitmap_mark_dirty(part, BLOCK_BITMAP, blk_lba - part->sb->blocks_lba);
+    return blk_lba;
+}
+
+// 将区段new_ex插入到path所指叶结点的第path[*depth].pos项之后，已满的结点自下而上分裂，根结点已满时树的深度加1
+// 所需的新结点在修改区段树之前一次性分配，分配失败时返回false且区段树保持不变
+bool ext_insert(inode *p_inode, ext_path *path, uint32_t *depth, const extent *new_ex)
+{
+    partition *part = p_inode->part;
+
+    // 自叶结点向上，每个已满的结点都需要一个新结点：非根结点用于分裂，根结点用于增加深度
+    int32_t level = *depth;
+    uint32_t need = 0;
+    while (level >= 0 && path[level].eh->count == path[level].eh->max)
+    {
+        ++need;
+        --level;
+    }
+    uint32_t blocks[EXT_MAX_DEPTH + 1];
+    for (uint32_t i = 0; i < need; ++i)
+    {
+        blocks[i] = ext_node_alloc(part);
+        if (!blocks[i])
+        {
+            while (i--)
+            {
+                block_free_range(part, blocks[i], 1);
+            }
+            return false;
+        }
+    }
+
+    if (level == -1)
+    {
+        // 根结点已满：将根结点的内容移到新结点中，根结点改为只有一个索引项的索引结点
+        ASSERT(*depth < EXT_MAX_DEPTH);
+        uint32_t blk_lba = blocks[--need];
+        buffer *pbuf = buffer_get(part->my_disk, blk_lba);
+        memset(pbuf->data, 0, SECTOR_SIZE);
+        extent_header *root = path[0].eh;
+        extent_header *eh = (extent_header *)pbuf->data;
+        memcpy(eh, root, sizeof(extent_header) + root->count * EXT_ENTRY_SIZE(root->depth));
+        eh->max = EXT_NODE_MAX(SECTOR_SIZE, eh->depth);
+        buffer_mark_dirty(pbuf);
+
+        ++root->depth;
+        root->max = EXT_NODE_MAX(EXT_ROOT_SIZE, root->depth);
+        root->count = 1;
+        EXT_FIRST_IDX(root)->block = ext_entry_block(eh, 0);
+        EXT_FIRST_IDX(root)->child = blk_lba;
+
+        // 路径整体下移一层，原根结点的内容所在的新结点有足够的空间容纳下层分裂产生的索引项
+        for (uint32_t i = *depth + 1; i > 1; --i)
+        {
+            path[i] = path[i - 1];
+        }
+        path[1].pbuf = pbuf;
+        path[1].eh = eh;
+        path[1].pos = path[0].pos;
+        path[0].pos = 0;
+        ++*depth;
+        level = 1;
+    }
+
+    // 自叶结点向上插入，已满的结点分裂为两个，新结点的索引项插入上一层
+    uint8_t entry[sizeof(extent)];
+    memcpy(entry, new_ex, sizeof(extent));
+    for (uint32_t i = *depth; ; --i)
+    {
+        extent_header *eh = path[i].eh;
+        uint32_t pos = path[i].pos + 1;
+        if (i == (uint32_t)level)
+        {
+            ext_insert_entry(eh, pos, entry);
+            ext_mark_dirty(path, i);
+            break;
+        }
+
+        // 在结点末尾插入时新结点只存放新的一项，使顺序写入的文件的结点保持全满
+        uint32_t blk_lba = blocks[--need];
+        buffer *pbuf = buffer_get(part->my_disk, blk_lba);
+        memset(pbuf->data, 0, SECTOR_SIZE);
+        extent_header *neh = (extent_header *)pbuf->data;
+        neh->magic = EXT_MAGIC;
+        neh->depth = eh->depth;
+        neh->max = EXT_NODE_MAX(SECTOR_SIZE, eh->depth);
+
+        uint32_t size = EXT_ENTRY_SIZE(eh->depth);
+        uint32_t split = (pos == eh->count) ? eh->count : eh->count / 2;
+        memcpy(neh + 1, (uint8_t *)(eh + 1) + split * size, (eh->count - split) * size);
+        neh->count = eh->count - split;
+        eh->count = split;
+        if (pos <= split && split < eh->max)
+        {
+            ext_insert_entry(eh, pos, entry);
+        }
+        else
+        {
+            ext_insert_entry(neh, pos - split, entry);
+        }
+        ext_mark_dirty(path, i);
+
+        extent_idx ix = {ext_entry_block(neh, 0), blk_lba};
+        memcpy(entry, &ix, sizeof(extent_idx));
+        buffer_mark_dirty(pbuf);
+        buffer_release(pbuf);
+    }
+    ASSERT(!need);
+    return true;
+}
+
+// 将文件从第idx个块开始的空洞映射到从lba开始的物理块，尽量与相邻的区段合并，
+// 一次只处理查找路径所指的叶结点能容纳的部分，返回处理的块数，分配结点失败时返回0
+uint32_t ext_do_map(inode *p_inode, ext_path *path, uint32_t *depth, uint32_t idx, uint32_t lba, uint32_t cnt)
+{
+    extent_header *leaf = path[*depth].eh;
+    int32_t pos = path[*depth].pos;
+    extent *ex = (pos == -1) ? NULL : EXT_FIRST(leaf) + pos;
+    extent *next = (pos + 1 < leaf->count) ? EXT_FIRST(leaf) + pos + 1 : NULL;
+    ASSERT(!ex || ex->block + ex->len <= idx);
+
+    // 映射的块不能越过下一个区段，也不能越过当前子树所覆盖的范围
+    uint32_t limit = ext_boundary(path, *depth);
+    if (next && next->block < limit)
+    {
+        limit = next->block;
+    }
+    ASSERT(limit > idx);
+    cnt = (cnt < limit - idx) ? cnt : limit - idx;
+    ext_fix_keys(path, *depth, idx);
+
+    if (ex && ex->block + ex->len == idx && ex->start + ex->len == lba)
+    {
+        // 追加到前一个区段末尾，这是顺序写入时最常见的情况
+        ex->len += cnt;
+        if (next && next->block == idx + cnt && next->start == lba + cnt)
+        {
+            ex->len += next->len;
+            ext_remove_entry(leaf, pos + 1);
+        }
+        ext_mark_dirty(path, *depth);
+        return cnt;
+    }
+    if (next && next->block == idx + cnt && next->start == lba + cnt)
+    {
+        next->block = idx;
+        next->start = lba;
+        next->len += cnt;
+        ext_mark_dirty(path, *depth);
+        return cnt;
+    }
+
+    extent new_ex = {idx, cnt, lba};
+    return ext_insert(p_inode, path, depth, &new_ex) ? cnt : 0;
+}
+
+// 解除文件从第idx个块开始的块的映射，一次只处理一个区段或空洞，返回处理的块数，
+// 解除区段中间部分的映射需要分裂区段，此时分配结点失败返回0
+uint32_t ext_do_unmap(inode *p_inode, ext_path *path, uint32_t *depth, uint32_t idx, uint32_t cnt)
+{
+    extent_header *leaf = path[*depth].eh;
+    int32_t pos = path[*depth].pos;
+    extent *ex = (pos == -1) ? NULL : EXT_FIRST(leaf) + pos;
+    if (!ex || ex->block + ex->len <= idx)
+    {
+        // 空洞一直延续到下一个区段或当前子树所覆盖的范围之外
+        uint32_t limit = ext_boundary(path, *depth);
+        if (pos + 1 < leaf->count && EXT_FIRST(leaf)[pos + 1].block < limit)
+        {
+            limit = EXT_FIRST(leaf)[pos + 1].block;
+        }
+        return (cnt < limit - idx) ? cnt : limit - idx;
+    }
+
+    uint32_t end = ex->block + ex->len;
+    cnt = (cnt < end - idx) ? cnt : end - idx;
+    if (idx == ex->block && cnt == ex->len)
+    {
+        ext_remove_entry(leaf, pos);
+    }
+    else if (idx == ex->block)
+    {
+        ex->block += cnt;
+        ex->start += cnt;
+        ex->len -= cnt;
+    }
+    else if (idx + cnt == end)
+    {
+        ex->len -= cnt;
+    }
+    else
+    {
+        // 区段一分为二，后一半作为新的区段插入
+        extent tail = {idx + cnt, end - idx - cnt, ex->start + (idx + cnt - ex->block)};
+        uint32_t old_len = ex->len;
+        ex->len = idx - ex->block;
+        if (!ext_insert(p_inode, path, depth, &tail))
+        {
+            ex->len = old_len;
+            return 0;
+        }
+    }
+    ext_mark_dirty(path, *depth);
+    return cnt;
+}
+
+// 获取文件第idx个块的LBA并存入*lba(为0表示该块尚未分配)，返回从该块开始物理连续的块数，最多为max_cnt
+// 整个区段只需一次查找，调用者须持有inode的读锁或写锁
+uint32_t extent_bmap(inode *p_inode, uint32_t idx, uint32_t max_cnt, uint32_t *lba)
+{
+    ASSERT(max_cnt > 0);
+    ext_path path[EXT_MAX_DEPTH + 1];
+    uint32_t depth = ext_find_path(p_inode, idx, path);
+    uint32_t cnt = 1;
+    *lba = 0;
+    if (path[depth].pos != -1)
+    {
+        extent *ex = EXT_FIRST(path[depth].eh) + path[depth].pos;
+        if (idx < ex->block + ex->len)
+        {
+            *lba = ex->start + (idx - ex->block);
+            cnt = ex->block + ex->len - idx;
+            cnt = (cnt < max_cnt) ? cnt : max_cnt;
+        }
+    }
+    ext_path_release(path, depth);
+    return cnt;
+}
+
+// 将文件从第idx个块开始的cnt个块依次映射到从lba开始的物理块，这些块须尚未映射，lba为0时解除这些块的映射，
+// 返回成功处理的块数，分配区段树结点失败时小于cnt，调用者须持有inode的写锁，并负责同步inode和块位图
+uint32_t extent_map(inode *p_inode, uint32_t idx, uint32_t lba, uint32_t cnt)
+{
+    uint32_t done = 0;
+    while (done < cnt)
+    {
+        ext_path path[EXT_MAX_DEPTH + 1];
+        uint32_t depth = ext_find_path(p_inode, idx + done, path);
+        uint32_t n = lba ? ext_do_map(p_inode, path, &depth, idx + done, lba + done, cnt - done)
+                         : ext_do_unmap(p_inode, path, &depth, idx + done, cnt - done);
+        ext_path_release(path, depth);
+        if (!n)
+        {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// 释放以eh为根的子树中下标不小于blk_cnt的块，自右向左处理，遇到完全位于blk_cnt之前的区段即停止，
+// 变空的子结点被一并释放，返回eh是否被修改
+bool ext_truncate_node(partition *part, extent_header *eh, uint32_t blk_cnt)
+{
+    bool modified = false;
+    if (!eh->depth)
+    {
+        while (eh->count)
+        {
+            extent *ex = EXT_FIRST(eh) + eh->count - 1;
+            if (ex->block + ex->len <= blk_cnt)
+            {
+                break;
+            }
+            if (ex->block >= blk_cnt)
+            {
+                block_free_range(part, ex->start, ex->len);
+                --eh->count;
+            }
+            else
+            {
+                uint32_t keep = blk_cnt - ex->block;
+                block_free_range(part, ex->start + keep, ex->len - keep);
+                ex->len = keep;
+            }
+            modified = true;
+        }
+        return modified;
+    }
+
+    while (eh->count)
+    {
+        extent_idx *ix = EXT_FIRST_IDX(eh) + eh->count - 1;
+        uint32_t key = ix->block;
+        buffer *pbuf = buffer_read(part->my_disk, ix->child);
+        extent_header *child = (extent_header *)pbuf->data;
+        ASSERT(child->magic == EXT_MAGIC);
+        if (ext_truncate_node(part, child, blk_cnt))
+        {
+            buffer_mark_dirty(pbuf);
+        }
+        bool empty = !child->count;
+        buffer_release(pbuf);
+
+        if (empty)
+        {
+            block_free_range(part, ix->child, 1);
+            --eh->count;
+            modified = true;
+        }
+        // 之前的子树中的块都小于key
+        if (key <= blk_cnt)
+        {
+            break;
+        }
+    }
+    return modified;
+}
+
+// 释放文件下标不小于blk_cnt的所有数据块以及因此变空的区段树结点，耗时与被释放的区段数成正比，
+// 调用者须持有inode的写锁，并负责同步inode和块位图
+void extent_truncate(inode *p_inode, uint32_t blk_cnt)
+{
+    extent_header *root = EXT_ROOT(p_inode);
+    ASSERT(root->magic == EXT_MAGIC);
+    ext_truncate_node(p_inode->part, root, blk_cnt);
+    if (!root->count && root->depth)
+    {
+        // 所有子结点都已释放，根结点恢复为叶结点
+        root->depth = 0;
+        root->max = EXT_NODE_MAX(EXT_ROOT_SIZE, 0);
+    }
+}
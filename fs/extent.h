@@ -0,0 +1,42 @@
+#ifndef __FS_EXTENT_H
+#define __FS_EXTENT_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "dir.h"
+
+#define EXT_MAGIC 0xf30a            // 区段树结点的魔数
+#define EXT_MAX_DEPTH 5             // 区段树的最大深度(根结点之下的层数)
+
+// 区段树结点的头部，根结点位于inode的i_sectors中，其余结点各占一个块
+typedef struct extent_header
+{
+    uint16_t magic;         // 魔数
+    uint16_t count;         // 结点中有效项的数量
+    uint16_t max;           // 结点最多能容纳的项数
+    uint16_t depth;         // 结点之下的层数，为0表示叶结点，叶结点中存放区段，其余结点中存放索引项
+} extent_header;
+
+// 区段：文件中从第block块开始的len个块依次位于从start开始的物理连续的块中
+typedef struct extent
+{
+    uint32_t block;         // 区段的第一个块在文件中的下标
+    uint32_t len;           // 区段的块数
+    uint32_t start;         // 区段的第一个块的LBA
+} extent;
+
+// 区段树的索引项，子树中所有区段的block都不小于该索引项的block，且小于下一个索引项的block
+typedef struct extent_idx
+{
+    uint32_t block;         // 子树覆盖的第一个块在文件中的下标
+    uint32_t child;         // 子结点的LBA
+} extent_idx;
+
+typedef struct inode inode;
+
+extern void extent_init(inode *p_inode, uint32_t lba, uint32_t cnt);     // 初始化inode中的区段树，cnt不为0时从lba开始的cnt个块作为文件的前cnt个块
+extern uint32_t extent_bmap(inode *p_inode, uint32_t idx, uint32_t max_cnt, uint32_t *lba);    // 获取文件第idx个块的LBA，返回从该块开始物理连续的块数
+extern uint32_t extent_map(inode *p_inode, uint32_t idx, uint32_t lba, uint32_t cnt);         // 将文件从第idx个块开始的cnt个块映射到从lba开始的物理块或解除映射，返回成功处理的块数
+extern void extent_truncate(inode *p_inode, uint32_t blk_cnt);      // 释放文件下标不小于blk_cnt的所有数据块以及因此变空的区段树结点
+
+#endif
@@ -1,9 +1,17 @@
 #include "file.h"
 #include "thread.h"
 #include "ide.h"
+#include "buffer.h"
+#include "inode.h"
+#include "superblock.h"
+#include "debug.h"
 
 file file_table[MAX_FILES_OPEN];    // 文件结构表 
 
+uint32_t free_run_length(bitmap *btmp, uint32_t bit_idx, uint32_t bit_cnt, uint32_t max_cnt);    // 获取从bit_idx开始连续为0的位数，最多为max_cnt
+int32_t best_fit_run(bitmap *btmp, uint32_t bit_cnt, uint32_t cnt, uint32_t *run_len);   // 查找能容纳cnt个位的最小空闲段，找不到时返回最大的空闲段
+void bitmap_flush_dirty(partition *part, bitmap *p_btmp, bitmap *dirty, uint32_t btmp_lba, uint32_t btmp_sects);    // 将指定位图中所有的脏扇区写回硬盘
+
 // 在file_table中获取一个空闲的槽位，成功返回下标，失败返回-1
 int32_t get_free_slot_in_file_table(void)
 {
@@ -34,7 +42,9 @@ int32_t get_free_slot_in_fd_table(void)
 int32_t bitmap_alloc(partition *part, bitmap_t bm_t)    
 {
     bitmap *p_btmp = ((bm_t == INODE_BITMAP) ? &part->inode_bitmap : &part->block_bitmap);
+    rw_lock_write_acquire(&part->rwlock);
     int32_t bit_idx = bitmap_scan(p_btmp, 1);
+    rw_lock_write_release(&part->rwlock);
     if (bit_idx != -1)
     {
         // inode位图分配时返回的是inode编号，块位图分配时返回的是块的LBA
@@ -43,23 +53,185 @@ int32_t bitmap_alloc(partition *part, bitmap_t bm_t)
     return -1;
 } 
 
-// 将指定分区位图中偏移为bit_idx的位所在的扇区同步到硬盘中
-void bitmap_sync(partition *part, bitmap_t bm_t, uint32_t bit_idx)
+// 在指定分区的inode位图或块位图中释放偏移为bit_idx的位
+void bitmap_free(partition *part, bitmap_t bm_t, uint32_t bit_idx)
+{
+    bitmap *p_btmp = ((bm_t == INODE_BITMAP) ? &part->inode_bitmap : &part->block_bitmap);
+    rw_lock_write_acquire(&part->rwlock);
+    bitmap_set(p_btmp, bit_idx, 0);
+    rw_lock_write_release(&part->rwlock);
+}
+
+// 将指定分区位图中偏移为bit_idx的位所在的扇区标记为脏，由bitmap_flush统一写回硬盘
+void bitmap_mark_dirty(partition *part, bitmap_t bm_t, uint32_t bit_idx)
+{
+    bitmap *dirty = ((bm_t == INODE_BITMAP) ? &part->inode_bitmap_dirty : &part->block_bitmap_dirty);
+    rw_lock_write_acquire(&part->rwlock);
+    bitmap_set(dirty, bit_idx / BITS_PER_SECTOR, 1);
+    rw_lock_write_release(&part->rwlock);
+}
+
+// 将指定分区位图中从bit_idx开始的连续cnt个位所在的扇区标记为脏，每个扇区只标记一次
+void bitmap_mark_dirty_range(partition *part, bitmap_t bm_t, uint32_t bit_idx, uint32_t cnt)
+{
+    ASSERT(cnt > 0);
+    bitmap *dirty = ((bm_t == INODE_BITMAP) ? &part->inode_bitmap_dirty : &part->block_bitmap_dirty);
+    uint32_t first_sec = bit_idx / BITS_PER_SECTOR;
+    uint32_t last_sec = (bit_idx + cnt - 1) / BITS_PER_SECTOR;
+    rw_lock_write_acquire(&part->rwlock);
+    bitmap_set_range(dirty, first_sec, last_sec - first_sec + 1, 1);
+    rw_lock_write_release(&part->rwlock);
+}
+
+// 将指定位图中所有的脏扇区写回硬盘，相邻的脏扇区合并为一次写入
+void bitmap_flush_dirty(partition *part, bitmap *p_btmp, bitmap *dirty, uint32_t btmp_lba, uint32_t btmp_sects)
+{
+    uint32_t sec_idx = 0;
+    while (sec_idx < btmp_sects)
+    {
+        if (!bitmap_test(dirty, sec_idx))
+        {
+            ++sec_idx;
+            continue;
+        }
+
+        uint32_t sec_cnt = 0;
+        while (sec_idx + sec_cnt < btmp_sects && bitmap_test(dirty, sec_idx + sec_cnt))
+        {
+            bitmap_set(dirty, sec_idx + sec_cnt, 0);
+            ++sec_cnt;
+        }
+        buffer_write_sectors(part->my_disk, p_btmp->btmp_ptr + sec_idx * SECTOR_SIZE, btmp_lba + sec_idx, sec_cnt);
+        sec_idx += sec_cnt;
+    }
+}
+
+// 将指定分区的inode位图和块位图中所有的脏扇区写回硬盘
+void bitmap_flush(partition *part)
+{
+    rw_lock_write_acquire(&part->rwlock);
+    bitmap_flush_dirty(part, &part->inode_bitmap, &part->inode_bitmap_dirty, part->sb->inode_bitmap_lba, part->sb->inode_bitmap_sects);
+    bitmap_flush_dirty(part, &part->block_bitmap, &part->block_bitmap_dirty, part->sb->block_bitmap_lba, part->sb->block_bitmap_sects);
+    rw_lock_write_release(&part->rwlock);
+}
+
+// 获取从bit_idx开始连续为0的位数，最多为max_cnt，bit_cnt为位图中有效的位数
+uint32_t free_run_length(bitmap *btmp, uint32_t bit_idx, uint32_t bit_cnt, uint32_t max_cnt)
+{
+    uint32_t limit = (max_cnt < bit_cnt - bit_idx) ? bit_idx + max_cnt : bit_cnt;
+    int32_t end = bitmap_find(btmp, bit_idx, limit, 1);
+    return ((end == -1) ? limit : (uint32_t)end) - bit_idx;
+}
+
+// 在位图的前bit_cnt个位中查找能容纳cnt个位的最小空闲段，找不到时返回最大的空闲段
+// 成功时返回空闲段的起始位索引并将其长度存入*run_len，位图已满时返回-1
+// 使用bitmap_find每次检查32位，从hint开始逐个空闲段地查找，全为1的字被整体跳过
+int32_t best_fit_run(bitmap *btmp, uint32_t bit_cnt, uint32_t cnt, uint32_t *run_len)
+{
+    int32_t best_idx = -1;
+    uint32_t best_len = 0;
+    int32_t start = (btmp->hint < bit_cnt) ? bitmap_find(btmp, btmp->hint, bit_cnt, 0) : -1;
+    while (start != -1)
+    {
+        int32_t end = bitmap_find(btmp, start, bit_cnt, 1);
+        uint32_t len = ((end == -1) ? bit_cnt : (uint32_t)end) - start;
+        // 能容纳cnt个位的空闲段中越短越好，都容纳不下时越长越好
+        if (best_idx == -1 ||
+            (len >= cnt && (best_len < cnt || len < best_len)) ||
+            (len < cnt && best_len < cnt && len > best_len))
+        {
+            best_idx = start;
+            best_len = len;
+            if (len == cnt)
+            {
+                break;      // 恰好合适的空闲段不会有更好的选择
+            }
+        }
+        start = (end == -1) ? -1 : bitmap_find(btmp, end, bit_cnt, 0);
+    }
+
+    *run_len = best_len;
+    return best_idx;
+}
+
+// 为文件p_inode分配最多cnt个物理连续的数据块，goal为期望的起始块LBA，为0时表示没有期望位置
+// 优先使用为该文件预留的块，其次从goal处开始分配，最后在整个块位图中选取最合适的空闲段
+// 每次分配都会额外预留至多BLOCK_RESERVE_CNT个紧随其后的块，供该文件之后的追加写入使用
+// 成功时返回首个块的LBA并将实际分配的块数存入*alloc_cnt，失败返回-1
+int32_t block_alloc(inode *p_inode, uint32_t goal, uint32_t cnt, uint32_t *alloc_cnt)
 {
-    bitmap *p_btmp;
-    uint32_t btmp_lba;
-    uint32_t sec_offset = bit_idx / BITS_PER_SECTOR;
-    if (bm_t == INODE_BITMAP)
+    ASSERT(cnt > 0);
+    partition *part = p_inode->part;
+    bitmap *btmp = &part->block_bitmap;
+    uint32_t bit_cnt = part->sb->blocks_sects;
+
+    // 预留块恰好位于期望位置时直接使用
+    if (p_inode->i_rsv_cnt)
     {
-        p_btmp = &part->inode_bitmap;
-        btmp_lba = part->sb->inode_bitmap_lba + sec_offset;
-    } 
-    else if (bm_t == BLOCK_BITMAP)
+        if (!goal || goal == p_inode->i_rsv_start)
+        {
+            uint32_t blk_lba = p_inode->i_rsv_start;
+            *alloc_cnt = (cnt < p_inode->i_rsv_cnt) ? cnt : p_inode->i_rsv_cnt;
+            p_inode->i_rsv_start += *alloc_cnt;
+            p_inode->i_rsv_cnt -= *alloc_cnt;
+            return blk_lba;
+        }
+        block_reserve_release(p_inode);
+    }
+
+    uint32_t want = cnt + BLOCK_RESERVE_CNT;
+    int32_t bit_idx = -1;
+    uint32_t run_len = 0;
+    rw_lock_write_acquire(&part->rwlock);
+    if (goal >= part->sb->blocks_lba && goal - part->sb->blocks_lba < bit_cnt)
     {
-        p_btmp = &part->block_bitmap;
-        btmp_lba = part->sb->block_bitmap_lba + sec_offset;
+        run_len = free_run_length(btmp, goal - part->sb->blocks_lba, bit_cnt, want);
+        if (run_len)
+        {
+            bit_idx = goal - part->sb->blocks_lba;
+        }
     }
+    if (bit_idx == -1)
+    {
+        bit_idx = best_fit_run(btmp, bit_cnt, want, &run_len);
+        if (bit_idx == -1)
+        {
+            rw_lock_write_release(&part->rwlock);
+            return -1;
+        }
+        run_len = (run_len < want) ? run_len : want;
+    }
+
+    bitmap_set_range(btmp, bit_idx, run_len, 1);
+    rw_lock_write_release(&part->rwlock);
+
+    *alloc_cnt = (cnt < run_len) ? cnt : run_len;
+    p_inode->i_rsv_start = part->sb->blocks_lba + bit_idx + *alloc_cnt;
+    p_inode->i_rsv_cnt = run_len - *alloc_cnt;
+    return part->sb->blocks_lba + bit_idx;
+}
 
-    write_disk(part->my_disk, p_btmp->btmp_ptr + sec_offset * SECTOR_SIZE, btmp_lba, 1);
-}  
+// 将块位图中从blk_lba开始的连续cnt个块释放，并将其所在的位图扇区标记为脏，由调用者负责bitmap_flush
+void block_free_range(partition *part, uint32_t blk_lba, uint32_t cnt)
+{
+    ASSERT(cnt > 0);
+    uint32_t bit_idx = blk_lba - part->sb->blocks_lba;
+    rw_lock_write_acquire(&part->rwlock);
+    bitmap_set_range(&part->block_bitmap, bit_idx, cnt, 0);
+    rw_lock_write_release(&part->rwlock);
+    bitmap_mark_dirty_range(part, BLOCK_BITMAP, bit_idx, cnt);
+}
+
+// 将为文件p_inode预留但未使用的块归还到块位图中
+void block_reserve_release(inode *p_inode)
+{
+    if (!p_inode->i_rsv_cnt)
+    {
+        return;
+    }
 
+    // 预留块所在的位图扇区可能已随其他块一起写入硬盘，需要重新同步
+    block_free_range(p_inode->part, p_inode->i_rsv_start, p_inode->i_rsv_cnt);
+    bitmap_flush(p_inode->part);
+    p_inode->i_rsv_start = p_inode->i_rsv_cnt = 0;
+}
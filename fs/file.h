@@ -15,6 +15,7 @@
 #define MAX_FILES_OPEN 128          // 最大支持的打开文件数
 
 #define BITS_PER_SECTOR   (SECTOR_SIZE * 8)              // 每个扇区的二进制位数
+#define BLOCK_RESERVE_CNT 16        // 为追加写入的文件额外预留的块数
 
 typedef struct inode inode;
 typedef struct partition partition;
@@ -37,6 +38,12 @@ extern file file_table[];    // 文件结构表
 extern int32_t get_free_slot_in_file_table(void);       // 在file_table中获取一个空闲的槽位，成功返回下标，失败返回-1
 extern int32_t get_free_slot_in_fd_table(void);         // 在fd_table中获取一个空闲的槽位，成功返回下标，失败返回-1
 extern int32_t bitmap_alloc(partition *part, bitmap_t bm_t);     // 在指定分区的inode位图中分配一个inode或块位图中分配一个块, 失败则返回-1
-extern void bitmap_sync(partition *part, bitmap_t bm_t, uint32_t bit_idx);  // 将指定分区位图中偏移为bit_idx的位所在的扇区同步到硬盘中
+extern void bitmap_free(partition *part, bitmap_t bm_t, uint32_t bit_idx);  // 在指定分区的inode位图或块位图中释放偏移为bit_idx的位
+extern void bitmap_mark_dirty(partition *part, bitmap_t bm_t, uint32_t bit_idx);  // 将指定分区位图中偏移为bit_idx的位所在的扇区标记为脏
+extern void bitmap_mark_dirty_range(partition *part, bitmap_t bm_t, uint32_t bit_idx, uint32_t cnt);  // 将指定分区位图中从bit_idx开始的连续cnt个位所在的扇区标记为脏
+extern void bitmap_flush(partition *part);      // 将指定分区的inode位图和块位图中所有的脏扇区写回硬盘
+extern int32_t block_alloc(inode *p_inode, uint32_t goal, uint32_t cnt, uint32_t *alloc_cnt);  // 为文件分配最多cnt个从goal开始的物理连续的块，返回首个块的LBA，失败返回-1
+extern void block_free_range(partition *part, uint32_t blk_lba, uint32_t cnt);   // 释放从blk_lba开始的连续cnt个块，由调用者负责bitmap_flush
+extern void block_reserve_release(inode *p_inode);     // 将为文件预留但未使用的块归还到块位图中
 
 #endif
\ No newline at end of file
@@ -4,31 +4,54 @@
 #include "_syscall.h"
 #include "debug.h"
 #include "ide.h"
+#include "buffer.h"
 #include "global.h"
 #include "string.h"
 #include "list.h"
 #include "file.h"
 #include "stdio.h"
 #include "thread.h"
+#include "slab.h"
+#include "pipe.h"
+#include "ioqueue.h"
+#include "dcache.h"
+#include "extent.h"
 
 #define FS_MAGIC    0x20010828              // 文件系统魔数
+#define DIRECT_WRITE_SECTS 64               // 连续写入的扇区数达到该值时绕过缓冲区直接写硬盘
 
 partition *root_part;                         // 根目录所在的分区
+slab_cache *sector_cache;           // 扇区大小的临时缓冲区的缓存
+slab_cache *search_record_cache;    // 路径搜索记录的缓存
 
 void partition_format(partition *part);                     // 分区格式化
 bool part_listnode_format(node *pnode, int arg UNUSED);     // 作为list_traversal的回调函数对不存在可识别文件系统的分区进行格式化
 bool part_listnode_mount(node *pnode, int part_name);     // 作为list_traversal的回调函数对名为part_name的分区进行挂载
+uint32_t file_alloc_blocks(inode *p_inode, uint32_t start_idx, uint32_t end_idx);    // 为文件分配下标为[start_idx, end_idx)的数据块并建立映射，返回首个未能分配的下标
 
 // 初始化文件系统
 void fs_init(void)
 {
+    // 创建文件系统常用对象的缓存
+    inode_cache = slab_cache_create("inode", sizeof(inode), 4, NULL);
+    inode_table_init();
+    dcache_init();
+    dir_cache = slab_cache_create("dir", sizeof(dir), 4, NULL);
+    sector_cache = slab_cache_create("sector", SECTOR_SIZE, 4, NULL);
+    search_record_cache = slab_cache_create("search_record", sizeof(search_record), 4, NULL);
+    pipe_cache = slab_cache_create("pipe", sizeof(ioqueue), 4, NULL);
+
     // 将所有未格式化的分区格式化
     list_traversal(&partition_list, part_listnode_format, 0);
     printk("Format partition done!\n");
 
     // 加载根文件系统
     node *pnode = list_traversal(&partition_list, part_listnode_mount, (int)"sdb1");
-    ASSERT(pnode);
+    if (!pnode)
+    {
+        // 没有根文件系统无法继续运行，release构建中ASSERT不生效，因此显式停机
+        panic_spin(__FILE__, __LINE__, __func__, "Cannot mount the root filesystem on sdb1!");
+    }
     root_part = member2struct(pnode, partition, list_node);
     printk("Successful to mount '%s' on '/'\n", root_part->name);
 
@@ -48,11 +71,12 @@ void partition_format(partition *part)
     /***  超级块初始化   ***/
     superblock *sb = (superblock *)kmalloc(SECTOR_SIZE);
     ASSERT(sb);
+    memset(sb, 0, SECTOR_SIZE);     // 超级块中未使用的部分清零，以便将来增加的字段在旧文件系统中为0
 
     // 初始化各个区域的扇区数
     sb->part_sects = part->sec_cnt;
     sb->inode_bitmap_sects = DIV_ROUND_UP(MAX_FILE_CNT, BITS_PER_SECTOR);
-    sb->inode_table_sects = DIV_ROUND_UP(MAX_FILE_CNT * sizeof(inode), SECTOR_SIZE);
+    sb->inode_table_sects = DIV_ROUND_UP(MAX_FILE_CNT * INODE_DISK_SIZE, SECTOR_SIZE);
     uint32_t free_blks = sb->part_sects - (1 + 1 + sb->inode_bitmap_sects + sb->inode_table_sects);
     sb->block_bitmap_sects = DIV_ROUND_UP(free_blks, BITS_PER_SECTOR);
     sb->blocks_sects = free_blks - sb->block_bitmap_sects;
@@ -68,8 +92,10 @@ void partition_format(partition *part)
     // 初始化其他信息
     sb->dentry_size = sizeof(dentry);
     sb->magic = FS_MAGIC;
+    sb->version = FS_VERSION;
     sb->inode_cnt = MAX_FILE_CNT;
     sb->root_i_no = 0;
+    sb->compat_flags = FS_COMPAT_DIR_INDEX | FS_COMPAT_EXTENTS;
     
     // 将超级块写入硬盘
     write_disk(part->my_disk, sb, sb->part_lba + 1, 1);
@@ -147,12 +173,8 @@ void partition_format(partition *part)
     p_inode->i_size = 2 * sizeof(dentry);
     p_inode->open_cnt = 0;
     p_inode->part = NULL;
-    p_inode->list_node.next = p_inode->list_node.prev = NULL;
-    p_inode->i_sectors[0] = blocks_lba;
-    for (uint32_t i = 1; i < 13; ++i)
-    {
-        p_inode->i_sectors[i] = 0;
-    }
+    p_inode->i_flags = INODE_FL_EXTENTS;
+    extent_init(p_inode, blocks_lba, 1);        // 根目录表占用数据块区的第一个块
     
     // 将根目录的inode写入硬盘
     write_disk(part->my_disk, p_inode, inode_table_lba, 1);
@@ -194,6 +216,7 @@ bool part_listnode_format(node *pnode, int arg UNUSED)
     // 将超级块读入后根据魔数判断该分区是否存在文件系统
     partition *part = member2struct(pnode, partition, list_node);
     read_disk(part->my_disk, sb, part->start_lba + 1, 1);
+    // 只格式化不存在文件系统的分区，魔数正确的分区保持原样，由挂载时识别其格式版本
     if (sb->magic != FS_MAGIC)
     {
         partition_format(part);
@@ -203,15 +226,35 @@ bool part_listnode_format(node *pnode, int arg UNUSED)
     return false;
 }    
 
-// 挂载指定分区
-void partition_mount(partition *part)
+// 挂载指定分区，分区上的文件系统格式不受支持时返回false
+bool partition_mount(partition *part)
 {
     superblock *sb = (superblock *)kmalloc(SECTOR_SIZE);
     ASSERT(sb);
 
     // 读入超级块
     read_disk(part->my_disk, sb, part->start_lba + 1, 1);
-    ASSERT(sb->magic == FS_MAGIC);
+    if (sb->magic != FS_MAGIC)
+    {
+        printk("partition_mount: %s: no filesystem\n", part->name);
+        sys_free(sb);
+        return false;
+    }
+
+    // 基线格式格式化时没有清零超级块，version和compat_flags是不确定的值，只能由inode表的大小识别
+    if (sb->inode_table_sects == DIV_ROUND_UP(sb->inode_cnt * INODE_V1_DISK_SIZE, SECTOR_SIZE))
+    {
+        sb->version = FS_VERSION_V1;
+        sb->compat_flags = 0;
+        printk("partition_mount: %s: baseline format, files are limited to %u blocks without extents or hashed directories\n",
+               part->name, INODE_V1_MAX_BLOCKS);
+    }
+    else if (sb->version != FS_VERSION)
+    {
+        printk("partition_mount: %s: unsupported filesystem version %u (expected %u)\n", part->name, sb->version, FS_VERSION);
+        sys_free(sb);
+        return false;
+    }
     part->sb = (superblock *)kmalloc(sizeof(superblock));
     ASSERT(part->sb);
     memcpy(part->sb, sb, sizeof(superblock));
@@ -221,15 +264,27 @@ void partition_mount(partition *part)
     part->block_bitmap.btmp_ptr = (uint8_t *)kmalloc(part->block_bitmap.bytes_length);
     ASSERT(part->block_bitmap.btmp_ptr);
     read_disk(part->my_disk, part->block_bitmap.btmp_ptr, sb->block_bitmap_lba, sb->block_bitmap_sects);
+    bitmap_reset_hint(&part->block_bitmap);
 
     // 读入inode位图
     part->inode_bitmap.bytes_length = sb->inode_bitmap_sects * SECTOR_SIZE;
     part->inode_bitmap.btmp_ptr = (uint8_t *)kmalloc(part->inode_bitmap.bytes_length);
     ASSERT(part->inode_bitmap.btmp_ptr);
     read_disk(part->my_disk, part->inode_bitmap.btmp_ptr, sb->inode_bitmap_lba, sb->inode_bitmap_sects);
+    bitmap_reset_hint(&part->inode_bitmap);
+
+    // 初始化位图脏扇区记录
+    part->block_bitmap_dirty.bytes_length = DIV_ROUND_UP(sb->block_bitmap_sects, 8);
+    part->block_bitmap_dirty.btmp_ptr = (uint8_t *)kmalloc(part->block_bitmap_dirty.bytes_length);
+    ASSERT(part->block_bitmap_dirty.btmp_ptr);
+    bitmap_init(&part->block_bitmap_dirty);
+    part->inode_bitmap_dirty.bytes_length = DIV_ROUND_UP(sb->inode_bitmap_sects, 8);
+    part->inode_bitmap_dirty.btmp_ptr = (uint8_t *)kmalloc(part->inode_bitmap_dirty.bytes_length);
+    ASSERT(part->inode_bitmap_dirty.btmp_ptr);
+    bitmap_init(&part->inode_bitmap_dirty);
 
-    // 初始化打开文件链表
-    list_init(&part->inode_list);
+    // 初始化分区的读写锁
+    rw_lock_init(&part->rwlock);
 
     // 初始化挂载信息
     list_init(&part->mount_list);
@@ -247,18 +302,14 @@ void partition_mount(partition *part)
     printk("blocks area: LBA  %u   sectors  %u\n", sb->blocks_lba, sb->blocks_sects); */
 
     sys_free(sb);
+    return true;
 }  
 
 // 作为list_traversal的回调函数对名为part_name的分区进行挂载
 bool part_listnode_mount(node *pnode, int part_name)
 {
     partition *part = member2struct(pnode, partition, list_node);
-    if (!strcmp(part->name, (const char *)part_name))
-    {
-        partition_mount(part);
-        return true;
-    }
-    return false;
+    return (!strcmp(part->name, (const char *)part_name) && partition_mount(part));
 }  
 
 // 获取指定路径的路径深度
@@ -368,6 +419,42 @@ void search_file(const char *pathname, search_record *sr)
     sr->parent_dir = dir_open(tmp_part, tmp_i_no);
 }  
 
+// 为文件p_inode分配下标为[start_idx, end_idx)的数据块并建立映射，返回首个未能分配的下标
+uint32_t file_alloc_blocks(inode *p_inode, uint32_t start_idx, uint32_t end_idx)
+{
+    // 新分配的块期望紧跟在文件的最后一个块之后
+    uint32_t goal = 0;
+    if (start_idx)
+    {
+        inode_bmap(p_inode, start_idx - 1, 1, &goal);
+        ++goal;
+    }
+
+    uint32_t idx = start_idx;
+    while (idx < end_idx)
+    {
+        uint32_t alloc_cnt;
+        int32_t blk_lba = block_alloc(p_inode, goal, end_idx - idx, &alloc_cnt);
+        if (blk_lba == -1)
+        {
+            break;
+        }
+        bitmap_mark_dirty_range(p_inode->part, BLOCK_BITMAP, blk_lba - p_inode->part->sb->blocks_lba, alloc_cnt);
+
+        // 映射的块在数据块之后分配，以免索引块打断数据块的连续性
+        uint32_t mapped = inode_bmap_map(p_inode, idx, blk_lba, alloc_cnt);
+        idx += mapped;
+        if (mapped < alloc_cnt)
+        {
+            // 索引块分配失败，未被映射的块无法由调用者回滚，在此直接归还
+            block_free_range(p_inode->part, blk_lba + mapped, alloc_cnt - mapped);
+            break;
+        }
+        goal = blk_lba + alloc_cnt;
+    }
+    return idx;
+}
+
 // 在目录pdir下创建一个名为filename的文件
 int32_t file_create(dir *pdir, const char *filename)
 {
@@ -376,25 +463,37 @@ int32_t file_create(dir *pdir, const char *filename)
         return -1;
     }
 
+    // 持有父目录的写锁，并重新确认同名文件不存在，避免与并发的创建操作冲突
+    rw_lock_write_acquire(&pdir->p_inode->rwlock);
+    dentry dir_e;
+    if (dir_search(pdir, filename, &dir_e))
+    {
+        rw_lock_write_release(&pdir->p_inode->rwlock);
+        return -1;
+    }
+
     uint32_t new_i_no = bitmap_alloc(pdir->p_inode->part, INODE_BITMAP);
     if (new_i_no == -1)
     {
+        rw_lock_write_release(&pdir->p_inode->rwlock);
         return -1;
     }
     inode new_inode;
     inode_init(pdir->p_inode->part, new_i_no, &new_inode);
 
-    dentry dir_e;
     dentry_init(new_i_no, filename, FT_REGULAR, &dir_e);
 
     if (!add_dentry(pdir, &dir_e))
     {
-        bitmap_set(&pdir->p_inode->part->inode_bitmap, new_i_no, 0);
+        bitmap_free(pdir->p_inode->part, INODE_BITMAP, new_i_no);
+        rw_lock_write_release(&pdir->p_inode->rwlock);
         return -1;
     }
 
     inode_sync(&new_inode);
-    bitmap_sync(pdir->p_inode->part, INODE_BITMAP, new_i_no);
+    bitmap_mark_dirty(pdir->p_inode->part, INODE_BITMAP, new_i_no);
+    bitmap_flush(pdir->p_inode->part);
+    rw_lock_write_release(&pdir->p_inode->rwlock);
     return new_i_no;
 }
 
@@ -442,181 +541,93 @@ int32_t file_write(file *p_file, const void *buf, uint32_t cnt)
         return 0;
     }
 
+    rw_lock_write_acquire(&p_file->p_inode->rwlock);
     uint32_t sec_cnt_before_writing = DIV_ROUND_UP(p_file->p_inode->i_size, SECTOR_SIZE);
     uint32_t sec_cnt_after_writing = DIV_ROUND_UP(p_file->p_inode->i_size + cnt, SECTOR_SIZE);
-
-    uint32_t *all_blocks = (uint32_t *)kmalloc(560);
-    ASSERT(all_blocks);
-    memset(all_blocks, 0, 560);
+    if (p_file->p_inode->i_size + cnt < p_file->p_inode->i_size || sec_cnt_after_writing > inode_max_blocks(p_file->p_inode->part))
+    {
+        // 超出文件大小的上限
+        rw_lock_write_release(&p_file->p_inode->rwlock);
+        return -1;
+    }
 
     // 将需要的块预先分配
-    uint8_t cond;               // 块分配失败时可根据该值确定回滚的步骤
-    uint32_t idx_fail_to_alloc; // 记录分配失败时正在等待写入的all_blocks元素的下标值
-    uint32_t blk_lba;
     if (sec_cnt_before_writing < sec_cnt_after_writing)
     {
-        if (sec_cnt_before_writing <= 12)
+        if (file_alloc_blocks(p_file->p_inode, sec_cnt_before_writing, sec_cnt_after_writing) != sec_cnt_after_writing)
         {
-            if (sec_cnt_after_writing <= 12)
-            {
-                if (p_file->p_inode->i_size % SECTOR_SIZE)
-                {
-                    all_blocks[sec_cnt_before_writing - 1] = p_file->p_inode->i_sectors[sec_cnt_before_writing - 1];
-                }
-
-                // 分配数据块
-                for (uint32_t i = sec_cnt_before_writing; i < sec_cnt_after_writing; ++i)
-                {
-                    blk_lba = bitmap_alloc(p_file->p_inode->part, BLOCK_BITMAP);
-                    if (blk_lba == -1)
-                    {
-                        cond = 0;
-                        idx_fail_to_alloc = i;
-                        goto roll_back;
-                    }
-                    all_blocks[i] = p_file->p_inode->i_sectors[i] = blk_lba;
-                }
-            }
-            else
-            {
-                if (p_file->p_inode->i_size % SECTOR_SIZE)
-                {
-                    all_blocks[sec_cnt_before_writing - 1] = p_file->p_inode->i_sectors[sec_cnt_before_writing - 1];
-                }
-
-                // 分配一个索引块
-                uint32_t indirect_blk_lba = bitmap_alloc(p_file->p_inode->part, BLOCK_BITMAP);
-                if (indirect_blk_lba == -1)
-                {
-                    sys_free(all_blocks);
-                    return -1;
-                }
-                p_file->p_inode->i_sectors[12] = indirect_blk_lba;
-
-                // 分配数据块
-                for (uint32_t i = sec_cnt_before_writing; i < sec_cnt_after_writing; ++i)
-                {
-                    blk_lba = bitmap_alloc(p_file->p_inode->part, BLOCK_BITMAP);
-                    if (blk_lba == -1)
-                    {
-                        cond = 1;
-                        idx_fail_to_alloc = i;
-                        goto roll_back;
-                    }
-                    all_blocks[i] = blk_lba;
-                    if (i < 12)
-                    {
-                        p_file->p_inode->i_sectors[i] = blk_lba;
-                    }
-                }
-
-                // 将索引块和位图同步到硬盘中
-                write_disk(p_file->p_inode->part->my_disk, all_blocks + 12, indirect_blk_lba, 1);
-                bitmap_sync(p_file->p_inode->part, BLOCK_BITMAP, indirect_blk_lba - p_file->p_inode->part->sb->blocks_lba);
-            }
-        }
-        else
-        {
-            ASSERT(p_file->p_inode->i_sectors[12]);
-            read_disk(p_file->p_inode->part->my_disk, all_blocks + 12, p_file->p_inode->i_sectors[12], 1);
-
-            // 分配数据块
-            for (uint32_t i = sec_cnt_before_writing; i < sec_cnt_after_writing; ++i)
-            {
-                blk_lba = bitmap_alloc(p_file->p_inode->part, BLOCK_BITMAP);
-                if (blk_lba == -1)
-                {
-                    cond = 0;
-                    idx_fail_to_alloc = i;
-                    goto roll_back;
-                }
-                all_blocks[i] = blk_lba;
-            }
-
-            // 将索引块同步到硬盘中
-            write_disk(p_file->p_inode->part->my_disk, all_blocks + 12, p_file->p_inode->i_sectors[12], 1);
-        }
-
-        // 将位图同步到硬盘中
-        for (uint32_t i = sec_cnt_before_writing; i < sec_cnt_after_writing; ++i)
-        {
-            bitmap_sync(p_file->p_inode->part, BLOCK_BITMAP, all_blocks[i] - p_file->p_inode->part->sb->blocks_lba);
-        }
-    }
-    else
-    {
-        if (sec_cnt_before_writing <= 12)
-        {
-            // 很显然可以断言这里的 i_size 必然不是 SECTOR_SIZE 的整数倍
-            all_blocks[sec_cnt_before_writing - 1] = p_file->p_inode->i_sectors[sec_cnt_before_writing - 1];
-        }
-        else
-        {
-            ASSERT(p_file->p_inode->i_sectors[12]);
-            read_disk(p_file->p_inode->part->my_disk, all_blocks + 12, p_file->p_inode->i_sectors[12], 1);
+            // 块分配失败时回滚块位图和块索引
+            inode_truncate_blocks(p_file->p_inode, sec_cnt_before_writing);
+            rw_lock_write_release(&p_file->p_inode->rwlock);
+            return -1;
         }
+        bitmap_flush(p_file->p_inode->part);
     }
 
     // 将数据写入文件
     p_file->f_pos = p_file->p_inode->i_size;        // 从文件尾开始写入
+    disk *hd = p_file->p_inode->part->my_disk;
     uint32_t sec_idx = p_file->f_pos / SECTOR_SIZE;
     uint32_t sec_offset = p_file->f_pos % SECTOR_SIZE;
-    uint32_t bytes_left_in_sec = SECTOR_SIZE - sec_offset;
     uint32_t bytes_write_done = 0;
     uint32_t bytes_to_write;
-    void *buf_to_write = kmalloc(SECTOR_SIZE);
-    ASSERT(buf_to_write);
+    uint32_t sec_cnt;
+    uint32_t blk_lba;
     while (cnt)
     {
-        ASSERT(all_blocks[sec_idx]);
-        bytes_to_write = (cnt > bytes_left_in_sec) ? bytes_left_in_sec : cnt;
-
-        read_disk(p_file->p_inode->part->my_disk, buf_to_write, all_blocks[sec_idx], 1);
-        memcpy(buf_to_write + sec_offset, buf, bytes_to_write);
-        write_disk(p_file->p_inode->part->my_disk, buf_to_write, all_blocks[sec_idx], 1);
+        if (sec_offset || cnt < SECTOR_SIZE)
+        {
+            // 只被部分覆盖的扇区经由缓冲区写入
+            inode_bmap(p_file->p_inode, sec_idx, 1, &blk_lba);
+            ASSERT(blk_lba);
+            bytes_to_write = (cnt > SECTOR_SIZE - sec_offset) ? (SECTOR_SIZE - sec_offset) : cnt;
+            buffer *pbuf;
+            if (sec_offset)
+            {
+                // 文件尾所在的扇区需要保留原有数据
+                pbuf = buffer_read(hd, blk_lba);
+            }
+            else
+            {
+                // 新分配的块无需读入旧数据
+                pbuf = buffer_get(hd, blk_lba);
+                memset(pbuf->data, 0, SECTOR_SIZE);
+            }
+            memcpy(pbuf->data + sec_offset, buf, bytes_to_write);
+            buffer_mark_dirty(pbuf);
+            buffer_release(pbuf);
+            sec_cnt = 1;
+        }
+        else
+        {
+            sec_cnt = inode_bmap(p_file->p_inode, sec_idx, cnt / SECTOR_SIZE, &blk_lba);
+            ASSERT(blk_lba);
+            bytes_to_write = sec_cnt * SECTOR_SIZE;
+            if (sec_cnt < DIRECT_WRITE_SECTS)
+            {
+                // 较短的写入只写到缓冲区中，由回写线程写回硬盘
+                buffer_write_sectors(hd, buf, blk_lba, sec_cnt);
+            }
+            else
+            {
+                // 大块的连续写入直接从调用者的缓冲区一次性写入硬盘，避免挤占缓冲区
+                buffer_update_range(hd, buf, blk_lba, sec_cnt);
+                write_disk(hd, (void *)buf, blk_lba, sec_cnt);
+            }
+        }
 
         buf += bytes_to_write;
         bytes_write_done += bytes_to_write;
         cnt -= bytes_to_write;
-        ++sec_idx;
+        sec_idx += sec_cnt;
         sec_offset = 0;
-        bytes_left_in_sec = SECTOR_SIZE;
     }
     p_file->f_pos += bytes_write_done;
 
     p_file->p_inode->i_size = p_file->f_pos;
     inode_sync(p_file->p_inode);
-
-    sys_free(all_blocks);
-    sys_free(buf_to_write);
+    rw_lock_write_release(&p_file->p_inode->rwlock);
     return bytes_write_done;
-
-// 块分配失败时回滚块位图
-roll_back:
-    switch (cond)
-    {
-        case 0:
-        {
-            bitmap_set(&p_file->p_inode->part->block_bitmap, 
-            p_file->p_inode->i_sectors[12] - p_file->p_inode->part->sb->blocks_lba, 0);
-
-            p_file->p_inode->i_sectors[12] = 0;
-        }
-        case 1:
-        {
-            for (uint32_t i = sec_cnt_before_writing; i < idx_fail_to_alloc; ++i)
-            {
-                bitmap_set(&p_file->p_inode->part->block_bitmap, all_blocks[i] - p_file->p_inode->part->sb->blocks_lba, 0);
-                if (i < 12)
-                {
-                    p_file->p_inode->i_sectors[i] = 0;
-                }
-            }
-            sys_free(all_blocks);
-            return -1;
-        }
-    }
-    return -1;          // 该行代码不会被执行到，作用主要是解除编译器警告
 } 
 
 // 从p_file指向的文件读取cnt个字节到buf处
@@ -632,46 +643,50 @@ int32_t file_read(file *p_file, void *buf, uint32_t cnt)
         return 0;
     }
 
-    uint32_t *all_blocks = (uint32_t *)kmalloc(560);
-    ASSERT(all_blocks);
-    memset(all_blocks, 0, 560);
-    for (uint32_t i = 0; i < 12; ++i)
-    {
-        all_blocks[i] = p_file->p_inode->i_sectors[i];
-    }
-    if (p_file->p_inode->i_sectors[12])
-    {
-        read_disk(p_file->p_inode->part->my_disk, all_blocks + 12, p_file->p_inode->i_sectors[12], 1);
-    }
+    rw_lock_read_acquire(&p_file->p_inode->rwlock);
 
+    disk *hd = p_file->p_inode->part->my_disk;
     uint32_t sec_idx = p_file->f_pos / SECTOR_SIZE;
     uint32_t sec_offset = p_file->f_pos % SECTOR_SIZE;
-    uint32_t bytes_left_in_sec = SECTOR_SIZE - sec_offset;
     uint32_t bytes_left_in_file = p_file->p_inode->i_size - p_file->f_pos;
     uint32_t bytes_to_read;
     uint32_t bytes_read_done = 0;
-    void *buf_to_read = kmalloc(SECTOR_SIZE);
-    ASSERT(buf_to_read);
+    uint32_t sec_cnt;
+    uint32_t blk_lba;
     while (p_file->f_pos < p_file->p_inode->i_size && cnt)
     {
         bytes_to_read = (bytes_left_in_file > cnt) ? cnt : bytes_left_in_file;
-        bytes_to_read = (bytes_to_read > bytes_left_in_sec) ? bytes_left_in_sec : bytes_to_read;
 
-        ASSERT(all_blocks[sec_idx]);
-        read_disk(p_file->p_inode->part->my_disk, buf_to_read, all_blocks[sec_idx], 1);
-        memcpy(buf, buf_to_read + sec_offset, bytes_to_read);
+        if (sec_offset || bytes_to_read < SECTOR_SIZE)
+        {
+            // 只读取扇区的一部分时经由缓冲区读取
+            inode_bmap(p_file->p_inode, sec_idx, 1, &blk_lba);
+            ASSERT(blk_lba);
+            bytes_to_read = (bytes_to_read > SECTOR_SIZE - sec_offset) ? (SECTOR_SIZE - sec_offset) : bytes_to_read;
+            buffer *pbuf = buffer_read(hd, blk_lba);
+            memcpy(buf, pbuf->data + sec_offset, bytes_to_read);
+            buffer_release(pbuf);
+            sec_cnt = 1;
+        }
+        else
+        {
+            // 读取完整且物理连续的扇区时直接一次性读入调用者的缓冲区
+            sec_cnt = inode_bmap(p_file->p_inode, sec_idx, bytes_to_read / SECTOR_SIZE, &blk_lba);
+            ASSERT(blk_lba);
+            bytes_to_read = sec_cnt * SECTOR_SIZE;
+            buffer_flush_range(hd, blk_lba, sec_cnt);
+            read_disk(hd, buf, blk_lba, sec_cnt);
+        }
 
         bytes_read_done += bytes_to_read;
         buf += bytes_to_read;
         p_file->f_pos += bytes_to_read;
         cnt -= bytes_to_read;
         bytes_left_in_file -= bytes_to_read;
-        ++sec_idx;
+        sec_idx += sec_cnt;
         sec_offset = 0;
-        bytes_left_in_sec = SECTOR_SIZE;
     }
 
-    sys_free(all_blocks);
-    sys_free(buf_to_read);
+    rw_lock_read_release(&p_file->p_inode->rwlock);
     return bytes_read_done;
 }
@@ -5,6 +5,7 @@
 
 typedef struct partition partition;
 typedef struct file file;
+typedef struct slab_cache slab_cache;
 
 #define MAX_PATH_LEN 256    // 最大路径长度
 
@@ -32,6 +33,8 @@ struct stat
 };
 
 extern partition *root_part;       // 根目录所在的分区
+extern slab_cache *sector_cache;           // 扇区大小的临时缓冲区的缓存
+extern slab_cache *search_record_cache;    // 路径搜索记录的缓存
 
 extern void search_file(const char *pathname, search_record *sr);  // 按照给定的路径搜索文件，将结构存储在search_record结构中
 
@@ -45,6 +48,6 @@ extern int32_t file_read(file *p_file, void *buf, uint32_t cnt);    // 从p_file
 extern uint32_t path_depth(const char *pathname);  // 获取指定路径的路径深度
 extern char *path_parse(const char *pathname, char *filename); // 路径解析，每解析一层，返回该层的文件名filename和下一个分隔符的地址
 
-extern void partition_mount(partition *part);      // 挂载指定分区
+extern bool partition_mount(partition *part);      // 挂载指定分区，文件系统格式不受支持时返回false
 
 #endif
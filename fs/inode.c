@@ -1,5 +1,6 @@
 #include "inode.h"
 #include "ide.h"
+#include "buffer.h"
 #include "dir.h"
 #include "_syscall.h"
 #include "thread.h"
@@ -7,27 +8,93 @@
 #include "debug.h"
 #include "string.h"
 #include "process.h"
+#include "slab.h"
+#include "fs.h"
+#include "extent.h"
+
+#define INODE_HASH(part, i_no) ((((uint32_t)(part) >> 4) ^ (i_no)) & (INODE_HASH_SIZE - 1))
 
 extern partition *root_part;                         // 根目录所在的分区
 
-bool inode_check(node *pnode, int i_no);            // 作为list_traversal的回调函数判断指定的inode节点的编号是否是i_no
+// 哈希查找时使用的关键字
+typedef struct inode_key
+{
+    partition *part;
+    uint32_t i_no;
+} inode_key;
+
+slab_cache *inode_cache;            // 内存中inode结构的缓存
+list inode_hash_table[INODE_HASH_SIZE];     // 以(分区, inode编号)为关键字的哈希表，包含所有打开和被缓存的inode
+list inode_lru_list;                // 打开计数为0但仍被缓存的inode，表头为最久未使用的inode
+mutex_lock inode_table_lock;        // 保护哈希表、LRU链表和所有inode的打开计数
+
+bool inode_check(node *pnode, int key);             // 作为list_traversal的回调函数判断inode是否对应指定的(分区, inode编号)
+inode *inode_lookup(partition *part, uint32_t i_no);    // 在哈希表中查找inode，找到时增加其打开计数
+void inode_put(inode *p_inode, bool keep);          // 减少inode的打开计数，计数为0时将其缓存或释放
+uint32_t inode_block_path(uint32_t idx, uint32_t *offsets);     // 计算文件第idx个块在块索引树中的路径，返回间接索引的层数
+uint32_t inode_index_alloc(partition *part);        // 分配一个清零的索引块，失败返回0
+void inode_block_free(partition *part, uint32_t blk_lba);       // 在块位图中释放一个块
+bool inode_free_tree(partition *part, uint32_t blk_lba, uint32_t level, uint32_t start);   // 释放索引子树中相对下标不小于start的块
+
+// 初始化inode哈希表和LRU链表
+void inode_table_init(void)
+{
+    for (uint32_t i = 0; i < INODE_HASH_SIZE; ++i)
+    {
+        list_init(&inode_hash_table[i]);
+    }
+    list_init(&inode_lru_list);
+    mutex_lock_init(&inode_table_lock);
+}
+
+// 分区中每个inode在硬盘上所占的字节数
+uint32_t inode_disk_size(partition *part)
+{
+    return (part->sb->version == FS_VERSION_V1 ? INODE_V1_DISK_SIZE : INODE_DISK_SIZE);
+}
+
+// 分区中文件最多的块数，基线格式的inode只能存放一级间接块
+uint32_t inode_max_blocks(partition *part)
+{
+    return (part->sb->version == FS_VERSION_V1 ? INODE_V1_MAX_BLOCKS : INODE_MAX_BLOCKS);
+}
 
 // 根据inode编号定位到inode的物理位置
 void inode_locate(partition *part, uint32_t i_no, inode_position *i_pos)
 {
-    i_pos->lba = part->sb->inode_table_lba + ((i_no * sizeof(inode)) / SECTOR_SIZE);
-    i_pos->offset = ((i_no * sizeof(inode)) % SECTOR_SIZE);
-    i_pos->two_sec = ((SECTOR_SIZE - i_pos->offset) < sizeof(inode));
+    uint32_t disk_size = inode_disk_size(part);
+    i_pos->lba = part->sb->inode_table_lba + ((i_no * disk_size) / SECTOR_SIZE);
+    i_pos->offset = ((i_no * disk_size) % SECTOR_SIZE);
+    i_pos->two_sec = ((SECTOR_SIZE - i_pos->offset) < disk_size);
 }       
 
-// 作为list_traversal的回调函数判断指定的inode节点的编号是否是i_no
-bool inode_check(node *pnode, int i_no)
+// 作为list_traversal的回调函数判断inode是否对应指定的(分区, inode编号)
+bool inode_check(node *pnode, int key)
 {
     inode *p_inode = member2struct(pnode, inode, list_node);
-    return (p_inode->i_no == i_no); 
+    return (p_inode->part == ((inode_key *)key)->part && p_inode->i_no == ((inode_key *)key)->i_no); 
 }       
 
-// 打开分区part中编号为i_no的inode
+// 在哈希表中查找inode，找到时增加其打开计数，须持有inode_table_lock
+inode *inode_lookup(partition *part, uint32_t i_no)
+{
+    inode_key key = {part, i_no};
+    node *pnode = list_traversal(&inode_hash_table[INODE_HASH(part, i_no)], inode_check, (int)&key);
+    if (!pnode)
+    {
+        return NULL;
+    }
+
+    // 被缓存的inode重新被打开，需要将其从LRU链表中取出
+    inode *p_inode = member2struct(pnode, inode, list_node);
+    if (p_inode->open_cnt++ == 0)
+    {
+        list_remove(&inode_lru_list, &p_inode->lru_node);
+    }
+    return p_inode;
+}
+
+// 打开分区part中编号为i_no的inode，inode已打开或仍被缓存时无需读硬盘
 inode *inode_open(partition *part, uint32_t i_no)
 {
     if (!part || i_no >= part->sb->inode_cnt)
@@ -35,47 +102,135 @@ inode *inode_open(partition *part, uint32_t i_no)
         return NULL;
     }
 
-    node *pnode = list_traversal(&part->inode_list, inode_check, i_no);
-    if (pnode)
+    mutex_lock_acquire(&inode_table_lock);
+    inode *p_inode = inode_lookup(part, i_no);
+    // 读硬盘时不持有inode表的锁
+    mutex_lock_release(&inode_table_lock);
+    if (p_inode)
     {
-        // 如果待打开的inode已经在打开文件链表中存在，只需将打开计数值加一即可
-        inode *p_inode = member2struct(pnode, inode, list_node);
-        ++p_inode->open_cnt;
         return p_inode;
     }
 
-    inode *p_inode = (inode *)kmalloc(sizeof(inode));     
+    p_inode = (inode *)slab_alloc(inode_cache);     
     ASSERT(p_inode);
 
-    uint8_t *buf;
+    // 直接从缓冲区中拷贝inode，inode跨扇区时分两次拷贝
     inode_position i_pos;
     inode_locate(part, i_no, &i_pos);
-    uint32_t sec_cnt = i_pos.two_sec ? 2 : 1;
-    buf = (uint8_t *)kmalloc(SECTOR_SIZE * sec_cnt);
-    ASSERT(buf);
-    read_disk(part->my_disk, buf, i_pos.lba, sec_cnt);
-
-    memcpy(p_inode, buf + i_pos.offset, sizeof(inode));
+    uint32_t disk_size = inode_disk_size(part);
+    uint32_t first_part = i_pos.two_sec ? (SECTOR_SIZE - i_pos.offset) : disk_size;
+    buffer *pbuf = buffer_read(part->my_disk, i_pos.lba);
+    memcpy(p_inode, pbuf->data + i_pos.offset, first_part);
+    buffer_release(pbuf);
+    if (i_pos.two_sec)
+    {
+        pbuf = buffer_read(part->my_disk, i_pos.lba + 1);
+        memcpy((uint8_t *)p_inode + first_part, pbuf->data, disk_size - first_part);
+        buffer_release(pbuf);
+    }
+    if (disk_size < INODE_DISK_SIZE)
+    {
+        // 基线格式的inode没有二级和三级间接块，i_flags和i_reserved所在位置是旧的链表结点，不能当作标志解释
+        memset((uint8_t *)p_inode + disk_size, 0, INODE_DISK_SIZE - disk_size);
+        p_inode->i_flags = p_inode->i_reserved = 0;
+    }
 
     ASSERT((p_inode->open_cnt == 0) && !p_inode->part);
+    p_inode->i_rsv_start = p_inode->i_rsv_cnt = 0;
     p_inode->open_cnt = 1;
+    node_init(&p_inode->list_node);
+    node_init(&p_inode->lru_node);
     p_inode->part = part;
-    list_push_front(&part->inode_list, &p_inode->list_node);          // 该inode可能很快就会被访问，将其放到链表头
+    rw_lock_init(&p_inode->rwlock);
+
+    mutex_lock_acquire(&inode_table_lock);
+    inode *exist = inode_lookup(part, i_no);
+    if (exist)
+    {
+        // 读硬盘期间其他线程已经打开了该inode，使用已有的inode
+        slab_free(inode_cache, p_inode);
+        p_inode = exist;
+    }
+    else
+    {
+        list_push_front(&inode_hash_table[INODE_HASH(part, i_no)], &p_inode->list_node);
+    }
+    mutex_lock_release(&inode_table_lock);
 
-    sys_free(buf);
     return p_inode;
 }  
 
-// 关闭指定inode
-void inode_close(inode *p_inode)
+// 增加已打开inode的打开计数，用于复制文件描述符等无需重新查找inode的场合
+void inode_get(inode *p_inode)
 {
-    ASSERT(list_find(&p_inode->part->inode_list, &p_inode->list_node));
+    mutex_lock_acquire(&inode_table_lock);
+    ASSERT(p_inode->open_cnt > 0);
+    ++p_inode->open_cnt;
+    mutex_lock_release(&inode_table_lock);
+}
+
+// 减少inode的打开计数，计数为0时归还预留的块，
+// keep为true时将inode放入LRU链表继续缓存(缓存数量超出上限时淘汰最久未使用的inode)，否则直接释放
+void inode_put(inode *p_inode, bool keep)
+{
+    inode *victim = NULL;
+    mutex_lock_acquire(&inode_table_lock);
+    ASSERT(p_inode->open_cnt > 0);
     if (--p_inode->open_cnt == 0)
     {
-        list_remove(&p_inode->part->inode_list, &p_inode->list_node);
-        sys_free(p_inode);
+        block_reserve_release(p_inode);     // 归还预留但未使用的块
+        if (keep)
+        {
+            list_push_back(&inode_lru_list, &p_inode->lru_node);
+            if (inode_lru_list.length > INODE_CACHE_SIZE)
+            {
+                node *pnode = list_pop_front(&inode_lru_list);
+                victim = member2struct(pnode, inode, lru_node);
+            }
+        }
+        else
+        {
+            victim = p_inode;
+        }
+
+        if (victim)
+        {
+            list_remove(&inode_hash_table[INODE_HASH(victim->part, victim->i_no)], &victim->list_node);
+        }
+    }
+    mutex_lock_release(&inode_table_lock);
+
+    if (victim)
+    {
+        slab_free(inode_cache, victim);
+    }
+}
+
+// 关闭指定inode，inode被缓存在内存中，再次打开时无需读硬盘
+void inode_close(inode *p_inode)
+{
+    inode_put(p_inode, true);
+}
+
+// 释放指定分区所有已关闭但仍被缓存的inode，用于卸载分区
+void inode_cache_shrink(partition *part)
+{
+    mutex_lock_acquire(&inode_table_lock);
+    node *pnode = inode_lru_list.head.next;
+    while (pnode != &inode_lru_list.tail)
+    {
+        node *next = pnode->next;
+        inode *p_inode = member2struct(pnode, inode, lru_node);
+        if (p_inode->part == part)
+        {
+            list_remove(&inode_lru_list, pnode);
+            list_remove(&inode_hash_table[INODE_HASH(part, p_inode->i_no)], &p_inode->list_node);
+            slab_free(inode_cache, p_inode);
+        }
+        pnode = next;
     }
-}   
+    mutex_lock_release(&inode_table_lock);
+}
 
 // 初始化指定inode
 void inode_init(partition *part, uint32_t i_no, inode *p_inode)
@@ -83,29 +238,40 @@ void inode_init(partition *part, uint32_t i_no, inode *p_inode)
     memset(p_inode, 0, sizeof(inode));
     p_inode->part = part;
     p_inode->i_no = i_no;
+    if (part->sb->compat_flags & FS_COMPAT_EXTENTS)
+    {
+        p_inode->i_flags = INODE_FL_EXTENTS;
+        extent_init(p_inode, 0, 0);
+    }
 }      
 
-// 将指定inode同步到硬盘中
+// 将指定inode写入缓冲区，由回写线程同步到硬盘中
 void inode_sync(inode *p_inode)
 {
     inode_position i_pos;
     inode_locate(p_inode->part, p_inode->i_no, &i_pos);
-    uint32_t sec_cnt = i_pos.two_sec ? 2 : 1;
-    uint8_t *buf = (uint8_t *)kmalloc(SECTOR_SIZE * sec_cnt);
-    ASSERT(buf);
-    read_disk(p_inode->part->my_disk, buf, i_pos.lba, sec_cnt);
-
-    memcpy(buf + i_pos.offset, p_inode, sizeof(inode));
+    uint32_t disk_size = inode_disk_size(p_inode->part);
+    ASSERT(disk_size == INODE_DISK_SIZE || (!p_inode->i_flags && !p_inode->i_sectors[13] && !p_inode->i_sectors[14]));
 
     // 清除无关项
-    inode *p = (inode *)(buf + i_pos.offset);
-    p->open_cnt = 0;
-    p->part = NULL;
-    p->list_node.next = p->list_node.prev = NULL;
-
-    write_disk(p_inode->part->my_disk, buf, i_pos.lba, sec_cnt);
+    inode tmp;
+    memcpy(&tmp, p_inode, INODE_DISK_SIZE);
+    tmp.open_cnt = 0;
+    tmp.part = NULL;
 
-    sys_free(buf);
+    // 直接修改缓冲区中的inode，inode跨扇区时分两次修改
+    uint32_t first_part = i_pos.two_sec ? (SECTOR_SIZE - i_pos.offset) : disk_size;
+    buffer *pbuf = buffer_read(p_inode->part->my_disk, i_pos.lba);
+    memcpy(pbuf->data + i_pos.offset, &tmp, first_part);
+    buffer_mark_dirty(pbuf);
+    buffer_release(pbuf);
+    if (i_pos.two_sec)
+    {
+        pbuf = buffer_read(p_inode->part->my_disk, i_pos.lba + 1);
+        memcpy(pbuf->data, (uint8_t *)&tmp + first_part, disk_size - first_part);
+        buffer_mark_dirty(pbuf);
+        buffer_release(pbuf);
+    }
 } 
 
 // 将指定inode和inode所指向的文件存储空间释放
@@ -117,35 +283,321 @@ void inode_release(partition *part, uint32_t i_no)
     ASSERT(p_inode);
 
     // 释放inode
-    bitmap_set(&part->inode_bitmap, i_no, 0);
-    bitmap_sync(part, INODE_BITMAP, i_no);
+    bitmap_free(part, INODE_BITMAP, i_no);
+    bitmap_mark_dirty(part, INODE_BITMAP, i_no);
+
+    // 释放数据块和索引块
+    inode_truncate_blocks(p_inode, 0);
 
-    uint32_t *all_blocks = (uint32_t *)kmalloc(560);
-    ASSERT(all_blocks);
-    memset(all_blocks, 0, 560);
-    for (uint32_t i = 0; i < 12; ++i)
+    // 释放inode的硬盘空间之后必须将inode移出缓存，否则内存中残留的inode会影响使用同一编号的新文件
+    ASSERT(p_inode->open_cnt == 1);
+    inode_put(p_inode, false); 
+}
+
+// 计算文件第idx个块在块索引树中的路径，offsets[0]为i_sectors中的下标，offsets[1...]为各级索引块中的下标，返回间接索引的层数
+uint32_t inode_block_path(uint32_t idx, uint32_t *offsets)
+{
+    if (idx < INODE_DIRECT_CNT)
     {
-        all_blocks[i] = p_inode->i_sectors[i];
+        offsets[0] = idx;
+        return 0;
     }
-    if (p_inode->i_sectors[12])
+
+    idx -= INODE_DIRECT_CNT;
+    uint32_t span = BLOCK_PTR_CNT;      // 当前层数的索引树覆盖的块数
+    uint32_t level = 1;
+    while (idx >= span)
     {
-        read_disk(part->my_disk, all_blocks + 12, p_inode->i_sectors[12], 1);
-        bitmap_set(&part->block_bitmap, p_inode->i_sectors[12] - part->sb->blocks_lba, 0);  // 释放索引块
-        bitmap_sync(part, BLOCK_BITMAP, p_inode->i_sectors[12] - part->sb->blocks_lba);
+        idx -= span;
+        span *= BLOCK_PTR_CNT;
+        ++level;
     }
+    ASSERT(level <= 3);
 
-    // 释放数据块
-    uint32_t blk_cnt = DIV_ROUND_UP(p_inode->i_size, SECTOR_SIZE);
-    for (uint32_t i = 0; i < blk_cnt; ++i)
+    offsets[0] = INODE_DIRECT_CNT + level - 1;
+    for (uint32_t i = level; i > 0; --i)
     {
-        ASSERT(all_blocks[i]);
-        bitmap_set(&part->block_bitmap, all_blocks[i] - part->sb->blocks_lba, 0);
-        bitmap_sync(part, BLOCK_BITMAP, all_blocks[i] - part->sb->blocks_lba);
+        offsets[i] = idx % BLOCK_PTR_CNT;
+        idx /= BLOCK_PTR_CNT;
     }
+    return level;
+}
 
-    sys_free(all_blocks);
-    // 释放inode的硬盘空间之后必须要关闭inode，否则会导致内存中残留的inode影响新文件的打开操作，新文件的大小被写入一个错误的值
-    ASSERT(p_inode->open_cnt == 1);
-    inode_close(p_inode); 
+// 获取文件第idx个块的LBA并存入*lba(为0表示该块尚未分配)，返回从该块开始物理连续的块数，最多为max_cnt
+// 块索引树只读取路径上的索引块，区段树只需查找一次即可得到整个区段，调用者须持有inode的读锁或写锁
+uint32_t inode_bmap(inode *p_inode, uint32_t idx, uint32_t max_cnt, uint32_t *lba)
+{
+    ASSERT(max_cnt > 0 && idx < INODE_MAX_BLOCKS);
+    if (p_inode->i_flags & INODE_FL_EXTENTS)
+    {
+        return extent_bmap(p_inode, idx, max_cnt, lba);
+    }
+
+    disk *hd = p_inode->part->my_disk;
+    uint32_t cnt = 0;
+    *lba = 0;
+    while (cnt < max_cnt && idx + cnt < INODE_MAX_BLOCKS)
+    {
+        uint32_t offsets[4];
+        uint32_t depth = inode_block_path(idx + cnt, offsets);
+
+        // 找到存放该块地址的数组：直接块在inode中，间接块在最后一级索引块中
+        uint32_t *ptrs = p_inode->i_sectors;
+        uint32_t pos = offsets[0];
+        uint32_t limit = INODE_DIRECT_CNT;
+        buffer *pbuf = NULL;
+        if (depth)
+        {
+            uint32_t blk_lba = p_inode->i_sectors[offsets[0]];
+            for (uint32_t level = 1; level <= depth && blk_lba; ++level)
+            {
+                if (pbuf)
+                {
+                    buffer_release(pbuf);
+                }
+                pbuf = buffer_read(hd, blk_lba);
+                blk_lba = ((uint32_t *)pbuf->data)[offsets[level]];
+            }
+            if (!blk_lba)
+            {
+                // 块尚未分配
+                if (pbuf)
+                {
+                    buffer_release(pbuf);
+                }
+                return (cnt ? cnt : 1);
+            }
+            ptrs = (uint32_t *)pbuf->data;
+            pos = offsets[depth];
+            limit = BLOCK_PTR_CNT;
+        }
+
+        if (!cnt)
+        {
+            *lba = ptrs[pos];
+            if (!*lba)
+            {
+                if (pbuf)
+                {
+                    buffer_release(pbuf);
+                }
+                return 1;
+            }
+        }
+        while (cnt < max_cnt && pos < limit && ptrs[pos] == *lba + cnt)
+        {
+            ++cnt;
+            ++pos;
+        }
+        if (pbuf)
+        {
+            buffer_release(pbuf);
+        }
+
+        // 遇到不连续的块，或已经得到max_cnt个块
+        if (pos < limit)
+        {
+            break;
+        }
+    }
+    return cnt;
 }
 
+// 分配一个清零的索引块，失败返回0，调用者负责同步块位图
+uint32_t inode_index_alloc(partition *part)
+{
+    int32_t blk_lba = bitmap_alloc(part, BLOCK_BITMAP);
+    if (blk_lba == -1)
+    {
+        return 0;
+    }
+    bitmap_mark_dirty(part, BLOCK_BITMAP, blk_lba - part->sb->blocks_lba);
+
+    buffer *pbuf = buffer_get(part->my_disk, blk_lba);
+    memset(pbuf->data, 0, SECTOR_SIZE);
+    buffer_mark_dirty(pbuf);
+    buffer_release(pbuf);
+    return blk_lba;
+}
+
+// 将文件从第idx个块开始的cnt个块依次映射到从lba开始的物理块，lba为0时解除这些块的映射，
+// 路径上缺少的索引块或区段树结点会被分配，返回成功处理的块数，分配失败时小于cnt
+// 调用者须持有inode的写锁，并负责同步inode和块位图
+uint32_t inode_bmap_map(inode *p_inode, uint32_t idx, uint32_t lba, uint32_t cnt)
+{
+    ASSERT(idx + cnt <= inode_max_blocks(p_inode->part));
+    if (p_inode->i_flags & INODE_FL_EXTENTS)
+    {
+        return extent_map(p_inode, idx, lba, cnt);
+    }
+
+    partition *part = p_inode->part;
+    uint32_t done = 0;
+    while (done < cnt)
+    {
+        uint32_t offsets[4];
+        uint32_t depth = inode_block_path(idx + done, offsets);
+        if (!depth)
+        {
+            p_inode->i_sectors[offsets[0]] = (lba ? lba + done : 0);
+            ++done;
+            continue;
+        }
+
+        // 沿路径找到最后一级索引块，必要时分配索引块
+        uint32_t *slot = &p_inode->i_sectors[offsets[0]];
+        buffer *pbuf = NULL;
+        bool hole = false;
+        for (uint32_t level = 1; level <= depth; ++level)
+        {
+            if (!*slot && !lba)
+            {
+                // 解除映射时不必分配索引块，路径上缺少索引块说明该块本来就是空洞
+                hole = true;
+                break;
+            }
+            if (!*slot)
+            {
+                uint32_t blk_lba = inode_index_alloc(part);
+                if (!blk_lba)
+                {
+                    if (pbuf)
+                    {
+                        buffer_release(pbuf);
+                    }
+                    return done;
+                }
+                *slot = blk_lba;
+                if (pbuf)
+                {
+                    buffer_mark_dirty(pbuf);
+                }
+            }
+            buffer *next = buffer_read(part->my_disk, *slot);
+            if (pbuf)
+            {
+                buffer_release(pbuf);
+            }
+            pbuf = next;
+            slot = (uint32_t *)pbuf->data + offsets[level];
+        }
+        if (hole)
+        {
+            if (pbuf)
+            {
+                buffer_release(pbuf);
+            }
+            ++done;
+            continue;
+        }
+
+        // 在最后一级索引块中连续填写
+        for (uint32_t i = offsets[depth]; i < BLOCK_PTR_CNT && done < cnt; ++i)
+        {
+            ((uint32_t *)pbuf->data)[i] = (lba ? lba + done : 0);
+            ++done;
+        }
+        buffer_mark_dirty(pbuf);
+        buffer_release(pbuf);
+    }
+    return done;
+}
+
+// 在块位图中释放一个块
+void inode_block_free(partition *part, uint32_t blk_lba)
+{
+    bitmap_free(part, BLOCK_BITMAP, blk_lba - part->sb->blocks_lba);
+    bitmap_mark_dirty(part, BLOCK_BITMAP, blk_lba - part->sb->blocks_lba);
+}
+
+// 释放以blk_lba为根、共level层的索引子树中相对下标不小于start的块，子树被完全释放(包括根索引块)时返回true
+bool inode_free_tree(partition *part, uint32_t blk_lba, uint32_t level, uint32_t start)
+{
+    uint32_t span = 1;      // 每个索引项覆盖的块数
+    for (uint32_t i = 1; i < level; ++i)
+    {
+        span *= BLOCK_PTR_CNT;
+    }
+
+    uint32_t *ptrs = (uint32_t *)slab_alloc(sector_cache);
+    ASSERT(ptrs);
+    buffer_read_sectors(part->my_disk, ptrs, blk_lba, 1);
+
+    bool modified = false;
+    for (uint32_t i = start / span; i < BLOCK_PTR_CNT; ++i)
+    {
+        if (!ptrs[i])
+        {
+            continue;
+        }
+        bool freed = true;
+        if (level == 1)
+        {
+            inode_block_free(part, ptrs[i]);
+        }
+        else
+        {
+            freed = inode_free_tree(part, ptrs[i], level - 1, (i == start / span) ? start % span : 0);
+        }
+        if (freed)
+        {
+            ptrs[i] = 0;
+            modified = true;
+        }
+    }
+
+    bool empty = true;
+    for (uint32_t i = 0; i < BLOCK_PTR_CNT && empty; ++i)
+    {
+        empty = !ptrs[i];
+    }
+    if (empty)
+    {
+        inode_block_free(part, blk_lba);
+    }
+    else if (modified)
+    {
+        buffer_write_sectors(part->my_disk, ptrs, blk_lba, 1);
+    }
+    slab_free(sector_cache, ptrs);
+    return empty;
+}
+
+// 释放文件下标不小于blk_cnt的所有数据块以及因此变空的索引块或区段树结点，调用者须持有inode的写锁并负责同步inode
+void inode_truncate_blocks(inode *p_inode, uint32_t blk_cnt)
+{
+    partition *part = p_inode->part;
+    if (p_inode->i_flags & INODE_FL_EXTENTS)
+    {
+        extent_truncate(p_inode, blk_cnt);
+        bitmap_flush(part);
+        return;
+    }
+
+    for (uint32_t i = blk_cnt; i < INODE_DIRECT_CNT; ++i)
+    {
+        if (p_inode->i_sectors[i])
+        {
+            inode_block_free(part, p_inode->i_sectors[i]);
+            p_inode->i_sectors[i] = 0;
+        }
+    }
+
+    // 依次处理一级、二级和三级间接索引树
+    uint32_t base = INODE_DIRECT_CNT;   // 该索引树中第一个块在文件中的下标
+    uint32_t span = BLOCK_PTR_CNT;      // 该索引树覆盖的块数
+    for (uint32_t level = 1; level <= 3; ++level)
+    {
+        uint32_t *slot = &p_inode->i_sectors[INODE_DIRECT_CNT + level - 1];
+        if (*slot && blk_cnt < base + span)
+        {
+            if (inode_free_tree(part, *slot, level, (blk_cnt > base) ? blk_cnt - base : 0))
+            {
+                *slot = 0;
+            }
+        }
+        base += span;
+        span *= BLOCK_PTR_CNT;
+    }
+    bitmap_flush(part);
+}
@@ -4,10 +4,20 @@
 #include "stdint.h"
 #include "stdbool.h"
 #include "list.h"
+#include "sync.h"
 
 #define MAX_FILE_CNT 4096   // 最大支持的文件数量
+#define INODE_HASH_SIZE 64  // inode哈希表的桶数，必须是2的幂
+#define INODE_CACHE_SIZE 64 // 关闭后仍保留在内存中的inode的最大数量
+#define INODE_DIRECT_CNT 12 // 直接块数量
+#define BLOCK_PTR_CNT 128   // 每个索引块中的块地址数量
+#define INODE_MAX_BLOCKS (INODE_DIRECT_CNT + BLOCK_PTR_CNT + BLOCK_PTR_CNT * BLOCK_PTR_CNT + BLOCK_PTR_CNT * BLOCK_PTR_CNT * BLOCK_PTR_CNT)   // 文件最多的块数
+#define INODE_FL_EXTENTS 0x1    // 文件的块由区段树而不是块索引树映射
+#define INODE_V1_DISK_SIZE 76   // 基线格式的inode在硬盘上所占的字节数，块地址同样从偏移24开始，但只有13个
+#define INODE_V1_MAX_BLOCKS (INODE_DIRECT_CNT + BLOCK_PTR_CNT)  // 基线格式的文件最多的块数
 
 typedef struct partition partition;
+typedef struct slab_cache slab_cache;
 
 // 文件索引节点，用于唯一标识一个文件
 typedef struct inode
@@ -17,11 +27,20 @@ typedef struct inode
     uint32_t i_size;        // 对目录而言，该项是目录表中所有有效目录项的总大小，对文件而言，该项标识文件大小
     uint32_t open_cnt;      // 文件打开次数
 
-    node list_node;         // 用于将inode挂到打开文件链表中的节点
+    uint32_t i_flags;       // inode标志，基线格式中此处是内存链表结点的prev指针，读入基线格式的inode时清零
+    uint32_t i_reserved;    // 保留，始终为0，基线格式中此处是链表结点的next指针
+    uint32_t i_sectors[15]; // 采用混合索引方式， 0-11 是直接索引， 12、13、14分别是一级、二级、三级间接索引，设置了INODE_FL_EXTENTS时存放区段树的根结点
 
-    uint32_t i_sectors[13]; // 采用混合索引方式， 0-11 是直接索引， 12是一级间接索引
+    // 以下字段只存在于内存中，不会被写入硬盘
+    uint32_t i_rsv_start;   // 为追加写入预留的块的起始LBA
+    uint32_t i_rsv_cnt;     // 预留的块数
+    rw_lock rwlock;         // 保护目录表和文件数据，查找目录项和读文件时持有读锁，修改时持有写锁
+    node list_node;         // 用于将inode挂到inode哈希表的桶中
+    node lru_node;          // 打开计数为0时用于将inode挂到LRU链表中
 } inode;
 
+#define INODE_DISK_SIZE member_offset(inode, i_rsv_start)     // inode在硬盘上所占的字节数
+
 // 该结构用于根据inode编号获取到inode在硬盘中的位置
 typedef struct inode_position
 {
@@ -30,11 +49,21 @@ typedef struct inode_position
     uint32_t offset;        // inode的扇区内偏移
 } inode_position;
 
+extern slab_cache *inode_cache;     // 内存中inode结构的缓存
+
+extern void inode_table_init(void);                 // 初始化inode哈希表和LRU链表
+extern uint32_t inode_disk_size(partition *part);   // 分区中每个inode在硬盘上所占的字节数
+extern uint32_t inode_max_blocks(partition *part);  // 分区中文件最多的块数
 extern void inode_locate(partition *part, uint32_t i_no, inode_position *i_pos);        // 根据inode编号定位到inode的物理位置
 extern inode *inode_open(partition *part, uint32_t i_no);               // 打开分区part中编号为i_no的inode
+extern void inode_get(inode *p_inode);              // 增加已打开inode的打开计数
 extern void inode_close(inode *p_inode);            // 关闭指定inode
 extern void inode_init(partition *part, uint32_t i_no, inode *p_inode);      // 初始化指定inode
 extern void inode_sync(inode *p_inode);            // 将指定inode同步到硬盘中
 extern void inode_release(partition *part, uint32_t i_no);   // 将指定inode和inode所指向的文件存储空间释放
+extern void inode_cache_shrink(partition *part);    // 释放指定分区所有已关闭但仍被缓存的inode
+extern uint32_t inode_bmap(inode *p_inode, uint32_t idx, uint32_t max_cnt, uint32_t *lba);     // 获取文件第idx个块的LBA，返回从该块开始物理连续的块数
+extern uint32_t inode_bmap_map(inode *p_inode, uint32_t idx, uint32_t lba, uint32_t cnt);      // 将文件从第idx个块开始的cnt个块映射到从lba开始的物理块，返回成功映射的块数
+extern void inode_truncate_blocks(inode *p_inode, uint32_t blk_cnt);    // 释放文件下标不小于blk_cnt的所有数据块以及因此变空的索引块
 
 #endif
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include "file.h"
 #include "ioqueue.h"
 #include "_syscall.h"
+#include "slab.h"
+
+slab_cache *pipe_cache;     // 管道环形缓冲队列结构的缓存
 
 // 判断指定描述符是否属于管道描述符
 bool is_pipe(const uint32_t fd)
@@ -39,7 +42,7 @@ int32_t pipe_close(const uint32_t fd)
     if (!(--file_table[g_idx].f_pos))
     {
         mfree_pages(1, ((ioqueue *)file_table[g_idx].p_inode)->buffer);
-        sys_free(file_table[g_idx].p_inode);
+        slab_free(pipe_cache, file_table[g_idx].p_inode);
         file_table[g_idx].p_inode = NULL;
     }
 
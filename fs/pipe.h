@@ -6,6 +6,10 @@
 
 #define PIPE_FLAG 0xff
 
+typedef struct slab_cache slab_cache;
+
+extern slab_cache *pipe_cache;      // 管道环形缓冲队列结构的缓存
+
 extern bool is_pipe(const uint32_t fd);           // 判断指定描述符是否属于管道描述符
 extern uint32_t pipe_read(const uint32_t fd, uint8_t *buf, const uint32_t cnt);    // 从管道中读取cnt个字节到buf中
 extern uint32_t pipe_write(const uint32_t fd, uint8_t *buf, const uint32_t cnt);   // 将buf中的cnt个字节写入到管道中
@@ -3,6 +3,12 @@
 
 #include "stdint.h"
 
+#define FS_COMPAT_DIR_INDEX 0x1     // 目录增长超过一个块时为其建立哈希索引
+#define FS_COMPAT_EXTENTS 0x2       // 新建的文件使用区段树映射数据块
+
+#define FS_VERSION_V1 1     // 基线格式：超级块中没有compat_flags和version字段，inode在硬盘上长76字节，只有一级间接块
+#define FS_VERSION 2        // 当前格式，inode等硬盘上的结构改变时递增
+
 // 存储文件系统元信息的超级块
 typedef struct superblock
 {
@@ -27,6 +33,8 @@ typedef struct superblock
 
     uint32_t root_i_no;             // 根目录的inode编号
     uint32_t dentry_size;           // 目录项大小
+    uint32_t compat_flags;          // 文件系统特性标志，基线格式的分区挂载时置为0
+    uint32_t version;               // 文件系统格式版本，基线格式的分区中该字段未初始化，挂载时按inode表大小识别并置为FS_VERSION_V1
 } superblock;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+; 应用处理器(AP)的启动代码
+; BSP在发送SIPI之前将ap_boot_start至ap_boot_end之间的代码复制到物理地址AP_BOOT_ADDR处，
+; AP从实模式的AP_BOOT_ADDR:0开始执行，依次进入保护模式、开启分页，最后跳转到ap_main
+; 由于代码被复制后才执行，访问本段中的数据必须使用相对于ap_boot_start的偏移
+
+AP_BOOT_ADDR equ 0x70000            ; 必须与smp.h中的AP_BOOT_ADDR保持一致，且4KB对齐、位于低端1MB内
+KERNEL_SPACE_ADDR equ 0xc0000000
+PAGE_DIR_TAB_ADDR equ 0x100000
+GCODE_SEL equ 0x0008
+GDATA_SEL equ 0x0010
+VIDEO_SEL equ 0x0018
+
+extern ap_main
+global ap_boot_start
+global ap_boot_end
+global ap_gdtr_phys
+global ap_gdtr_virt
+global ap_stack_top
+
+SECTION .text
+
+[bits 16]
+ap_boot_start:
+    cli
+    cld
+    mov ax, cs                      ; SIPI使CS = AP_BOOT_ADDR >> 4, IP = 0
+    mov ds, ax
+
+    ; 使用BSP的GDT(基址为物理地址)进入保护模式
+    lgdt [ap_gdtr_phys - ap_boot_start]
+    mov eax, cr0
+    or eax, 0x00000001
+    mov cr0, eax
+    jmp dword GCODE_SEL:(AP_BOOT_ADDR + ap_protect_mode - ap_boot_start)
+
+[bits 32]
+ap_protect_mode:
+    mov ax, GDATA_SEL
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov ss, ax
+    mov ax, VIDEO_SEL
+    mov gs, ax
+
+    ; 使用内核页目录表开启分页，低端1MB同时映射在0和0xc0000000处
+    mov eax, PAGE_DIR_TAB_ADDR
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80000000
+    mov cr0, eax
+
+    ; 转到高端地址继续执行，并重新加载基址为虚拟地址的GDT
+    mov eax, KERNEL_SPACE_ADDR + AP_BOOT_ADDR + ap_high_half - ap_boot_start
+    jmp eax
+ap_high_half:
+    lgdt [KERNEL_SPACE_ADDR + AP_BOOT_ADDR + ap_gdtr_virt - ap_boot_start]
+    mov esp, [KERNEL_SPACE_ADDR + AP_BOOT_ADDR + ap_stack_top - ap_boot_start]
+
+    ; 代码被复制过，必须通过绝对地址调用
+    mov eax, ap_main
+    call eax
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; 以下数据由BSP在复制代码后填写
+align 4
+ap_gdtr_phys:
+    dw 0
+    dd 0
+ap_gdtr_virt:
+    dw 0
+    dd 0
+ap_stack_top:
+    dd 0
+ap_boot_end:
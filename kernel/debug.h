@@ -5,7 +5,7 @@
 extern void panic_spin(const char *filename, const int line, const char *func, const char *condition);
 
 #ifdef NDEBUG
-    #define ASSERT(CONDITION) ((void)0) 
+    #define ASSERT(CONDITION) ((void)sizeof(CONDITION))     // 不求值，仅使条件中的变量被视为已使用
 #else
     #define ASSERT(CONDITION) if (!(CONDITION)) panic_spin(__FILE__, __LINE__, __func__, #CONDITION)
 #endif
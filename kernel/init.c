@@ -7,10 +7,13 @@
 #include "init.h"
 #include "ide.h"
 #include "fs.h"
+#include "buffer.h"
 #include "_syscall.h"
 #include "syscall.h"
 #include "stdio.h"
 #include "debug.h"
+#include "smp.h"
+#include "tss.h"
 
 #define NEED_WRITE false
 #define START_SEC 600
@@ -23,14 +26,19 @@ void other_init(void);
 
 void init_all(void)
 {
+    MAIN_THREAD->cpu = 0;   // 中断入口需要通过current得到所在的处理器，须在开中断之前设置
     intr_init();        // 中断初始化
     timer_init();       // 8253定时计数器初始化
     console_init();     // 控制台初始化
     keyboard_init();    // 键盘初始化
     mem_init();         // 内存初始化
+    tss_init();         // 将GDT复制到内核中并添加应用处理器的TSS
+    smp_init();         // 多处理器探测与本地APIC定时器校准
     ide_init();         // 硬盘初始化
+    buffer_init();      // 缓冲区高速缓存初始化
     fs_init();          // 文件系统初始化
     thread_init();      // 线程初始化
+    smp_start_aps();    // 启动应用处理器，各自作为idle线程参与调度
     other_init();       // 其他初始化
     
     init_finish = true;
@@ -39,6 +47,8 @@ void init_all(void)
 // 一些初始化操作必须在某些特定初始化操作完成后才能进行，为了避免循环依赖，这类初始化操作统一由other_init进行
 void other_init(void)
 {
+    buffer_flusher_start();     // 回写线程依赖线程初始化
+
     sys_mkdir("/home");
     sys_mkdir("/bin");
     sys_mkdir("/sbin");
@@ -70,13 +70,19 @@ void intr_init()
     pic_init();
     put_str("Init PIC successfully!\n");
 
-    //设置LDTR
+    //设置IDTR
+    idt_load();
+    put_str("Init interrupt successfully!\n");
+}
+
+//加载IDTR，所有处理器共用同一个IDT，应用处理器启动后也需调用
+void idt_load(void)
+{
     //注意，在C标准中 *未要求* 结构体各个成员之间必须连续分布，在进行4字节对齐后，一个2字节成员后面会有两个字节的空隙，然后才是下一个成员
     //因此此处采取结构体idt48执行lidt指令会出现错误
     //idt48 _idt48 = {sizeof(idt) - 1, (uint32_t)idt};
     uint64_t idt48 = (sizeof(idt) - 1) | ((uint64_t)(uint32_t)idt << 16);
     asm ("lidt %0"::"m"(idt48));
-    put_str("Init interrupt successfully!\n");
 }
 
 //安装idt内所有门描述符
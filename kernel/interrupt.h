@@ -6,6 +6,7 @@ extern intr_entry intr_entry_table[];   //中断入口表
 extern intr_entry intr_handler_table[]; //中断处理函数表
 
 extern void intr_init(void);                   //中断初始化的主函数
+extern void idt_load(void);                    //加载IDTR
 
 // 中断状态：中断开--中断关
 typedef enum intr_status 
@@ -17,6 +17,20 @@ static inline uint8_t inb(const uint16_t port)
     return data;
 }
 
+// 向port端口写入32位数据data
+static inline void outl(const uint32_t data, const uint16_t port)
+{
+    asm volatile ("outl %0, %w1"::"a"(data), "d"(port));
+}
+
+// 从port端口读取32位数据并返回
+static inline uint32_t inl(const uint16_t port)
+{
+    uint32_t data;
+    asm volatile ("inl %w1, %0":"=a"(data): "d"(port));
+    return data;
+}
+
 // 将内存src处的word_cnt个16位数据连续写入port端口
 static inline void outsw(void *src, const uint16_t port, const uint32_t word_cnt)
 {
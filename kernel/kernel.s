@@ -7,9 +7,11 @@ GDATA_SEL equ 0x0010
 extern syscall_table
 extern intr_handler_table
 extern put_str
+extern schedule_tail
 
 global intr_entry_table
 global intr_exit
+global fork_return
 global syscall_handler
 
 SECTION .data
@@ -26,10 +28,12 @@ intr_%1_entry:
     push fs
     push gs
 
-    ;发送EOI
+    ;发送EOI，0x30及以上的向量来自本地APIC，由中断处理函数向本地APIC发送EOI
+%if %1 < 0x30
     mov al, 0x20
     out 0x20, al
     out 0xa0, al
+%endif
 
     ; 中断进入内核后最重要的是把所有的段寄存器转移到内核全局段中
     ; 例如：put_char中会修改ds和es，如果此时发生中断，ds和es中的值对于中断处理程序来说是错误的！
@@ -63,6 +67,11 @@ intr_exit:
     add esp, 4  ;跳过错误码
     iret
 
+; fork出的子进程第一次被调度时由switch_to返回到这里，先完成线程切换的收尾工作，再经中断出口返回用户态
+fork_return:
+    call schedule_tail
+    jmp intr_exit
+
 ;中断处理程序
 ; 内部异常
 INTR_VECTOR 0x00, NO_ERROR_CODE
@@ -118,6 +127,24 @@ INTR_VECTOR 0x2d, NO_ERROR_CODE
 INTR_VECTOR 0x2e, NO_ERROR_CODE
 INTR_VECTOR 0x2f, NO_ERROR_CODE
 
+; 本地APIC中断与处理器间中断
+INTR_VECTOR 0x30, NO_ERROR_CODE
+INTR_VECTOR 0x31, NO_ERROR_CODE
+INTR_VECTOR 0x32, NO_ERROR_CODE
+INTR_VECTOR 0x33, NO_ERROR_CODE
+INTR_VECTOR 0x34, NO_ERROR_CODE
+INTR_VECTOR 0x35, NO_ERROR_CODE
+INTR_VECTOR 0x36, NO_ERROR_CODE
+INTR_VECTOR 0x37, NO_ERROR_CODE
+INTR_VECTOR 0x38, NO_ERROR_CODE
+INTR_VECTOR 0x39, NO_ERROR_CODE
+INTR_VECTOR 0x3a, NO_ERROR_CODE
+INTR_VECTOR 0x3b, NO_ERROR_CODE
+INTR_VECTOR 0x3c, NO_ERROR_CODE
+INTR_VECTOR 0x3d, NO_ERROR_CODE
+INTR_VECTOR 0x3e, NO_ERROR_CODE
+INTR_VECTOR 0x3f, NO_ERROR_CODE
+
 
 SECTION .text
 ; 系统调用中断处理函数
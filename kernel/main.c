@@ -10,18 +10,17 @@ int main(void)
 
     while (1)
     {
-        node *pnode = list_traversal(&thread_all_list, find_died_thread, 0);
-        if (pnode)
-        {
-            task_struct *pthread = member2struct(pnode, task_struct, all_list_node);
-            list_remove(&thread_all_list, &pthread->all_list_node);
-            release_pid(pthread->pid);
-            mfree_pages(1, pthread);
-        }
-        else
-        {
-            thread_block(TASK_WAITING);
-        }
+        // 只有线程结束时才会被唤醒并重新查找
+        node *pnode;
+        wait_event(&thread_died_wq, (pnode = thread_all_traversal(find_died_thread, 0)) != NULL);
+
+        task_struct *pthread = member2struct(pnode, task_struct, all_list_node);
+        intr_status old_status = spin_lock_irqsave(&thread_all_lock);
+        list_remove(&thread_all_list, &pthread->all_list_node);
+        spin_unlock_irqrestore(&thread_all_lock, old_status);
+        thread_wait_off_cpu(pthread);
+        release_pid(pthread->pid);
+        mfree_pages(1, pthread);
     }
 
     return 0;
@@ -5,8 +5,9 @@
 #include "print.h"
 #include "thread.h"
 #include "interrupt.h"
+#include "smp.h"
 
-#define MEM_BITMAP 0xc009a000          // 所有内存池对应的bitmap均存放在0xc009a000 - 0xc009e000区间
+#define MEM_BITMAP 0xc009a000          // 内核虚拟池对应的bitmap存放在0xc009a000 - 0xc009e000区间
 
 virt_mem_pool kernel_vm_pool;   // 内核专用的虚拟内存池
 phy_mem_pool kernel_pm_pool;    // 内核物理内存池
@@ -19,8 +20,14 @@ void *alloc_a_ppage(pool_flag pf);                       // 在指定类型的
 void set_mmap(void *phy_addr, void *virt_addr);           // 在页表项中设置新的虚拟页和物理页之间的映射
 void free_vpages(const uint32_t pg_cnt, void *ptr);         // 在虚拟池中释放ptr起的连续pg_cnt个页
 void reset_mmap(void *ptr);                                 // 在页表中清除虚拟地址ptr与物理地址之间的映射
+void buddy_init(phy_mem_pool *p_pm_pool);                   // 初始化物理池的伙伴系统
+int32_t buddy_alloc(phy_mem_pool *p_pm_pool, uint32_t order);     // 在物理池中分配一个2^order个页的块，返回首页的页号，失败返回-1
+void buddy_free(phy_mem_pool *p_pm_pool, uint32_t pg_idx, uint32_t order);     // 释放物理池中首页页号为pg_idx的2^order个页的块，并与空闲的伙伴合并
+void buddy_free_range(phy_mem_pool *p_pm_pool, uint32_t start, uint32_t end);  // 将物理池中页号为[start, end)的页拆分为尽量大的块释放
+void fix_list_head(list *plist);                            // 修正被复制的链表头尾结点与首尾元素之间的链接
 
 uint8_t *pg_ref_tab;        // 页引用表, 用于记录所有物理页的引用数
+spinlock pg_ref_lock;       // 保护页引用表
 
 void mem_init(void)
 {
@@ -41,49 +48,50 @@ void mem_init(void)
     // 初始化内核物理池
     kernel_pm_pool.phy_addr_start = (void *)used_mem;
     kernel_pm_pool.pool_size = kernel_free_pages * PAGE_SIZE;
-    kernel_pm_pool.pmp_bitmap.bytes_length = kernel_free_pages / 8;
-    kernel_pm_pool.pmp_bitmap.btmp_ptr = (uint8_t *)MEM_BITMAP;
-    bitmap_init(&kernel_pm_pool.pmp_bitmap);
+    kernel_pm_pool.frame_cnt = kernel_free_pages;
 
     // 初始化用户物理池
     user_pm_pool.phy_addr_start = kernel_pm_pool.phy_addr_start + kernel_pm_pool.pool_size;
     user_pm_pool.pool_size = user_free_pages * PAGE_SIZE;
-    user_pm_pool.pmp_bitmap.bytes_length = user_free_pages / 8;
-    user_pm_pool.pmp_bitmap.btmp_ptr = kernel_pm_pool.pmp_bitmap.btmp_ptr + kernel_pm_pool.pmp_bitmap.bytes_length;
-    bitmap_init(&user_pm_pool.pmp_bitmap);
+    user_pm_pool.frame_cnt = user_free_pages;
 
     // 初始化内核虚拟池
     kernel_vm_pool.virt_addr_start = (void *)KERNEL_VMP_START;     //不能写成0x100000, 否则会发现内核缺少了3个物理页(被用作页表)
-    kernel_vm_pool.vmp_bitmap.bytes_length = kernel_pm_pool.pmp_bitmap.bytes_length;
-    kernel_vm_pool.vmp_bitmap.btmp_ptr = user_pm_pool.pmp_bitmap.btmp_ptr + user_pm_pool.pmp_bitmap.bytes_length;
+    kernel_vm_pool.vmp_bitmap.bytes_length = kernel_free_pages / 8;
+    kernel_vm_pool.vmp_bitmap.btmp_ptr = (uint8_t *)MEM_BITMAP;
     bitmap_init(&kernel_vm_pool.vmp_bitmap);
 
     // 初始化内存池的互斥锁
-    mutex_lock_init(&kernel_pm_pool.mutex);
+    spin_lock_init(&kernel_pm_pool.lock);
     mutex_lock_init(&kernel_vm_pool.mutex);
-    mutex_lock_init(&user_pm_pool.mutex);
+    spin_lock_init(&user_pm_pool.lock);
+
+    // 初始化物理池的伙伴系统，页框描述符数组需要映射到内核虚拟池中，因此必须在内核虚拟池之后初始化
+    buddy_init(&kernel_pm_pool);
+    buddy_init(&user_pm_pool);
 
     // 初始化内核的内存块描述符组
     mblock_desc_init(k_mblock_descs);
 
     // 初始化页引用表
-    uint32_t prt_len = user_pm_pool.pmp_bitmap.bytes_length << 3;
+    uint32_t prt_len = user_pm_pool.frame_cnt;
     pg_ref_tab = get_kernel_pages(DIV_ROUND_UP(prt_len, PAGE_SIZE));
     memset(pg_ref_tab, 0, prt_len);
+    spin_lock_init(&pg_ref_lock);
 
     // 输出内核物理池信息
     put_str("kernel physical pool:\n");
     put_str("start physical address: 0x"); put_int((uint32_t)kernel_pm_pool.phy_addr_start); put_char('\n');
     put_str("pool size: 0x"); put_int(kernel_pm_pool.pool_size); put_str(" bytes\n");
-    put_str("bitmap length: 0x"); put_int(kernel_pm_pool.pmp_bitmap.bytes_length); put_str(" bytes\n");
-    put_str("bitmap start address: 0x"); put_int((uint32_t)kernel_pm_pool.pmp_bitmap.btmp_ptr); put_char('\n');
+    put_str("page frame count: 0x"); put_int(kernel_pm_pool.frame_cnt); put_char('\n');
+    put_str("page frame table address: 0x"); put_int((uint32_t)kernel_pm_pool.frames); put_char('\n');
 
     // 输出用户物理池信息
     put_str("user physical pool:\n");
     put_str("start physical address: 0x"); put_int((uint32_t)user_pm_pool.phy_addr_start); put_char('\n');
     put_str("pool size: 0x"); put_int(user_pm_pool.pool_size); put_str(" bytes\n");
-    put_str("bitmap length: 0x"); put_int(user_pm_pool.pmp_bitmap.bytes_length); put_str(" bytes\n");
-    put_str("bitmap start address: 0x"); put_int((uint32_t)user_pm_pool.pmp_bitmap.btmp_ptr); put_char('\n');
+    put_str("page frame count: 0x"); put_int(user_pm_pool.frame_cnt); put_char('\n');
+    put_str("page frame table address: 0x"); put_int((uint32_t)user_pm_pool.frames); put_char('\n');
 
     // 输出内核虚拟池信息
     put_str("kernel virtual pool:\n");
@@ -113,14 +121,137 @@ void *alloc_a_ppage(pool_flag pf)
 {
     phy_mem_pool *p_pm_pool = (pf == PF_KERNEL ? &kernel_pm_pool : &user_pm_pool);
 
-    mutex_lock_acquire(&p_pm_pool->mutex);
-    int32_t bit_idx = bitmap_scan(&p_pm_pool->pmp_bitmap, 1);
-    mutex_lock_release(&p_pm_pool->mutex);
+    intr_status old_status = spin_lock_irqsave(&p_pm_pool->lock);
+    int32_t pg_idx = buddy_alloc(p_pm_pool, 0);
+    spin_unlock_irqrestore(&p_pm_pool->lock, old_status);
 
-    if (bit_idx == -1) return NULL;
-    return p_pm_pool->phy_addr_start + bit_idx * PAGE_SIZE;
+    if (pg_idx == -1) return NULL;
+    return p_pm_pool->phy_addr_start + pg_idx * PAGE_SIZE;
 }   
 
+// 初始化物理池的伙伴系统
+// 页框描述符数组存放在物理池开头的若干页中，并被映射到内核虚拟池，这些页不参与分配
+void buddy_init(phy_mem_pool *p_pm_pool)
+{
+    for (uint32_t i = 0; i <= BUDDY_MAX_ORDER; ++i)
+    {
+        list_init(&p_pm_pool->free_area[i]);
+    }
+
+    uint32_t frames_pg_cnt = DIV_ROUND_UP(p_pm_pool->frame_cnt * sizeof(page_frame), PAGE_SIZE);
+    ASSERT(frames_pg_cnt < p_pm_pool->frame_cnt);
+    p_pm_pool->frames = (page_frame *)alloc_vpages(PF_KERNEL, frames_pg_cnt);
+    ASSERT(p_pm_pool->frames != NULL);
+    for (uint32_t i = 0; i < frames_pg_cnt; ++i)
+    {
+        set_mmap(p_pm_pool->phy_addr_start + i * PAGE_SIZE, (void *)p_pm_pool->frames + i * PAGE_SIZE);
+    }
+
+    for (uint32_t i = 0; i < p_pm_pool->frame_cnt; ++i)
+    {
+        p_pm_pool->frames[i].order = 0;
+        p_pm_pool->frames[i].free = false;
+        node_init(&p_pm_pool->frames[i].list_node);
+    }
+    buddy_free_range(p_pm_pool, frames_pg_cnt, p_pm_pool->frame_cnt);
+}
+
+// 在物理池中分配一个2^order个页的块，返回首页的页号，失败返回-1
+int32_t buddy_alloc(phy_mem_pool *p_pm_pool, uint32_t order)
+{
+    ASSERT(order <= BUDDY_MAX_ORDER);
+
+    // 找到不小于order的最小的非空空闲链表
+    uint32_t cur_order = order;
+    while (cur_order <= BUDDY_MAX_ORDER && p_pm_pool->free_area[cur_order].length == 0) ++cur_order;
+    if (cur_order > BUDDY_MAX_ORDER) return -1;
+
+    page_frame *pframe = member2struct(list_pop_front(&p_pm_pool->free_area[cur_order]), page_frame, list_node);
+    uint32_t pg_idx = pframe - p_pm_pool->frames;
+
+    // 将大块逐级对半拆分，后一半作为空闲块放回低一阶的空闲链表
+    while (cur_order > order)
+    {
+        --cur_order;
+        page_frame *pbuddy = &p_pm_pool->frames[pg_idx + (1 << cur_order)];
+        pbuddy->order = cur_order;
+        pbuddy->free = true;
+        list_push_front(&p_pm_pool->free_area[cur_order], &pbuddy->list_node);
+    }
+
+    pframe->order = order;
+    pframe->free = false;
+    return pg_idx;
+}
+
+// 释放物理池中首页页号为pg_idx的2^order个页的块，并与空闲的伙伴合并
+void buddy_free(phy_mem_pool *p_pm_pool, uint32_t pg_idx, uint32_t order)
+{
+    ASSERT(!p_pm_pool->frames[pg_idx].free && !(pg_idx & ((1 << order) - 1)));
+    while (order < BUDDY_MAX_ORDER)
+    {
+        uint32_t buddy_idx = pg_idx ^ (1 << order);
+        if (buddy_idx >= p_pm_pool->frame_cnt) break;
+        page_frame *pbuddy = &p_pm_pool->frames[buddy_idx];
+        if (!pbuddy->free || pbuddy->order != order) break;
+
+        // 伙伴空闲，将其从空闲链表中取出并合并为高一阶的块
+        list_remove(&p_pm_pool->free_area[order], &pbuddy->list_node);
+        pbuddy->free = false;
+        pg_idx &= ~(1 << order);
+        ++order;
+    }
+
+    page_frame *pframe = &p_pm_pool->frames[pg_idx];
+    pframe->order = order;
+    pframe->free = true;
+    list_push_front(&p_pm_pool->free_area[order], &pframe->list_node);
+}
+
+// 将物理池中页号为[start, end)的页拆分为尽量大的块释放
+void buddy_free_range(phy_mem_pool *p_pm_pool, uint32_t start, uint32_t end)
+{
+    while (start < end)
+    {
+        // 块的首页页号必须按块的大小对齐
+        uint32_t order = 0;
+        while (order < BUDDY_MAX_ORDER && !(start & (1 << order)) && start + (2 << order) <= end) ++order;
+
+        for (uint32_t i = 0; i < (1u << order); ++i)
+        {
+            p_pm_pool->frames[start + i].free = false;
+        }
+        buddy_free(p_pm_pool, start, order);
+        start += (1 << order);
+    }
+}
+
+// 在指定物理池中分配2^order个物理连续的页，并返回首页的物理地址
+void *alloc_ppages(pool_flag pf, const uint32_t order)
+{
+    phy_mem_pool *p_pm_pool = (pf == PF_KERNEL ? &kernel_pm_pool : &user_pm_pool);
+    if (order > BUDDY_MAX_ORDER) return NULL;
+
+    intr_status old_status = spin_lock_irqsave(&p_pm_pool->lock);
+    int32_t pg_idx = buddy_alloc(p_pm_pool, order);
+    spin_unlock_irqrestore(&p_pm_pool->lock, old_status);
+
+    if (pg_idx == -1) return NULL;
+    return p_pm_pool->phy_addr_start + pg_idx * PAGE_SIZE;
+}
+
+// 释放由alloc_ppages分配的物理连续的页
+void free_ppages(void *paddr)
+{
+    ASSERT(paddr >= kernel_pm_pool.phy_addr_start);
+    phy_mem_pool *p_pm_pool = (paddr >= user_pm_pool.phy_addr_start ? &user_pm_pool : &kernel_pm_pool);
+
+    intr_status old_status = spin_lock_irqsave(&p_pm_pool->lock);
+    uint32_t pg_idx = ((uint32_t)paddr - (uint32_t)p_pm_pool->phy_addr_start) / PAGE_SIZE;
+    buddy_free(p_pm_pool, pg_idx, p_pm_pool->frames[pg_idx].order);
+    spin_unlock_irqrestore(&p_pm_pool->lock, old_status);
+}
+
 // 在页表项中设置新的虚拟页和物理页之间的映射
 void set_mmap(void *phy_addr, void *virt_addr)
 {
@@ -145,11 +276,64 @@ void set_mmap(void *phy_addr, void *virt_addr)
                                                 | PG_RW_W | PG_P_1;  
 }   
 
+// 分配pg_cnt个物理连续的页，并返回首个虚拟页的虚拟地址，失败返回NULL
+// 返回的每个页都可以单独通过mfree_pages或free_a_ppage释放
+void *malloc_contig_pages(pool_flag pf, const uint32_t pg_cnt)
+{
+    ASSERT(pg_cnt > 0);
+    phy_mem_pool *p_pm_pool = (pf == PF_KERNEL ? &kernel_pm_pool : &user_pm_pool);
+
+    // 计算能容纳pg_cnt个页的最小的阶
+    uint32_t order = 0;
+    while ((1u << order) < pg_cnt) ++order;
+    if (order > BUDDY_MAX_ORDER) return NULL;
+
+    void *vpages_start_addr = alloc_vpages(pf, pg_cnt);
+    if (vpages_start_addr == NULL) return NULL;
+
+    intr_status old_status = spin_lock_irqsave(&p_pm_pool->lock);
+    int32_t pg_idx = buddy_alloc(p_pm_pool, order);
+    if (pg_idx == -1)
+    {
+        spin_unlock_irqrestore(&p_pm_pool->lock, old_status);
+        free_vpages(pg_cnt, vpages_start_addr);
+        return NULL;
+    }
+    // 将块拆分为单个的页，多余的尾部页归还给伙伴系统
+    for (uint32_t i = 0; i < pg_cnt; ++i)
+    {
+        p_pm_pool->frames[pg_idx + i].order = 0;
+        p_pm_pool->frames[pg_idx + i].free = false;
+    }
+    buddy_free_range(p_pm_pool, pg_idx + pg_cnt, pg_idx + (1 << order));
+    spin_unlock_irqrestore(&p_pm_pool->lock, old_status);
+
+    void *ppage_addr = p_pm_pool->phy_addr_start + pg_idx * PAGE_SIZE;
+    for (uint32_t i = 0; i < pg_cnt; ++i)
+    {
+        set_mmap(ppage_addr + i * PAGE_SIZE, vpages_start_addr + i * PAGE_SIZE);
+    }
+    return vpages_start_addr;
+}
+
+// 为内核分配pg_cnt个物理连续的页，并返回首个虚拟页的虚拟地址
+void *get_kernel_contig_pages(const uint32_t pg_cnt)
+{
+    return malloc_contig_pages(PF_KERNEL, pg_cnt);
+}
+
 // 为内核或用户进程分配pg_cnt个页，并返回首个虚拟页的虚拟地址
 void *malloc_pages(pool_flag pf, const uint32_t pg_cnt)
 {
+    // 优先分配物理连续的页，内存碎片导致无法分配时再逐页分配
+    void *vpages_start_addr = malloc_contig_pages(pf, pg_cnt);
+    if (vpages_start_addr != NULL)
+    {
+        return vpages_start_addr;
+    }
+
     // 先在虚拟池中分配连续pg_cnt个页面
-    void *vpages_start_addr = alloc_vpages(pf, pg_cnt);
+    vpages_start_addr = alloc_vpages(pf, pg_cnt);
     
     ASSERT(vpages_start_addr != NULL);
 
@@ -168,6 +352,23 @@ void *malloc_pages(pool_flag pf, const uint32_t pg_cnt)
     return vpages_start_addr;
 }   
 
+// 将不属于物理池的物理地址(如设备寄存器)映射到内核虚拟空间，并返回对应的虚拟地址
+void *mmio_map(void *phy_addr, const uint32_t pg_cnt)
+{
+    void *vaddr_start = alloc_vpages(PF_KERNEL, pg_cnt);
+    if (!vaddr_start)
+    {
+        return NULL;
+    }
+
+    uint32_t paddr = (uint32_t)phy_addr & 0xfffff000;
+    for (uint32_t i = 0; i < pg_cnt; ++i)
+    {
+        set_mmap((void *)(paddr + i * PAGE_SIZE), vaddr_start + i * PAGE_SIZE);
+    }
+    return vaddr_start + ((uint32_t)phy_addr & 0x00000fff);
+}
+
 // 为内核分配pg_cnt个页，并返回首个虚拟页的虚拟地址
 void *get_kernel_pages(const uint32_t pg_cnt)
 {
@@ -263,7 +464,9 @@ void mblock_desc_init(mem_block_desc *pdesc)
     {
         pdesc[i].block_size = block_size;
         pdesc[i].block_cnt_per_arena = (PAGE_SIZE - sizeof(arena)) / block_size;
-        list_init(&pdesc[i].free_list);
+        list_init(&pdesc[i].partial_list);
+        list_init(&pdesc[i].full_list);
+        mutex_lock_init(&pdesc[i].lock);
     }
 }       
 
@@ -299,10 +502,11 @@ void free_a_ppage(void *paddr)
 
     phy_mem_pool *p_pm_pool = (paddr >= user_pm_pool.phy_addr_start ? &user_pm_pool : &kernel_pm_pool);
 
-    mutex_lock_acquire(&p_pm_pool->mutex);
-    uint32_t bit_idx = ((uint32_t)paddr - (uint32_t)p_pm_pool->phy_addr_start) / PAGE_SIZE;
-    bitmap_set(&p_pm_pool->pmp_bitmap, bit_idx, 0);
-    mutex_lock_release(&p_pm_pool->mutex);
+    intr_status old_status = spin_lock_irqsave(&p_pm_pool->lock);
+    uint32_t pg_idx = ((uint32_t)paddr - (uint32_t)p_pm_pool->phy_addr_start) / PAGE_SIZE;
+    ASSERT(p_pm_pool->frames[pg_idx].order == 0);
+    buddy_free(p_pm_pool, pg_idx, 0);
+    spin_unlock_irqrestore(&p_pm_pool->lock, old_status);
 }   
 
 // 在页表中清除虚拟地址ptr与物理地址之间的映射
@@ -327,6 +531,12 @@ void reset_mmap(void *ptr)
             Intel486 之前是不支持的。
         */
         asm volatile ("invlpg (%0)":: "a"(ptr): "memory");
+
+        // 内核空间为所有处理器共享，其他处理器的TLB中可能还缓存着该映射，必须等它们刷新后该页才能被重新分配
+        if ((uint32_t)ptr >= KERNEL_SPACE_START)
+        {
+            smp_kernel_unmapped();
+        }
     }
 }                            
 
@@ -340,8 +550,8 @@ void mfree_pages(const uint32_t pg_cnt, void *ptr)
     {
         void *paddr = vaddr2paddr(vaddr);
         ASSERT(paddr != NULL);
+        reset_mmap(vaddr);          // 先清除映射，其他处理器不可能再通过该映射访问物理页之后才能释放物理页
         free_a_ppage(paddr);
-        reset_mmap(vaddr);
         _pg_cnt--;
         vaddr = (void *)((uint32_t)vaddr + PAGE_SIZE);
     }
@@ -358,19 +568,19 @@ void free_a_page_without_setting_pbitmap(void *vaddr)
 // 使指定物理页的引用数加一
 void inc_pg_ref(uint32_t page)
 {
-    intr_status old_status = set_intr_status(INTR_OFF);
+    intr_status old_status = spin_lock_irqsave(&pg_ref_lock);
 
     uint32_t i = (page - (uint32_t)user_pm_pool.phy_addr_start) / PAGE_SIZE;
     ASSERT(pg_ref_tab[i] < 0xff);
     ++pg_ref_tab[i];
 
-    set_intr_status(old_status);
+    spin_unlock_irqrestore(&pg_ref_lock, old_status);
 }   
 
 // 检测指定物理页的引用数，若引用数大于零，使其引用数减一，并返回原引用数
 uint8_t test_dec_pg_ref(uint32_t page)       
 {
-    intr_status old_status = set_intr_status(INTR_OFF);
+    intr_status old_status = spin_lock_irqsave(&pg_ref_lock);
 
     uint32_t i = (page - (uint32_t)user_pm_pool.phy_addr_start) / PAGE_SIZE;
     uint8_t pg_ref = pg_ref_tab[i];
@@ -379,7 +589,7 @@ uint8_t test_dec_pg_ref(uint32_t page)
         --pg_ref_tab[i];
     }
 
-    set_intr_status(old_status);
+    spin_unlock_irqrestore(&pg_ref_lock, old_status);
 
     return pg_ref;
 }   
@@ -387,9 +597,9 @@ uint8_t test_dec_pg_ref(uint32_t page)
 // 判断指定物理页是否是一个共享页
 bool is_shared_page(uint32_t page)  
 {
-    intr_status old_status = set_intr_status(INTR_OFF);
+    intr_status old_status = spin_lock_irqsave(&pg_ref_lock);
     uint8_t pg_ref = pg_ref_tab[(page - (uint32_t)user_pm_pool.phy_addr_start) / PAGE_SIZE];
-    set_intr_status(old_status);
+    spin_unlock_irqrestore(&pg_ref_lock, old_status);
     return pg_ref ? true : false;
 }
 
@@ -400,6 +610,7 @@ void *kmalloc(const uint32_t size)
 }      
 
 // sys_malloc 和 kmalloc 的分配过程由该函数实现
+// 小内存块只需持有对应规格描述符的锁，不同规格之间以及与页分配之间互不阻塞
 void *_malloc(pool_flag pf, const uint32_t size)
 {
     if (!size)
@@ -407,34 +618,21 @@ void *_malloc(pool_flag pf, const uint32_t size)
         return NULL;
     }
 
-    mem_block_desc *mblock_descs;
-    phy_mem_pool *p_pm_pool;
-    if (pf == PF_USER)
-    {
-        mblock_descs = current->u_mblock_descs;
-        p_pm_pool = &user_pm_pool;
-    }
-    else
-    {
-        mblock_descs = k_mblock_descs;
-        p_pm_pool = &kernel_pm_pool;
-    }
-    mutex_lock_acquire(&p_pm_pool->mutex);
+    mem_block_desc *mblock_descs = (pf == PF_USER ? current->u_mblock_descs : k_mblock_descs);
 
     if (size > 1024)
     {
+        // 大内存块直接分配页，物理池和虚拟池的锁在malloc_pages内部获取
         uint32_t pg_cnt = DIV_ROUND_UP(size + sizeof(arena), PAGE_SIZE);
         arena *parena = (arena *)malloc_pages(pf, pg_cnt);
         if (!parena)
         {
-            mutex_lock_release(&p_pm_pool->mutex);
             return NULL;
         }
         parena->cnt = pg_cnt;
         parena->large = true;
         parena->pdesc = NULL;
 
-        mutex_lock_release(&p_pm_pool->mutex);
         return (void *)(parena + 1);            // 跨过开头的arena元数据返回可用内存块的地址
     }
     else
@@ -450,49 +648,140 @@ void *_malloc(pool_flag pf, const uint32_t size)
             }
         }
 
-        if (pdesc->free_list.length == 0)
+        mutex_lock_acquire(&pdesc->lock);
+
+        if (pdesc->partial_list.length == 0)
         {
-            // 当空闲块已经用完，分配一个新的页作为arena使用
+            // 当空闲块已经用完，分配一个新的页作为arena使用，其中的内存块在分配时才逐个切分
             arena *parena = (arena *)malloc_pages(pf, 1);
             if (!parena)
             {
-                mutex_lock_release(&p_pm_pool->mutex);
+                mutex_lock_release(&pdesc->lock);
                 return NULL;
             }
             parena->cnt = pdesc->block_cnt_per_arena;
             parena->large = false;
             parena->pdesc = pdesc;
+            parena->next_idx = 0;
+            parena->free_blocks = NULL;
+            node_init(&parena->list_node);
+            list_push_front(&pdesc->partial_list, &parena->list_node);
+        }
 
-            intr_status old_status = set_intr_status(INTR_OFF);
-            // 将新arena中的所有内存块添加到free_list中
-            for (uint32_t blk_idx = 0; blk_idx < pdesc->block_cnt_per_arena; blk_idx++)
-            {
-                mem_block *blk_addr = (mem_block *)ARENA2BLOCK(parena, blk_idx);
-                ASSERT(!list_find(&pdesc->free_list, &blk_addr->list_node));
-                list_push_back(&pdesc->free_list, &blk_addr->list_node);
-            }
+        // 优先复用arena中已被释放的内存块，否则从未分配过的部分切出一块
+        arena *parena = member2struct(pdesc->partial_list.head.next, arena, list_node);
+        mem_block *blk_addr = parena->free_blocks;
+        if (blk_addr)
+        {
+            parena->free_blocks = blk_addr->next;
+        }
+        else
+        {
+            ASSERT(parena->next_idx < pdesc->block_cnt_per_arena);
+            blk_addr = ARENA2BLOCK(parena, parena->next_idx);
+            parena->next_idx++;
+        }
 
-            set_intr_status(old_status);
+        if (--parena->cnt == 0)
+        {
+            list_remove(&pdesc->partial_list, &parena->list_node);
+            list_push_front(&pdesc->full_list, &parena->list_node);
         }
-        // 在free_list中分配一块内存块
-        void *blk_addr = (void *)member2struct(list_pop_front(&pdesc->free_list), mem_block, list_node);
-        BLOCK2ARENA(blk_addr)->cnt--;
     
-        mutex_lock_release(&p_pm_pool->mutex);
+        mutex_lock_release(&pdesc->lock);
         return blk_addr;
     }
 } 
 
+// sys_free 的释放过程由该函数实现
+void _free(void *ptr)
+{
+    ASSERT(ptr != NULL);
+    ASSERT(ptr >= (void *)KERNEL_VMP_START || 
+            (ptr < (void *)KERNEL_SPACE_START && ptr >= current->user_vm_pool.virt_addr_start));
+
+    arena *parena = BLOCK2ARENA(ptr);
+    ASSERT(parena->large == 0 || parena->large == 1);
+    if (parena->large && parena->pdesc == NULL)
+    {
+        mfree_pages(parena->cnt, (void *)parena);
+        return;
+    }
+
+    mem_block_desc *pdesc = parena->pdesc;
+    mem_block *blk_addr = (mem_block *)ptr;
+
+    mutex_lock_acquire(&pdesc->lock);
+    blk_addr->next = parena->free_blocks;
+    parena->free_blocks = blk_addr;
+
+    // 原本已分配满的arena重新有了空闲块
+    if (parena->cnt++ == 0)
+    {
+        list_remove(&pdesc->full_list, &parena->list_node);
+        list_push_front(&pdesc->partial_list, &parena->list_node);
+    }
+
+    // 若回收内存块后该arena的所有块均空闲，只需将arena从链表中摘除即可释放，无需处理其中的内存块
+    bool release = (parena->cnt == pdesc->block_cnt_per_arena);
+    if (release)
+    {
+        list_remove(&pdesc->partial_list, &parena->list_node);
+    }
+    mutex_lock_release(&pdesc->lock);
+
+    // arena已不可见，释放页时无需再持有描述符的锁
+    if (release)
+    {
+        mfree_pages(1, (void *)parena);
+    }
+}
+
 // 修正arena中的描述符指针
 bool fix_arena_pdesc(node *pnode, int correct_pdesc)
 {
-    void *blk_addr = (void *)member2struct(pnode, mem_block, list_node);
-    arena *parena = BLOCK2ARENA(blk_addr);
+    arena *parena = member2struct(pnode, arena, list_node);
+    mem_block_desc *pdesc = (mem_block_desc *)correct_pdesc;
     if (parena->pdesc)
     {
-        parena->pdesc = (mem_block_desc *)correct_pdesc;
+        parena->pdesc = pdesc;
     }
+    // 结点记录的所属链表同样指向父进程的描述符
+    pnode->owner = (parena->cnt ? &pdesc->partial_list : &pdesc->full_list);
     return false;
 }
 
+// 修正被复制的链表头尾结点与首尾元素之间的链接
+void fix_list_head(list *plist)
+{
+    if (!plist->length)
+    {
+        plist->head.next = &plist->tail;
+        plist->tail.prev = &plist->head;
+    }
+    else
+    {
+        plist->head.next->prev = &plist->head;
+        plist->tail.prev->next = &plist->tail;
+    }
+}
+
+// fork后修正子进程内存块描述符数组中错乱的链接关系
+// 子进程复制了父进程的PCB，描述符中的链表头尾以及arena中的描述符指针仍然指向父进程
+void mblock_desc_fix(mem_block_desc *pdesc)
+{
+    if (pdesc[0].partial_list.head.next->prev == &pdesc[0].partial_list.head)
+    {
+        return;
+    }
 
+    for (uint32_t i = 0; i < MBLOCK_DESC_CNT; ++i)
+    {
+        fix_list_head(&pdesc[i].partial_list);
+        fix_list_head(&pdesc[i].full_list);
+
+        /* 必须修正arena中的描述符指针, 因为原来的指针指向的是父进程的描述符 */
+        list_traversal(&pdesc[i].partial_list, fix_arena_pdesc, (int)&pdesc[i]);
+        list_traversal(&pdesc[i].full_list, fix_arena_pdesc, (int)&pdesc[i]);
+    }
+}
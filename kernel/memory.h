@@ -18,6 +18,8 @@
 
 #define MBLOCK_DESC_CNT    7    // 内存块描述符的种类
 
+#define BUDDY_MAX_ORDER 10      // 伙伴系统的最大阶，最大的块包含2^10个页
+
 #define ARENA2BLOCK(arena_addr, block_idx) \
 ((mem_block *)((uint32_t)arena_addr + sizeof(arena) + block_idx * (arena_addr->pdesc->block_size)))    // 获取arena中偏移为block_idx内存块的地址
 #define BLOCK2ARENA(block_addr) ((arena *)((uint32_t)block_addr & 0xfffff000))   // 将内存块的地址转化为对应arena的地址
@@ -42,25 +44,37 @@ typedef struct virt_mem_pool
     mutex_lock mutex;       // 实现互斥访问
 } virt_mem_pool;
 
+// 页框描述符，伙伴系统用其记录每个物理页的状态
+typedef struct page_frame
+{
+    node list_node;         // 空闲块的首页用于将空闲块挂到对应阶的空闲链表中
+    uint8_t order;          // 页所在块的阶，只对块的首页有意义
+    bool free;              // 页是否是一个空闲块的首页
+} page_frame;
+
 // 物理内存池
 typedef struct phy_mem_pool
 {
-    bitmap pmp_bitmap;
     void *phy_addr_start;
     uint32_t pool_size;
-    mutex_lock mutex;       // 实现互斥访问
+    uint32_t frame_cnt;                     // 物理池中的页数
+    page_frame *frames;                     // 页框描述符数组，存放在物理池开头的若干页中
+    list free_area[BUDDY_MAX_ORDER + 1];    // 第i个链表中为所有包含2^i个页的空闲块
+    spinlock lock;          // 实现互斥访问，伙伴系统的操作都很短且不会睡眠
 } phy_mem_pool;
 
 typedef struct mem_block_desc
 {
     uint32_t block_size;            // 内存块大小(规格)
     uint32_t block_cnt_per_arena;    // 每个arena中包含的内存块数量
-    list free_list;                 // 空闲内存块链表
+    list partial_list;              // 尚有空闲内存块的arena链表
+    list full_list;                 // 内存块已全部分配的arena链表
+    mutex_lock lock;                // 保护本规格的arena链表及其中各arena的空闲块
 } mem_block_desc;
 
 typedef struct mem_block
 {
-    node list_node;
+    struct mem_block *next;         // 空闲时指向同一arena中的下一个空闲内存块
 } mem_block;
 
 typedef struct arena
@@ -68,6 +82,9 @@ typedef struct arena
     mem_block_desc *pdesc;          // 指向本arena对应的内存块描述符, 对于大内存块的arena，此项为NULL
     bool large;                     
     uint32_t cnt;                   // 当large为false时，cnt代表arena中空闲内存块的数量，当large为true时，cnt代表页框的数量
+    uint32_t next_idx;              // 从未分配过的内存块的起始下标，此后的内存块按需切分
+    mem_block *free_blocks;         // 已被释放回本arena的空闲内存块链表
+    node list_node;                 // 用于将arena挂到描述符的partial_list或full_list中
 } arena;
 
 extern virt_mem_pool kernel_vm_pool;   // 内核专用的虚拟内存池
@@ -80,6 +97,11 @@ extern void mem_init(void);
 extern void *malloc_pages(pool_flag pf, const uint32_t pg_cnt);     // 为内核或用户进程分配pg_cnt个页，并返回首个虚拟页的虚拟地址
 extern void *get_kernel_pages(const uint32_t pg_cnt);               // 为内核分配pg_cnt个页，并返回首个虚拟页的虚拟地址
 extern void *get_user_pages(const uint32_t pg_cnt);                 // 为用户进程分配pg_cnt个页，并返回首个虚拟页的虚拟地址
+extern void *alloc_ppages(pool_flag pf, const uint32_t order);      // 在指定物理池中分配2^order个物理连续的页，并返回首页的物理地址
+extern void free_ppages(void *paddr);                               // 释放由alloc_ppages分配的物理连续的页
+extern void *malloc_contig_pages(pool_flag pf, const uint32_t pg_cnt);  // 分配pg_cnt个物理连续的页，并返回首个虚拟页的虚拟地址，失败返回NULL
+extern void *get_kernel_contig_pages(const uint32_t pg_cnt);        // 为内核分配pg_cnt个物理连续的页，并返回首个虚拟页的虚拟地址
+extern void *mmio_map(void *phy_addr, const uint32_t pg_cnt);       // 将不属于物理池的物理地址(如设备寄存器)映射到内核虚拟空间，并返回对应的虚拟地址
 extern void *get_a_page(void *virt_addr);             // 分配指定虚拟地址所在的页，返回虚拟地址对应虚拟页的起始地址
 extern void *get_a_page_without_setting_vbitmap(void *virt_addr);    // 功能与get_a_page相同，只是不设置虚拟地址位图中的对应位
 extern void *vaddr2paddr(void *vaddr);                 // 将虚拟地址转换为物理地址后返回
@@ -94,7 +116,9 @@ extern bool is_shared_page(uint32_t page);        // 判断指定物理页是否
 
 extern void *kmalloc(const uint32_t size);      // 在内核堆空间中分配指定大小的内存
 extern void *_malloc(pool_flag pf, const uint32_t size);      // sys_malloc 和 kmalloc 的分配过程由该函数实现
+extern void _free(void *ptr);                                 // sys_free 的释放过程由该函数实现
 
 extern bool fix_arena_pdesc(node *pnode, int correct_pdesc);   // 修正arena中的描述符指针
+extern void mblock_desc_fix(mem_block_desc *pdesc);            // fork后修正子进程内存块描述符数组中错乱的链接关系
 
 #endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "slab.h"
+#include "memory.h"
+#include "global.h"
+#include "debug.h"
+
+#define SLAB_END 0xffff         // 空闲对象链表的结束标记
+
+#define ROUND_UP(val, align) (((val) + (align) - 1) & ~((align) - 1))      // 将val向上取整为align的倍数，align必须是2的幂
+#define SLAB_BUFCTL(pslab) ((uint16_t *)((pslab) + 1))      // slab描述符之后的数组，第i项为对象i之后的下一个空闲对象的下标
+#define OBJ2SLAB(obj) ((slab *)((uint32_t)(obj) & 0xfffff000))       // 获取对象所在的slab
+
+slab *slab_grow(slab_cache *cache);     // 为缓存分配一个新的slab，并对其中的所有对象调用构造函数
+
+// 创建一个对象大小为size、按align对齐的缓存，每个对象在slab创建时由ctor构造一次
+slab_cache *slab_cache_create(const char *name, uint32_t size, uint32_t align, slab_ctor ctor)
+{
+    ASSERT(size > 0 && align > 0 && !(align & (align - 1)));
+    slab_cache *cache = (slab_cache *)kmalloc(sizeof(slab_cache));
+    ASSERT(cache);
+
+    cache->name = name;
+    cache->obj_size = ROUND_UP(size, align);
+    cache->ctor = ctor;
+
+    // 每个对象还需要在空闲对象链表中占用2个字节，对象数组的起始地址需要满足对齐要求
+    uint32_t cnt = (PAGE_SIZE - sizeof(slab)) / (cache->obj_size + sizeof(uint16_t));
+    while (cnt && ROUND_UP(sizeof(slab) + cnt * sizeof(uint16_t), align) + cnt * cache->obj_size > PAGE_SIZE) --cnt;
+    ASSERT(cnt > 0 && cnt < SLAB_END);
+    cache->obj_cnt_per_slab = cnt;
+    cache->obj_offset = ROUND_UP(sizeof(slab) + cnt * sizeof(uint16_t), align);
+
+    list_init(&cache->partial_list);
+    list_init(&cache->full_list);
+    list_init(&cache->free_list);
+    mutex_lock_init(&cache->lock);
+    return cache;
+}
+
+// 为缓存分配一个新的slab，并对其中的所有对象调用构造函数
+slab *slab_grow(slab_cache *cache)
+{
+    slab *pslab = (slab *)get_kernel_pages(1);
+    if (!pslab)
+    {
+        return NULL;
+    }
+
+    pslab->cache = cache;
+    pslab->inuse = 0;
+    pslab->free_idx = 0;
+    node_init(&pslab->list_node);
+    uint16_t *bufctl = SLAB_BUFCTL(pslab);
+    for (uint32_t i = 0; i < cache->obj_cnt_per_slab; ++i)
+    {
+        bufctl[i] = (i + 1 < cache->obj_cnt_per_slab) ? i + 1 : SLAB_END;
+        if (cache->ctor)
+        {
+            cache->ctor((uint8_t *)pslab + cache->obj_offset + i * cache->obj_size);
+        }
+    }
+    return pslab;
+}
+
+// 从缓存中分配一个对象，失败返回NULL
+// 优先使用部分分配的slab，其次是空闲的slab，都没有时才向内存池申请新的页
+void *slab_alloc(slab_cache *cache)
+{
+    mutex_lock_acquire(&cache->lock);
+
+    slab *pslab;
+    if (cache->partial_list.length)
+    {
+        pslab = member2struct(list_pop_front(&cache->partial_list), slab, list_node);
+    }
+    else if (cache->free_list.length)
+    {
+        pslab = member2struct(list_pop_front(&cache->free_list), slab, list_node);
+    }
+    else
+    {
+        pslab = slab_grow(cache);
+        if (!pslab)
+        {
+            mutex_lock_release(&cache->lock);
+            return NULL;
+        }
+    }
+
+    uint32_t idx = pslab->free_idx;
+    ASSERT(idx != SLAB_END);
+    pslab->free_idx = SLAB_BUFCTL(pslab)[idx];
+    ++pslab->inuse;
+    if (pslab->inuse == cache->obj_cnt_per_slab)
+    {
+        list_push_back(&cache->full_list, &pslab->list_node);
+    }
+    else
+    {
+        list_push_front(&cache->partial_list, &pslab->list_node);
+    }
+
+    mutex_lock_release(&cache->lock);
+    return (uint8_t *)pslab + cache->obj_offset + idx * cache->obj_size;
+}
+
+// 将对象归还给缓存，对象应当处于构造完成时的状态
+void slab_free(slab_cache *cache, void *obj)
+{
+    slab *pslab = OBJ2SLAB(obj);
+    ASSERT(pslab->cache == cache);
+    uint32_t offset = (uint32_t)obj - (uint32_t)pslab - cache->obj_offset;
+    ASSERT(offset % cache->obj_size == 0);
+    uint32_t idx = offset / cache->obj_size;
+
+    mutex_lock_acquire(&cache->lock);
+
+    list_remove((pslab->inuse == cache->obj_cnt_per_slab) ? &cache->full_list : &cache->partial_list, &pslab->list_node);
+    SLAB_BUFCTL(pslab)[idx] = pslab->free_idx;
+    pslab->free_idx = idx;
+    --pslab->inuse;
+
+    if (pslab->inuse)
+    {
+        list_push_front(&cache->partial_list, &pslab->list_node);
+    }
+    else if (cache->free_list.length < SLAB_MAX_FREE)
+    {
+        list_push_back(&cache->free_list, &pslab->list_node);
+    }
+    else
+    {
+        mfree_pages(1, pslab);
+    }
+
+    mutex_lock_release(&cache->lock);
+}
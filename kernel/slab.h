@@ -0,0 +1,40 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+
+#include "stdint.h"
+#include "list.h"
+#include "sync.h"
+
+#define SLAB_MAX_FREE 1         // 每个缓存最多保留的空闲slab数量，多余的空闲slab会被归还给内存池
+
+typedef void (*slab_ctor)(void *obj);     // 对象构造函数，只在slab创建时对其中的每个对象调用一次
+
+// 对象缓存，管理大小固定的一类内核对象
+typedef struct slab_cache
+{
+    const char *name;           // 缓存名称
+    uint32_t obj_size;          // 对象大小，已按对齐要求向上取整
+    uint32_t obj_offset;        // 首个对象相对于slab起始地址的偏移
+    uint32_t obj_cnt_per_slab;  // 每个slab中的对象数量
+    slab_ctor ctor;             // 对象构造函数，可以为NULL
+
+    list partial_list;          // 部分对象已被分配的slab
+    list full_list;             // 所有对象都已被分配的slab
+    list free_list;             // 所有对象都空闲的slab
+    mutex_lock lock;            // 每个缓存独立的互斥锁
+} slab_cache;
+
+// slab占据一个页，页的开头是slab描述符和空闲对象链表，之后是对象数组
+typedef struct slab
+{
+    slab_cache *cache;          // slab所属的缓存
+    node list_node;             // 用于将slab挂到缓存的三个链表之一
+    uint32_t inuse;             // 已分配的对象数量
+    uint32_t free_idx;          // 首个空闲对象的下标
+} slab;
+
+extern slab_cache *slab_cache_create(const char *name, uint32_t size, uint32_t align, slab_ctor ctor);  // 创建一个对象大小为size、按align对齐的缓存
+extern void *slab_alloc(slab_cache *cache);             // 从缓存中分配一个对象，失败返回NULL
+extern void slab_free(slab_cache *cache, void *obj);    // 将对象归还给缓存
+
+#endif
@@ -0,0 +1,615 @@
+#include "smp.h"
+#include "memory.h"
+#include "string.h"
+#include "global.h"
+#include "debug.h"
+#include "print.h"
+#include "io.h"
+#include "sync.h"
+#include "thread.h"
+#include "timer.h"
+#include "interrupt.h"
+#include "tss.h"
+#include "stdio.h"
+
+#define MP_FLOAT_SIGNATURE  0x5f504d5f      // MP浮动指针结构的签名"_MP_"
+#define MP_CONFIG_SIGNATURE 0x504d4350      // MP配置表的签名"PCMP"
+#define MP_ENTRY_PROCESSOR  0               // 处理器表项的类型，该表项长20字节，其余表项均长8字节
+#define MP_CPU_ENABLED      0x01            // 处理器可用
+
+#define ACPI_RSDP_SIG_LOW   0x20445352      // RSDP签名"RSD PTR "的前4字节
+#define ACPI_RSDP_SIG_HIGH  0x20525450      // RSDP签名的后4字节
+#define ACPI_RSDT_SIGNATURE 0x54445352      // RSDT的签名"RSDT"
+#define ACPI_MADT_SIGNATURE 0x43495041      // MADT的签名"APIC"
+#define ACPI_MADT_LAPIC     0               // MADT中本地APIC表项的类型
+#define ACPI_LAPIC_ENABLED  0x01            // 处理器可用
+
+#define LAPIC_ID        0x020       // 本地APIC ID寄存器，高8位为ID
+#define LAPIC_TPR       0x080       // 任务优先级寄存器
+#define LAPIC_EOI       0x0b0       // 中断结束寄存器
+#define LAPIC_SVR       0x0f0       // 伪中断向量寄存器
+#define LAPIC_ICR_LOW   0x300       // 中断命令寄存器低32位
+#define LAPIC_ICR_HIGH  0x310       // 中断命令寄存器高32位
+#define LAPIC_LVT_TIMER 0x320       // 定时器的本地向量表项
+#define LAPIC_TIMER_INIT 0x380      // 定时器初始计数寄存器
+#define LAPIC_TIMER_CUR 0x390       // 定时器当前计数寄存器
+#define LAPIC_TIMER_DIV 0x3e0       // 定时器分频寄存器
+
+#define LAPIC_SVR_ENABLE    0x100   // 软件启用本地APIC
+#define LAPIC_LVT_MASKED    0x00010000  // 屏蔽该本地中断
+#define LAPIC_TIMER_PERIODIC 0x00020000 // 定时器工作在周期模式
+#define LAPIC_TIMER_DIV_16  0x3     // 定时器以总线频率的1/16计数
+#define ICR_FIXED           0x00004000  // 以固定方式发送IPI，低8位为中断向量号
+#define ICR_INIT            0x00004500  // 发送INIT IPI，电平触发并置位
+#define ICR_STARTUP         0x00004600  // 发送STARTUP IPI，低8位为启动代码所在的页号
+#define ICR_PENDING         0x00001000  // IPI尚未发送完毕
+#define ICR_ALL_BUT_SELF    0x000c0000  // 发送给除自己以外的所有处理器
+
+#define LOW_MEM(paddr) ((void *)(KERNEL_SPACE_START + (uint32_t)(paddr)))     // 低端1MB物理内存在内核空间中的虚拟地址
+
+// MP浮动指针结构，位于EBDA、基本内存最后1KB或BIOS ROM中，16字节对齐
+typedef struct mp_float_ptr
+{
+    uint32_t signature;
+    uint32_t config_addr;       // MP配置表的物理地址
+    uint8_t length;             // 以16字节为单位的结构长度
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t features[5];
+} PACKED mp_float_ptr;
+
+// MP配置表头，之后紧跟entry_cnt个表项
+typedef struct mp_config_header
+{
+    uint32_t signature;
+    uint16_t base_len;          // 表头与所有基本表项的总长度
+    uint8_t spec_rev;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table_addr;
+    uint16_t oem_table_size;
+    uint16_t entry_cnt;         // 基本表项的数量
+    uint32_t lapic_addr;        // 本地APIC寄存器的物理地址
+    uint16_t ext_len;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} PACKED mp_config_header;
+
+// 处理器表项
+typedef struct mp_processor_entry
+{
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_ver;
+    uint8_t cpu_flags;
+    uint32_t cpu_signature;
+    uint32_t feature_flags;
+    uint32_t reserved[2];
+} PACKED mp_processor_entry;
+
+// ACPI的根系统描述指针，位于EBDA的前1KB或0xe0000至0xfffff中，16字节对齐
+typedef struct acpi_rsdp
+{
+    uint32_t signature[2];
+    uint8_t checksum;           // 前20字节之和为0
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;         // RSDT的物理地址
+} PACKED acpi_rsdp;
+
+// ACPI系统描述表的公共表头
+typedef struct acpi_sdt_header
+{
+    uint32_t signature;
+    uint32_t length;            // 包括表头在内的整个表的长度
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} PACKED acpi_sdt_header;
+
+// 多APIC描述表(MADT)，之后紧跟各个变长表项
+typedef struct acpi_madt
+{
+    acpi_sdt_header header;
+    uint32_t lapic_addr;        // 本地APIC寄存器的物理地址
+    uint32_t flags;
+} PACKED acpi_madt;
+
+// MADT中的本地APIC表项，每个处理器一项
+typedef struct acpi_madt_lapic
+{
+    uint8_t type;
+    uint8_t length;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} PACKED acpi_madt_lapic;
+
+// GDTR寄存器的内容
+typedef struct gdt_ptr
+{
+    uint16_t limit;
+    uint32_t base;
+} PACKED gdt_ptr;
+
+extern uint8_t ap_boot_start[], ap_boot_end[];                  // AP启动代码的起止地址，定义于ap_boot.s
+extern uint8_t ap_gdtr_phys[], ap_gdtr_virt[], ap_stack_top[];  // AP启动代码中由BSP填写的数据
+
+cpu_info cpus[MAX_CPU_CNT] = {[0] = {.bsp = true, .online = true}};     // 系统中所有可用的处理器
+uint32_t cpu_cnt = 1;               // 系统中可用的处理器数量
+uint32_t cpu_online_cnt = 1;        // 已经完成启动的处理器数量
+void *lapic_base;                   // 本地APIC寄存器映射到的虚拟地址，所有处理器的本地APIC都位于同一地址
+uint32_t lapic_timer_count;         // 本地APIC定时器在一个tick内的计数值，由BSP校准
+
+volatile uint32_t kernel_tlb_gen;   // 内核空间映射的版本号，每清除一次内核空间的映射加1
+
+uint8_t mp_checksum(void *addr, uint32_t len);                  // 计算指定区域所有字节之和，和为0时校验通过
+mp_float_ptr *mp_search(uint32_t paddr, uint32_t len);          // 在低端1MB物理内存的指定区域中寻找MP浮动指针结构
+mp_float_ptr *mp_find(void);                                    // 按规范规定的顺序寻找MP浮动指针结构
+bool mp_parse(uint32_t *lapic_addr);                            // 解析MP配置表，获取所有可用处理器和本地APIC的物理地址
+acpi_rsdp *acpi_search(uint32_t paddr, uint32_t len);           // 在低端1MB物理内存的指定区域中寻找ACPI的RSDP
+acpi_sdt_header *acpi_map_table(uint32_t paddr, uint32_t signature);    // 映射指定物理地址处的ACPI表
+bool madt_parse(uint32_t *lapic_addr);                          // 解析ACPI的MADT，获取所有可用处理器和本地APIC的物理地址
+void cpu_add(uint8_t apic_id);                                  // 记录一个可用的处理器
+uint32_t lapic_read(uint32_t reg);                              // 读本地APIC寄存器
+void lapic_write(uint32_t reg, uint32_t val);                   // 写本地APIC寄存器
+void lapic_send_ipi(uint8_t apic_id, uint32_t cmd);             // 向指定处理器发送IPI
+void intr_lapic_timer_handler(void);                            // 本地APIC定时器中断处理函数
+void intr_resched_handler(void);                                // 重新调度IPI的处理函数
+void intr_tlb_handler(void);                                    // 刷新TLB的IPI的处理函数
+void intr_lapic_spurious_handler(void);                         // 本地APIC伪中断处理函数
+void ap_boot_fill(void *field, const void *src, uint32_t size); // 填写已复制到AP_BOOT_ADDR处的启动代码中的数据
+
+// 计算指定区域所有字节之和，和为0时校验通过
+uint8_t mp_checksum(void *addr, uint32_t len)
+{
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        sum += ((uint8_t *)addr)[i];
+    }
+    return sum;
+}
+
+// 在低端1MB物理内存的指定区域中寻找MP浮动指针结构
+mp_float_ptr *mp_search(uint32_t paddr, uint32_t len)
+{
+    for (uint32_t addr = paddr; addr + sizeof(mp_float_ptr) <= paddr + len; addr += 16)
+    {
+        mp_float_ptr *mpf = (mp_float_ptr *)LOW_MEM(addr);
+        if (mpf->signature == MP_FLOAT_SIGNATURE && !mp_checksum(mpf, sizeof(mp_float_ptr)))
+        {
+            return mpf;
+        }
+    }
+    return NULL;
+}
+
+// 按规范规定的顺序寻找MP浮动指针结构：EBDA的前1KB、基本内存的最后1KB、BIOS ROM区域
+mp_float_ptr *mp_find(void)
+{
+    mp_float_ptr *mpf = NULL;
+    uint32_t ebda = (uint32_t)(*(uint16_t *)LOW_MEM(0x40e)) << 4;
+    if (ebda)
+    {
+        mpf = mp_search(ebda, 1024);
+    }
+    else
+    {
+        uint32_t base_mem = (uint32_t)(*(uint16_t *)LOW_MEM(0x413)) * 1024;
+        mpf = mp_search(base_mem - 1024, 1024);
+    }
+    return (mpf ? mpf : mp_search(0xf0000, 0x10000));
+}
+
+// 解析MP配置表，获取所有可用处理器和本地APIC的物理地址
+bool mp_parse(uint32_t *lapic_addr)
+{
+    mp_float_ptr *mpf = mp_find();
+    if (!mpf || !mpf->config_addr)
+    {
+        // 没有配置表时(使用默认配置)交给MADT处理
+        return false;
+    }
+
+    // 配置表一般位于BIOS ROM中，若不在低端1MB中则需要单独映射
+    mp_config_header *conf = (mpf->config_addr < 0x100000 ? (mp_config_header *)LOW_MEM(mpf->config_addr) :
+                              (mp_config_header *)mmio_map((void *)mpf->config_addr, 2));
+    if (!conf || conf->signature != MP_CONFIG_SIGNATURE || mp_checksum(conf, conf->base_len))
+    {
+        return false;
+    }
+
+    *lapic_addr = conf->lapic_addr;
+    uint8_t *entry = (uint8_t *)(conf + 1);
+    for (uint32_t i = 0; i < conf->entry_cnt; ++i)
+    {
+        if (*entry == MP_ENTRY_PROCESSOR)
+        {
+            mp_processor_entry *proc = (mp_processor_entry *)entry;
+            if (proc->cpu_flags & MP_CPU_ENABLED)
+            {
+                cpu_add(proc->apic_id);
+            }
+            entry += sizeof(mp_processor_entry);
+        }
+        else
+        {
+            entry += 8;
+        }
+    }
+    return cpu_cnt > 0;
+}
+
+// 在低端1MB物理内存的指定区域中寻找ACPI的RSDP
+acpi_rsdp *acpi_search(uint32_t paddr, uint32_t len)
+{
+    for (uint32_t addr = paddr; addr + sizeof(acpi_rsdp) <= paddr + len; addr += 16)
+    {
+        acpi_rsdp *rsdp = (acpi_rsdp *)LOW_MEM(addr);
+        if (rsdp->signature[0] == ACPI_RSDP_SIG_LOW && rsdp->signature[1] == ACPI_RSDP_SIG_HIGH &&
+            !mp_checksum(rsdp, sizeof(acpi_rsdp)))
+        {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+// 映射指定物理地址处的ACPI表，签名或校验和不符时返回NULL
+// ACPI表一般位于物理内存的末尾，先映射表头得到表的长度，再映射整个表
+acpi_sdt_header *acpi_map_table(uint32_t paddr, uint32_t signature)
+{
+    acpi_sdt_header *table = mmio_map((void *)paddr, 2);
+    if (!table || table->signature != signature)
+    {
+        return NULL;
+    }
+
+    uint32_t pg_cnt = DIV_ROUND_UP((paddr & (PAGE_SIZE - 1)) + table->length, PAGE_SIZE);
+    if (pg_cnt > 2)
+    {
+        table = mmio_map((void *)paddr, pg_cnt);
+    }
+    return (table && !mp_checksum(table, table->length) ? table : NULL);
+}
+
+// 解析ACPI的MADT，获取所有可用处理器和本地APIC的物理地址，在没有MP配置表的机器上使用
+bool madt_parse(uint32_t *lapic_addr)
+{
+    uint32_t ebda = (uint32_t)(*(uint16_t *)LOW_MEM(0x40e)) << 4;
+    acpi_rsdp *rsdp = (ebda ? acpi_search(ebda, 1024) : NULL);
+    rsdp = (rsdp ? rsdp : acpi_search(0xe0000, 0x20000));
+    if (!rsdp)
+    {
+        return false;
+    }
+
+    acpi_sdt_header *rsdt = acpi_map_table(rsdp->rsdt_addr, ACPI_RSDT_SIGNATURE);
+    if (!rsdt)
+    {
+        return false;
+    }
+
+    // RSDT的表头之后是其他各表的物理地址
+    uint32_t *entry = (uint32_t *)(rsdt + 1);
+    uint32_t entry_cnt = (rsdt->length - sizeof(acpi_sdt_header)) / 4;
+    for (uint32_t i = 0; i < entry_cnt; ++i)
+    {
+        acpi_madt *madt = (acpi_madt *)acpi_map_table(entry[i], ACPI_MADT_SIGNATURE);
+        if (!madt)
+        {
+            continue;
+        }
+
+        *lapic_addr = madt->lapic_addr;
+        uint8_t *pos = (uint8_t *)(madt + 1);
+        uint8_t *end = (uint8_t *)madt + madt->header.length;
+        while (pos + 2 <= end && pos[1])
+        {
+            acpi_madt_lapic *lapic = (acpi_madt_lapic *)pos;
+            if (lapic->type == ACPI_MADT_LAPIC && (lapic->flags & ACPI_LAPIC_ENABLED))
+            {
+                cpu_add(lapic->apic_id);
+            }
+            pos += lapic->length;
+        }
+        return cpu_cnt > 0;
+    }
+    return false;
+}
+
+// 记录一个可用的处理器，超出MAX_CPU_CNT的处理器被忽略
+void cpu_add(uint8_t apic_id)
+{
+    if (cpu_cnt < MAX_CPU_CNT)
+    {
+        cpus[cpu_cnt++].apic_id = apic_id;
+    }
+}
+
+// 读本地APIC寄存器
+uint32_t lapic_read(uint32_t reg)
+{
+    return *(volatile uint32_t *)(lapic_base + reg);
+}
+
+// 写本地APIC寄存器
+void lapic_write(uint32_t reg, uint32_t val)
+{
+    *(volatile uint32_t *)(lapic_base + reg) = val;
+}
+
+// 向指定处理器发送IPI
+void lapic_send_ipi(uint8_t apic_id, uint32_t cmd)
+{
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, cmd);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING);
+}
+
+// 使本地APIC定时器以时钟中断的频率周期性地产生中断
+void lapic_timer_start(void)
+{
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VEC);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+// 停止本地APIC定时器，初始计数为0时定时器不再计数
+void lapic_timer_stop(void)
+{
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+// 使本地APIC定时器在tick_cnt个tick后产生一次中断，超出32位计数范围时缩短定时
+// 返回实际定时的tick数，没有本地APIC时返回0
+uint32_t lapic_timer_oneshot(uint32_t tick_cnt)
+{
+    if (!lapic_timer_count)
+    {
+        return 0;
+    }
+    uint32_t max_ticks = 0xffffffff / lapic_timer_count;
+    tick_cnt = (tick_cnt < max_ticks ? tick_cnt : max_ticks);
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VEC);
+    lapic_write(LAPIC_TIMER_INIT, tick_cnt * lapic_timer_count);
+    return tick_cnt;
+}
+
+// 单次定时开始后经过的完整tick数，定时到期后计数停在0，此时为整个定时的tick数
+uint32_t lapic_timer_passed(void)
+{
+    return (lapic_read(LAPIC_TIMER_INIT) - lapic_read(LAPIC_TIMER_CUR)) / lapic_timer_count;
+}
+
+// 本地APIC定时器中断处理函数，应用处理器以此代替8253的时钟中断进行线程调度
+// BSP只在无时钟空闲时使用本地APIC定时器，定时到期时退出空闲状态即可
+void intr_lapic_timer_handler(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+    timer_tickless_exit();
+    if (!cpus[current->cpu].bsp)
+    {
+        timer_sched_tick(1);
+    }
+}
+
+// 重新调度IPI的处理函数，其他处理器向本处理器的就绪队列中放入线程后发送该IPI以唤醒idle线程
+// 无时钟空闲的处理器先恢复时钟中断，再运行新的线程
+void intr_resched_handler(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+    timer_tickless_exit();
+    if (thread_need_preempt())
+    {
+        schedule();
+    }
+}
+
+// 刷新TLB的IPI的处理函数
+void intr_tlb_handler(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+    smp_tlb_check();
+}
+
+// 本地APIC伪中断处理函数，伪中断不需要发送EOI
+void intr_lapic_spurious_handler(void)
+{
+}
+
+// 通知指定处理器重新调度
+void smp_send_resched(uint32_t cpu)
+{
+    lapic_send_ipi(cpus[cpu].apic_id, ICR_FIXED | RESCHED_VEC);
+}
+
+// 清除内核空间的映射后调用，通知其他在线的处理器刷新TLB并等待它们完成，之后被解除映射的页才能重新使用
+// 等待期间其他处理器可能关着中断自旋等待本处理器持有的锁，它们在自旋循环中调用cpu_relax处理刷新请求，因此不会死锁
+void smp_kernel_unmapped(void)
+{
+    if (cpu_online_cnt == 1)
+    {
+        return;
+    }
+
+    uint32_t gen = kernel_tlb_gen;
+    while (atomic_cmpxchg(&kernel_tlb_gen, gen, gen + 1) != gen)
+    {
+        gen = kernel_tlb_gen;
+    }
+    ++gen;
+
+    intr_status old_status = set_intr_status(INTR_OFF);
+    lapic_write(LAPIC_ICR_HIGH, 0);
+    lapic_write(LAPIC_ICR_LOW, ICR_ALL_BUT_SELF | ICR_FIXED | TLB_VEC);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING);
+    uint32_t self = current->cpu;
+    for (uint32_t i = 0; i < cpu_cnt; ++i)
+    {
+        while (i != self && cpus[i].online && (int32_t)(cpus[i].tlb_gen - gen) < 0)
+        {
+            cpu_relax();
+        }
+    }
+    set_intr_status(old_status);
+}
+
+// 内核空间的映射在本处理器上次刷新TLB之后被清除过时刷新TLB
+// 先记下版本号再刷新，刷新期间又有映射被清除时版本号仍然落后，下次检查时会再刷新一次
+void smp_tlb_check(void)
+{
+    cpu_info *cpu = &cpus[current->cpu];
+    uint32_t gen = kernel_tlb_gen;
+    if (cpu->tlb_gen != gen)
+    {
+        asm volatile ("movl %%cr3, %%eax; movl %%eax, %%cr3" : : : "eax", "memory");
+        cpu->tlb_gen = gen;
+    }
+}
+
+// 自旋等待的每次循环中调用，等待者可能关着中断，因此顺便处理其他处理器发来的TLB刷新请求
+void cpu_relax(void)
+{
+    if (cpu_online_cnt > 1)
+    {
+        smp_tlb_check();
+    }
+    asm volatile ("pause");
+}
+
+// 填写已复制到AP_BOOT_ADDR处的启动代码中的数据
+void ap_boot_fill(void *field, const void *src, uint32_t size)
+{
+    memcpy(LOW_MEM(AP_BOOT_ADDR) + ((uint32_t)field - (uint32_t)ap_boot_start), src, size);
+}
+
+// 探测系统中的处理器，初始化BSP的本地APIC并以8253为基准校准本地APIC定时器
+// 优先使用MP配置表，没有时使用ACPI的MADT，两者都没有时按单处理器运行
+void smp_init(void)
+{
+    put_str("Start to init SMP......\n");
+
+    uint32_t lapic_addr;
+    cpu_cnt = 0;
+    if (!mp_parse(&lapic_addr))
+    {
+        cpu_cnt = 0;
+        if (!madt_parse(&lapic_addr))
+        {
+            cpu_cnt = 1;
+            put_str("No MP configuration table or MADT, running on a single processor\n");
+            return;
+        }
+    }
+
+    lapic_base = mmio_map((void *)lapic_addr, 1);
+    ASSERT(lapic_base);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+
+    // 表中处理器的顺序是任意的，按本地APIC ID找出BSP并将其放到cpus[0]
+    uint8_t bsp_id = (uint8_t)(lapic_read(LAPIC_ID) >> 24);
+    for (uint32_t i = 0; i < cpu_cnt; ++i)
+    {
+        if (cpus[i].apic_id == bsp_id)
+        {
+            cpus[i].apic_id = cpus[0].apic_id;
+            cpus[0].apic_id = bsp_id;
+            break;
+        }
+    }
+
+    // 让定时器从最大值开始递减一个tick的时间，以此得到一个tick内的计数值
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xffffffff);
+    timer_udelay(1000000 / HZ);
+    lapic_timer_count = 0xffffffff - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    intr_handler_table[LAPIC_TIMER_VEC] = (intr_entry)intr_lapic_timer_handler;
+    intr_handler_table[RESCHED_VEC] = (intr_entry)intr_resched_handler;
+    intr_handler_table[TLB_VEC] = (intr_entry)intr_tlb_handler;
+    intr_handler_table[LAPIC_SPURIOUS_VEC] = (intr_entry)intr_lapic_spurious_handler;
+
+    put_str("processors detected: 0x"); put_int(cpu_cnt); put_char('\n');
+    put_str("Init SMP done!\n");
+}
+
+// 启动所有应用处理器，须在线程初始化之后调用
+// 每个AP以其idle线程的PCB所在页作为启动栈，启动后即作为该idle线程运行，延时都以8253的计数为基准
+void smp_start_aps(void)
+{
+    if (cpu_cnt == 1)
+    {
+        return;
+    }
+
+    // 将启动代码复制到低端内存，并填入内核的GDT(分别以物理地址和虚拟地址为基址)
+    memcpy(LOW_MEM(AP_BOOT_ADDR), ap_boot_start, (uint32_t)ap_boot_end - (uint32_t)ap_boot_start);
+    gdt_ptr gdtr;
+    asm volatile ("sgdt %0" : "=m"(gdtr));
+    ap_boot_fill(ap_gdtr_virt, &gdtr, sizeof(gdt_ptr));
+    gdtr.base = (uint32_t)vaddr2paddr((void *)gdtr.base);
+    ap_boot_fill(ap_gdtr_phys, &gdtr, sizeof(gdt_ptr));
+
+    for (uint32_t i = 1; i < cpu_cnt; ++i)
+    {
+        // AP依次启动，因此可以共用启动代码中的数据
+        task_struct *idle_thread = thread_idle_create(i, true);
+        uint32_t stack_top = (uint32_t)idle_thread + PAGE_SIZE;
+        ap_boot_fill(ap_stack_top, &stack_top, sizeof(uint32_t));
+
+        // INIT-SIPI-SIPI启动序列
+        lapic_send_ipi(cpus[i].apic_id, ICR_INIT);
+        timer_udelay(10000);
+        for (uint32_t j = 0; j < 2 && !cpus[i].online; ++j)
+        {
+            lapic_send_ipi(cpus[i].apic_id, ICR_STARTUP | (AP_BOOT_ADDR >> 12));
+            timer_udelay(200);
+        }
+
+        // 最多等待100ms
+        for (uint32_t wait = 0; wait < 1000 && !cpus[i].online; ++wait)
+        {
+            timer_udelay(100);
+        }
+
+        if (cpus[i].online)
+        {
+            ++cpu_online_cnt;
+        }
+        else
+        {
+            printk("Processor %d (APIC ID %d) failed to start\n", i, cpus[i].apic_id);
+        }
+    }
+
+    printk("processors online: %d\n", cpu_online_cnt);
+}
+
+// 应用处理器进入保护模式并开启分页后的入口，此时已经运行在该处理器的idle线程中
+// 完成本处理器的初始化后作为idle线程参与调度，就绪线程由时钟中断和重新调度IPI从其他处理器迁移过来
+void ap_main(void)
+{
+    uint32_t cpu = current->cpu;
+    idt_load();
+    tss_load(cpu);
+
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_timer_start();
+
+    // 上线之前内核空间的映射可能已被清除过，上线之后的清除都会等待本处理器刷新
+    cpus[cpu].tlb_gen = kernel_tlb_gen;
+    cpus[cpu].online = true;
+    asm volatile ("movl %%cr3, %%eax; movl %%eax, %%cr3" : : : "eax", "memory");
+    idle(NULL);
+}
@@ -0,0 +1,40 @@
+#ifndef __KERNEL_SMP_H
+#define __KERNEL_SMP_H
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define MAX_CPU_CNT 8               // 支持的最大处理器数量
+#define AP_BOOT_ADDR 0x70000        // AP启动代码被复制到的物理地址，必须与ap_boot.s中的定义保持一致
+
+#define LAPIC_TIMER_VEC     0x30    // 本地APIC定时器的中断向量号
+#define RESCHED_VEC         0x31    // 通知处理器重新调度的IPI向量号
+#define TLB_VEC             0x32    // 通知处理器刷新TLB的IPI向量号
+#define LAPIC_SPURIOUS_VEC  0x3f    // 本地APIC伪中断向量号，低4位须全为1
+
+// 处理器信息，cpus[0]固定为引导处理器(BSP)
+typedef struct cpu_info
+{
+    uint8_t apic_id;        // 处理器的本地APIC ID
+    bool bsp;               // 是否是引导处理器
+    volatile bool online;   // AP是否已经完成启动
+    volatile uint32_t tlb_gen;      // 该处理器上次刷新TLB时内核空间映射的版本号
+} cpu_info;
+
+extern cpu_info cpus[];             // 系统中所有可用的处理器
+extern uint32_t cpu_cnt;            // 系统中可用的处理器数量
+extern uint32_t cpu_online_cnt;     // 已经完成启动的处理器数量
+
+extern void smp_init(void);         // 探测系统中的处理器，初始化BSP的本地APIC并校准其定时器
+extern void smp_start_aps(void);    // 启动所有应用处理器，须在线程初始化之后调用
+extern void ap_main(void);          // 应用处理器进入保护模式并开启分页后的入口
+extern void smp_send_resched(uint32_t cpu);     // 通知指定处理器重新调度
+extern void smp_kernel_unmapped(void);          // 清除内核空间的映射后调用，等待其他处理器刷新TLB
+extern void smp_tlb_check(void);                // 内核空间的映射被清除过时刷新当前处理器的TLB
+extern void cpu_relax(void);                    // 自旋等待的每次循环中调用
+extern void lapic_timer_start(void);            // 使本地APIC定时器以时钟中断的频率周期性地产生中断
+extern void lapic_timer_stop(void);             // 停止本地APIC定时器
+extern uint32_t lapic_timer_oneshot(uint32_t tick_cnt);     // 使本地APIC定时器在tick_cnt个tick后产生一次中断，返回实际定时的tick数
+extern uint32_t lapic_timer_passed(void);       // 单次定时开始后经过的完整tick数
+
+#endif
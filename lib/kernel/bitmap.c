@@ -6,11 +6,20 @@
 
 #define BTMP_MASK 1
 
+uint32_t bitmap_word(bitmap *btmp, uint32_t word_idx);         // 读取位图中的第word_idx个32位字，超出位图的字节视为全1
+
 // 将位图中所有的位清零
 void bitmap_init(bitmap *btmp)
 {
     ASSERT(btmp != NULL);
     memset(btmp->btmp_ptr, 0, btmp->bytes_length);
+    btmp->hint = 0;
+}
+
+// 位图内容被直接修改(如从硬盘读入)后重置扫描起点
+void bitmap_reset_hint(bitmap *btmp)
+{
+    btmp->hint = 0;
 }
 
 // 返回指定位的状态
@@ -30,53 +39,106 @@ void bitmap_set(bitmap *btmp, uint32_t bit_idx, const uint8_t val)
     uint32_t bit_off = bit_idx % 8;
     if (val) btmp->btmp_ptr[byte_idx] |= (BTMP_MASK << bit_off);  // 置1
     else    btmp->btmp_ptr[byte_idx] &= ~(BTMP_MASK << bit_off);  // 置0
+
+    // 释放的位在扫描起点之前时，需要将扫描起点前移
+    if (!val && bit_idx < btmp->hint) btmp->hint = bit_idx;
 }   
 
-// 在bitmap中申请连续cnt个位, 并返回首个位的位索引, 找不到则返回-1
-int32_t bitmap_scan(bitmap *btmp, uint32_t cnt)
+// 将从bit_idx开始的连续cnt个位置为val(0或1)
+void bitmap_set_range(bitmap *btmp, uint32_t bit_idx, uint32_t cnt, const uint8_t val)
 {
-    ASSERT(btmp != NULL && cnt <= (btmp->bytes_length << 3));
-
-    // 逐字节扫描，找到第一个非0xff的字节
-    uint32_t byte_idx = 0;
-    while (byte_idx < btmp->bytes_length && btmp->btmp_ptr[byte_idx] == 0xff) byte_idx++;
-
-    if (byte_idx == btmp->bytes_length) return -1;
-
-    // 在查找到的字节中查找第一个为0的位
-    uint32_t bit_idx = byte_idx << 3;
-    while (bitmap_test(btmp, bit_idx)) bit_idx++; 
-    
-    // 从第一个为0的位出发寻找连续的cnt个值为0的位
-    bit_idx++;
-    uint32_t _cnt = 1;
-    while (_cnt < cnt && bit_idx < (btmp->bytes_length << 3))
+    ASSERT(btmp != NULL && bit_idx + cnt <= (btmp->bytes_length << 3) && (val == 0 || val == 1));
+    uint32_t end = bit_idx + cnt;
+
+    // 首尾不足一个字节的部分逐位设置，中间的完整字节整体设置
+    while (bit_idx < end && (bit_idx % 8)) bitmap_set(btmp, bit_idx++, val);
+    if (end - bit_idx >= 8)
     {
-        if (bitmap_test(btmp, bit_idx))
-        {
-            _cnt = 0;
-            bit_idx++;
-            while (bitmap_test(btmp, bit_idx) && bit_idx < (btmp->bytes_length << 3)) bit_idx++; 
-            if (bit_idx == btmp->bytes_length << 3) return -1;
-        }
-        _cnt++;
-        bit_idx++;
+        uint32_t byte_cnt = (end - bit_idx) / 8;
+        memset(btmp->btmp_ptr + bit_idx / 8, val ? 0xff : 0, byte_cnt);
+        if (!val && bit_idx < btmp->hint) btmp->hint = bit_idx;
+        bit_idx += byte_cnt * 8;
+    }
+    while (bit_idx < end) bitmap_set(btmp, bit_idx++, val);
+}
+
+// 读取位图中的第word_idx个32位字，超出位图的字节视为全1
+uint32_t bitmap_word(bitmap *btmp, uint32_t word_idx)
+{
+    uint32_t byte_idx = word_idx * 4;
+    if (byte_idx + 4 <= btmp->bytes_length)
+    {
+        return *(uint32_t *)(btmp->btmp_ptr + byte_idx);      // x86允许非对齐访问
     }
 
-    if (_cnt == cnt)
+    uint32_t word = 0xffffffff;
+    for (uint32_t i = 0; byte_idx + i < btmp->bytes_length; ++i)
     {
-        bit_idx--;
-        while (_cnt)
+        word &= ~((uint32_t)0xff << (i * 8));
+        word |= (uint32_t)btmp->btmp_ptr[byte_idx + i] << (i * 8);
+    }
+    return word;
+}
+
+// 使用bsf指令返回非0值中最低的为1的位的位置
+uint32_t bit_scan_forward(uint32_t val)
+{
+    uint32_t idx;
+    asm ("bsfl %1, %0" : "=r"(idx) : "rm"(val));
+    return idx;
+}
+
+// 使用bsr指令返回非0值中最高的为1的位的位置
+uint32_t bit_scan_reverse(uint32_t val)
+{
+    uint32_t idx;
+    asm ("bsrl %1, %0" : "=r"(idx) : "rm"(val));
+    return idx;
+}
+
+// 在[bit_idx, limit)中查找第一个值为val的位，每次检查32位，找不到则返回-1
+int32_t bitmap_find(bitmap *btmp, uint32_t bit_idx, uint32_t limit, uint8_t val)
+{
+    while (bit_idx < limit)
+    {
+        uint32_t word = bitmap_word(btmp, bit_idx / 32);
+        if (!val) word = ~word;
+        word &= (0xffffffff << (bit_idx % 32));      // 忽略bit_idx之前的位
+        if (word)
         {
-            bitmap_set(btmp, bit_idx, 1);
-            bit_idx--;
-            _cnt--;
+            uint32_t found = (bit_idx & ~31) + bit_scan_forward(word);
+            return (found < limit) ? (int32_t)found : -1;
         }
-        bit_idx++;
-        return (int32_t)bit_idx;
+        bit_idx = (bit_idx & ~31) + 32;
     }
-    else
+    return -1;
+}
+
+// 在bitmap中申请连续cnt个位, 并返回首个位的位索引, 找不到则返回-1
+int32_t bitmap_scan(bitmap *btmp, uint32_t cnt)
+{
+    ASSERT(btmp != NULL && cnt > 0 && cnt <= (btmp->bytes_length << 3));
+    uint32_t bit_cnt = btmp->bytes_length << 3;
+
+    int32_t start = bitmap_find(btmp, btmp->hint, bit_cnt, 0);
+    if (start == -1)
     {
+        btmp->hint = bit_cnt;
         return -1;
     }
+    btmp->hint = start;         // hint之前的位已确认全部为1
+
+    while (start != -1 && start + cnt <= bit_cnt)
+    {
+        // 查找空闲段的结尾，空闲段足够长时即可完成分配
+        int32_t end = bitmap_find(btmp, start, start + cnt, 1);
+        if (end == -1)
+        {
+            bitmap_set_range(btmp, start, cnt, 1);
+            if ((uint32_t)start == btmp->hint) btmp->hint = start + cnt;
+            return start;
+        }
+        start = bitmap_find(btmp, end, bit_cnt, 0);
+    }
+    return -1;
 }
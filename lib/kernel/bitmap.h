@@ -8,11 +8,17 @@ typedef struct bitmap
 {
     uint32_t bytes_length;
     uint8_t *btmp_ptr;
+    uint32_t hint;          // 位索引小于hint的位全部为1，bitmap_scan从此处开始扫描
 } bitmap;
 
 extern void bitmap_init(bitmap *btmp);  // 将位图中所有的位清零
+extern void bitmap_reset_hint(bitmap *btmp);    // 位图内容被直接修改(如从硬盘读入)后重置扫描起点
 extern bool bitmap_test(bitmap *btmp, uint32_t bit_idx);    // 返回指定位的状态
 extern void bitmap_set(bitmap *btmp, uint32_t bit_idx, const uint8_t val);      // 将指定位置为val(0或1)
+extern void bitmap_set_range(bitmap *btmp, uint32_t bit_idx, uint32_t cnt, const uint8_t val);    // 将从bit_idx开始的连续cnt个位置为val(0或1)
+extern int32_t bitmap_find(bitmap *btmp, uint32_t bit_idx, uint32_t limit, uint8_t val);     // 在[bit_idx, limit)中查找第一个值为val的位，找不到则返回-1
 extern int32_t bitmap_scan(bitmap *btmp, uint32_t cnt);        // 在bitmap中申请连续cnt个位, 并返回首个位的位索引
+extern uint32_t bit_scan_forward(uint32_t val);                 // 使用bsf指令返回非0值中最低的为1的位的位置
+extern uint32_t bit_scan_reverse(uint32_t val);                 // 使用bsr指令返回非0值中最高的为1的位的位置
 
 #endif
\ No newline at end of file
@@ -11,11 +11,19 @@ void list_init(list *plist)
     plist->head.prev = plist->tail.next = NULL;
     plist->head.next = &plist->tail;
     plist->tail.prev = &plist->head;
+    plist->head.owner = plist->tail.owner = NULL;
     plist->length = 0;
 
     set_intr_status(old_status);
 }
 
+// 初始化结点，使其不属于任何链表。结点所在的内存未被清零或是从别处复制而来时，必须先调用此函数
+void node_init(node *elem)
+{
+    elem->prev = elem->next = NULL;
+    elem->owner = NULL;
+}
+
 // 实际上这里plist参数是冗余的，但是可以提高访问length成员变量的效率
 void list_insert_before(list *plist, node *before, node *elem)
 {
@@ -28,6 +36,7 @@ void list_insert_before(list *plist, node *before, node *elem)
     elem->next = before;
     before->prev = elem;
     elem->prev->next = elem;
+    elem->owner = plist;
     plist->length++;
 
     set_intr_status(old_status);
@@ -43,6 +52,7 @@ void list_remove(list *plist, node *elem)
     ASSERT(elem != &plist->head && elem != &plist->tail);           // 不允许删除头结点和尾节点
     elem->prev->next = elem->next;
     elem->next->prev = elem->prev;
+    elem->owner = NULL;
     plist->length--;
 
     set_intr_status(old_status);
@@ -114,22 +124,9 @@ node *list_traversal(list *plist, func_ptr function, int arg)
     return NULL;
 }
 
+// 结点记录了其所在的链表，因此无需遍历链表即可判断
 bool list_find(list *plist, node *elem)
 {
-    intr_status old_status = set_intr_status(INTR_OFF);
-
     ASSERT((plist != NULL && elem != NULL));
-    node *pnode = &plist->head;
-    while (pnode != NULL)
-    {
-        if (pnode == elem)
-        {
-            set_intr_status(old_status);
-            return true;
-        }
-        pnode = pnode->next;
-    }
-
-    set_intr_status(old_status);
-    return false;
-}
\ No newline at end of file
+    return elem->owner == plist;
+}
@@ -16,6 +16,7 @@ typedef struct node
 {
     struct node *prev;
     struct node *next;
+    struct list *owner;     // 结点当前所在的链表，不在任何链表中时为NULL，用于O(1)判断结点是否在链表中
 } node;
 
 // 双向链表
@@ -30,6 +31,7 @@ typedef struct list
 typedef bool (*func_ptr)(node *elem, int arg);
 
 extern void list_init(list *plist);
+extern void node_init(node *elem);
 extern void list_insert_before(list *plist, node *before, node *elem);
 extern void list_remove(list *plist, node *elem);
 extern void list_push_front(list *plist, node *elem);
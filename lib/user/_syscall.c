@@ -15,9 +15,14 @@
 #include "keyboard.h"
 #include "exec.h"
 #include "pipe.h"
+#include "slab.h"
+#include "buffer.h"
+#include "dcache.h"
 
 typedef void *syscall;
 
+task_struct *find_hanging_child(task_struct *parent);      // 在parent的子进程中查找一个已退出但尚未被回收的子进程
+
 // 真正系统调用服务函数的入口地址表，由syscall_handler访问维护
 syscall syscall_table[] = 
 {
@@ -49,7 +54,9 @@ syscall syscall_table[] =
     sys_exit,
     sys_wait,
     sys_pipe,
-    sys_fd_redirect
+    sys_fd_redirect,
+    sys_sync,
+    sys_fsync
 };
 
 /***        真正提供服务的系统调用函数          ***/
@@ -94,25 +101,10 @@ int32_t sys_write(const uint32_t fd, const void *buf, uint32_t cnt)
 
 void *sys_malloc(const uint32_t size)
 {
-    if (current->pdt_base && current->u_mblock_descs[0].free_list.head.next->prev != &current->u_mblock_descs[0].free_list.head)
+    if (current->pdt_base)
     {
-        for (uint32_t i = 0; i < MBLOCK_DESC_CNT; ++i)
-        {
-            /* 由于链接关系的错乱，必须修正进程的内存块描述符数组 */
-            if (!current->u_mblock_descs[i].free_list.length)
-            {
-                current->u_mblock_descs[i].free_list.head.next = &current->u_mblock_descs[i].free_list.tail;
-                current->u_mblock_descs[i].free_list.tail.prev = &current->u_mblock_descs[i].free_list.head;
-            }
-            else
-            {
-                current->u_mblock_descs[i].free_list.head.next->prev = &current->u_mblock_descs[i].free_list.head;
-                current->u_mblock_descs[i].free_list.tail.prev->next = &current->u_mblock_descs[i].free_list.tail;
-            }
-
-            /* 必须修正arena中的描述符指针, 因为原来的指针指向的是父进程的描述符 */
-            list_traversal(&current->u_mblock_descs[i].free_list, fix_arena_pdesc, (int)&current->u_mblock_descs[i]);
-        }
+        /* 由于链接关系的错乱，必须修正进程的内存块描述符数组 */
+        mblock_desc_fix(current->u_mblock_descs);
     }
 
     return _malloc(current->pdt_base ? PF_USER : PF_KERNEL, size);
@@ -120,66 +112,13 @@ void *sys_malloc(const uint32_t size)
 
 void sys_free(void *ptr)
 {
-    if (current->pdt_base && current->u_mblock_descs[0].free_list.head.next->prev != &current->u_mblock_descs[0].free_list.head)
-    {
-        for (uint32_t i = 0; i < MBLOCK_DESC_CNT; ++i)
-        {
-            /* 由于链接关系的错乱，必须修正进程的内存块描述符数组 */
-            if (!current->u_mblock_descs[i].free_list.length)
-            {
-                current->u_mblock_descs[i].free_list.head.next = &current->u_mblock_descs[i].free_list.tail;
-                current->u_mblock_descs[i].free_list.tail.prev = &current->u_mblock_descs[i].free_list.head;
-            }
-            else
-            {
-                current->u_mblock_descs[i].free_list.head.next->prev = &current->u_mblock_descs[i].free_list.head;
-                current->u_mblock_descs[i].free_list.tail.prev->next = &current->u_mblock_descs[i].free_list.tail;
-            }
-
-            /* 必须修正arena中的描述符指针, 因为原来的指针指向的是父进程的描述符 */
-            list_traversal(&current->u_mblock_descs[i].free_list, fix_arena_pdesc, (int)&current->u_mblock_descs[i]);
-        }
-    }
-
-    phy_mem_pool *p_pm_pool = (ptr >= kernel_vm_pool.virt_addr_start ? &kernel_pm_pool : &user_pm_pool);
-    mutex_lock_acquire(&p_pm_pool->mutex);
-
-    ASSERT(ptr != NULL);
-    ASSERT(ptr >= (void *)KERNEL_VMP_START || 
-            (ptr < (void *)KERNEL_SPACE_START && ptr >= current->user_vm_pool.virt_addr_start));
-
-    arena *parena = BLOCK2ARENA(ptr);
-    ASSERT(parena->large == 0 || parena->large == 1);
-    if (parena->large && parena->pdesc == NULL)
-    {
-        mfree_pages(parena->cnt, (void *)parena);
-    }
-    else
+    if (current->pdt_base)
     {
-        mem_block_desc *pdesc = parena->pdesc;
-        mem_block *blk_addr = ARENA2BLOCK(parena, (((uint32_t)ptr - (uint32_t)parena - sizeof(arena)) / pdesc->block_size));
-        ASSERT(!list_find(&pdesc->free_list, &blk_addr->list_node));
-        list_push_back(&pdesc->free_list, &blk_addr->list_node);
-        parena->cnt++;
-
-        // 若回收内存块后该arena的所有块均空闲，应释放该arena
-        if (parena->cnt == pdesc->block_cnt_per_arena)
-        {
-            intr_status old_status = set_intr_status(INTR_OFF);
-            // 此处要注意在释放arena之前要将所有的内存块从free_list中去除，否则会导致奇怪的缺页故障
-            for (uint32_t blk_idx = 0; blk_idx < parena->cnt; blk_idx++)
-            {
-                blk_addr = ARENA2BLOCK(parena, blk_idx);
-                ASSERT(list_find(&pdesc->free_list, &blk_addr->list_node));
-                list_remove(&pdesc->free_list, &blk_addr->list_node);
-            }
-            set_intr_status(old_status);
-
-            mfree_pages(1, (void *)parena);
-        }
+        /* 由于链接关系的错乱，必须修正进程的内存块描述符数组 */
+        mblock_desc_fix(current->u_mblock_descs);
     }
 
-    mutex_lock_release(&p_pm_pool->mutex);
+    _free(ptr);
 }
 
 int32_t sys_open(const char* pathname, const uint8_t flag)
@@ -193,7 +132,7 @@ int32_t sys_open(const char* pathname, const uint8_t flag)
         return -1;
     }
 
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(pathname, sr);
     if (sr->f_type != FT_UNKNOWN)
@@ -203,14 +142,14 @@ int32_t sys_open(const char* pathname, const uint8_t flag)
             // 处理用户提供的路径中把某个文件当目录的情况
             printk("Unable to access '%s': not a directory.\n", sr->search_path);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
         if (flag & O_CREAT)
         {
             printk("A file or directory with the same name already exists.\n");
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
         else
@@ -219,13 +158,13 @@ int32_t sys_open(const char* pathname, const uint8_t flag)
             {
                 printk("Unable to open a directory '%s'. Please use opendir() instead.\n", sr->search_path);
                 dir_close(sr->parent_dir);
-                sys_free(sr);
+                slab_free(search_record_cache, sr);
                 return -1;
             }
 
             int32_t ret_val = file_open(sr->part, sr->i_no, flag);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return ret_val;
         }
     }
@@ -242,19 +181,19 @@ int32_t sys_open(const char* pathname, const uint8_t flag)
                 if (i_no == -1)
                 {
                     dir_close(sr->parent_dir);
-                    sys_free(sr);
+                    slab_free(search_record_cache, sr);
                     return -1;
                 }
                 int32_t ret_val = file_open(sr->parent_dir->p_inode->part, (uint32_t)i_no, flag);
                 dir_close(sr->parent_dir);
-                sys_free(sr);
+                slab_free(search_record_cache, sr);
                 return ret_val;
             }
             else
             {
                 printk("Unable to access '%s': fail to create a file.\n", sr->search_path);
                 dir_close(sr->parent_dir);
-                sys_free(sr);
+                slab_free(search_record_cache, sr);
                 return -1;
             }
         }
@@ -262,7 +201,7 @@ int32_t sys_open(const char* pathname, const uint8_t flag)
         {
             printk("Unable to access '%s': no this file or directory.\n", sr->search_path);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
     }
@@ -376,7 +315,7 @@ int32_t sys_lseek(const uint32_t fd, const int32_t offset, const uint8_t whence)
 
 int32_t sys_unlink(const char *pathname)
 {
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(pathname, sr);
 
@@ -384,14 +323,28 @@ int32_t sys_unlink(const char *pathname)
     {
         printk("sys_unlink: unable to find '%s'\n", sr->search_path);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return -1;
     }
     else if (sr->f_type == FT_DIRECTORY)
     {
         printk("Unable to unlink a directory '%s'. Please use rmdir() instead.\n", sr->search_path);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
+        return -1;
+    }
+
+    // 持有父目录的写锁，并确认目录项在搜索之后没有被其他线程删除
+    char *filename = strrchr(sr->search_path, '/');
+    filename = (filename ? (filename + 1) : sr->search_path);
+    rw_lock_write_acquire(&sr->parent_dir->p_inode->rwlock);
+    dentry dir_e;
+    if (dir_search(sr->parent_dir, filename, &dir_e) != sr->part || dir_e.i_no != sr->i_no)
+    {
+        printk("sys_unlink: unable to find '%s'\n", sr->search_path);
+        rw_lock_write_release(&sr->parent_dir->p_inode->rwlock);
+        dir_close(sr->parent_dir);
+        slab_free(search_record_cache, sr);
         return -1;
     }
 
@@ -401,26 +354,25 @@ int32_t sys_unlink(const char *pathname)
         if (file_table[i].p_inode && (file_table[i].p_inode->part == sr->part) && (file_table[i].p_inode->i_no == sr->i_no))
         {
             printk("sys_unlink: unable to delete the file '%s': this file has been opened\n", sr->search_path);
+            rw_lock_write_release(&sr->parent_dir->p_inode->rwlock);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
     }
 
     inode_release(sr->part, sr->i_no);
-    
-    char *filename = strrchr(sr->search_path, '/');
-    filename = (filename ? (filename + 1) : sr->search_path);
     del_dentry(sr->parent_dir, filename);
+    rw_lock_write_release(&sr->parent_dir->p_inode->rwlock);
 
     dir_close(sr->parent_dir);
-    sys_free(sr);
+    slab_free(search_record_cache, sr);
     return 0;
 }
 
 int32_t sys_mkdir(const char *pathname)
 {
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(pathname, sr);
     if (sr->f_type == FT_UNKNOWN)
@@ -431,14 +383,14 @@ int32_t sys_mkdir(const char *pathname)
             filename = (filename ? (filename + 1) : sr->search_path);
             int32_t ret_val = dir_create(sr->parent_dir, filename);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return ret_val;
         }
         else
         {
             printk("sys_mkdir: unable to access the directory '%s'\n", sr->search_path);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
     }
@@ -448,19 +400,19 @@ int32_t sys_mkdir(const char *pathname)
         {
             printk("sys_mkdir: unable to access '%s': not a directory.\n", sr->search_path);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
         printk("sys_mkdir: a file or directory with the same name already exists\n");
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return -1;
     }
 }
 
 dir *sys_opendir(const char *pathname)
 {
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(pathname, sr);
 
@@ -470,19 +422,19 @@ dir *sys_opendir(const char *pathname)
         {
             printk("sys_opendir: unable to open a regular file and please use open() instead\n");
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return NULL;
         }
         dir *pdir = dir_open(sr->part, sr->i_no);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return pdir;
     }
     else
     {
         printk("sys_opendir: unable to find the directory '%s'\n", sr->search_path);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return NULL;
     }
 }
@@ -508,7 +460,7 @@ dentry *sys_readdir(dir *pdir)
 
 int32_t sys_rmdir(const char* pathname)
 {
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(pathname, sr);
 
@@ -518,36 +470,52 @@ int32_t sys_rmdir(const char* pathname)
         {
             printk("sys_rmdir: unable to remove a regular file and please use unlink() instead\n");
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
+            return -1;
+        }
+        // 依次持有父目录和待删除目录的写锁，并确认目录项在搜索之后没有被其他线程删除
+        char *filename = strrchr(sr->search_path, '/');
+        filename = (filename ? (filename + 1) : sr->search_path);
+        rw_lock_write_acquire(&sr->parent_dir->p_inode->rwlock);
+        dentry dir_e;
+        if (dir_search(sr->parent_dir, filename, &dir_e) != sr->part || dir_e.i_no != sr->i_no)
+        {
+            printk("sys_rmdir: unable to find '%s'\n", sr->search_path);
+            rw_lock_write_release(&sr->parent_dir->p_inode->rwlock);
+            dir_close(sr->parent_dir);
+            slab_free(search_record_cache, sr);
             return -1;
         }
+
         inode *p_inode = inode_open(sr->part, sr->i_no);
+        rw_lock_write_acquire(&p_inode->rwlock);
         ASSERT(p_inode->i_size >= 2 * sizeof(dentry));
         if (p_inode->i_size > 2 * sizeof(dentry))
         {
             printk("sys_rmdir: unable to remove a non-empty directory '%s'\n", sr->search_path);
+            rw_lock_write_release(&p_inode->rwlock);
             inode_close(p_inode);
+            rw_lock_write_release(&sr->parent_dir->p_inode->rwlock);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
+        rw_lock_write_release(&p_inode->rwlock);
         inode_close(p_inode);
 
         inode_release(sr->part, sr->i_no);
-
-        char *filename = strrchr(sr->search_path, '/');
-        filename = (filename ? (filename + 1) : sr->search_path);
         del_dentry(sr->parent_dir, filename);
+        rw_lock_write_release(&sr->parent_dir->p_inode->rwlock);
         
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return 0;
     }
     else
     {
         printk("sys_rmdir: unable to find '%s'\n", sr->search_path);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return -1;
     }
 }
@@ -602,7 +570,7 @@ char *sys_getcwd(char *buf, uint32_t size)
 
 int32_t sys_chdir(const char *pathname)
 {
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(pathname, sr);
 
@@ -612,27 +580,27 @@ int32_t sys_chdir(const char *pathname)
         {
             printk("sys_chdir: '%s': not a directory\n", sr->search_path);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
         current->wd_part = sr->part;
         current->wd_i_no = sr->i_no;
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return 0;
     }
     else
     {
         printk("sys_chdir: unable to find '%s'\n", sr->search_path);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return -1;
     }
 }
 
 int32_t sys_stat(const char *pathname, struct stat *buf)
 {
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(pathname, sr);
 
@@ -642,7 +610,7 @@ int32_t sys_stat(const char *pathname, struct stat *buf)
         {
             printk("sys_stat: '%s': not a directory\n", sr->search_path);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
         inode *p_inode = inode_open(sr->part, sr->i_no);
@@ -651,14 +619,14 @@ int32_t sys_stat(const char *pathname, struct stat *buf)
         buf->f_type = sr->f_type;
         inode_close(p_inode);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return 0;
     }
     else
     {
         // printk("sys_stat: unable to find '%s'\n", sr->search_path);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return -1;
     }
 }
@@ -673,7 +641,7 @@ bool mnt_pt_check(node *pnode, int arg)
 
 int32_t sys_mount(const char *source, const char *target)
 {
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(target, sr);
 
@@ -683,7 +651,7 @@ int32_t sys_mount(const char *source, const char *target)
         {
             printk("sys_mount: '%s': not a directory\n", sr->search_path);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
         node *pnode = list_traversal(&partition_list, part_name_check, (int)source);
@@ -691,18 +659,29 @@ int32_t sys_mount(const char *source, const char *target)
         {
             printk("sys_mount: unable to find the partition named '%s'\n", source);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
         partition *child_part = member2struct(pnode, partition, list_node);
 
+        // 如果文件系统的相关信息尚未加载到内存，需要先加载文件系统的相关信息，须在改变任何挂载信息之前完成
+        if (!child_part->sb && !partition_mount(child_part))
+        {
+            printk("sys_mount: '%s': unsupported filesystem\n", source);
+            dir_close(sr->parent_dir);
+            slab_free(search_record_cache, sr);
+            return -1;
+        }
+
         // 如果目标文件系统原来已挂载于其他挂载点，则应该先将其从原挂载点卸载
         mount_point tmp;
         if (child_part->parent_part)
         {
+            rw_lock_write_acquire(&child_part->parent_part->rwlock);
             node *pnode = list_traversal(&child_part->parent_part->mount_list, mnt_pt_check, child_part->mount_i_no);
             ASSERT(pnode);
             list_remove(&child_part->parent_part->mount_list, pnode);
+            rw_lock_write_release(&child_part->parent_part->rwlock);
             mount_point *mnt_pt = member2struct(pnode, mount_point, list_node);
             memcpy(&tmp, mnt_pt, sizeof(mount_point));
             sys_free(mnt_pt);
@@ -724,10 +703,13 @@ int32_t sys_mount(const char *source, const char *target)
                 mount_point *mnt_pt = (mount_point *)kmalloc(sizeof(mount_point));
                 ASSERT(mnt_pt);
                 memcpy(mnt_pt, &tmp, sizeof(mount_point));
+                rw_lock_write_acquire(&child_part->parent_part->rwlock);
                 list_push_front(&child_part->parent_part->mount_list, &mnt_pt->list_node);
+                rw_lock_write_release(&child_part->parent_part->rwlock);
+                dcache_invalidate_all();
 
                 dir_close(sr->parent_dir);
-                sys_free(sr);
+                slab_free(search_record_cache, sr);
                 return -1;
             }
 
@@ -736,14 +718,20 @@ int32_t sys_mount(const char *source, const char *target)
             mp_p_i_no = sr->part->mount_p_i_no;
 
             // 将原来已挂载的文件系统卸载
+            rw_lock_write_acquire(&sr->part->rwlock);
             sr->part->parent_part = NULL;
+            rw_lock_write_release(&sr->part->rwlock);
+            rw_lock_write_acquire(&parent_part->rwlock);
             node *pnode = list_traversal(&parent_part->mount_list, mnt_pt_check, sr->part->mount_i_no);
             if (pnode)
             {
                 // 由于同一个文件系统可能会被重复挂载于同一个挂载点，因此此处无法执行 ASSERT(pnode);
                 list_remove(&parent_part->mount_list, pnode);
-                mount_point *mnt_pt = member2struct(pnode, mount_point, list_node);
-                sys_free(mnt_pt);
+            }
+            rw_lock_write_release(&parent_part->rwlock);
+            if (pnode)
+            {
+                sys_free(member2struct(pnode, mount_point, list_node));
             }
         }
         else
@@ -753,39 +741,38 @@ int32_t sys_mount(const char *source, const char *target)
             mp_p_i_no = sr->parent_dir->p_inode->i_no;
         }
 
-        // 如果文件系统的相关信息尚未加载到内存，需要先加载文件系统的相关信息
-        if (!child_part->sb)
-        {
-            partition_mount(child_part);
-        }
-
         // 挂载目标文件系统
         mount_point *mnt_pt = (mount_point *)kmalloc(sizeof(mount_point));
         ASSERT(mnt_pt);
         mnt_pt->i_no = mp_i_no;
         mnt_pt->part = child_part;
+        rw_lock_write_acquire(&parent_part->rwlock);
         list_push_front(&parent_part->mount_list, &mnt_pt->list_node);  
+        rw_lock_write_release(&parent_part->rwlock);
 
+        rw_lock_write_acquire(&child_part->rwlock);
         child_part->parent_part = parent_part;
         child_part->mount_i_no = mp_i_no;
         child_part->mount_p_i_no = mp_p_i_no;
+        rw_lock_write_release(&child_part->rwlock);
+        dcache_invalidate_all();         // 挂载点处的路径解析结果已经改变
 
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return 0;
     }   
     else
     {
         printk("sys_mount: unable to find '%s'\n", sr->search_path);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return -1;
     }
 }
 
 int32_t sys_umount(const char *target)
 {
-    search_record *sr = (search_record *)kmalloc(sizeof(search_record));
+    search_record *sr = (search_record *)slab_alloc(search_record_cache);
     ASSERT(sr);
     search_file(target, sr);
 
@@ -795,33 +782,41 @@ int32_t sys_umount(const char *target)
         {
             printk("sys_umount: '%s': not mounted\n", sr->search_path);
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
         if (sr->part->mount_list.length)
         {
             printk("sys_umount: target is busy\n");
             dir_close(sr->parent_dir);
-            sys_free(sr);
+            slab_free(search_record_cache, sr);
             return -1;
         }
 
-        node *pnode = list_traversal(&sr->part->parent_part->mount_list, mnt_pt_check, sr->part->mount_i_no);
+        partition *parent_part = sr->part->parent_part;
+        rw_lock_write_acquire(&parent_part->rwlock);
+        node *pnode = list_traversal(&parent_part->mount_list, mnt_pt_check, sr->part->mount_i_no);
         ASSERT(pnode);
-        list_remove(&sr->part->parent_part->mount_list, pnode);
+        list_remove(&parent_part->mount_list, pnode);
+        rw_lock_write_release(&parent_part->rwlock);
         mount_point *mnt_pt = member2struct(pnode, mount_point, list_node);
         sys_free(mnt_pt);
+        rw_lock_write_acquire(&sr->part->rwlock);
         sr->part->parent_part = NULL;
+        rw_lock_write_release(&sr->part->rwlock);
+        dcache_invalidate_all();
+        inode_cache_shrink(sr->part);
+        buffer_flush(sr->part->my_disk);        // 卸载后确保该分区的修改都已写入硬盘
         
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return 0;
     }
     else
     {
         printk("sys_umount: unable to find '%s'\n", sr->search_path);
         dir_close(sr->parent_dir);
-        sys_free(sr);
+        slab_free(search_record_cache, sr);
         return -1;
     }
 }
@@ -833,10 +828,11 @@ int32_t sys_fork(void)
 
     copy_process(child);
 
-    intr_status old_status = set_intr_status(INTR_OFF);
-
+    intr_status old_status = spin_lock_irqsave(&thread_all_lock);
     list_push_back(&thread_all_list, &child->all_list_node);
-    list_push_back(&thread_ready_list, &child->general_list_node);
+    spin_unlock(&thread_all_lock);
+
+    thread_enqueue(child, false);
 
     thread_yield();         // 尽可能让子进程先运行，减少内存拷贝的开销
 
@@ -862,7 +858,7 @@ void sys_clear(void)
 void sys_ps(void)
 {
     printk("PID     PPID    STAT        TICKS       NAME\n");
-    list_traversal(&thread_all_list, node2thread_info, 0);
+    thread_all_traversal(node2thread_info, 0);
 }
 
 int32_t sys_execv(const char *pathname, char *argv[])
@@ -917,17 +913,38 @@ void sys_exit(const int32_t status)
 
     current->exit_status = status;
 
+    // 被init收养的子进程中可能已有退出的，需要通知init回收
+    bool has_child = (current->child != NULL);
     adopt_children(process_init, current);
     release_process_resource();
 
+    // 父进程持有进程树的锁查找挂起的子进程，因此在该锁的保护下先置为挂起态再唤醒父进程，父进程不会错过唤醒
+    // 父进程回收前会等待本进程在处理器上完成切换
     set_intr_status(INTR_OFF);
+    spin_lock(&proc_tree_lock);
 
-    if (current->parent->status == TASK_WAITING)
+    current->status = TASK_HANGING;
+    if (has_child)
     {
-        thread_unblock(current->parent);
+        wake_up_one(&process_init->child_exit_wq);
     }
+    wake_up_one(&current->parent->child_exit_wq);
+
+    spin_unlock(&proc_tree_lock);
+    schedule();
+}
 
-    thread_block(TASK_HANGING);
+// 在parent的子进程中查找一个已退出但尚未被回收的子进程，找不到则返回NULL，调用者须持有进程树的锁
+task_struct *find_hanging_child(task_struct *parent)
+{
+    for (task_struct *p = parent->child; p; p = p->o_sibling)
+    {
+        if (p->status == TASK_HANGING)
+        {
+            return p;
+        }
+    }
+    return NULL;
 }
 
 int32_t sys_wait(int32_t *status)
@@ -937,25 +954,19 @@ int32_t sys_wait(int32_t *status)
         return -1;
     }
 
-    while (1)
-    {
-        task_struct *p = current->child;
-        while (p)
-        {
-            if (p->status == TASK_HANGING)
-            {
-                *status = p->exit_status;
-                pid_t pid = p->pid;
+    // 子进程退出时才会唤醒父进程，每次被唤醒只需重新查找一次子进程链表
+    task_struct *p;
+    intr_status old_status = spin_lock_irqsave(&proc_tree_lock);
+    wait_event_locked(&current->child_exit_wq, (p = find_hanging_child(current)) != NULL, &proc_tree_lock);
+    spin_unlock_irqrestore(&proc_tree_lock, old_status);
 
-                p->status = TASK_DIED;
-                process_exit(p);
+    *status = p->exit_status;
+    pid_t pid = p->pid;
 
-                return pid;
-            }
-            p = p->o_sibling;
-        }
-        thread_block(TASK_WAITING);
-    }
+    p->status = TASK_DIED;
+    process_exit(p);
+
+    return pid;
 }
 
 int32_t sys_pipe(uint32_t pipe_fd[2])
@@ -980,7 +991,7 @@ int32_t sys_pipe(uint32_t pipe_fd[2])
         return -1;
     }
 
-    ioqueue *pioqueue = kmalloc(sizeof(ioqueue));
+    ioqueue *pioqueue = slab_alloc(pipe_cache);
     if (!pioqueue)
     {
         return -1;
@@ -989,7 +1000,7 @@ int32_t sys_pipe(uint32_t pipe_fd[2])
     void *buf = get_kernel_pages(1);
     if (!buf)
     {
-        sys_free(pioqueue);
+        slab_free(pipe_cache, pioqueue);
         return -1;
     }
 
@@ -1020,4 +1031,28 @@ int32_t sys_fd_redirect(uint32_t old_fd, uint32_t new_fd)
     }
     current->fd_table[old_fd] = (new_fd < 3) ? new_fd : current->fd_table[new_fd];
     return 0;
-}
\ No newline at end of file
+}
+
+void sys_sync(void)
+{
+    buffer_flush(NULL);
+}
+
+int32_t sys_fsync(const uint32_t fd)
+{
+    if (fd >= MAX_FILES_OPEN_PER_PROC || fd < 3 || is_pipe(fd))
+    {
+        printk("sys_fsync: invalid fd.\n");
+        return -1;
+    }
+    uint32_t g_idx = current->fd_table[fd];
+    if (g_idx == -1)
+    {
+        printk("sys_fsync: fd provided hasn't been attached with any file.\n");
+        return -1;
+    }
+
+    // 缓冲区不记录所属文件，写回文件所在硬盘的全部脏缓冲区，其中包括该文件的数据和inode
+    buffer_flush(file_table[g_idx].p_inode->part->my_disk);
+    return 0;
+}
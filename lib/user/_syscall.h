@@ -36,5 +36,7 @@ extern void sys_exit(const int32_t status);
 extern int32_t sys_wait(int32_t *status);
 extern int32_t sys_pipe(uint32_t pipe_fd[2]);
 extern int32_t sys_fd_redirect(uint32_t old_fd, uint32_t new_fd);
+extern void sys_sync(void);
+extern int32_t sys_fsync(const uint32_t fd);
 
 #endif
\ No newline at end of file
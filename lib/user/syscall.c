@@ -29,6 +29,8 @@
 #define SYS_WAIT 26
 #define SYS_PIPE 27
 #define SYS_FD_REDIRECT 28
+#define SYS_SYNC 29
+#define SYS_FSYNC 30
 
 
 #define _syscall0(SYS_NR) \
@@ -235,4 +237,16 @@ int32_t pipe(uint32_t pipe_fd[2])
 int32_t fd_redirect(uint32_t old_fd, uint32_t new_fd)
 {
     return _syscall2(SYS_FD_REDIRECT, old_fd, new_fd);
-} 
\ No newline at end of file
+}
+
+// 将所有已修改的缓冲区写回硬盘
+void sync(void)
+{
+    _syscall0(SYS_SYNC);
+}
+
+// 将fd指向的文件已修改的数据写回硬盘，成功返回0，失败返回-1
+int32_t fsync(const uint32_t fd)
+{
+    return _syscall1(SYS_FSYNC, fd);
+}
@@ -36,5 +36,7 @@ extern void exit(const int32_t status);   // 释放当前进程占有的大部
 extern int32_t wait(int32_t *status);   // 使当前进程等待某一个子进程调用exit函数退出，获取该子进程的退出状态并返回其pid，若当前进程无子进程则返回-1 
 extern int32_t pipe(uint32_t pipe_fd[2]); // 创建一个管道，成功返回0，失败返回-1
 extern int32_t fd_redirect(uint32_t old_fd, uint32_t new_fd);  // 文件描述符重定位, 成功返回0，失败返回-1
+extern void sync(void);     // 将所有已修改的缓冲区写回硬盘
+extern int32_t fsync(const uint32_t fd);    // 将fd指向的文件已修改的数据写回硬盘，成功返回0，失败返回-1
 
 #endif
\ No newline at end of file
@@ -1,6 +1,5 @@
 [bits 32]
 
-extern current
 global switch_to
 
 SECTION .text
@@ -16,12 +15,11 @@ switch_to:
     ; eax中保存的是next变量的值，之前错误地把该行删了(判断是否需要切换的代码转移到schedule中了)，导致了奇怪的缺页中断，调试了很久
     mov eax, [esp + 20]
 
-    mov ebx, [current]
+    mov ebx, esp
+    and ebx, 0xfffff000 ; PCB与内核栈位于同一页中，当前线程的PCB即栈指针所在页的起始地址
     mov [ebx], esp      ; 将esp存入kstack_ptr变量中
 
-    mov [current], eax  ; current = next
-
-    mov esp, [eax]       ; 切换到新线程或新进程的栈
+    mov esp, [eax]       ; 切换到新线程或新进程的栈，之后由栈指针得到的current即为next
 
     pop ebx
     pop ebp
@@ -3,43 +3,43 @@
 #include "interrupt.h"
 #include "global.h"
 #include "debug.h"
+#include "smp.h"
 
 // 信号量初始化
 void sem_init(semaphore *psem, const int32_t value)
 {
-    pthread_status old_status = set_intr_status(INTR_OFF);
-
     ASSERT(psem != NULL);
+    spin_lock_init(&psem->lock);
     psem->value = value;
     list_init(&psem->block_queue);
-
-    set_intr_status(old_status);
 }  
 
 // 信号量的P操作(原子操作)
 void sem_down(semaphore *psem)
 {
-    pthread_status old_status = set_intr_status(INTR_OFF);
-
     ASSERT(psem != NULL);
+    intr_status old_status = spin_lock_irqsave(&psem->lock);
+
     psem->value--;
     if (psem->value < 0)
     {
-        // 没有资源时应当进入阻塞队列阻塞等待
+        // 没有资源时应当进入阻塞队列阻塞等待，阻塞的同时释放信号量的锁
         ASSERT(!list_find(&psem->block_queue, &current->general_list_node));
         list_push_back(&psem->block_queue, &current->general_list_node); 
-        thread_block(TASK_BLOCKED);
+        thread_block_locked(TASK_BLOCKED, &psem->lock);
+        set_intr_status(old_status);
+        return;
     }
 
-    set_intr_status(old_status);
+    spin_unlock_irqrestore(&psem->lock, old_status);
 }  
 
 // 信号量的V操作(原子操作)
 void sem_up(semaphore *psem)
 {
-    pthread_status old_status = set_intr_status(INTR_OFF);
-
     ASSERT(psem != NULL);
+    intr_status old_status = spin_lock_irqsave(&psem->lock);
+
     psem->value++;
     if (psem->value <= 0)
     {
@@ -47,67 +47,272 @@ void sem_up(semaphore *psem)
         thread_unblock(member2struct(list_pop_front(&psem->block_queue), task_struct, general_list_node));
     }
 
-    set_intr_status(old_status);
+    spin_unlock_irqrestore(&psem->lock, old_status);
 }  
 
+// 自旋锁初始化
+void spin_lock_init(spinlock *plock)
+{
+    ASSERT(plock != NULL);
+    plock->locked = 0;
+}
+
+// 获取自旋锁
+void spin_lock(spinlock *plock)
+{
+    while (atomic_xchg(&plock->locked, 1))
+    {
+        // 先只读地等待锁被释放，避免反复执行带锁的总线操作
+        while (plock->locked)
+        {
+            cpu_relax();
+        }
+    }
+}
+
+// 尝试获取自旋锁，锁已被持有时立即返回false
+bool spin_trylock(spinlock *plock)
+{
+    return atomic_xchg(&plock->locked, 1) == 0;
+}
+
+// 释放自旋锁
+void spin_unlock(spinlock *plock)
+{
+    ASSERT(plock->locked);
+    atomic_xchg(&plock->locked, 0);
+}
+
+// 关中断并获取自旋锁，返回原来的中断状态
+// 关中断防止本处理器上的中断处理程序竞争同一把锁，自旋锁防止其他处理器竞争，临界区内不能睡眠
+intr_status spin_lock_irqsave(spinlock *plock)
+{
+    intr_status old_status = set_intr_status(INTR_OFF);
+    spin_lock(plock);
+    return old_status;
+}
+
+// 释放自旋锁并恢复中断状态
+void spin_unlock_irqrestore(spinlock *plock, intr_status old_status)
+{
+    spin_unlock(plock);
+    set_intr_status(old_status);
+}
+
+// 等待队列初始化
+void wait_queue_init(wait_queue *pwq)
+{
+    ASSERT(pwq != NULL);
+    spin_lock_init(&pwq->lock);
+    list_init(&pwq->waiters);
+}
+
+// 将当前线程阻塞在等待队列上(须关中断)，plock非空时阻塞期间释放该自旋锁，被唤醒后重新获取
+// 先取得等待队列的锁再释放plock，入队后直到线程切换出去都持有锁，唤醒者不会错过该线程
+void wait_queue_sleep(wait_queue *pwq, spinlock *plock)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    if (plock != &pwq->lock)
+    {
+        spin_lock(&pwq->lock);
+        if (plock)
+        {
+            spin_unlock(plock);
+        }
+    }
+
+    ASSERT(!list_find(&pwq->waiters, &current->general_list_node));
+    list_push_back(&pwq->waiters, &current->general_list_node);
+    thread_block_locked(TASK_BLOCKED, &pwq->lock);
+
+    if (plock)
+    {
+        spin_lock(plock);
+    }
+}
+
+// 唤醒等待队列中最早阻塞的一个线程
+void wake_up_one(wait_queue *pwq)
+{
+    intr_status old_status = spin_lock_irqsave(&pwq->lock);
+    if (pwq->waiters.length)
+    {
+        thread_unblock(member2struct(list_pop_front(&pwq->waiters), task_struct, general_list_node));
+    }
+    spin_unlock_irqrestore(&pwq->lock, old_status);
+}
+
+// 唤醒等待队列中的所有线程
+void wake_up_all(wait_queue *pwq)
+{
+    intr_status old_status = spin_lock_irqsave(&pwq->lock);
+    while (pwq->waiters.length)
+    {
+        thread_unblock(member2struct(list_pop_front(&pwq->waiters), task_struct, general_list_node));
+    }
+    spin_unlock_irqrestore(&pwq->lock, old_status);
+}
+
 // 锁的初始化
 void mutex_lock_init(mutex_lock *plock)
 {
-    pthread_status old_status = set_intr_status(INTR_OFF);
-
     ASSERT(plock != NULL);
     plock->holder = NULL;
+    plock->state = 0;
     plock->acquire_nr = 0;
-    sem_init(&plock->sem, 1);
-
-    set_intr_status(old_status);
+    wait_queue_init(&plock->waiters);
 }
 
-// 获取锁     
+// 获取锁
 void mutex_lock_acquire(mutex_lock *plock)
 {
-    pthread_status old_status = set_intr_status(INTR_OFF);
-
     ASSERT(plock != NULL);
-    if (plock->holder != current)
-    {
-        // 若当前未持有锁，则尝试获取获取锁
-        sem_down(&plock->sem);
-        plock->holder = current;
-        ASSERT(plock->acquire_nr == 0);
-        plock->acquire_nr = 1;
-    }
-    else
+    if (plock->holder == current)
     {
         // 若已经持有锁，则不应该继续尝试获取锁，否则会造成死锁
         ASSERT(plock->acquire_nr >= 1);
         plock->acquire_nr++;
+        return;
     }
 
-    set_intr_status(old_status);
-}  
+    // 快速路径：锁空闲时一次原子操作即可获得锁
+    if (atomic_cmpxchg(&plock->state, 0, 1) != 0)
+    {
+        // 慢速路径：将状态标记为有等待者后阻塞，被唤醒后重新竞争
+        // 被唤醒的线程总是把状态重新置为2，从而保证队列中剩余的等待者不会被遗漏
+        // 标记和入队都在持有等待队列的锁时进行，释放者看到2后唤醒时一定能找到该线程
+        intr_status old_status = spin_lock_irqsave(&plock->waiters.lock);
+        while (atomic_xchg(&plock->state, 2) != 0)
+        {
+            wait_queue_sleep(&plock->waiters, &plock->waiters.lock);
+        }
+        spin_unlock_irqrestore(&plock->waiters.lock, old_status);
+    }
+
+    plock->holder = current;
+    ASSERT(plock->acquire_nr == 0);
+    plock->acquire_nr = 1;
+}
 
-// 释放锁, 如果释放锁的操作不是原子的，那么如果在plock->holder = NULL; 执行完之后发生了时钟中断，
-// 时钟中断中某些获取锁的操作可能会导致死锁，因为sem_up 和 plock->holder = NULL 没有一次性执行完毕
+// 释放锁
 void mutex_lock_release(mutex_lock *plock)
 {
-    pthread_status old_status = set_intr_status(INTR_OFF);
-
     ASSERT(plock != NULL && plock->holder == current);
     ASSERT(plock->acquire_nr >= 1);
 
-    // 申请了多少次锁，就得释放多少次锁
-    plock->acquire_nr--;
-    if (plock->acquire_nr > 0)
+    // 申请了多少次锁，就得释放多少次锁，只有最后一次释放锁才会真正释放该锁
+    if (--plock->acquire_nr > 0)
     {
-        set_intr_status(old_status);
         return;
     }
-    // 只有最后一次释放锁才会真正释放该锁
-    ASSERT(plock->acquire_nr == 0);
     plock->holder = NULL;
-    sem_up(&plock->sem);
 
-    set_intr_status(old_status);
-}  
+    // 快速路径：没有等待者时一次原子操作即可释放锁
+    if (atomic_xchg(&plock->state, 0) == 1)
+    {
+        return;
+    }
+
+    // 慢速路径：唤醒一个等待者，锁已经释放，被唤醒者仍需重新竞争
+    wake_up_one(&plock->waiters);
+}
+
+// 读写锁的初始化
+void rw_lock_init(rw_lock *plock)
+{
+    ASSERT(plock != NULL);
+    spin_lock_init(&plock->guard);
+    plock->readers = 0;
+    plock->writer = NULL;
+    plock->write_nr = 0;
+    wait_queue_init(&plock->read_queue);
+    wait_queue_init(&plock->write_queue);
+}
+
+// 获取读锁
+void rw_lock_read_acquire(rw_lock *plock)
+{
+    ASSERT(plock != NULL);
+    intr_status old_status = spin_lock_irqsave(&plock->guard);
+
+    if (plock->writer == current)
+    {
+        // 写者在持有写锁时读取，视为再次获取写锁
+        plock->write_nr++;
+    }
+    else
+    {
+        // 有写者持有或等待写锁时阻塞，避免写者饿死
+        wait_event_locked(&plock->read_queue, !plock->writer && !plock->write_queue.waiters.length, &plock->guard);
+        plock->readers++;
+    }
 
+    spin_unlock_irqrestore(&plock->guard, old_status);
+}
+
+// 释放读锁
+void rw_lock_read_release(rw_lock *plock)
+{
+    ASSERT(plock != NULL);
+    if (plock->writer == current)
+    {
+        rw_lock_write_release(plock);
+        return;
+    }
+
+    intr_status old_status = spin_lock_irqsave(&plock->guard);
+
+    ASSERT(plock->readers > 0);
+    if (--plock->readers == 0)
+    {
+        // 最后一个读者离开时唤醒一个写者
+        wake_up_one(&plock->write_queue);
+    }
+
+    spin_unlock_irqrestore(&plock->guard, old_status);
+}
+
+// 获取写锁
+void rw_lock_write_acquire(rw_lock *plock)
+{
+    ASSERT(plock != NULL);
+    intr_status old_status = spin_lock_irqsave(&plock->guard);
+
+    if (plock->writer == current)
+    {
+        plock->write_nr++;
+    }
+    else
+    {
+        wait_event_locked(&plock->write_queue, !plock->writer && !plock->readers, &plock->guard);
+        plock->writer = current;
+        plock->write_nr = 1;
+    }
+
+    spin_unlock_irqrestore(&plock->guard, old_status);
+}
+
+// 释放写锁
+void rw_lock_write_release(rw_lock *plock)
+{
+    ASSERT(plock != NULL && plock->writer == current);
+    intr_status old_status = spin_lock_irqsave(&plock->guard);
+
+    ASSERT(plock->write_nr >= 1);
+    if (--plock->write_nr == 0)
+    {
+        plock->writer = NULL;
+        if (plock->write_queue.waiters.length)
+        {
+            // 优先唤醒一个写者
+            wake_up_one(&plock->write_queue);
+        }
+        else
+        {
+            // 没有写者等待时唤醒所有读者
+            wake_up_all(&plock->read_queue);
+        }
+    }
+
+    spin_unlock_irqrestore(&plock->guard, old_status);
+}
@@ -3,10 +3,75 @@
 
 #include "stdint.h"
 #include "list.h"
+#include "interrupt.h"
+
+// 原子地将*ptr设置为val，返回*ptr原来的值
+static inline uint32_t atomic_xchg(volatile uint32_t *ptr, uint32_t val)
+{
+    asm volatile ("xchgl %0, %1" : "+r"(val), "+m"(*ptr) : : "memory");
+    return val;
+}
+
+// 若*ptr等于old则原子地将其设置为val，返回*ptr原来的值
+static inline uint32_t atomic_cmpxchg(volatile uint32_t *ptr, uint32_t old, uint32_t val)
+{
+    uint32_t prev;
+    asm volatile ("lock cmpxchgl %2, %1" : "=a"(prev), "+m"(*ptr) : "r"(val), "0"(old) : "memory");
+    return prev;
+}
+
+// 自旋锁结构体，适用于不会睡眠的短临界区
+typedef struct spinlock
+{
+    volatile uint32_t locked;   // 0表示空闲，1表示已被持有
+} spinlock;
+
+extern void spin_lock_init(spinlock *plock);       // 自旋锁初始化
+extern void spin_lock(spinlock *plock);            // 获取自旋锁
+extern bool spin_trylock(spinlock *plock);         // 尝试获取自旋锁，锁已被持有时立即返回false
+extern void spin_unlock(spinlock *plock);          // 释放自旋锁
+extern intr_status spin_lock_irqsave(spinlock *plock);                       // 关中断并获取自旋锁，返回原来的中断状态
+extern void spin_unlock_irqrestore(spinlock *plock, intr_status old_status); // 释放自旋锁并恢复中断状态
+
+// 等待队列，线程在其上阻塞直到被等待的事件发生
+typedef struct wait_queue
+{
+    spinlock lock;          // 保护waiters，睡眠者持有该锁检查条件并入队，唤醒者持有该锁出队，因此不会错过唤醒
+    list waiters;           // 阻塞在该队列上的线程
+} wait_queue;
+
+extern void wait_queue_init(wait_queue *pwq);                       // 等待队列初始化
+extern void wait_queue_sleep(wait_queue *pwq, spinlock *plock);     // 将当前线程阻塞在等待队列上(须关中断)，plock非空时阻塞期间释放该自旋锁，plock可以是等待队列自身的锁
+extern void wake_up_one(wait_queue *pwq);                           // 唤醒等待队列中最早阻塞的一个线程
+extern void wake_up_all(wait_queue *pwq);                           // 唤醒等待队列中的所有线程
+
+// 阻塞当前线程直到condition成立，每次被唤醒后重新检查一次condition
+// condition在持有等待队列的锁时检查，不能睡眠，唤醒者只需在使condition成立之后调用wake_up_one或wake_up_all
+#define wait_event(pwq, condition) \
+    do \
+    { \
+        intr_status __old_status = spin_lock_irqsave(&(pwq)->lock); \
+        while (!(condition)) \
+        { \
+            wait_queue_sleep((pwq), &(pwq)->lock); \
+        } \
+        spin_unlock_irqrestore(&(pwq)->lock, __old_status); \
+    } while (0)
+
+// 在持有自旋锁plock(由spin_lock_irqsave获取)的情况下阻塞直到condition成立，阻塞期间释放plock，返回时仍持有plock
+#define wait_event_locked(pwq, condition, plock) \
+    do \
+    { \
+        while (!(condition)) \
+        { \
+            wait_queue_sleep((pwq), (plock)); \
+        } \
+    } while (0)
 
 // 信号量结构体
 typedef struct semaphore
 {
+    spinlock lock;          // 保护value和block_queue
     int32_t value;           // value >= 0时表示某种资源的数量，value <= 0时其绝对值表示阻塞在该信号量上线程的数量
     list block_queue;       // 阻塞在该信号量上的线程队列
 } semaphore;
@@ -18,10 +83,13 @@ extern void sem_up(semaphore *psem);    // 信号量的V操作(原子操作)
 typedef struct task_struct task_struct;         // 为了避免头文件嵌套包含出现的未定义问题，需要将thread.h放在原文件中，同时加上前置声明
 
 // 互斥锁结构体
+// state为0表示空闲，1表示被持有且没有等待者，2表示被持有且可能有等待者
+// 无竞争时获取和释放只需一次原子操作，只有state为2时才需要持有等待队列的锁操作等待队列
 typedef struct mutex_lock
 {
     task_struct *holder;    // 锁的持有线程
-    semaphore sem;          // 互斥锁是对互斥信号量的封装
+    volatile uint32_t state;    // 锁的状态
+    wait_queue waiters;     // 等待该锁的线程
     uint32_t acquire_nr;    // 锁的持有者申请锁的总次数，可用于避免死锁
 } mutex_lock;
 
@@ -29,4 +97,22 @@ extern void mutex_lock_init(mutex_lock *plock);     // 锁的初始化
 extern void mutex_lock_acquire(mutex_lock *plock);  // 获取锁
 extern void mutex_lock_release(mutex_lock *plock);  // 释放锁
 
+// 读写锁结构体，允许多个读者同时持有，写者独占，有写者等待时新的读者也需要等待
+// 写者可以重复获取写锁，也可以在持有写锁时获取读锁(视为再次获取写锁)
+typedef struct rw_lock
+{
+    spinlock guard;         // 保护以下成员
+    uint32_t readers;       // 持有读锁的线程数
+    task_struct *writer;    // 持有写锁的线程
+    uint32_t write_nr;      // 写者申请锁的总次数
+    wait_queue read_queue;  // 等待读锁的线程
+    wait_queue write_queue; // 等待写锁的线程
+} rw_lock;
+
+extern void rw_lock_init(rw_lock *plock);           // 读写锁的初始化
+extern void rw_lock_read_acquire(rw_lock *plock);   // 获取读锁
+extern void rw_lock_read_release(rw_lock *plock);   // 释放读锁
+extern void rw_lock_write_acquire(rw_lock *plock);  // 获取写锁
+extern void rw_lock_write_release(rw_lock *plock);  // 释放写锁
+
 #endif
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include "init.h"
 #include "stdio.h"
 #include "_syscall.h"
+#include "timer.h"
 
 #define PID_CNT 32768
 
@@ -25,13 +26,19 @@ struct
 void pid_init(void);
 
 
-void idle(void *arg UNUSED);                // 系统空闲时运行的线程
+task_struct *thread_ready_pop(run_queue *rq, uint32_t level);     // 取出指定就绪队列中指定级别的队头线程
+uint32_t rq_load(run_queue *rq);                    // 处理器的负载，即就绪线程数加上正在运行的非idle线程数
+bool thread_pull(uint32_t cpu);                     // 从负载最重的处理器迁移一个就绪线程到指定处理器
+void thread_kick_idle(void);                        // 通知一个空闲的处理器来迁移当前处理器上多余的就绪线程
+void schedule_locked(run_queue *rq);                // 持有当前处理器就绪队列的锁进行线程调度
+bool reset_thread_level(node *pnode, int arg UNUSED);   // 作为list_traversal的回调函数将线程的级别重置为最高级别
+task_struct *thread_start_at_level(const char *name, thread_pfunc function, void *arg, const uint32_t priority, uint32_t level);  // 创建一个位于指定级别的线程
 
-task_struct *current = MAIN_THREAD;       // 指向当前处于TASK_RUNNING状态的TCB
 task_struct *process_init;                  // init进程
-task_struct *thread_idle;                   // idle线程 
-list thread_ready_list;                   // 线程的就绪队列
+run_queue run_queues[MAX_CPU_CNT];        // 各处理器的就绪队列
 list thread_all_list;                     // 线程的全队列
+spinlock thread_all_lock;                 // 保护线程的全队列
+wait_queue thread_died_wq;                // 主线程在其上等待回收已结束的线程
 
 extern partition *root_part;                         // 根目录所在的分区
 
@@ -40,7 +47,22 @@ void thread_init(void)
 {
     // 将就绪队列和全队列初始化（之前忘记初始化导致了奇怪的问题）
     list_init(&thread_all_list);
-    list_init(&thread_ready_list);
+    spin_lock_init(&thread_all_lock);
+    spin_lock_init(&proc_tree_lock);
+    wait_queue_init(&thread_died_wq);
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CNT; ++cpu)
+    {
+        run_queue *rq = &run_queues[cpu];
+        spin_lock_init(&rq->lock);
+        for (uint32_t i = 0; i < MLFQ_LEVEL_CNT; ++i)
+        {
+            list_init(&rq->ready_lists[i]);
+        }
+        rq->ready_level_bitmap = 0;
+        rq->ready_cnt = 0;
+        rq->idle = rq->curr = rq->prev = NULL;
+    }
+    run_queues[0].curr = MAIN_THREAD;
 
     // 初始化pid池
     pid_init();
@@ -48,8 +70,8 @@ void thread_init(void)
     // 创建init进程
     process_init = create_process("/sbin/init", 10, "init");
 
-    // 创建idle线程
-    thread_idle = thread_start("idle", idle, NULL, 1);
+    // 创建BSP的idle线程，其他处理器的idle线程在启动该处理器时创建
+    thread_idle_create(0, false);
 
     // 使主线程合法化
     make_main_thread();
@@ -64,8 +86,11 @@ void thread_task_struct_init(task_struct *pthread, const uint32_t priority, cons
     pthread->kstack_ptr = (uint32_t)pthread + PAGE_SIZE;
     pthread->magic = MAGIC;
     pthread->priority = priority;
-    pthread->ticks = priority;
+    pthread->level = 0;
+    pthread->ticks = thread_time_slice(pthread);
     pthread->elapsed_ticks = 0;
+    pthread->cpu = 0;
+    pthread->on_cpu = (pthread == MAIN_THREAD);
     pthread->status = (pthread == MAIN_THREAD ? TASK_RUNNING : TASK_READY);
     pthread->pdt_base = NULL;
     pthread->pid = alloc_pid();
@@ -76,6 +101,9 @@ void thread_task_struct_init(task_struct *pthread, const uint32_t priority, cons
     pthread->wd_part = root_part;
     pthread->wd_i_no = root_part->sb->root_i_no;
     pthread->parent = pthread->child = pthread->y_sibling = pthread->o_sibling = NULL;
+    node_init(&pthread->general_list_node);
+    node_init(&pthread->all_list_node);
+    wait_queue_init(&pthread->child_exit_wq);
     for (uint32_t i = 3; i < MAX_FILES_OPEN_PER_PROC; ++i)
     {
         pthread->fd_table[i] = -1;
@@ -99,21 +127,31 @@ void thread_kstack_init(task_struct *pthread, thread_pfunc function, void *arg)
 
 // 创建一个线程
 task_struct *thread_start(const char *name, thread_pfunc function, void *arg, const uint32_t priority) 
+{
+    return thread_start_at_level(name, function, arg, priority, 0);
+}
+
+// 创建一个位于指定级别的线程，级别须在线程首次加入就绪队列之前确定
+task_struct *thread_start_at_level(const char *name, thread_pfunc function, void *arg, const uint32_t priority, uint32_t level)
 {
     ASSERT(name != NULL && function != NULL);
 
     task_struct *pthread = (task_struct *)get_kernel_pages(1);
     ASSERT(pthread != NULL);
     thread_task_struct_init(pthread, priority, name);
+    pthread->level = level;
+    pthread->ticks = thread_time_slice(pthread);
     thread_kstack_init(pthread, function, arg);
 
     // 把线程加入全队列
+    intr_status old_status = spin_lock_irqsave(&thread_all_lock);
     ASSERT(!list_find(&thread_all_list, &pthread->all_list_node));
     list_push_back(&thread_all_list, &pthread->all_list_node);
+    spin_unlock(&thread_all_lock);
 
     // 把线程加入就绪队列
-    ASSERT(!list_find(&thread_ready_list, &pthread->general_list_node));
-    list_push_back(&thread_ready_list, &pthread->general_list_node);
+    thread_enqueue(pthread, false);
+    set_intr_status(old_status);
 
     return pthread;
 }
@@ -124,78 +162,361 @@ void make_main_thread(void)
     thread_task_struct_init(MAIN_THREAD, 10, "kernel_main_thread");
 
     // 由于内核主线程已经在运行态，因此无需将其加入就绪队列，只需加入全队列
+    intr_status old_status = spin_lock_irqsave(&thread_all_lock);
     ASSERT(!list_find(&thread_all_list, &MAIN_THREAD->all_list_node));
     list_push_back(&thread_all_list, &MAIN_THREAD->all_list_node);
+    spin_unlock_irqrestore(&thread_all_lock, old_status);
 }        
 
-// 负责调用线程入口函数，真正启动线程
+// 负责调用线程入口函数，真正启动线程，新线程第一次被调度时由switch_to返回到这里
 void kernel_thread(thread_pfunc function, void *arg)
 {
+    schedule_tail();
     set_intr_status(INTR_ON);
     function(arg);
 }       
 
-// 线程调度函数
-void schedule(void)
+// 线程在其当前级别下的时间片长度，级别越低时间片越长
+uint32_t thread_time_slice(task_struct *pthread)
+{
+    return pthread->priority * (pthread->level + 1);
+}
+
+// 将线程放入其所在处理器、所在级别就绪队列的队头或队尾，调用者须关中断并持有该就绪队列的锁
+void thread_ready_push(task_struct *pthread, bool front)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    ASSERT(pthread->level < MLFQ_LEVEL_CNT && pthread->cpu < MAX_CPU_CNT);
+    run_queue *rq = &run_queues[pthread->cpu];
+    ASSERT(rq->lock.locked);
+    ASSERT(pthread != rq->idle);
+    list *plist = &rq->ready_lists[pthread->level];
+    ASSERT(!list_find(plist, &pthread->general_list_node));
+    if (front)
+    {
+        list_push_front(plist, &pthread->general_list_node);
+    }
+    else
+    {
+        list_push_back(plist, &pthread->general_list_node);
+    }
+    rq->ready_level_bitmap |= (1 << pthread->level);
+    rq->ready_cnt++;
+}
+
+// 取出指定就绪队列中指定级别的队头线程，调用者须持有该就绪队列的锁
+task_struct *thread_ready_pop(run_queue *rq, uint32_t level)
+{
+    list *plist = &rq->ready_lists[level];
+    task_struct *pthread = member2struct(list_pop_front(plist), task_struct, general_list_node);
+    if (plist->length == 0)
+    {
+        rq->ready_level_bitmap &= ~(1 << level);
+    }
+    rq->ready_cnt--;
+    return pthread;
+}
+
+// 处理器的负载，即就绪线程数加上正在运行的非idle线程数，不持有锁读取时只是一个估计值
+uint32_t rq_load(run_queue *rq)
+{
+    return rq->ready_cnt + (rq->curr != rq->idle);
+}
+
+// 将就绪线程放入负载最轻的处理器的就绪队列，负载相同时优先放回线程原来所在的处理器，调用者须关中断
+// 目标处理器正在运行idle线程时通知其重新调度
+// 刚阻塞的线程可能还在原处理器上进行切换，必须等它离开处理器后才能被其他处理器选中，否则会在两个处理器上同时使用同一个内核栈
+// 等待者不持有任何就绪队列的锁，而换下该线程的处理器完成切换不需要其他锁，因此不会死锁
+void thread_enqueue(task_struct *pthread, bool front)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    while (pthread->on_cpu)
+    {
+        cpu_relax();
+    }
+
+    // 各处理器的负载只是用来选择目标的估计值，不需要加锁读取
+    uint32_t target = pthread->cpu;
+    for (uint32_t cpu = 0; cpu < cpu_cnt; ++cpu)
+    {
+        if (cpus[cpu].online && rq_load(&run_queues[cpu]) < rq_load(&run_queues[target]))
+        {
+            target = cpu;
+        }
+    }
+
+    run_queue *rq = &run_queues[target];
+    spin_lock(&rq->lock);
+    pthread->cpu = target;
+    thread_ready_push(pthread, front);
+    bool kick = (target != current->cpu && rq->curr == rq->idle);
+    spin_unlock(&rq->lock);
+
+    if (kick)
+    {
+        smp_send_resched(target);
+    }
+}
+
+// 从负载最重的处理器迁移一个就绪线程到指定处理器，两者负载相差不超过1时不迁移，调用者须关中断并持有指定处理器就绪队列的锁
+// 迁移的是最低非空级别的队尾线程，它在原处理器上最晚才会被调度
+// 已经持有一个就绪队列的锁，只尝试获取另一个，获取不到就放弃本次迁移，避免两个处理器互相迁移时死锁
+bool thread_pull(uint32_t cpu)
+{
+    run_queue *busiest = NULL;
+    uint32_t max_load = rq_load(&run_queues[cpu]) + 1;
+    for (uint32_t i = 0; i < cpu_cnt; ++i)
+    {
+        if (i != cpu && cpus[i].online && run_queues[i].ready_cnt && rq_load(&run_queues[i]) > max_load)
+        {
+            busiest = &run_queues[i];
+            max_load = rq_load(busiest);
+        }
+    }
+    if (!busiest || !spin_trylock(&busiest->lock))
+    {
+        return false;
+    }
+    if (!busiest->ready_cnt)
+    {
+        spin_unlock(&busiest->lock);
+        return false;
+    }
+
+    uint32_t level = bit_scan_reverse(busiest->ready_level_bitmap);
+    list *plist = &busiest->ready_lists[level];
+    task_struct *pthread = member2struct(list_pop_back(plist), task_struct, general_list_node);
+    if (plist->length == 0)
+    {
+        busiest->ready_level_bitmap &= ~(1 << level);
+    }
+    busiest->ready_cnt--;
+    spin_unlock(&busiest->lock);
+
+    pthread->cpu = cpu;
+    thread_ready_push(pthread, false);
+    return true;
+}
+
+// 当前处理器上是否存在级别高于当前线程的就绪线程，当前线程为idle线程时只要有就绪线程即可
+// 不持有锁读取位图，其他处理器同时放入的线程最迟在下一个tick被发现
+bool thread_need_preempt(void)
+{
+    run_queue *rq = &run_queues[current->cpu];
+    if (current == rq->idle)
+    {
+        return rq->ready_level_bitmap != 0;
+    }
+    return rq->ready_level_bitmap && bit_scan_forward(rq->ready_level_bitmap) < current->level;
+}
+
+// 每个tick调用，当前处理器的负载比最忙的处理器轻1以上时从其迁移一个就绪线程过来，调用者须关中断
+// 空闲的处理器停止了时钟中断，不会自己来迁移，因此仍有多余就绪线程时通知一个空闲的处理器
+void thread_balance(void)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    if (cpu_online_cnt > 1)
+    {
+        run_queue *rq = &run_queues[current->cpu];
+        spin_lock(&rq->lock);
+        thread_pull(current->cpu);
+        bool surplus = (rq->curr != rq->idle && rq->ready_cnt);
+        spin_unlock(&rq->lock);
+
+        if (surplus)
+        {
+            thread_kick_idle();
+        }
+    }
+}
+
+// 通知一个空闲的处理器来迁移当前处理器上多余的就绪线程，它在idle线程中重新调度时会调用thread_pull
+void thread_kick_idle(void)
+{
+    for (uint32_t cpu = 0; cpu < cpu_cnt; ++cpu)
+    {
+        run_queue *rq = &run_queues[cpu];
+        if (cpu != current->cpu && cpus[cpu].online && rq->curr == rq->idle && !rq->ready_cnt)
+        {
+            smp_send_resched(cpu);
+            return;
+        }
+    }
+}
+
+// 除当前处理器外的所有在线处理器是否都在运行idle线程且没有就绪线程，调用者须关中断
+// 逐个持有各处理器就绪队列的锁读取，不会看到调度到一半的中间状态
+bool thread_others_idle(void)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    for (uint32_t cpu = 0; cpu < cpu_cnt; ++cpu)
+    {
+        if (cpu != current->cpu && cpus[cpu].online)
+        {
+            run_queue *rq = &run_queues[cpu];
+            spin_lock(&rq->lock);
+            bool idle = (rq->curr == rq->idle && !rq->ready_cnt);
+            spin_unlock(&rq->lock);
+            if (!idle)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// 作为list_traversal的回调函数将线程的级别重置为最高级别
+bool reset_thread_level(node *pnode, int arg UNUSED)
 {
+    task_struct *pthread = member2struct(pnode, task_struct, all_list_node);
+    if (pthread != run_queues[pthread->cpu].idle)
+    {
+        pthread->level = 0;
+    }
+    return false;
+}
 
+// 将所有线程提升到最高级别，使长期位于低级别的CPU密集型线程不至于饥饿
+void thread_priority_boost(void)
+{
     ASSERT(get_intr_status() == INTR_OFF);
-    // 时间片轮转调度算法
-    if (current->status == TASK_RUNNING)
+    spin_lock(&thread_all_lock);
+    list_traversal(&thread_all_list, reset_thread_level, 0);
+    spin_unlock(&thread_all_lock);
+
+    // 按原有顺序将各处理器低级别就绪队列中的线程移入最高级别，每次只持有一个就绪队列的锁
+    for (uint32_t cpu = 0; cpu < cpu_cnt; ++cpu)
     {
-        // 如果当前线程的状态是TASK_RUNNING, 说明是时间片用完引起的调度，需要把线程状态设置为TASK_READY并放回就绪队列
-        ASSERT(current->ticks == 0);
-        current->status = TASK_READY;
-        current->ticks = current->priority;
+        run_queue *rq = &run_queues[cpu];
+        spin_lock(&rq->lock);
+        for (uint32_t level = 1; level < MLFQ_LEVEL_CNT; ++level)
+        {
+            for (uint32_t cnt = rq->ready_lists[level].length; cnt; --cnt)
+            {
+                thread_ready_push(thread_ready_pop(rq, level), false);
+            }
+        }
+        spin_unlock(&rq->lock);
+    }
+}
+
+// 线程调度函数，在当前处理器的就绪队列中选择下一个线程，队列为空时先尝试从其他处理器迁移
+void schedule(void)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    run_queue *rq = &run_queues[current->cpu];
+    spin_lock(&rq->lock);
+    schedule_locked(rq);
+}
 
-        // 将当前运行的进程放回到就绪队列中
-        ASSERT(!list_find(&thread_ready_list, &current->general_list_node));
-        list_push_back(&thread_ready_list, &current->general_list_node);
+// 持有当前处理器就绪队列的锁进行线程调度，返回时已释放该锁
+// 锁一直持有到切换完成，在此之前被放回就绪队列的当前线程不会被其他处理器迁移走
+void schedule_locked(run_queue *rq)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    uint32_t cpu = rq - run_queues;
+    task_struct *cur = current;
 
+    // 多级反馈队列调度算法
+    if (cur == rq->idle)
+    {
+        // idle线程只在没有其他就绪线程时运行，被换下时直接阻塞而不放回就绪队列
+        cur->status = TASK_BLOCKED;
+    }
+    else if (cur->status == TASK_RUNNING)
+    {
+        // 如果当前线程的状态是TASK_RUNNING, 说明是时间片用完或被更高级别线程抢占引起的调度，需要把线程状态设置为TASK_READY并放回就绪队列
+        cur->status = TASK_READY;
+        if (cur->ticks == 0)
+        {
+            // 用完整个时间片的线程是CPU密集型的，将其降一级并放到新级别的队尾
+            if (cur->level < MLFQ_LOWEST_LEVEL)
+            {
+                cur->level++;
+            }
+            cur->ticks = thread_time_slice(cur);
+            thread_ready_push(cur, false);
+        }
+        else
+        {
+            // 被抢占的线程保留剩余的时间片，放回原级别的队头
+            thread_ready_push(cur, true);
+        }
     }
-    // TASK_HANGING TASK_BLOCKDE TASK_WAITING则无需将其放入就绪队列中
+    // TASK_HANGING TASK_BLOCKDE TASK_WAITING则无需将其放入就绪队列中，主动让出的线程已经放回了就绪队列
 
-    // 将就绪队列头部的线程转入运行态
-    if (thread_ready_list.length == 0)
+    // 当前线程已经放回就绪队列或不再就绪，计算负载时不再将其视为正在运行
+    rq->curr = rq->idle;
+    if (!rq->ready_level_bitmap)
     {
-        // 若没有就绪线程，则唤醒idle线程并执行
-        thread_unblock(thread_idle);
+        thread_pull(cpu);
     }
-    task_struct *next = member2struct(list_pop_front(&thread_ready_list), task_struct, general_list_node);
+
+    // 将最高的非空级别的队头线程转入运行态，若没有就绪线程，则运行idle线程
+    task_struct *next = (rq->ready_level_bitmap ? thread_ready_pop(rq, bit_scan_forward(rq->ready_level_bitmap)) : rq->idle);
 
     next->status = TASK_RUNNING;            // 不要忘记把新线程的状态置为运行态
+    next->cpu = cpu;
+    rq->curr = next;
 
     // 如果切换目标是当前线程，则无需切换
-    if (current == next)
+    if (cur == next)
     {
+        spin_unlock(&rq->lock);
         return;
     }
-    
+
     // 当线程和线程直接切换时，无需切换页表
-    if (!(current->pdt_base == NULL && next->pdt_base == NULL))
+    if (!(cur->pdt_base == NULL && next->pdt_base == NULL))
     {
         switch_page_table(next);
     }
-    
+
     // 修改TSS中的ESP0
     update_tss_esp0(next);
 
+    next->on_cpu = true;
+    rq->prev = cur;
     switch_to(next);
+    schedule_tail();
+}
+
+// 线程切换的收尾工作，由切换后的线程调用：此时被换下的线程的上下文已经保存完毕，可以在其他处理器上运行或被回收
+void schedule_tail(void)
+{
+    run_queue *rq = &run_queues[current->cpu];
+    rq->prev->on_cpu = false;
+    rq->prev = NULL;
+    spin_unlock(&rq->lock);
 }
 
 // 阻塞调用该函数的线程（原子操作）
 void thread_block(pthread_status status)
 {
     intr_status old_status = set_intr_status(INTR_OFF);
-    
-    ASSERT(status == TASK_BLOCKED || status == TASK_HANGING || status == TASK_WAITING);
-    current->status = status;
-    schedule();
-
+    thread_block_locked(status, NULL);
     set_intr_status(old_status);
 }   
 
+// 阻塞调用该函数的线程并同时释放自旋锁plock(须关中断)，被唤醒后不会重新获取plock
+// 调用者在plock的保护下把线程挂到某个等待队列上，唤醒者持有plock才能看到该线程，因此状态必须在释放plock之前设置
+void thread_block_locked(pthread_status status, spinlock *plock)
+{
+    ASSERT(get_intr_status() == INTR_OFF);
+    ASSERT(status == TASK_BLOCKED || status == TASK_HANGING || status == TASK_WAITING);
+    run_queue *rq = &run_queues[current->cpu];
+    spin_lock(&rq->lock);
+    current->status = status;
+    if (plock)
+    {
+        spin_unlock(plock);
+    }
+    schedule_locked(rq);
+}
+
 // 使pthread指向的线程接触阻塞态（原子操作）
+// 调用者须持有线程所在等待队列的锁，线程可能还未在原处理器上完成切换，由thread_enqueue等待
 void thread_unblock(task_struct *pthread)
 {
     intr_status old_status = set_intr_status(INTR_OFF);
@@ -205,10 +526,14 @@ void thread_unblock(task_struct *pthread)
     if (pthread->status == TASK_BLOCKED || pthread->status == TASK_HANGING || pthread->status == TASK_WAITING)
     {
         pthread->status = TASK_READY;
-        // 接触阻塞的线程将在剩余的时间片下继续运行
+        // 因等待资源而阻塞的线程往往是I/O密集型的，被唤醒时将其提升一级并给予新级别下完整的时间片
+        if (pthread->level > 0)
+        {
+            pthread->level--;
+        }
+        pthread->ticks = thread_time_slice(pthread);
         // 将该进程放回到就绪队列的队头中，以保证该线程尽快得到调度
-        ASSERT(!list_find(&thread_ready_list, &pthread->general_list_node));
-        list_push_front(&thread_ready_list, &pthread->general_list_node);
+        thread_enqueue(pthread, true);
     }
 
     set_intr_status(old_status);
@@ -220,11 +545,12 @@ void thread_yield(void)
     intr_status old_status = set_intr_status(INTR_OFF);
 
     ASSERT(current->status == TASK_RUNNING);
+    run_queue *rq = &run_queues[current->cpu];
+    spin_lock(&rq->lock);
     current->status = TASK_READY;
-    // 将当前运行的进程放回到就绪队列中
-    ASSERT(!list_find(&thread_ready_list, &current->general_list_node));
-    list_push_back(&thread_ready_list, &current->general_list_node);
-    schedule();
+    // 主动让出CPU的线程保持原有级别，放回到该级别就绪队列的队尾
+    thread_ready_push(current, false);
+    schedule_locked(rq);
 
     set_intr_status(old_status);
 }
@@ -242,12 +568,29 @@ void thread_exit(void)
 
     set_intr_status(INTR_OFF);
 
+    // 主线程可能在本线程切换出去之前就看到TASK_DIED，回收前会等待本线程离开处理器
     current->status = TASK_DIED;
-    if (MAIN_THREAD->status == TASK_WAITING)
+    wake_up_one(&thread_died_wq);       // 通知主线程回收
+    schedule();
+}
+
+// 等待已结束的线程在其处理器上完成切换，回收其PCB之前调用，否则其处理器可能仍在使用该线程的内核栈
+void thread_wait_off_cpu(task_struct *pthread)
+{
+    ASSERT(pthread->status == TASK_DIED);
+    while (pthread->on_cpu)
     {
-        thread_unblock(MAIN_THREAD);
+        cpu_relax();
     }
-    schedule();
+}
+
+// 持有全队列的锁遍历全队列，回调函数不能睡眠
+node *thread_all_traversal(func_ptr function, int arg)
+{
+    intr_status old_status = spin_lock_irqsave(&thread_all_lock);
+    node *pnode = list_traversal(&thread_all_list, function, arg);
+    spin_unlock_irqrestore(&thread_all_lock, old_status);
+    return pnode;
 }
 
 // 寻找已结束的线程
@@ -285,13 +628,57 @@ void release_pid(pid_t pid)
     mutex_lock_release(&pid_pool.lock);
 }                
 
+// 创建指定处理器的idle线程，idle线程固定位于最低级别，不参与升降级，也从不进入就绪队列
+// running为true时该线程将由启动中的处理器直接在其PCB所在页上运行，否则在该处理器首次空闲时被调度
+task_struct *thread_idle_create(uint32_t cpu, bool running)
+{
+    task_struct *pthread = (task_struct *)get_kernel_pages(1);
+    ASSERT(pthread != NULL);
+
+    char name[MAX_THREAD_NAME_LEN];
+    if (cpu == 0)
+    {
+        strcpy(name, "idle");
+    }
+    else
+    {
+        sprintf(name, "idle%d", cpu);
+    }
+    thread_task_struct_init(pthread, 1, name);
+    pthread->level = MLFQ_LOWEST_LEVEL;
+    pthread->ticks = thread_time_slice(pthread);
+    pthread->cpu = cpu;
+    thread_kstack_init(pthread, idle, NULL);
+    pthread->status = (running ? TASK_RUNNING : TASK_BLOCKED);
+    pthread->on_cpu = running;
+
+    intr_status old_status = spin_lock_irqsave(&thread_all_lock);
+    ASSERT(!list_find(&thread_all_list, &pthread->all_list_node));
+    list_push_back(&thread_all_list, &pthread->all_list_node);
+    spin_unlock_irqrestore(&thread_all_lock, old_status);
+
+    run_queues[cpu].idle = pthread;
+    if (running)
+    {
+        run_queues[cpu].curr = pthread;
+    }
+    return pthread;
+}
+
 // 系统空闲时运行的线程
 void idle(void *arg UNUSED)
 {
     while (1)
     {
         thread_block(TASK_BLOCKED);
+
+        // 能运行到这里说明没有其他就绪线程，在下一个定时到期或其他中断到来之前停止周期性时钟中断
+        // 其他处理器放入就绪线程后发送的重新调度IPI在关中断期间保持挂起，sti之后的hlt会被它唤醒
+        set_intr_status(INTR_OFF);
+        timer_tickless_enter();
         asm volatile ("sti; hlt");
+        set_intr_status(INTR_OFF);
+        timer_tickless_exit();
     }
 }    
 
@@ -5,10 +5,15 @@
 #include "memory.h"
 #include "file.h"
 #include "global.h"
+#include "smp.h"
 
 #define MAGIC 0x20010828 
 #define MAX_THREAD_NAME_LEN 32
 
+#define MLFQ_LEVEL_CNT 8            // 多级反馈队列的级别数，0级最高，不能超过32
+#define MLFQ_LOWEST_LEVEL (MLFQ_LEVEL_CNT - 1)     // 最低级别，idle线程固定位于该级别
+#define MLFQ_BOOST_INTERVAL 100     // 每隔多少个tick将所有线程提升到最高级别，防止低级别线程饥饿
+
 typedef void (*thread_pfunc) (void *);      // 万能函数指针
 typedef uint32_t pid_t;        // 进程标识符类型
 
@@ -34,9 +39,13 @@ typedef struct task_struct
 
     pthread_status status;      // 线程的当前状态
 
-    uint32_t priority;          // 优先级
+    uint32_t priority;          // 优先级，即最高级别队列中的时间片长度
+    uint32_t level;             // 所在的多级反馈队列级别，用完时间片会降级，被唤醒时会升级
     uint32_t ticks;             // 时间片
     uint32_t elapsed_ticks;     // 线程在处理器上运行的总时间片
+    uint32_t wakeup_tick;       // 睡眠中的线程被唤醒的时刻
+    uint32_t cpu;               // 线程所在的处理器，即其所在就绪队列或正在其上运行的处理器在cpus中的下标
+    volatile bool on_cpu;       // 线程正在处理器上运行，或已被换下但其处理器尚未完成切换
 
     node general_list_node;      
     node all_list_node;
@@ -59,6 +68,7 @@ typedef struct task_struct
     task_struct *o_sibling;        // 指向所有创建时间早于当前进程的子进程中最晚创建的进程
 
     int32_t exit_status;           // 进程的退出状态
+    wait_queue child_exit_wq;      // 在sys_wait中等待子进程退出
 
     uint32_t magic;             // 作为内核栈和task_struct之间的界限
 
@@ -99,12 +109,29 @@ typedef struct thread_stack
     void *arg;          // 传递给线程入口函数的参数
 } thread_stack;
 
+// 每个处理器的就绪队列，idle线程不进入就绪队列
+// 调度时持有lock直到切换完成，由切换后的线程在schedule_tail中释放
+typedef struct run_queue
+{
+    spinlock lock;                      // 保护以下成员，加锁顺序在等待队列等其他锁之后
+    list ready_lists[MLFQ_LEVEL_CNT];   // 各级别的就绪队列
+    uint32_t ready_level_bitmap;        // 第i位为1表示第i级就绪队列非空，用于O(1)找到最高的非空级别
+    uint32_t ready_cnt;                 // 所有级别就绪线程的总数
+    task_struct *idle;                  // 该处理器的idle线程
+    task_struct *curr;                  // 该处理器上正在运行的线程
+    task_struct *prev;                  // 正在被换下的线程
+} run_queue;
+
 #define MAIN_THREAD ((task_struct *)0xc009e000)
 
-extern task_struct *current;                    // 指向当前处于TASK_RUNNING状态的TCB
+// 指向当前处理器上处于TASK_RUNNING状态的TCB，PCB与内核栈位于同一页中，由栈指针即可得到
+#define current ({ uint32_t esp; asm ("movl %%esp, %0" : "=r"(esp)); (task_struct *)(esp & 0xfffff000); })
+
 extern task_struct *process_init;                // init进程
-extern list thread_ready_list;                   // 线程的就绪队列
+extern run_queue run_queues[];                   // 各处理器的就绪队列
 extern list thread_all_list;                     // 线程的全队列
+extern spinlock thread_all_lock;                 // 保护线程的全队列
+extern wait_queue thread_died_wq;                // 主线程在其上等待回收已结束的线程
 
 extern void thread_init(void);              // 系统启动初期将线程有关的数据结构初始化
 extern void thread_task_struct_init(task_struct *pthread, const uint32_t priority, const char *name);           // 初始化task_struct
@@ -114,15 +141,29 @@ extern void make_main_thread(void);             //使内核主线程合法化
 extern void kernel_thread(thread_pfunc function, void *arg);        // 负责调用线程入口函数，真正启动线程
 
 extern void schedule(void);                 // 线程调度函数
+extern void schedule_tail(void);            // 线程切换的收尾工作，由切换后的线程调用
+extern uint32_t thread_time_slice(task_struct *pthread);        // 线程在其当前级别下的时间片长度
+extern void thread_ready_push(task_struct *pthread, bool front);    // 将线程放入其所在处理器、所在级别就绪队列的队头或队尾
+extern void thread_enqueue(task_struct *pthread, bool front);       // 将就绪线程放入负载最轻的处理器的就绪队列
+extern bool thread_need_preempt(void);      // 当前处理器上是否存在级别高于当前线程的就绪线程
+extern void thread_balance(void);           // 与其他处理器均衡负载，必要时迁移就绪线程或通知空闲的处理器
+extern bool thread_others_idle(void);       // 除当前处理器外的所有在线处理器是否都空闲
+extern void thread_priority_boost(void);    // 将所有线程提升到最高级别
 extern void switch_to(task_struct *next);   // 线程切换函数
 
 extern void thread_block(pthread_status status);    // 阻塞调用该函数的线程（原子操作）
+extern void thread_block_locked(pthread_status status, spinlock *plock);   // 阻塞调用该函数的线程并同时释放自旋锁plock(须关中断)
 extern void thread_unblock(task_struct *pthread);   // 使pthread指向的线程接触阻塞态（原子操作）
 extern void thread_yield(void);                     // 调用该函数的线程主动让出CPU使用权，回到就绪态
 extern void thread_exit(void);                      // 结束当前线程
 
+extern void thread_wait_off_cpu(task_struct *pthread);   // 等待已结束的线程在其处理器上完成切换，回收PCB之前调用
+extern node *thread_all_traversal(func_ptr function, int arg);     // 持有全队列的锁遍历全队列
 extern bool find_died_thread(node *pnode, int arg UNUSED); // 寻找已结束的线程
 
+extern task_struct *thread_idle_create(uint32_t cpu, bool running);  // 创建指定处理器的idle线程
+extern void idle(void *arg UNUSED);                // 系统空闲时运行的线程
+
 extern pid_t alloc_pid(void);                      // 分配pid
 extern void release_pid(pid_t pid);                // 回收pid
 
@@ -17,6 +17,9 @@ void create_pg_dir(task_struct *pthread);                             // 为用
 void create_user_vm_pool(task_struct *pthread);                       // 为用户进程创建并初始化用户虚拟内存池 
 void start_process(void *pathname);                             // 加载可执行文件体并进行栈的初始化工作以启动进程
 void intr_exit(void);                                                 // 位于kernel.s中的中断出口函数
+void fork_return(void);                                               // 位于kernel.s中，fork出的子进程第一次被调度时的入口
+
+spinlock proc_tree_lock;     // 保护进程树，即所有进程的parent、child和兄弟指针
 
 // 从可执行文件创建一个用户进程
 task_struct *create_process(const char *pathname, const uint32_t priority, const char *name) 
@@ -35,12 +38,14 @@ task_struct *create_process(const char *pathname, const uint32_t priority, const
     mblock_desc_init(pthread->u_mblock_descs);
 
     // 把进程加入全队列
+    intr_status old_status = spin_lock_irqsave(&thread_all_lock);
     ASSERT(!list_find(&thread_all_list, &pthread->all_list_node));
     list_push_back(&thread_all_list, &pthread->all_list_node);
+    spin_unlock(&thread_all_lock);
 
     // 把进程加入就绪队列
-    ASSERT(!list_find(&thread_ready_list, &pthread->general_list_node));
-    list_push_back(&thread_ready_list, &pthread->general_list_node);
+    thread_enqueue(pthread, false);
+    set_intr_status(old_status);
 
     return pthread;
 }   
@@ -120,8 +125,12 @@ void copy_process(task_struct *child)
     // 修改PCB
     child->elapsed_ticks = 0;
     child->pid = alloc_pid();
-    child->ticks = child->priority;
+    child->ticks = thread_time_slice(child);     // 子进程继承父进程所在的级别
     child->status = TASK_READY;
+    child->on_cpu = false;
+    node_init(&child->general_list_node);      // 复制来的结点仍记录着父进程所在的链表
+    node_init(&child->all_list_node);
+    wait_queue_init(&child->child_exit_wq);
     create_pg_dir(child);
     
     char tmp[16];
@@ -130,7 +139,7 @@ void copy_process(task_struct *child)
     strcat(child->name, tmp);
 
     /* 将子进程加入进程树中 */
-    intr_status old_status = set_intr_status(INTR_OFF);
+    intr_status old_status = spin_lock_irqsave(&proc_tree_lock);
 
     child->parent = current;
     child->child = child->y_sibling = NULL;
@@ -141,7 +150,7 @@ void copy_process(task_struct *child)
     }
     current->child = child;
 
-    set_intr_status(old_status);
+    spin_unlock_irqrestore(&proc_tree_lock, old_status);
 
     for (uint32_t i = 3; i < MAX_FILES_OPEN_PER_PROC; ++i)
     {
@@ -154,21 +163,27 @@ void copy_process(task_struct *child)
             }
             else
             {
-                ++file_table[child->fd_table[i]].p_inode->open_cnt;
+                inode_get(file_table[child->fd_table[i]].p_inode);
             }
         }
     }
 
+    // 内存块描述符的锁随PCB一并被复制，其等待队列仍指向父进程，必须重新初始化
+    for (uint32_t i = 0; i < MBLOCK_DESC_CNT; ++i)
+    {
+        mutex_lock_init(&child->u_mblock_descs[i].lock);
+    }
+
     /* 为方便起见，父进程的虚拟地址位图应当直接复制给子进程  */
     uint32_t btmp_pg_cnt = DIV_ROUND_UP(child->user_vm_pool.vmp_bitmap.bytes_length, PAGE_SIZE);
     child->user_vm_pool.vmp_bitmap.btmp_ptr = get_kernel_pages(btmp_pg_cnt);
     ASSERT(child->user_vm_pool.vmp_bitmap.btmp_ptr);
     memcpy(child->user_vm_pool.vmp_bitmap.btmp_ptr, current->user_vm_pool.vmp_bitmap.btmp_ptr, child->user_vm_pool.vmp_bitmap.bytes_length);
 
-    // 修改内核栈
+    // 修改内核栈，子进程第一次被调度时经fork_return从中断返回
     intr_stack *pis = (intr_stack *)((uint32_t)child + PAGE_SIZE - sizeof(intr_stack));
     pis->eax = 0;           // 使子进程返回值为0
-    *((uint32_t *)pis - 1) = (uint32_t)intr_exit;
+    *((uint32_t *)pis - 1) = (uint32_t)fork_return;
     child->kstack_ptr = (uint32_t)((uint32_t *)pis - 5);
 
     // 采用写时复制技术，仅仅为子进程复制父进程的页表，而不直接复制父进程的进程体
@@ -202,7 +217,7 @@ void copy_process(task_struct *child)
 // 将parent的所有子进程过继给stepparent
 void adopt_children(task_struct *stepparent, task_struct *parent)
 {
-    intr_status old_status = set_intr_status(INTR_OFF);
+    intr_status old_status = spin_lock_irqsave(&proc_tree_lock);
 
     task_struct *oldest_child = NULL;
     task_struct *p = parent->child;
@@ -225,7 +240,7 @@ void adopt_children(task_struct *stepparent, task_struct *parent)
         parent->child = NULL;
     }
 
-    set_intr_status(old_status);
+    spin_unlock_irqrestore(&proc_tree_lock, old_status);
 }
 
 // 释放当前进程占有的大部分资源
@@ -270,7 +285,7 @@ void process_exit(task_struct *pthread)
     ASSERT(pthread->status == TASK_DIED);
     ASSERT(pthread->parent);
 
-    intr_status old_status = set_intr_status(INTR_OFF);
+    intr_status old_status = spin_lock_irqsave(&proc_tree_lock);
 
     // 将进程从进程树中移除
     if (pthread->parent->child == pthread)
@@ -286,13 +301,16 @@ void process_exit(task_struct *pthread)
         pthread->o_sibling->y_sibling = pthread->y_sibling;
     }
 
-    list_remove(&thread_all_list, &pthread->all_list_node);
+    spin_unlock(&proc_tree_lock);
 
-    set_intr_status(old_status);
+    spin_lock(&thread_all_lock);
+    list_remove(&thread_all_list, &pthread->all_list_node);
+    spin_unlock_irqrestore(&thread_all_lock, old_status);
 
     release_pid(pthread->pid);
 
-    // 释放页目录、PCB和内核栈
+    // 释放页目录、PCB和内核栈，子进程挂起后其处理器可能还未完成切换
+    thread_wait_off_cpu(pthread);
     mfree_pages(1, pthread->pdt_base);
     mfree_pages(1, pthread);
 }    
\ No newline at end of file
@@ -4,9 +4,12 @@
 #define USER_SPACE_START 0x8048000                                      // 用户空间的起始地址
 
 #include "stdint.h"
+#include "sync.h"
 
 typedef struct task_struct task_struct; 
 
+extern spinlock proc_tree_lock;     // 保护进程树，即所有进程的parent、child和兄弟指针
+
 extern task_struct *create_process(const char *pathname, const uint32_t priority, const char *name);  // 从可执行文件创建一个用户进程
 extern void switch_page_table(task_struct *pthread);                         // 进程切换时切换页表
 
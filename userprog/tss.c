@@ -3,8 +3,11 @@
 #include "debug.h"
 #include "global.h"
 #include "stdint.h"
+#include "string.h"
+#include "smp.h"
 
 #define TSS_VADDR   0xc0000904  // TSS结构位于loader模块中，位于虚拟地址0xc0000904处 
+#define GDT_LOADER_CNT  7       // loader中GDT的描述符数量，应用处理器的TSS描述符依次位于其后
 
 typedef struct tss_struct 
 {
@@ -36,8 +39,58 @@ typedef struct tss_struct
     uint32_t iobitmap_off;
 } tss_struct;
 
-// 修改TSS结构中的ESP0字段
+// GDTR寄存器的内容
+typedef struct gdt_ptr
+{
+    uint16_t limit;
+    uint32_t base;
+} PACKED gdt_ptr;
+
+uint64_t gdt[GDT_LOADER_CNT + MAX_CPU_CNT - 1];     // 内核的GDT，BSP沿用loader中的TSS，其余处理器各有一个TSS
+tss_struct ap_tss[MAX_CPU_CNT - 1];                 // 应用处理器的TSS
+
+tss_struct *cpu_tss(uint32_t cpu);                  // 获取指定处理器的TSS
+
+// 将loader中的GDT复制到内核中，并为每个应用处理器添加一个TSS描述符
+void tss_init(void)
+{
+    gdt_ptr gdtr;
+    asm volatile ("sgdt %0" : "=m"(gdtr));
+    ASSERT(gdtr.limit + 1 <= GDT_LOADER_CNT * 8);
+    memcpy(gdt, (void *)gdtr.base, gdtr.limit + 1);
+
+    for (uint32_t i = 0; i < MAX_CPU_CNT - 1; ++i)
+    {
+        ap_tss[i].ss0 = GDATA_SEL;
+        ap_tss[i].iobitmap_off = (sizeof(tss_struct) - 1) << 16;
+
+        // 32位可用TSS，DPL为0，界限为0x67
+        uint32_t base = (uint32_t)&ap_tss[i];
+        uint32_t low = (base << 16) | 0x67;
+        uint32_t high = (base & 0xff000000) | 0x8900 | ((base >> 16) & 0xff);
+        gdt[GDT_LOADER_CNT + i] = ((uint64_t)high << 32) | low;
+    }
+
+    uint64_t gdt48 = (sizeof(gdt) - 1) | ((uint64_t)(uint32_t)gdt << 16);
+    asm volatile ("lgdt %0" : : "m"(gdt48));
+}
+
+// 在应用处理器上加载其TSS
+void tss_load(uint32_t cpu)
+{
+    ASSERT(cpu > 0 && cpu < MAX_CPU_CNT);
+    uint16_t sel = (GDT_LOADER_CNT + cpu - 1) << 3;
+    asm volatile ("ltr %w0" : : "r"(sel));
+}
+
+// 获取指定处理器的TSS
+tss_struct *cpu_tss(uint32_t cpu)
+{
+    return (cpu == 0 ? (tss_struct *)TSS_VADDR : &ap_tss[cpu - 1]);
+}
+
+// 修改线程所在处理器的TSS中的ESP0字段
 void update_tss_esp0(task_struct *pthread)
 {
-    ((tss_struct *)TSS_VADDR)->esp0 = (uint32_t)pthread + PAGE_SIZE;
+    cpu_tss(pthread->cpu)->esp0 = (uint32_t)pthread + PAGE_SIZE;
 }   
\ No newline at end of file
@@ -1,8 +1,12 @@
 #ifndef __USERPROG_TSS_H
 #define __USERPROG_TSS_H
 
+#include "stdint.h"
+
 typedef struct task_struct task_struct;
 
-extern void update_tss_esp0(task_struct *pthread);        // 修改TSS结构中的ESP0字段
+extern void tss_init(void);                               // 将GDT复制到内核中并为每个应用处理器添加TSS描述符
+extern void tss_load(uint32_t cpu);                       // 在应用处理器上加载其TSS
+extern void update_tss_esp0(task_struct *pthread);        // 修改线程所在处理器的TSS中的ESP0字段
 
 #endif
\ No newline at end of file